@@ -0,0 +1,204 @@
+#!/usr/bin/perl -w
+# This file is part of Hubbub.
+# Licensed under the MIT License,
+#                http://www.opensource.org/licenses/mit-license.php
+
+# Generate a minimal perfect hash of the element names in build/Atoms.
+#
+# A name is hashed with 32-bit FNV-1a over its bytes, with ASCII letters
+# folded to lowercase. That hash selects a bucket, whose displacement
+# is then hashed in too, and the result taken modulo the number of names
+# gives the name's slot. Displacements are found here, largest buckets
+# first, so that every name has a slot to itself.
+
+use strict;
+use integer;
+
+use constant ATOMS_FILE => 'build/Atoms';
+use constant ATOMS_INC  => 'src/tokeniser/atoms.inc';
+use constant ATOMS_H    => 'include/hubbub/atoms.h';
+
+use constant FNV_BASIS => 2166136261;
+use constant FNV_PRIME => 16777619;
+
+open(INFILE, "<", ATOMS_FILE) || die "Unable to open " . ATOMS_FILE;
+
+my @names;
+
+while (my $line = <INFILE>) {
+   last unless (defined $line);
+   next if ($line =~ /^#/);
+   chomp $line;
+   next if ($line eq '');
+   my @elements = split /\s+/, $line;
+   push @names, lc(shift @elements);
+}
+
+close(INFILE);
+
+sub atom_of {
+   my ($name) = @_;
+
+   $name = uc($name);
+   $name =~ s/-/_/g;
+
+   return "HUBBUB_ATOM_$name";
+}
+
+# The public header's enumeration of atoms is kept by hand, so that their
+# values are stable. Check that it names the same atoms as the list.
+
+open(HEADER, "<", ATOMS_H) || die "Unable to open " . ATOMS_H;
+
+my %declared;
+my $in_enum = 0;
+
+while (my $line = <HEADER>) {
+   $in_enum = 1 if ($line =~ /^typedef enum hubbub_atom \{/);
+   next unless ($in_enum);
+   last if ($line =~ /^\}/);
+   $declared{$1} = 1 if ($line =~ /^\s*(HUBBUB_ATOM_\w+)/);
+}
+
+close(HEADER);
+
+delete $declared{'HUBBUB_ATOM_UNKNOWN'} ||
+      die "No HUBBUB_ATOM_UNKNOWN in " . ATOMS_H;
+
+my @missing = grep { !exists $declared{$_} } map { atom_of($_) } @names;
+delete $declared{atom_of($_)} foreach (@names);
+my @extra = sort keys %declared;
+
+die "Atoms in " . ATOMS_FILE . " but not " . ATOMS_H . ": @missing\n"
+      if (@missing);
+die "Atoms in " . ATOMS_H . " but not " . ATOMS_FILE . ": @extra\n"
+      if (@extra);
+
+my $n_names = scalar(@names);
+my $n_buckets = int(($n_names + 1) / 2);
+
+sub fnv_step {
+   my ($hash, $byte) = @_;
+
+   return (($hash ^ $byte) * FNV_PRIME) & 0xffffffff;
+}
+
+sub hash_name {
+   my ($name) = @_;
+   my $hash = FNV_BASIS;
+
+   foreach my $byte (unpack("C*", $name)) {
+      $hash = fnv_step($hash, $byte);
+   }
+
+   return $hash;
+}
+
+sub slot_of {
+   my ($hash, $displacement) = @_;
+
+   $hash = fnv_step($hash, $displacement & 0xff);
+   $hash = fnv_step($hash, $displacement >> 8);
+
+   return $hash % $n_names;
+}
+
+# Distribute the names among buckets
+
+my @buckets = map { [] } (1 .. $n_buckets);
+my %hashes;
+
+foreach my $name (@names) {
+   die "Duplicate name $name" if (exists $hashes{$name});
+   $hashes{$name} = hash_name($name);
+   push @{$buckets[$hashes{$name} % $n_buckets]}, $name;
+}
+
+# Find a displacement for each bucket, placing the largest first
+
+my @displacements = (0) x $n_buckets;
+my @slots;
+
+foreach my $bucket (sort { scalar(@{$buckets[$b]}) <=> scalar(@{$buckets[$a]})
+      || $a <=> $b } (0 .. $n_buckets - 1)) {
+   my @members = @{$buckets[$bucket]};
+   next if (scalar(@members) == 0);
+
+   my $found = 0;
+
+   for (my $d = 0; $d < 65536 && !$found; $d++) {
+      my %taken;
+
+      $found = 1;
+
+      foreach my $name (@members) {
+         my $slot = slot_of($hashes{$name}, $d);
+
+         if (defined($slots[$slot]) || exists $taken{$slot}) {
+            $found = 0;
+            last;
+         }
+
+         $taken{$slot} = $name;
+      }
+
+      if ($found) {
+         $displacements[$bucket] = $d;
+         $slots[$_] = $taken{$_} foreach (keys %taken);
+      }
+   }
+
+   die "No displacement for bucket $bucket" unless ($found);
+}
+
+my $output = <<'EOH';
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ *
+ * Note: This file is automatically generated by make-atoms.pl
+ *
+ * Do not edit this file, changes will be overwritten during build.
+ */
+
+
+EOH
+
+$output .= "#define ATOM_BUCKETS $n_buckets\n";
+$output .= "#define ATOM_SLOTS $n_names\n\n";
+
+$output .= "static const uint16_t atom_displacements[ATOM_BUCKETS] = {\n";
+for (my $i = 0; $i < $n_buckets; $i += 8) {
+   my $last = ($i + 8 < $n_buckets) ? $i + 8 : $n_buckets;
+   $output .= "\t" . join(", ", @displacements[$i .. $last - 1]) . ",\n";
+}
+$output .= "};\n\n";
+
+$output .= "static const hubbub_atom_slot atom_slots[ATOM_SLOTS] = {\n";
+foreach my $name (@slots) {
+   $output .= "\t{ \"$name\", " . length($name) . ", " .
+         atom_of($name) . " },\n";
+}
+$output .= "};\n\n";
+
+$output .= "static const char *const atom_names[] = {\n";
+foreach my $name (@names) {
+   $output .= "\t[" . atom_of($name) . "] = \"$name\",\n";
+}
+$output .= "};\n";
+
+# Write file out
+
+if (open(EXISTING, "<", ATOMS_INC)) {
+   local $/ = undef();
+   my $now = <EXISTING>;
+   undef($output) if ($output eq $now);
+   close(EXISTING);
+}
+
+if (defined($output)) {
+   open(OUTF, ">", ATOMS_INC);
+   print OUTF $output;
+   close(OUTF);
+}
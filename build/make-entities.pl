@@ -42,85 +42,146 @@ my $output = <<'EOH';
 
 EOH
 
-# Build a Trie of the entities
+# Build a trie of the entities, in which each node is a hash of its
+# children keyed by character
 
-my $heapindex = 0;
+my $trie = { children => {} };
 
-my @nodelist;
+foreach my $key (keys %entities) {
+   my $node = $trie;
+
+   foreach my $char (split //, $key) {
+      $node->{children}{$char} ||= { children => {} };
+      $node = $node->{children}{$char};
+   }
+
+   $node->{value} = $entities{$key};
+}
+
+# Number the characters that appear in entity names from 1. Transitions
+# are made on these codes rather than bytes, which keeps the array small.
+
+my %codes;
+
+foreach my $key (keys %entities) {
+   $codes{$_} = 1 foreach (split //, $key);
+}
 
-sub insert_node {
-   my ($parent, $key, $code) = @_;
-   my ($pivot, $tail);
+my @alphabet = sort keys %codes;
+my $code = 1;
+$codes{$_} = $code++ foreach (@alphabet);
+my $max_code = $code - 1;
 
-   if (length($key) == 0) {
-      $pivot = ''; $tail = '';
-   } elsif (length($key) == 1) {
-      $pivot = $key; $tail = '';
-   } else {
-      $pivot = substr($key, 0, 1);
-      $tail = substr($key, 1);
+# Lay the trie out as a double array. The children of a node with a given
+# base are found at index base + code, and each records the index of its
+# parent as a check. Index 0 is unused, so that a check of 0 marks a free
+# slot, and the root lives at index 1. Nodes are placed breadth first, each
+# set of children going in the first gap they fit, so that the nodes near
+# the root, which every search visits, are close together.
+
+use constant ROOT => 1;
+use constant TERMINAL => 0x8000;
+
+my @base;
+my @check = (0, 0);
+my @value;
+my $first_free = ROOT + 1;
+
+$trie->{index} = ROOT;
+
+my @queue = ($trie);
+
+while (my $node = shift @queue) {
+   my @chars = sort keys %{$node->{children}};
+
+   next unless (@chars);
+
+   my @offsets = map { $codes{$_} } @chars;
+   my $base = $first_free - $offsets[0];
+   $base = 1 if ($base < 1);
+
+   BASE: while (1) {
+      foreach my $offset (@offsets) {
+         if ($check[$base + $offset]) {
+            $base++;
+            next BASE;
+         }
+      }
+      last;
    }
 
-   unless (defined($parent)) {
-      $parent = { pivot => $pivot, heapindex => $heapindex };
-      push @nodelist, $parent;
-      $heapindex++;
+   die "Trie too large" if ($base + $max_code >= TERMINAL);
+
+   $base[$node->{index}] = $base;
+
+   foreach my $char (@chars) {
+      my $child = $node->{children}{$char};
+
+      $child->{index} = $base + $codes{$char};
+      $check[$child->{index}] = $node->{index};
+
+      push @queue, $child;
    }
 
-   if ($pivot lt $parent->{pivot}) {
-      $parent->{lt} = insert_node($parent->{lt}, $key, $code);
-   } elsif ($pivot eq $parent->{pivot}) {
-      if ($pivot eq '') {
-         $parent->{value} = $code;
-      } elsif (substr($tail, 0, 1) eq '') {
-         $parent->{value} = $code;
-         $parent->{eq} = insert_node($parent->{eq}, $tail, $code);
-      } else {
-         $parent->{eq} = insert_node($parent->{eq}, $tail, $code);
-      }
-   } else {
-      $parent->{gt} = insert_node($parent->{gt}, $key, $code);
+   $first_free++ while ($check[$first_free]);
+}
+
+# Flag the nodes that complete an entity, and pad the array so that any
+# transition from any node lands within it
+
+sub collect_values {
+   my ($node) = @_;
+
+   if (defined($node->{value})) {
+      $value[$node->{index}] = $node->{value};
    }
-   return $parent;
+
+   collect_values($_) foreach (values %{$node->{children}});
 }
 
-my $trie;
+collect_values($trie);
 
-foreach my $key (keys %entities) {
-   $trie = insert_node($trie, $key, $entities{$key});
+my $n_states = scalar(@check);
+
+foreach my $base (@base) {
+   $n_states = $base + $max_code + 1
+         if (defined($base) && $base + $max_code + 1 > $n_states);
 }
 
-# Serialise the Trie to the output string
+# Serialise the double array to the output string
 
-$output .= "static hubbub_entity_node dict[] = {\n";
+$output .= "#define ENTITY_ROOT " . ROOT . "\n";
+$output .= "#define ENTITY_TERMINAL " . sprintf("0x%04X", TERMINAL) . "\n";
+$output .= "#define ENTITY_STATES $n_states\n\n";
 
-foreach my $node (@nodelist) {
-   my $split = $node->{pivot};
-   my $lt = $node->{lt};
-   my $eq = $node->{eq};
-   my $gt = $node->{gt};
-   my $value = $node->{value};
+$output .= "static const uint8_t entity_codes[256] = {\n";
 
-   $lt = $lt->{heapindex} if defined($lt);
-   $lt = "-1" unless defined($lt);
+foreach my $char (@alphabet) {
+   $output .= "\t['$char'] = $codes{$char},\n";
+}
 
-   $eq = $eq->{heapindex} if defined($eq);
-   $eq = "-1" unless defined($eq);
+$output .= "};\n\n";
 
-   $gt = $gt->{heapindex} if defined($gt);
-   $gt = "-1" unless defined($gt);
+$output .= "static const hubbub_entity_state entity_states[ENTITY_STATES] = {\n";
 
-   $split = ord($split) if ($split ne '');
-   $split = 0 if ($split eq '');
+for (my $i = 0; $i < $n_states; $i++) {
+   my $base = $base[$i] || 0;
+   my $check = $check[$i] || 0;
 
-   $value = "0" unless defined($value);
+   $base |= TERMINAL if (defined($value[$i]));
 
-   $output .= "\t{ $split, $lt, $eq, $gt, $value },\n";
+   $output .= sprintf("\t{ 0x%04X, %d },\n", $base, $check);
 }
 
 $output .= "};\n\n";
 
-$output .= "static int32_t dict_root = " . $trie->{heapindex} . ";\n";
+$output .= "static const uint32_t entity_values[ENTITY_STATES] = {\n";
+
+for (my $i = 0; $i < $n_states; $i++) {
+   $output .= "\t[$i] = $value[$i],\n" if (defined($value[$i]));
+}
+
+$output .= "};\n\n";
 
 # Write file out
 
@@ -0,0 +1,40 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_arena_h_
+#define hubbub_arena_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+
+typedef struct hubbub_arena hubbub_arena;
+
+/* Create an arena to allocate from */
+hubbub_error hubbub_arena_create(size_t chunk_size,
+		hubbub_allocator_fn alloc, void *pw, hubbub_arena **arena);
+
+/* Destroy an arena, and everything allocated from it */
+hubbub_error hubbub_arena_destroy(hubbub_arena *arena);
+
+/* Release everything allocated from an arena, for it to be reused */
+hubbub_error hubbub_arena_reset(hubbub_arena *arena);
+
+/* Allocation function drawing on the arena given as ::pw */
+void *hubbub_arena_alloc(void *ptr, size_t size, void *pw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,186 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_atoms_h_
+#define hubbub_atoms_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Atoms for known element names
+ *
+ * The tokeniser resolves the name of each tag it emits to one of these,
+ * so that the name need not be compared as a string to identify the
+ * element. Names are matched once lowercased, so SVG names such as
+ * foreignObject have lowercase atoms. Names which are not known have
+ * the atom HUBBUB_ATOM_UNKNOWN.
+ */
+typedef enum hubbub_atom {
+	HUBBUB_ATOM_UNKNOWN = 0,
+
+	HUBBUB_ATOM_A,
+	HUBBUB_ATOM_ABBR,
+	HUBBUB_ATOM_ACRONYM,
+	HUBBUB_ATOM_ADDRESS,
+	HUBBUB_ATOM_ANNOTATION_XML,
+	HUBBUB_ATOM_APPLET,
+	HUBBUB_ATOM_AREA,
+	HUBBUB_ATOM_ARTICLE,
+	HUBBUB_ATOM_ASIDE,
+	HUBBUB_ATOM_AUDIO,
+	HUBBUB_ATOM_B,
+	HUBBUB_ATOM_BASE,
+	HUBBUB_ATOM_BASEFONT,
+	HUBBUB_ATOM_BDI,
+	HUBBUB_ATOM_BDO,
+	HUBBUB_ATOM_BGSOUND,
+	HUBBUB_ATOM_BIG,
+	HUBBUB_ATOM_BLINK,
+	HUBBUB_ATOM_BLOCKQUOTE,
+	HUBBUB_ATOM_BODY,
+	HUBBUB_ATOM_BR,
+	HUBBUB_ATOM_BUTTON,
+	HUBBUB_ATOM_CANVAS,
+	HUBBUB_ATOM_CAPTION,
+	HUBBUB_ATOM_CENTER,
+	HUBBUB_ATOM_CITE,
+	HUBBUB_ATOM_CODE,
+	HUBBUB_ATOM_COL,
+	HUBBUB_ATOM_COLGROUP,
+	HUBBUB_ATOM_COMMAND,
+	HUBBUB_ATOM_DATA,
+	HUBBUB_ATOM_DATAGRID,
+	HUBBUB_ATOM_DATALIST,
+	HUBBUB_ATOM_DD,
+	HUBBUB_ATOM_DEL,
+	HUBBUB_ATOM_DESC,
+	HUBBUB_ATOM_DETAILS,
+	HUBBUB_ATOM_DFN,
+	HUBBUB_ATOM_DIALOG,
+	HUBBUB_ATOM_DIR,
+	HUBBUB_ATOM_DIV,
+	HUBBUB_ATOM_DL,
+	HUBBUB_ATOM_DT,
+	HUBBUB_ATOM_EM,
+	HUBBUB_ATOM_EMBED,
+	HUBBUB_ATOM_FIELDSET,
+	HUBBUB_ATOM_FIGCAPTION,
+	HUBBUB_ATOM_FIGURE,
+	HUBBUB_ATOM_FONT,
+	HUBBUB_ATOM_FOOTER,
+	HUBBUB_ATOM_FOREIGNOBJECT,
+	HUBBUB_ATOM_FORM,
+	HUBBUB_ATOM_FRAME,
+	HUBBUB_ATOM_FRAMESET,
+	HUBBUB_ATOM_H1,
+	HUBBUB_ATOM_H2,
+	HUBBUB_ATOM_H3,
+	HUBBUB_ATOM_H4,
+	HUBBUB_ATOM_H5,
+	HUBBUB_ATOM_H6,
+	HUBBUB_ATOM_HEAD,
+	HUBBUB_ATOM_HEADER,
+	HUBBUB_ATOM_HGROUP,
+	HUBBUB_ATOM_HR,
+	HUBBUB_ATOM_HTML,
+	HUBBUB_ATOM_I,
+	HUBBUB_ATOM_IFRAME,
+	HUBBUB_ATOM_IMAGE,
+	HUBBUB_ATOM_IMG,
+	HUBBUB_ATOM_INPUT,
+	HUBBUB_ATOM_INS,
+	HUBBUB_ATOM_ISINDEX,
+	HUBBUB_ATOM_KBD,
+	HUBBUB_ATOM_KEYGEN,
+	HUBBUB_ATOM_LABEL,
+	HUBBUB_ATOM_LEGEND,
+	HUBBUB_ATOM_LI,
+	HUBBUB_ATOM_LINK,
+	HUBBUB_ATOM_LISTING,
+	HUBBUB_ATOM_MAIN,
+	HUBBUB_ATOM_MALIGNMARK,
+	HUBBUB_ATOM_MAP,
+	HUBBUB_ATOM_MARK,
+	HUBBUB_ATOM_MARQUEE,
+	HUBBUB_ATOM_MATH,
+	HUBBUB_ATOM_MENU,
+	HUBBUB_ATOM_MENUITEM,
+	HUBBUB_ATOM_META,
+	HUBBUB_ATOM_METER,
+	HUBBUB_ATOM_MGLYPH,
+	HUBBUB_ATOM_MI,
+	HUBBUB_ATOM_MN,
+	HUBBUB_ATOM_MO,
+	HUBBUB_ATOM_MS,
+	HUBBUB_ATOM_MTEXT,
+	HUBBUB_ATOM_NAV,
+	HUBBUB_ATOM_NOBR,
+	HUBBUB_ATOM_NOEMBED,
+	HUBBUB_ATOM_NOFRAMES,
+	HUBBUB_ATOM_NOSCRIPT,
+	HUBBUB_ATOM_OBJECT,
+	HUBBUB_ATOM_OL,
+	HUBBUB_ATOM_OPTGROUP,
+	HUBBUB_ATOM_OPTION,
+	HUBBUB_ATOM_OUTPUT,
+	HUBBUB_ATOM_P,
+	HUBBUB_ATOM_PARAM,
+	HUBBUB_ATOM_PICTURE,
+	HUBBUB_ATOM_PLAINTEXT,
+	HUBBUB_ATOM_PRE,
+	HUBBUB_ATOM_PROGRESS,
+	HUBBUB_ATOM_Q,
+	HUBBUB_ATOM_RB,
+	HUBBUB_ATOM_RP,
+	HUBBUB_ATOM_RT,
+	HUBBUB_ATOM_RTC,
+	HUBBUB_ATOM_RUBY,
+	HUBBUB_ATOM_S,
+	HUBBUB_ATOM_SAMP,
+	HUBBUB_ATOM_SCRIPT,
+	HUBBUB_ATOM_SECTION,
+	HUBBUB_ATOM_SELECT,
+	HUBBUB_ATOM_SMALL,
+	HUBBUB_ATOM_SOURCE,
+	HUBBUB_ATOM_SPACER,
+	HUBBUB_ATOM_SPAN,
+	HUBBUB_ATOM_STRIKE,
+	HUBBUB_ATOM_STRONG,
+	HUBBUB_ATOM_STYLE,
+	HUBBUB_ATOM_SUB,
+	HUBBUB_ATOM_SUMMARY,
+	HUBBUB_ATOM_SUP,
+	HUBBUB_ATOM_SVG,
+	HUBBUB_ATOM_TABLE,
+	HUBBUB_ATOM_TBODY,
+	HUBBUB_ATOM_TD,
+	HUBBUB_ATOM_TEMPLATE,
+	HUBBUB_ATOM_TEXTAREA,
+	HUBBUB_ATOM_TFOOT,
+	HUBBUB_ATOM_TH,
+	HUBBUB_ATOM_THEAD,
+	HUBBUB_ATOM_TIME,
+	HUBBUB_ATOM_TITLE,
+	HUBBUB_ATOM_TR,
+	HUBBUB_ATOM_TRACK,
+	HUBBUB_ATOM_TT,
+	HUBBUB_ATOM_U,
+	HUBBUB_ATOM_UL,
+	HUBBUB_ATOM_VAR,
+	HUBBUB_ATOM_VIDEO,
+	HUBBUB_ATOM_WBR,
+	HUBBUB_ATOM_XMP
+} hubbub_atom;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -41,6 +41,36 @@ typedef void *(*hubbub_allocator_fn)(void *ptr, size_t size, void *pw);
 typedef hubbub_error (*hubbub_token_handler)(
 		const hubbub_token *token, void *pw);
 
+/**
+ * Type of batched token handling function
+ *
+ * \param tokens    Pointer to array of tokens to handle
+ * \param n_tokens  Number of tokens in array
+ * \param pw        Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * The tokens, and all the data they refer to, remain valid until the
+ * handler returns.
+ *
+ * Returning HUBBUB_PAUSED pauses the tokeniser, and an error stops it, after
+ * the last token of the batch, whenever the batch is delivered; the result
+ * is returned from the call that was tokenising.
+ */
+typedef hubbub_error (*hubbub_token_batch_handler)(
+		const hubbub_token *tokens, uint32_t n_tokens, void *pw);
+
+/**
+ * Type of preload handling function
+ *
+ * \param preload  Pointer to resource found ahead of the parse
+ * \param pw       Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * The strings in the resource remain valid until the handler returns.
+ */
+typedef hubbub_error (*hubbub_preload_handler)(
+		const hubbub_preload *preload, void *pw);
+
 /**
  * Type of parse error handling function
  *
@@ -0,0 +1,43 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_lines_h_
+#define hubbub_lines_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+
+typedef struct hubbub_line_index hubbub_line_index;
+
+/* Create an index of the lines in a document
+ *
+ * Offsets into it are counted as in tokens, after any byte order mark.
+ * Tokens after data inserted into the parse are placed beyond where they
+ * are in the document, by the length of the data. */
+hubbub_error hubbub_line_index_create(const uint8_t *data, size_t len,
+		hubbub_allocator_fn alloc, void *pw,
+		hubbub_line_index **index);
+
+/* Destroy a line index */
+hubbub_error hubbub_line_index_destroy(hubbub_line_index *index);
+
+/* Find the line and column at an offset into the document */
+hubbub_error hubbub_line_index_locate(hubbub_line_index *index,
+		size_t offset, uint32_t *line, uint32_t *col);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -23,6 +23,8 @@ extern "C"
 
 typedef struct hubbub_parser hubbub_parser;
 
+typedef struct hubbub_parser_snapshot hubbub_parser_snapshot;
+
 /**
  * Hubbub parser option types
  */
@@ -34,7 +36,12 @@ typedef enum hubbub_parser_opttype {
 	HUBBUB_PARSER_DOCUMENT_NODE,
 	HUBBUB_PARSER_ENABLE_SCRIPTING,
 	HUBBUB_PARSER_PAUSE,
-	HUBBUB_PARSER_ENABLE_STYLING
+	HUBBUB_PARSER_ENABLE_STYLING,
+	HUBBUB_PARSER_COALESCE_CHARACTERS,
+	HUBBUB_PARSER_TOKEN_BATCH,
+	HUBBUB_PARSER_TOKEN_FILTER,
+	HUBBUB_PARSER_LIMITS,
+	HUBBUB_PARSER_PRELOAD_HANDLER
 } hubbub_parser_opttype;
 
 /**
@@ -63,14 +70,94 @@ typedef union hubbub_parser_optparams {
 	bool enable_styling;		/**< Whether to enable styling */
 
 	bool pause_parse;		/**< Pause parsing */
+
+	bool coalesce_characters;	/**< Whether to emit runs of text
+					 * with line breaks and NULs in as
+					 * single character tokens */
+
+	struct {
+		hubbub_token_batch_handler handler;
+		hubbub_token *tokens;
+		uint32_t size;
+		void *pw;
+	} token_batch;			/**< Batched token handling callback,
+					 * with array of ::size tokens to
+					 * fill for it */
+
+	uint32_t token_filter;		/**< Mask of the token types to
+					 * emit, from HUBBUB_TOKEN_MASK() */
+
+	/**
+	 * Limits on the resources used for a document, each 0 for none
+	 *
+	 * The text of a token is cut off at ::max_token_bytes, at a
+	 * character boundary, except for character data, which is split
+	 * into as many tokens as it takes. The limit applies to each
+	 * token's text as a whole: a tag's name and attributes, for
+	 * instance. It must be at least 4. Attributes beyond
+	 * ::max_attributes in a tag are dropped, as are any whose names
+	 * are cut off entirely. The input behind a token that outgrows
+	 * the limit is let go as it is read, so a token that never ends
+	 * holds on to little more than that.
+	 *
+	 * Once ::max_depth elements are open, including the html
+	 * element, no more are opened: an element that would be is left
+	 * out, along with the rest of its start tag's effects. Void
+	 * elements are still inserted, as are elements whose start tags
+	 * close others first.
+	 *
+	 * If the parser would need more than ::max_alloc_bytes of memory
+	 * at once, including its own overheads, the parse fails with
+	 * HUBBUB_NOMEM. Memory allocated by the client's tree handler
+	 * isn't counted. Only a parser made by
+	 * hubbub_parser_create_limited() with a limit counts its memory,
+	 * so for others this must be 0.
+	 */
+	struct {
+		size_t max_token_bytes;	/**< Most bytes of text in a token */
+		uint32_t max_attributes;	/**< Most attributes in a tag */
+		uint32_t max_depth;	/**< Most elements open at once */
+		size_t max_alloc_bytes;	/**< Most memory to allocate */
+	} limits;
+
+	/**
+	 * Callback for resources found ahead of a paused parse
+	 *
+	 * While the parse is paused, the data buffered ahead of it, and
+	 * each chunk passed to the parser after, is scanned for the URLs
+	 * of scripts, links, images and imported style sheets, so that
+	 * they may be fetched early. What is found is passed to the
+	 * handler. A NULL handler turns scanning off.
+	 */
+	struct {
+		hubbub_preload_handler handler;
+		void *pw;
+	} preload_handler;
 } hubbub_parser_optparams;
 
+/**
+ * Flags for hubbub_parser_parse_buffer
+ */
+typedef enum hubbub_parser_buffer_flags {
+	HUBBUB_PARSER_BUFFER_BORROW	= (1 << 0)	/**< Buffer outlives
+							 * the parser, so may
+							 * be read in place */
+} hubbub_parser_buffer_flags;
+
 /* Create a hubbub parser */
 hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 		hubbub_allocator_fn alloc, void *pw, hubbub_parser **parser);
+/* Create a hubbub parser whose memory may be limited */
+hubbub_error hubbub_parser_create_limited(const char *enc, bool fix_enc,
+		size_t max_alloc_bytes, hubbub_allocator_fn alloc, void *pw,
+		hubbub_parser **parser);
 /* Destroy a hubbub parser */
 hubbub_error hubbub_parser_destroy(hubbub_parser *parser);
 
+/* Return a hubbub parser to its initial state, to parse a new document */
+hubbub_error hubbub_parser_reset(hubbub_parser *parser, const char *enc,
+		bool fix_enc);
+
 /* Configure a hubbub parser */
 hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		hubbub_parser_opttype type,
@@ -81,6 +168,14 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
 		const uint8_t *data, size_t len);
 
+/* Pass the whole of a document to a hubbub parser for parsing */
+/* This data is encoded in the input charset */
+hubbub_error hubbub_parser_parse_buffer(hubbub_parser *parser,
+		const uint8_t *data, size_t len, uint32_t flags);
+/* Pass the whole of a document in a file to a hubbub parser for parsing */
+hubbub_error hubbub_parser_parse_file(hubbub_parser *parser,
+		const char *path);
+
 /**
  * Insert a chunk of data into a hubbub parser input stream
  *
@@ -100,6 +195,16 @@ hubbub_error hubbub_parser_insert_chunk(hubbub_parser *parser,
 /* Inform the parser that the last chunk of data has been parsed */
 hubbub_error hubbub_parser_completed(hubbub_parser *parser);
 
+/* Take a snapshot of the tokenisation of a document */
+hubbub_error hubbub_parser_snapshot_create(hubbub_parser *parser,
+		hubbub_parser_snapshot **snapshot);
+/* Return the tokenisation of a document to a snapshot */
+hubbub_error hubbub_parser_snapshot_restore(hubbub_parser *parser,
+		const hubbub_parser_snapshot *snapshot);
+/* Destroy a snapshot of the tokenisation of a document */
+hubbub_error hubbub_parser_snapshot_destroy(hubbub_parser *parser,
+		hubbub_parser_snapshot *snapshot);
+
 /* Read the document charset */
 const char *hubbub_parser_read_charset(hubbub_parser *parser,
 		hubbub_charset_source *source);
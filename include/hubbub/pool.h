@@ -0,0 +1,45 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_pool_h_
+#define hubbub_pool_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/parser.h>
+
+typedef struct hubbub_parser_pool hubbub_parser_pool;
+
+/* Create a pool of parsers */
+hubbub_error hubbub_parser_pool_create(const char *enc, bool fix_enc,
+		uint32_t size, hubbub_allocator_fn alloc, void *pw,
+		hubbub_parser_pool **pool);
+
+/* Destroy a pool of parsers */
+hubbub_error hubbub_parser_pool_destroy(hubbub_parser_pool *pool);
+
+/* Take a parser from a pool, ready to parse a document */
+hubbub_error hubbub_parser_pool_acquire(hubbub_parser_pool *pool,
+		hubbub_parser **parser);
+
+/* Give a parser back to the pool it was taken from */
+hubbub_error hubbub_parser_pool_release(hubbub_parser_pool *pool,
+		hubbub_parser *parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
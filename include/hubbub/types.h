@@ -16,6 +16,8 @@ extern "C"
 #include <stdbool.h>
 #include <inttypes.h>
 
+#include <hubbub/atoms.h>
+
 /** Source of charset information, in order of importance
  * A client-dictated charset will override all others.
  * A document-specified charset will override autodetection or the default */
@@ -57,6 +59,12 @@ typedef enum hubbub_token_type {
 	HUBBUB_TOKEN_EOF
 } hubbub_token_type;
 
+/** Bit representing a token type in a mask of token types */
+#define HUBBUB_TOKEN_MASK(type) (1u << (type))
+
+/** Mask of all token types */
+#define HUBBUB_TOKEN_MASK_ALL (HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_EOF + 1) - 1)
+
 /**
  * Possible namespaces
  */
@@ -111,10 +119,18 @@ typedef struct hubbub_tag {
 	uint32_t n_attributes;		/**< Count of attributes */
 	hubbub_attribute *attributes;	/**< Array of attribute data */
 	bool self_closing;		/**< Whether the tag can have children */
+	hubbub_atom atom;		/**< Atom for tag name */
 } hubbub_tag;
 
 /**
  * Token data
+ *
+ * The offsets locate the source text of the token within the input, as
+ * converted to UTF-8, counted from the start of the document. A byte order
+ * mark is not part of the document, so is not counted. Data inserted with
+ * hubbub_parser_insert_chunk() is counted as though it were part of the
+ * input, so offsets after an insertion exceed those in the original input
+ * by the length of the data inserted.
  */
 typedef struct hubbub_token {
 	hubbub_token_type type;		/**< The token type */
@@ -128,8 +144,33 @@ typedef struct hubbub_token {
 
 		hubbub_string character;
 	} data;				/**< Type-specific data */
+
+	size_t start;			/**< Byte offset of start of token */
+	size_t end;			/**< Byte offset just past end of token */
 } hubbub_token;
 
+/**
+ * Types of resource found ahead of the parse
+ */
+typedef enum hubbub_preload_type {
+	HUBBUB_PRELOAD_SCRIPT,		/**< src of a script element */
+	HUBBUB_PRELOAD_LINK,		/**< href of a link element */
+	HUBBUB_PRELOAD_IMAGE,		/**< src of an img element, or a URL
+					 * in its srcset */
+	HUBBUB_PRELOAD_IMPORT		/**< URL of an @import rule in a
+					 * style element */
+} hubbub_preload_type;
+
+/**
+ * Resource found ahead of the parse, which may be fetched early
+ */
+typedef struct hubbub_preload {
+	hubbub_preload_type type;	/**< Type of resource */
+	hubbub_string url;		/**< URL, as in the document */
+	hubbub_string rel;		/**< rel attribute of a link element,
+					 * or empty */
+} hubbub_preload;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <hubbub/hubbub.h>
+
+#include "tokeniser/atoms.h"
+
+#define S(x)   x, sizeof(x) - 1
+
+/* Number of names looked up per pass */
+#define N_LOOKUPS (1024 * 1024)
+
+/* Element names as they might be found in a typical document, weighted by
+ * roughly how often each occurs. A few of them aren't known elements. */
+static const struct {
+	const char *name;
+	size_t len;
+	int weight;
+} sample[] = {
+	{ S("a"), 20 },		{ S("div"), 20 },	{ S("span"), 14 },
+	{ S("li"), 8 },		{ S("p"), 8 },		{ S("td"), 6 },
+	{ S("img"), 6 },	{ S("tr"), 4 },		{ S("br"), 4 },
+	{ S("script"), 3 },	{ S("meta"), 3 },	{ S("link"), 3 },
+	{ S("input"), 2 },	{ S("ul"), 2 },		{ S("b"), 2 },
+	{ S("i"), 2 },		{ S("strong"), 2 },	{ S("option"), 2 },
+	{ S("table"), 1 },	{ S("form"), 1 },	{ S("h2"), 1 },
+	{ S("button"), 1 },	{ S("style"), 1 },	{ S("noscript"), 1 },
+	{ S("iframe"), 1 },	{ S("svg"), 1 },	{ S("path"), 1 },
+	{ S("blockquote"), 1 },	{ S("html"), 1 },	{ S("body"), 1 },
+	{ S("head"), 1 },	{ S("title"), 1 },	{ S("section"), 1 },
+	{ S("nav"), 1 },	{ S("custom-el"), 1 },	{ S("DIV"), 1 },
+};
+
+#define N_SAMPLES (sizeof(sample) / sizeof(sample[0]))
+
+/* The names the treebuilder used to search linearly, in the same order,
+ * from before tag names were resolved to atoms */
+static const struct {
+	const char *name;
+	size_t len;
+} linear_names[] = {
+	{ S("address") },	{ S("area") },		{ S("base") },
+	{ S("basefont") },	{ S("bgsound") },	{ S("blockquote") },
+	{ S("body") },		{ S("br") },		{ S("center") },
+	{ S("col") },		{ S("colgroup") },	{ S("dd") },
+	{ S("dir") },		{ S("div") },		{ S("dl") },
+	{ S("dt") },		{ S("embed") },		{ S("fieldset") },
+	{ S("form") },		{ S("frame") },		{ S("frameset") },
+	{ S("h1") },		{ S("h2") },		{ S("h3") },
+	{ S("h4") },		{ S("h5") },		{ S("h6") },
+	{ S("head") },		{ S("hr") },		{ S("iframe") },
+	{ S("image") },		{ S("img") },		{ S("input") },
+	{ S("isindex") },	{ S("li") },		{ S("link") },
+	{ S("listing") },	{ S("menu") },		{ S("meta") },
+	{ S("noembed") },	{ S("noframes") },	{ S("noscript") },
+	{ S("ol") },		{ S("optgroup") },	{ S("option") },
+	{ S("output") },	{ S("p") },		{ S("param") },
+	{ S("plaintext") },	{ S("pre") },		{ S("script") },
+	{ S("select") },	{ S("spacer") },	{ S("style") },
+	{ S("tbody") },		{ S("textarea") },	{ S("tfoot") },
+	{ S("thead") },		{ S("title") },		{ S("tr") },
+	{ S("ul") },		{ S("wbr") },		{ S("applet") },
+	{ S("button") },	{ S("caption") },	{ S("html") },
+	{ S("marquee") },	{ S("object") },	{ S("table") },
+	{ S("td") },		{ S("th") },		{ S("a") },
+	{ S("b") },		{ S("big") },		{ S("em") },
+	{ S("font") },		{ S("i") },		{ S("nobr") },
+	{ S("s") },		{ S("small") },		{ S("strike") },
+	{ S("strong") },	{ S("tt") },		{ S("u") },
+	{ S("xmp") },		{ S("math") },		{ S("mglyph") },
+	{ S("malignmark") },	{ S("mi") },		{ S("mo") },
+	{ S("mn") },		{ S("ms") },		{ S("mtext") },
+	{ S("annotation-xml") },	{ S("svg") },	{ S("desc") },
+	{ S("foreignobject") },
+};
+
+#define N_LINEAR (sizeof(linear_names) / sizeof(linear_names[0]))
+
+static size_t linear_lookup(const uint8_t *name, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < N_LINEAR; i++) {
+		if (linear_names[i].len != len)
+			continue;
+
+		if (strncasecmp(linear_names[i].name,
+				(const char *) name, len) == 0)
+			return i + 1;
+	}
+
+	return 0;
+}
+
+static size_t hash_lookup(const uint8_t *name, size_t len)
+{
+	return hubbub_atom_from_name(name, len);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *label, size_t (*lookup)(const uint8_t *, size_t),
+		const size_t *order, int iterations)
+{
+	double start, elapsed;
+	size_t found = 0;
+	size_t i;
+	int n;
+
+	start = now();
+
+	for (n = 0; n < iterations; n++) {
+		for (i = 0; i < N_LOOKUPS; i++) {
+			size_t s = order[i];
+
+			if (lookup((const uint8_t *) sample[s].name,
+					sample[s].len) != 0)
+				found++;
+		}
+	}
+
+	elapsed = now() - start;
+
+	printf("%-8s %d x %d lookups in %.3fs: %.1f ns/lookup, "
+			"%zu found/pass\n", label, iterations, N_LOOKUPS,
+			elapsed, elapsed * 1e9 / ((double) N_LOOKUPS *
+					iterations),
+			found / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	size_t *order;
+	int total = 0, iterations = 20;
+	unsigned int seed = 1;
+	size_t i, s;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	for (s = 0; s < N_SAMPLES; s++)
+		total += sample[s].weight;
+
+	/* Draw names at random according to their weights, so the branch
+	 * predictor can't learn the sequence */
+	order = malloc(N_LOOKUPS * sizeof(size_t));
+	if (order == NULL)
+		return 1;
+
+	for (i = 0; i < N_LOOKUPS; i++) {
+		int pick;
+
+		seed = seed * 1103515245 + 12345;
+		pick = (seed >> 16) % total;
+
+		for (s = 0; pick >= sample[s].weight; s++)
+			pick -= sample[s].weight;
+
+		order[i] = s;
+	}
+
+	run("linear", linear_lookup, order, iterations);
+	run("atoms", hash_lookup, order, iterations);
+
+	free(order);
+
+	return 0;
+}
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+#include <hubbub/pool.h>
+
+#define UNUSED(x) ((x) = (x))
+
+/* Size of the generated document, about that of a typical page */
+#define DOC_SIZE (32 * 1024)
+
+/* Size of chunks fed to the parser, as if arriving from the network */
+#define CHUNK_SIZE 4096
+
+typedef struct buf_t buf_t;
+
+struct buf_t {
+	uint8_t *buf;
+	size_t len;
+	size_t alloc;
+};
+
+typedef struct worker_t worker_t;
+
+struct worker_t {
+	pthread_t thread;
+	hubbub_parser_pool *pool;	/* Pool to take parsers from, or NULL
+					 * to create one for each document */
+	int documents;			/* Documents to parse */
+	size_t n_tokens;		/* Tokens seen */
+};
+
+static buf_t doc;
+
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	worker_t *w = pw;
+
+	UNUSED(token);
+
+	w->n_tokens++;
+
+	return HUBBUB_OK;
+}
+
+static void buf_append(buf_t *buf, const char *data, size_t len)
+{
+	if (buf->len + len > buf->alloc) {
+		buf->alloc = (buf->alloc + len) * 2;
+		buf->buf = realloc(buf->buf, buf->alloc);
+		assert(buf->buf != NULL);
+	}
+
+	memcpy(buf->buf + buf->len, data, len);
+	buf->len += len;
+}
+
+#define APPEND(buf, s) buf_append((buf), (s), sizeof(s) - 1)
+
+static void gen_page(buf_t *buf)
+{
+	APPEND(buf, "<!DOCTYPE html><html><head><title>Page</title>"
+			"<link rel=stylesheet href=/s.css></head><body>\n");
+
+	while (buf->len < DOC_SIZE) {
+		APPEND(buf, "<div class=item><h2><a href=\"/item?id=1\">"
+				"Heading</a></h2><p>Some text about the item, "
+				"with <b>bold</b> and <i>italic</i> words &amp; "
+				"an entity or two.</p><ul><li>One<li>Two</ul>"
+				"</div>\n");
+	}
+
+	APPEND(buf, "</body></html>\n");
+}
+
+static void parse(worker_t *w, hubbub_parser *parser)
+{
+	hubbub_parser_optparams params;
+	size_t off;
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = w;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	for (off = 0; off < doc.len; off += CHUNK_SIZE) {
+		size_t len = doc.len - off;
+
+		if (len > CHUNK_SIZE)
+			len = CHUNK_SIZE;
+
+		assert(hubbub_parser_parse_chunk(parser, doc.buf + off,
+				len) == HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+}
+
+static void *worker(void *arg)
+{
+	worker_t *w = arg;
+	hubbub_parser *parser;
+	int n;
+
+	for (n = 0; n < w->documents; n++) {
+		if (w->pool != NULL) {
+			assert(hubbub_parser_pool_acquire(w->pool,
+					&parser) == HUBBUB_OK);
+			parse(w, parser);
+			assert(hubbub_parser_pool_release(w->pool,
+					parser) == HUBBUB_OK);
+		} else {
+			assert(hubbub_parser_create("UTF-8", false,
+					myrealloc, NULL, &parser) ==
+					HUBBUB_OK);
+			parse(w, parser);
+			hubbub_parser_destroy(parser);
+		}
+	}
+
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parse documents on a number of threads at once, returning the rate */
+static double run(hubbub_parser_pool *pool, int threads, int documents)
+{
+	worker_t *workers;
+	double start, elapsed;
+	int t;
+
+	workers = calloc(threads, sizeof(worker_t));
+	assert(workers != NULL);
+
+	start = now();
+
+	for (t = 0; t < threads; t++) {
+		workers[t].pool = pool;
+		workers[t].documents = documents;
+		assert(pthread_create(&workers[t].thread, NULL, worker,
+				&workers[t]) == 0);
+	}
+
+	for (t = 0; t < threads; t++)
+		assert(pthread_join(workers[t].thread, NULL) == 0);
+
+	elapsed = now() - start;
+
+	free(workers);
+
+	return (threads * (double) documents) / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser_pool *pool = NULL;
+	bool use_pool = true;
+	int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int documents = 2000;
+	double base = 0;
+	int threads;
+
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		use_pool = false;
+		argc--;
+		argv++;
+	}
+
+	if (argc > 1 && argv[1][0] == '-') {
+		printf("Usage: %s [-c] [threads] [documents-per-thread]\n\n"
+				"Pass -c to create a parser for each document, "
+				"rather than taking one from a pool.\n",
+				argv[0]);
+		return 1;
+	}
+
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+	if (argc > 2)
+		documents = atoi(argv[2]);
+	if (max_threads < 1)
+		max_threads = 1;
+
+	gen_page(&doc);
+
+	if (use_pool) {
+		assert(hubbub_parser_pool_create("UTF-8", false, max_threads,
+				myrealloc, NULL, &pool) == HUBBUB_OK);
+	}
+
+	printf("%s: %zu byte document, %d per thread\n",
+			use_pool ? "pool" : "create", doc.len, documents);
+
+	for (threads = 1; ; threads *= 2) {
+		double rate;
+
+		/* Finish with the number asked for, if not a power of two */
+		if (threads > max_threads)
+			threads = max_threads;
+
+		rate = run(pool, threads, documents);
+		if (threads == 1)
+			base = rate;
+
+		printf("%3d threads: %9.0f documents/s, %5.2fx\n",
+				threads, rate, rate / base);
+
+		if (threads == max_threads)
+			break;
+	}
+
+	if (pool != NULL)
+		assert(hubbub_parser_pool_destroy(pool) == HUBBUB_OK);
+
+	free(doc.buf);
+
+	return 0;
+}
+
@@ -0,0 +1,515 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+
+#define UNUSED(x) ((x) = (x))
+
+/* Size of generated documents */
+#define DOC_SIZE (4 * 1024 * 1024)
+
+/* Size of chunks fed to the parser, as if arriving from the network */
+#define CHUNK_SIZE 4096
+
+/* Number of tokens delivered at once, when batching */
+#define BATCH_SIZE 256
+
+typedef struct buf_t buf_t;
+
+struct buf_t {
+	uint8_t *buf;
+	size_t len;
+	size_t alloc;
+};
+
+typedef struct workload_t workload_t;
+
+struct workload_t {
+	const char *name;
+	const char *description;
+	void (*generate)(buf_t *buf);
+};
+
+static void gen_text(buf_t *buf);
+static void gen_tags(buf_t *buf);
+static void gen_attrs(buf_t *buf);
+static void gen_collide(buf_t *buf);
+static void gen_entities(buf_t *buf);
+static void gen_script(buf_t *buf);
+static void gen_comments(buf_t *buf);
+
+static const workload_t workloads[] = {
+	{ "text", "long runs of prose, few tags", gen_text },
+	{ "tags", "dense, short tags with attributes", gen_tags },
+	{ "attrs", "one element with 50,000 attributes", gen_attrs },
+	{ "collide", "50,000 attributes with colliding hashes", gen_collide },
+	{ "entities", "a table full of character references", gen_entities },
+	{ "script", "large inline scripts and JSON", gen_script },
+	{ "comments", "large commented-out blocks", gen_comments },
+};
+
+#define N_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static size_t n_tokens;
+
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	hubbub_parser *parser = pw;
+	hubbub_parser_optparams params;
+
+	n_tokens++;
+
+	/* Switch content model as the treebuilder would, so that raw text
+	 * is tokenised as such */
+	if (token->type != HUBBUB_TOKEN_START_TAG)
+		return HUBBUB_OK;
+
+	switch (token->data.tag.atom) {
+	case HUBBUB_ATOM_SCRIPT:
+	case HUBBUB_ATOM_STYLE:
+		params.content_model.model = HUBBUB_CONTENT_MODEL_CDATA;
+		break;
+	case HUBBUB_ATOM_TEXTAREA:
+	case HUBBUB_ATOM_TITLE:
+		params.content_model.model = HUBBUB_CONTENT_MODEL_RCDATA;
+		break;
+	default:
+		return HUBBUB_OK;
+	}
+
+	return hubbub_parser_setopt(parser, HUBBUB_PARSER_CONTENT_MODEL,
+			&params);
+}
+
+static hubbub_error batch_handler(const hubbub_token *tokens,
+		uint32_t count, void *pw)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		hubbub_error error = token_handler(&tokens[i], pw);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	return HUBBUB_OK;
+}
+
+static void buf_append(buf_t *buf, const char *data, size_t len)
+{
+	if (buf->len + len > buf->alloc) {
+		buf->alloc = (buf->alloc + len) * 2;
+		buf->buf = realloc(buf->buf, buf->alloc);
+		assert(buf->buf != NULL);
+	}
+
+	memcpy(buf->buf + buf->len, data, len);
+	buf->len += len;
+}
+
+#define APPEND(buf, s) buf_append((buf), (s), sizeof(s) - 1)
+
+static void gen_text(buf_t *buf)
+{
+	static const char *words[] = {
+		"lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+		"adipiscing", "elit", "sed", "do", "eiusmod", "tempor",
+		"incididunt", "ut", "labore", "et", "dolore", "magna",
+		"aliqua", "caf\xc3\xa9", "na\xc3\xafve", "\xe2\x80\x94"
+	};
+	unsigned int seed = 1;
+
+	APPEND(buf, "<!DOCTYPE html><html><head><title>Text</title></head>"
+			"<body>\n");
+
+	while (buf->len < DOC_SIZE) {
+		int w;
+
+		APPEND(buf, "<p>");
+		for (w = 0; w < 200; w++) {
+			const char *word;
+
+			seed = seed * 1103515245 + 12345;
+			word = words[(seed >> 16) %
+					(sizeof(words) / sizeof(words[0]))];
+
+			buf_append(buf, word, strlen(word));
+			buf_append(buf, (w % 17 == 16) ? ".\n" : " ",
+					(w % 17 == 16) ? 2 : 1);
+		}
+		APPEND(buf, "</p>\n");
+	}
+
+	APPEND(buf, "</body></html>\n");
+}
+
+static void gen_tags(buf_t *buf)
+{
+	APPEND(buf, "<!DOCTYPE html><html><head><title>Tags</title></head>"
+			"<body><table>\n");
+
+	while (buf->len < DOC_SIZE) {
+		APPEND(buf, "<tr class=row><td><a href=\"/item?id=1\" "
+				"title='Item'>1</a></td><td align=right>"
+				"<b>2</b><br/><i>3</i></td><td><img src=x.png "
+				"alt=\"\" width=16 height=16></td></tr>\n");
+	}
+
+	APPEND(buf, "</table></body></html>\n");
+}
+
+static void gen_attrs(buf_t *buf)
+{
+	char attr[32];
+	int i;
+
+	APPEND(buf, "<!DOCTYPE html><html><head><title>Attributes</title>"
+			"</head><body><div");
+
+	/* Every fifth attribute repeats the name of an earlier one */
+	for (i = 0; i < 50000; i++) {
+		int len = sprintf(attr, " a%d=%d",
+				(i % 5 == 4) ? i - 3 : i, i);
+
+		buf_append(buf, attr, len);
+	}
+
+	APPEND(buf, "></div></body></html>\n");
+}
+
+static void gen_collide(buf_t *buf)
+{
+	char attr[32];
+	uint32_t candidate = 0, hash;
+	int i, len = 0, k;
+
+	APPEND(buf, "<!DOCTYPE html><html><head><title>Collisions</title>"
+			"</head><body><div");
+
+	/* Names whose unseeded FNV-1a hashes all fall in the first 1024
+	 * slots of the 2^17 slot table a hash of 50,000 attributes would
+	 * use, so that linear probing would make one long cluster of them.
+	 * Every fifth attribute repeats the name of the one before. */
+	for (i = 0; i < 50000; i++) {
+		while (i % 5 != 4) {
+			len = sprintf(attr, " c%" PRIx32, candidate++);
+
+			hash = 2166136261u;
+			for (k = 1; k < len; k++) {
+				hash ^= (uint8_t) attr[k];
+				hash *= 16777619u;
+			}
+
+			if ((hash & ((1 << 17) - 1)) < 1024)
+				break;
+		}
+
+		buf_append(buf, attr, len);
+	}
+
+	APPEND(buf, "></div></body></html>\n");
+}
+
+static void gen_entities(buf_t *buf)
+{
+	APPEND(buf, "<!DOCTYPE html><html><head><title>Entities</title>"
+			"</head><body><table>\n");
+
+	while (buf->len < DOC_SIZE) {
+		APPEND(buf, "<tr><td>&nbsp;</td><td>&nbsp;&nbsp;</td>"
+				"<td>Caf&eacute; &amp; Cr&egrave;me</td>"
+				"<td>&copy;&nbsp;2010 &mdash; &lt;&gt;</td>"
+				"<td title=\"a&amp;b&nbsp;c\">&nbsp;</td></tr>\n");
+	}
+
+	APPEND(buf, "</table></body></html>\n");
+}
+
+static void gen_script(buf_t *buf)
+{
+	APPEND(buf, "<!DOCTYPE html><html><head><title>Script</title>"
+			"</head><body>\n");
+
+	while (buf->len < DOC_SIZE) {
+		int i;
+
+		APPEND(buf, "<script>\n<!--\n");
+		for (i = 0; i < 200; i++) {
+			APPEND(buf, "for (var i = 0; i < n; i++) { "
+					"if (a[i]->next > b && c-- > 0) "
+					"d.innerHTML = '<b>' + e + '</b>'; }\n");
+		}
+		APPEND(buf, "// -->\n</script>\n"
+				"<script type=\"application/json\">");
+		for (i = 0; i < 200; i++) {
+			APPEND(buf, "{\"id\": 1, \"tags\": [\"a\", \"b\"], "
+					"\"html\": \"<p>x</p>\"},\n");
+		}
+		APPEND(buf, "{}</script>\n");
+	}
+
+	APPEND(buf, "</body></html>\n");
+}
+
+static void gen_comments(buf_t *buf)
+{
+	APPEND(buf, "<!DOCTYPE html><html><head><title>Comments</title>"
+			"</head><body>\n");
+
+	while (buf->len < DOC_SIZE) {
+		int i;
+
+		APPEND(buf, "<!--[if lt IE 9]><script src=\"html5shiv.js\">"
+				"</script><![endif]-->\n<!-- disabled:\n");
+		for (i = 0; i < 100; i++) {
+			APPEND(buf, "<div class=\"old-nav\"><a href=\"/a\">"
+					"Home</a> - <a href=\"/b\">About</a>"
+					"</div>\n");
+		}
+		APPEND(buf, "-->\n<p>Text</p>\n");
+	}
+
+	APPEND(buf, "</body></html>\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Hardware events counted over the parse, where the system allows */
+enum { EVENT_INSTRUCTIONS, EVENT_BRANCHES, EVENT_BRANCH_MISSES, N_EVENTS };
+
+typedef struct counters_t counters_t;
+
+struct counters_t {
+	int fd[N_EVENTS];
+	uint64_t value[N_EVENTS];
+};
+
+static void counters_start(counters_t *c)
+{
+#ifdef __linux__
+	static const uint64_t config[N_EVENTS] = {
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES
+	};
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < N_EVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = config[i];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		c->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (c->fd[i] != -1)
+			ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#else
+	int i;
+
+	for (i = 0; i < N_EVENTS; i++)
+		c->fd[i] = -1;
+#endif
+}
+
+/* Stop counting; returns false if the events couldn't be counted */
+static bool counters_stop(counters_t *c)
+{
+	bool ok = true;
+	int i;
+
+	for (i = 0; i < N_EVENTS; i++) {
+		c->value[i] = 0;
+
+		if (c->fd[i] == -1) {
+			ok = false;
+			continue;
+		}
+
+#ifdef __linux__
+		ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(c->fd[i], &c->value[i], sizeof(uint64_t)) !=
+				sizeof(uint64_t))
+			ok = false;
+		close(c->fd[i]);
+#endif
+	}
+
+	return ok;
+}
+
+static void load_file(const char *path, buf_t *buf)
+{
+	FILE *fp = fopen(path, "rb");
+	char data[4096];
+	size_t n;
+
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	while ((n = fread(data, 1, sizeof(data), fp)) > 0)
+		buf_append(buf, data, n);
+
+	fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_token *batch = NULL;
+	uint32_t filter = HUBBUB_TOKEN_MASK_ALL;
+	buf_t doc = { NULL, 0, 0 };
+	int iterations = 20;
+	counters_t counters;
+	double start, elapsed;
+	size_t i, off;
+	int n;
+
+	while (argc > 1 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-b") == 0) {
+			batch = malloc(BATCH_SIZE * sizeof(hubbub_token));
+			assert(batch != NULL);
+		} else if (strcmp(argv[1], "-s") == 0) {
+			filter = HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_START_TAG);
+		} else {
+			break;
+		}
+		argc--;
+		argv++;
+	}
+
+	if (argc < 2) {
+		printf("Usage: %s [-b] [-s] <workload|filename> "
+				"[iterations]\n\n", argv[0]);
+		printf("Workloads:\n");
+		for (i = 0; i < N_WORKLOADS; i++) {
+			printf("  %-10s %s\n", workloads[i].name,
+					workloads[i].description);
+		}
+		return 1;
+	}
+
+	if (argc > 2)
+		iterations = atoi(argv[2]);
+
+	for (i = 0; i < N_WORKLOADS; i++) {
+		if (strcmp(argv[1], workloads[i].name) == 0) {
+			workloads[i].generate(&doc);
+			break;
+		}
+	}
+
+	if (i == N_WORKLOADS)
+		load_file(argv[1], &doc);
+
+	counters_start(&counters);
+	start = now();
+
+	for (n = 0; n < iterations; n++) {
+		assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+				&parser) == HUBBUB_OK);
+
+		if (batch != NULL) {
+			params.token_batch.handler = batch_handler;
+			params.token_batch.tokens = batch;
+			params.token_batch.size = BATCH_SIZE;
+			params.token_batch.pw = parser;
+			assert(hubbub_parser_setopt(parser,
+					HUBBUB_PARSER_TOKEN_BATCH,
+					&params) == HUBBUB_OK);
+		} else {
+			params.token_handler.handler = token_handler;
+			params.token_handler.pw = parser;
+			assert(hubbub_parser_setopt(parser,
+					HUBBUB_PARSER_TOKEN_HANDLER,
+					&params) == HUBBUB_OK);
+		}
+
+		if (filter != HUBBUB_TOKEN_MASK_ALL) {
+			params.token_filter = filter;
+			assert(hubbub_parser_setopt(parser,
+					HUBBUB_PARSER_TOKEN_FILTER,
+					&params) == HUBBUB_OK);
+		}
+
+		for (off = 0; off < doc.len; off += CHUNK_SIZE) {
+			size_t len = doc.len - off;
+
+			if (len > CHUNK_SIZE)
+				len = CHUNK_SIZE;
+
+			assert(hubbub_parser_parse_chunk(parser,
+					doc.buf + off, len) == HUBBUB_OK);
+		}
+		assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+		hubbub_parser_destroy(parser);
+	}
+
+	elapsed = now() - start;
+
+	printf("%s: %zu bytes x %d in %.3fs: %.1f MB/s, %zu tokens/pass\n",
+			argv[1], doc.len, iterations, elapsed,
+			(doc.len * (double) iterations) /
+					(elapsed * 1024 * 1024),
+			n_tokens / iterations);
+
+	if (counters_stop(&counters)) {
+		uint64_t branches = counters.value[EVENT_BRANCHES];
+		uint64_t misses = counters.value[EVENT_BRANCH_MISSES];
+
+		printf("%" PRIu64 " instructions, %" PRIu64 " branches, "
+				"%" PRIu64 " misses (%.2f%%) per pass; "
+				"%.3f misses per token\n",
+				counters.value[EVENT_INSTRUCTIONS] / iterations,
+				branches / iterations, misses / iterations,
+				branches ? 100.0 * misses / branches : 0.0,
+				n_tokens ? (double) misses / n_tokens : 0.0);
+	} else {
+		printf("Branch counters unavailable; "
+				"try perf stat -e branch-misses\n");
+	}
+
+	free(doc.buf);
+	free(batch);
+
+	return 0;
+}
+
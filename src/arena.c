@@ -0,0 +1,312 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hubbub/arena.h>
+
+/** Size of chunk to draw allocations from, if the client has no opinion */
+#define HUBBUB_ARENA_CHUNK_SIZE (64 * 1024)
+
+/**
+ * Header of an allocation, which records its size, aligned as the
+ * allocator would align the allocation itself
+ */
+typedef union hubbub_arena_header {
+	size_t size;			/**< Size of allocation, in bytes,
+					 * rounded up to a whole header */
+	void *align_ptr;
+	double align_double;
+	long double align_long_double;
+} hubbub_arena_header;
+
+typedef struct hubbub_arena_chunk hubbub_arena_chunk;
+
+/**
+ * Chunk of memory, from which allocations are carved in turn
+ */
+struct hubbub_arena_chunk {
+	hubbub_arena_chunk *next;	/**< Next chunk */
+	size_t size;			/**< Bytes available in data */
+	size_t used;			/**< Bytes of data allocated */
+
+	hubbub_arena_header data[];	/**< Allocations */
+};
+
+/**
+ * Arena allocator
+ *
+ * Allocations are carved from the current chunk in turn, each preceded by
+ * a header giving its size. Individual frees are ignored, except of the
+ * most recent allocation, which is also the only one that may grow in
+ * place; everything is released at once when the arena is reset or
+ * destroyed. This suits the parser, whose buffers grow at the end while
+ * they are in use and are freed together when it is destroyed.
+ */
+struct hubbub_arena {
+	hubbub_arena_chunk *chunks;	/**< Chunks, in order of use */
+	hubbub_arena_chunk *current;	/**< Chunk being allocated from,
+					 * or NULL if none yet */
+	hubbub_arena_header *last;	/**< Header of most recent allocation,
+					 * or NULL if it may not be extended */
+
+	size_t chunk_size;		/**< Usual size of chunk data */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client data */
+};
+
+/**
+ * Round a size up to a whole number of headers
+ *
+ * \param size     Size to round, in bytes
+ * \param rounded  Pointer to location to receive rounded size
+ * \return true on success, false if the rounded size is unrepresentable
+ */
+static inline bool hubbub_arena_round(size_t size, size_t *rounded)
+{
+	if (size > SIZE_MAX - 2 * sizeof(hubbub_arena_header))
+		return false;
+
+	*rounded = (size + sizeof(hubbub_arena_header) - 1) /
+			sizeof(hubbub_arena_header) *
+			sizeof(hubbub_arena_header);
+
+	return true;
+}
+
+/**
+ * Create an arena to allocate from
+ *
+ * \param chunk_size  Size of chunk to request from ::alloc at a time, or 0
+ *                    for a reasonable default
+ * \param alloc       Memory (de)allocation function
+ * \param pw          Pointer to client-specific private data (may be NULL)
+ * \param arena       Pointer to location to receive arena instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * Pass ::hubbub_arena_alloc as the allocation function and the arena as
+ * its private data to have a parser allocate from the arena:
+ *
+ *   hubbub_parser_create(enc, false, hubbub_arena_alloc, arena, &parser);
+ *
+ * The parser must still be destroyed before the arena is destroyed or
+ * reset, as that releases its references to the tree and any resources it
+ * holds other than memory, but doing so then costs little.
+ */
+hubbub_error hubbub_arena_create(size_t chunk_size,
+		hubbub_allocator_fn alloc, void *pw, hubbub_arena **arena)
+{
+	hubbub_arena *a;
+
+	if (alloc == NULL || arena == NULL)
+		return HUBBUB_BADPARM;
+
+	if (chunk_size == 0)
+		chunk_size = HUBBUB_ARENA_CHUNK_SIZE;
+
+	if (hubbub_arena_round(chunk_size, &chunk_size) == false ||
+			chunk_size > SIZE_MAX - sizeof(hubbub_arena_chunk))
+		return HUBBUB_BADPARM;
+
+	a = alloc(NULL, sizeof(hubbub_arena), pw);
+	if (a == NULL)
+		return HUBBUB_NOMEM;
+
+	a->chunks = NULL;
+	a->current = NULL;
+	a->last = NULL;
+	a->chunk_size = chunk_size;
+	a->alloc = alloc;
+	a->pw = pw;
+
+	*arena = a;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy an arena, and everything allocated from it
+ *
+ * \param arena  Arena to destroy
+ * \return HUBBUB_OK on success, HUBBUB_BADPARM on bad parameters
+ */
+hubbub_error hubbub_arena_destroy(hubbub_arena *arena)
+{
+	hubbub_arena_chunk *c, *next;
+
+	if (arena == NULL)
+		return HUBBUB_BADPARM;
+
+	for (c = arena->chunks; c != NULL; c = next) {
+		next = c->next;
+		arena->alloc(c, 0, arena->pw);
+	}
+
+	arena->alloc(arena, 0, arena->pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Release everything allocated from an arena, for it to be reused
+ *
+ * \param arena  Arena to reset
+ * \return HUBBUB_OK on success, HUBBUB_BADPARM on bad parameters
+ *
+ * Chunks of the usual size are kept, so that a document like the last
+ * allocates nothing more from the client. Chunks made larger to hold a
+ * single big allocation are given back.
+ */
+hubbub_error hubbub_arena_reset(hubbub_arena *arena)
+{
+	hubbub_arena_chunk **c;
+
+	if (arena == NULL)
+		return HUBBUB_BADPARM;
+
+	c = &arena->chunks;
+	while (*c != NULL) {
+		hubbub_arena_chunk *chunk = *c;
+
+		if (chunk->size > arena->chunk_size) {
+			*c = chunk->next;
+			arena->alloc(chunk, 0, arena->pw);
+			continue;
+		}
+
+		chunk->used = 0;
+		c = &chunk->next;
+	}
+
+	arena->current = arena->chunks;
+	arena->last = NULL;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Carve a new allocation from an arena
+ *
+ * \param arena  Arena to allocate from
+ * \param size   Size of allocation, rounded to a whole number of headers
+ * \return Header of allocation, or NULL on memory exhaustion
+ */
+static hubbub_arena_header *hubbub_arena_carve(hubbub_arena *arena,
+		size_t size)
+{
+	size_t need = sizeof(hubbub_arena_header) + size;
+	hubbub_arena_chunk *c = arena->current;
+	hubbub_arena_header *h;
+
+	/* Move on to a later chunk with room, if any are left from before
+	 * a reset; the rest of those passed over goes unused */
+	while (c != NULL && c->size - c->used < need)
+		c = c->next;
+
+	if (c == NULL) {
+		size_t size = need > arena->chunk_size ?
+				need : arena->chunk_size;
+
+		if (size > SIZE_MAX - sizeof(hubbub_arena_chunk))
+			return NULL;
+
+		c = arena->alloc(NULL, sizeof(hubbub_arena_chunk) + size,
+				arena->pw);
+		if (c == NULL)
+			return NULL;
+
+		c->size = size;
+		c->used = 0;
+
+		/* Insert after the current chunk, ahead of any not yet
+		 * reused, which are too full for this allocation */
+		if (arena->current != NULL) {
+			c->next = arena->current->next;
+			arena->current->next = c;
+		} else {
+			c->next = arena->chunks;
+			arena->chunks = c;
+		}
+	}
+
+	h = (hubbub_arena_header *) ((uint8_t *) c->data + c->used);
+	h->size = size;
+	c->used += need;
+
+	arena->current = c;
+	arena->last = h;
+
+	return h;
+}
+
+/**
+ * Allocation function drawing on an arena
+ *
+ * \param ptr   Pointer to object to reallocate, or NULL for a new allocation
+ * \param size  Required length in bytes, or zero to free ::ptr
+ * \param pw    Arena to allocate from
+ * \return Pointer to allocated object, or NULL on failure
+ *
+ * This has the semantics of realloc(), as ::hubbub_allocator_fn requires.
+ * The most recent allocation grows and shrinks in place while there is
+ * room in its chunk, and freeing it gives the space back; any other object
+ * is moved to grow, and its space is only reclaimed by resetting the arena.
+ */
+void *hubbub_arena_alloc(void *ptr, size_t size, void *pw)
+{
+	hubbub_arena *arena = pw;
+	hubbub_arena_header *h, *moved;
+	size_t rounded;
+
+	assert(arena != NULL);
+
+	if (ptr == NULL && size == 0)
+		return NULL;
+
+	h = (ptr != NULL) ? (hubbub_arena_header *) ptr - 1 : NULL;
+
+	if (size == 0) {
+		if (h == arena->last) {
+			arena->current->used -=
+					sizeof(hubbub_arena_header) + h->size;
+			arena->last = NULL;
+		}
+
+		return NULL;
+	}
+
+	if (hubbub_arena_round(size, &rounded) == false)
+		return NULL;
+
+	if (h != NULL) {
+		if (h == arena->last) {
+			hubbub_arena_chunk *c = arena->current;
+
+			if (c->used - h->size + rounded <= c->size) {
+				c->used = c->used - h->size + rounded;
+				h->size = rounded;
+				return ptr;
+			}
+		} else if (rounded <= h->size) {
+			return ptr;
+		}
+	}
+
+	moved = hubbub_arena_carve(arena, rounded);
+	if (moved == NULL)
+		return NULL;
+
+	if (h != NULL)
+		memcpy(moved + 1, ptr, h->size < rounded ? h->size : rounded);
+
+	return moved + 1;
+}
+
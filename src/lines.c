@@ -0,0 +1,210 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <string.h>
+
+#include <hubbub/lines.h>
+
+#include "utils/scan.h"
+
+/**
+ * Index of the lines in a document
+ *
+ * The table of line starts is only built when a position is first looked
+ * up, so that clients which never need to report one don't pay for it.
+ */
+struct hubbub_line_index {
+	const uint8_t *data;		/**< Document data */
+	size_t len;			/**< Byte length of document */
+
+	size_t *starts;			/**< Offsets of the starts of lines,
+					 * or NULL if not yet built */
+	uint32_t n_lines;		/**< Number of lines in table */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client data */
+};
+
+/** UTF-8 byte order mark */
+static const uint8_t hubbub_line_index_bom[] = { 0xEF, 0xBB, 0xBF };
+
+/**
+ * Create an index of the lines in a document
+ *
+ * \param data   Document data, in UTF-8
+ * \param len    Length, in bytes, of data
+ * \param alloc  Memory (de)allocation function
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param index  Pointer to location to receive index
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * The data is referred to, rather than copied, so must remain unchanged
+ * for the lifetime of the index. It should be the document as it was
+ * converted to UTF-8, so that the offsets in tokens refer into it; for a
+ * document which was UTF-8 in the first place, this is the original input.
+ * Offsets are counted after any byte order mark at the start of the data,
+ * as they are in tokens. The data has none of that inserted into the parse,
+ * so the offset of a token after an insertion must have the length of the
+ * data inserted taken off before being looked up.
+ */
+hubbub_error hubbub_line_index_create(const uint8_t *data, size_t len,
+		hubbub_allocator_fn alloc, void *pw,
+		hubbub_line_index **index)
+{
+	hubbub_line_index *idx;
+
+	if ((data == NULL && len > 0) || alloc == NULL || index == NULL)
+		return HUBBUB_BADPARM;
+
+	idx = alloc(NULL, sizeof(hubbub_line_index), pw);
+	if (idx == NULL)
+		return HUBBUB_NOMEM;
+
+	/* A byte order mark is not part of the document */
+	if (len >= sizeof(hubbub_line_index_bom) &&
+			memcmp(data, hubbub_line_index_bom,
+				sizeof(hubbub_line_index_bom)) == 0) {
+		data += sizeof(hubbub_line_index_bom);
+		len -= sizeof(hubbub_line_index_bom);
+	}
+
+	idx->data = data;
+	idx->len = len;
+	idx->starts = NULL;
+	idx->n_lines = 0;
+	idx->alloc = alloc;
+	idx->pw = pw;
+
+	*index = idx;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a line index
+ *
+ * \param index  Index to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_line_index_destroy(hubbub_line_index *index)
+{
+	if (index == NULL)
+		return HUBBUB_BADPARM;
+
+	if (index->starts != NULL)
+		index->alloc(index->starts, 0, index->pw);
+
+	index->alloc(index, 0, index->pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find the line breaks in a document, filling in the line starts
+ *
+ * \param index   Index to build
+ * \param starts  Table to fill, or NULL just to count the lines
+ * \return Number of lines in the document
+ *
+ * As when tokenising, CR, LF and CRLF each end a line.
+ */
+static uint32_t hubbub_line_index_scan(const hubbub_line_index *index,
+		size_t *starts)
+{
+	hubbub_scan_set breaks;
+	const uint8_t *data = index->data;
+	size_t len = index->len;
+	size_t off = 0;
+	uint32_t n = 0;
+
+	hubbub_scan_set_init(&breaks, (const uint8_t *) "\r\n", 2);
+
+	if (starts != NULL)
+		starts[n] = 0;
+	n++;
+
+	while (off < len) {
+		off += hubbub_scan(&breaks, data + off, len - off);
+		if (off == len)
+			break;
+
+		if (data[off] == '\r' && off + 1 < len &&
+				data[off + 1] == '\n')
+			off++;
+		off++;
+
+		if (starts != NULL)
+			starts[n] = off;
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Find the line and column at an offset into the document
+ *
+ * \param index   Index to search
+ * \param offset  Byte offset into the document, which may be its length
+ * \param line    Pointer to location to receive line number
+ * \param col     Pointer to location to receive column number
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * Both lines and columns are numbered from 1. Columns count characters,
+ * rather than bytes, from the start of the line.
+ */
+hubbub_error hubbub_line_index_locate(hubbub_line_index *index,
+		size_t offset, uint32_t *line, uint32_t *col)
+{
+	const uint8_t *data;
+	uint32_t lo, hi;
+	size_t i;
+
+	if (index == NULL || offset > index->len || line == NULL ||
+			col == NULL)
+		return HUBBUB_BADPARM;
+
+	if (index->starts == NULL) {
+		uint32_t n_lines = hubbub_line_index_scan(index, NULL);
+
+		index->starts = index->alloc(NULL, n_lines * sizeof(size_t),
+				index->pw);
+		if (index->starts == NULL)
+			return HUBBUB_NOMEM;
+
+		index->n_lines = hubbub_line_index_scan(index, index->starts);
+	}
+
+	/* Find the last line starting at or before the offset */
+	lo = 0;
+	hi = index->n_lines;
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (index->starts[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	*line = lo + 1;
+	*col = 1;
+
+	/* Count the characters preceding the offset, skipping UTF-8
+	 * continuation bytes */
+	data = index->data;
+	for (i = index->starts[lo]; i < offset; i++) {
+		if ((data[i] & 0xc0) != 0x80)
+			(*col)++;
+	}
+
+	return HUBBUB_OK;
+}
+
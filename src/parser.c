@@ -14,9 +14,14 @@
 #include <hubbub/parser.h>
 
 #include "charset/detect.h"
+#include "parser_internal.h"
+#include "preload/preload.h"
 #include "tokeniser/tokeniser.h"
 #include "treebuilder/treebuilder.h"
+#include "utils/file.h"
 #include "utils/parserutilserror.h"
+#include "utils/utf8.h"
+#include "utils/utils.h"
 
 /**
  * Hubbub parser object
@@ -26,10 +31,353 @@ struct hubbub_parser {
 	hubbub_tokeniser *tok;		/**< Tokeniser instance */
 	hubbub_treebuilder *tb;		/**< Treebuilder instance */
 
+	bool utf8;			/**< Whether the input is known to be
+					 * UTF-8, so bypasses conversion */
+	bool bom;			/**< Whether a byte order mark may yet
+					 * start the input */
+	uint8_t carry[3];		/**< Incomplete UTF-8 sequence at the
+					 * end of the last chunk */
+	size_t carry_len;		/**< Length, in bytes, of carry */
+
+	hubbub_file file;		/**< File being parsed, if any */
+
+	hubbub_preload_handler preload_handler;	/**< Preload handling
+						 * callback, or NULL */
+	void *preload_pw;			/**< Preload handler data */
+	hubbub_preload_scanner *preload;	/**< Scanner of the input
+						 * ahead of a paused parse,
+						 * or NULL */
+
 	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
 	void *pw;			/**< Client data */
+
+	hubbub_allocator_fn part_alloc;	/**< Allocator for the parser's
+					 * components: the client's, or
+					 * hubbub_parser_alloc() if the
+					 * parse's memory is limited */
+	void *part_pw;			/**< Client data for part_alloc */
+
+	size_t allocated;		/**< Bytes allocated for the parse,
+					 * if its memory is limited */
+	size_t max_alloc_bytes;		/**< Most bytes to allocate for the
+					 * parse, or 0 for no limit */
+	size_t create_max_alloc_bytes;	/**< Limit given on creation */
+};
+
+/**
+ * Snapshot of the tokenisation of a document
+ */
+struct hubbub_parser_snapshot {
+	hubbub_tokeniser_snapshot *tok;	/**< Snapshot of tokeniser */
 };
 
+/**
+ * Header of a block of memory allocated for the parse, which records its
+ * size, aligned as the allocator would align the block itself
+ */
+typedef union hubbub_parser_block {
+	size_t size;			/**< Size of block, in bytes */
+	void *align_ptr;
+	double align_double;
+	long double align_long_double;
+} hubbub_parser_block;
+
+/**
+ * Allocate memory for the parse, keeping count of the total
+ *
+ * \param ptr  Block to resize or free, or NULL to allocate a new one
+ * \param len  Size, in bytes, to make block, or 0 to free it
+ * \param pw   Parser instance
+ * \return Pointer to block, or NULL if it was freed, or on failure
+ *
+ * This stands in for the client's allocator in the components of a parser
+ * whose memory is limited, failing once their total use would exceed the
+ * limit. Other parsers give their components the client's allocator.
+ */
+static void *hubbub_parser_alloc(void *ptr, size_t len, void *pw)
+{
+	hubbub_parser *parser = pw;
+	hubbub_parser_block *block = NULL;
+	size_t old = 0;
+
+	if (ptr != NULL) {
+		block = (hubbub_parser_block *) ptr - 1;
+		old = sizeof(hubbub_parser_block) + block->size;
+	}
+
+	if (len == 0) {
+		if (block != NULL) {
+			parser->allocated -= old;
+			parser->alloc(block, 0, parser->pw);
+		}
+		return NULL;
+	}
+
+	if (len > (size_t) -1 - sizeof(hubbub_parser_block))
+		return NULL;
+
+	if (parser->max_alloc_bytes != 0 &&
+			parser->allocated - old + sizeof(hubbub_parser_block) +
+					len > parser->max_alloc_bytes)
+		return NULL;
+
+	block = parser->alloc(block, sizeof(hubbub_parser_block) + len,
+			parser->pw);
+	if (block == NULL)
+		return NULL;
+
+	parser->allocated = parser->allocated - old +
+			sizeof(hubbub_parser_block) + len;
+	block->size = len;
+
+	return block + 1;
+}
+
+/** UTF-8 encoding of U+FFFD REPLACEMENT CHARACTER */
+static const uint8_t hubbub_parser_replacement[] = { 0xEF, 0xBF, 0xBD };
+
+/** UTF-8 byte order mark */
+static const uint8_t hubbub_parser_bom[] = { 0xEF, 0xBB, 0xBF };
+
+/**
+ * Append UTF-8 input to the input stream's decoded data
+ *
+ * \param parser  Parser instance
+ * \param data    Data to append
+ * \param len     Length, in bytes, of data
+ * \param used    Pointer to location to receive number of bytes used,
+ *                which falls short of len by any incomplete sequence at
+ *                the end of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Each ill-formed sequence is replaced by U+FFFD, so the tokeniser only
+ * ever sees valid UTF-8.
+ */
+static hubbub_error hubbub_parser_append_utf8(hubbub_parser *parser,
+		const uint8_t *data, size_t len, size_t *used)
+{
+	parserutils_buffer *utf8 = parser->stream->utf8;
+	parserutils_error perror;
+	size_t pos = 0, n;
+	bool incomplete;
+
+	while (pos < len) {
+		n = hubbub_utf8_valid_length(data + pos, len - pos);
+
+		/* A byte order mark is not part of the document */
+		if (parser->bom && n >= sizeof(hubbub_parser_bom) &&
+				memcmp(data + pos, hubbub_parser_bom,
+					sizeof(hubbub_parser_bom)) == 0) {
+			pos += sizeof(hubbub_parser_bom);
+			n -= sizeof(hubbub_parser_bom);
+			parser->bom = false;
+		}
+
+		if (n > 0) {
+			perror = parserutils_buffer_append(utf8, data + pos, n);
+			if (perror != PARSERUTILS_OK)
+				return hubbub_error_from_parserutils_error(
+						perror);
+
+			pos += n;
+			parser->bom = false;
+		}
+
+		if (pos == len)
+			break;
+
+		n = hubbub_utf8_invalid_length(data + pos, len - pos,
+				&incomplete);
+		if (incomplete)
+			break;
+
+		perror = parserutils_buffer_append(utf8,
+				hubbub_parser_replacement,
+				sizeof(hubbub_parser_replacement));
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		pos += n;
+		parser->bom = false;
+	}
+
+	*used = pos;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Pass a chunk of UTF-8 input through to the tokeniser
+ *
+ * \param parser  Parser instance
+ * \param data    Data to pass through
+ * \param len     Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The chunk is validated once, here, and placed directly in the input
+ * stream's decoded data, which the tokeniser reads in place. The stream's
+ * undecoded data is left empty, so it never converts anything itself.
+ */
+static hubbub_error hubbub_parser_feed_utf8(hubbub_parser *parser,
+		const uint8_t *data, size_t len)
+{
+	parserutils_inputstream *stream = parser->stream;
+	parserutils_error perror;
+	hubbub_error error;
+	uint8_t seq[sizeof(parser->carry) + 4];
+	size_t n, used;
+
+	/* Discard what has been consumed, as the stream would on refilling.
+	 * The tokeniser refers to its input by offset from the cursor, and
+	 * has no tokens batched between runs, so this moves nothing under
+	 * it. */
+	if (stream->cursor > 0) {
+		perror = parserutils_buffer_discard(stream->utf8, 0,
+				stream->cursor);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		stream->cursor = 0;
+	}
+
+	/* Complete a sequence which the last chunk ended partway through.
+	 * Enough follows it to settle every sequence starting in it. */
+	if (parser->carry_len > 0) {
+		n = len < sizeof(seq) - parser->carry_len ?
+				len : sizeof(seq) - parser->carry_len;
+
+		memcpy(seq, parser->carry, parser->carry_len);
+		memcpy(seq + parser->carry_len, data, n);
+
+		error = hubbub_parser_append_utf8(parser, seq,
+				parser->carry_len + n, &used);
+		if (error != HUBBUB_OK)
+			return error;
+
+		if (used < parser->carry_len) {
+			/* Still incomplete, having taken all of data */
+			assert(n == len);
+
+			parser->carry_len = parser->carry_len + n - used;
+			assert(parser->carry_len <= sizeof(parser->carry));
+			memcpy(parser->carry, seq + used, parser->carry_len);
+
+			return HUBBUB_OK;
+		}
+
+		data += used - parser->carry_len;
+		len -= used - parser->carry_len;
+		parser->carry_len = 0;
+	}
+
+	error = hubbub_parser_append_utf8(parser, data, len, &used);
+	if (error != HUBBUB_OK)
+		return error;
+
+	parser->carry_len = len - used;
+	assert(parser->carry_len <= sizeof(parser->carry));
+	memcpy(parser->carry, data + used, parser->carry_len);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Scan the input buffered ahead of a paused parse for resources
+ *
+ * \param parser  Parser instance
+ *
+ * The scanner is kept until the parse resumes, so that further input is
+ * scanned as it arrives. Scanning is only advisory, so the parse goes on
+ * regardless of its failure.
+ */
+static void hubbub_parser_preload(hubbub_parser *parser)
+{
+	if (parser->preload == NULL && hubbub_preload_scanner_create(
+			parser->preload_handler, parser->preload_pw,
+			parser->part_alloc, parser->part_pw,
+			&parser->preload) != HUBBUB_OK)
+		return;
+
+	hubbub_preload_scanner_scan(parser->preload, parser->stream);
+}
+
+/**
+ * Discard the scanner of the input ahead of a paused parse, if any
+ *
+ * \param parser  Parser instance
+ */
+static void hubbub_parser_end_preload(hubbub_parser *parser)
+{
+	if (parser->preload != NULL) {
+		hubbub_preload_scanner_destroy(parser->preload);
+		parser->preload = NULL;
+	}
+}
+
+/**
+ * Fix up a parser's source encoding
+ *
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \param utf8     Pointer to location to receive whether the input is
+ *                 certainly UTF-8
+ * \return The encoding to use, or NULL to autodetect
+ */
+static const char *hubbub_parser_fix_encoding(const char *enc, bool fix_enc,
+		bool *utf8)
+{
+	/* If we have an encoding and we're permitted to fix up likely broken
+	 * ones, then attempt to do so. */
+	if (enc != NULL && fix_enc == true) {
+		uint16_t mibenum = parserutils_charset_mibenum_from_name(enc,
+				strlen(enc));
+
+		if (mibenum != 0) {
+			hubbub_charset_fix_charset(&mibenum);
+
+			enc = parserutils_charset_mibenum_to_name(mibenum);
+		}
+	}
+
+	/* Input which is certainly UTF-8 needs no conversion */
+	*utf8 = enc != NULL && parserutils_charset_mibenum_from_name(enc,
+			strlen(enc)) == parserutils_charset_mibenum_from_name(
+			"UTF-8", SLEN("UTF-8"));
+
+	return enc;
+}
+
+/**
+ * Create an input stream for a parser
+ *
+ * \param parser   Parser instance
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \param stream   Pointer to location to receive input stream
+ * \param utf8     Pointer to location to receive whether the input is
+ *                 certainly UTF-8
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if ::enc is unsupported
+ */
+static hubbub_error hubbub_parser_create_stream(hubbub_parser *parser,
+		const char *enc, bool fix_enc,
+		parserutils_inputstream **stream, bool *utf8)
+{
+	parserutils_error perror;
+
+	enc = hubbub_parser_fix_encoding(enc, fix_enc, utf8);
+
+	perror = parserutils_inputstream_create(enc,
+		enc != NULL ? HUBBUB_CHARSET_CONFIDENT : HUBBUB_CHARSET_UNKNOWN,
+		hubbub_charset_extract, parser->part_alloc, parser->part_pw,
+		stream);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	return HUBBUB_OK;
+}
+
 /**
  * Create a hubbub parser
  *
@@ -46,7 +394,36 @@ struct hubbub_parser {
 hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 		hubbub_allocator_fn alloc, void *pw, hubbub_parser **parser)
 {
-	parserutils_error perror;
+	return hubbub_parser_create_limited(enc, fix_enc, 0, alloc, pw,
+			parser);
+}
+
+/**
+ * Create a hubbub parser whose memory may be limited
+ *
+ * \param enc              Source document encoding, or NULL to autodetect
+ * \param fix_enc          Permit fixing up of encoding if it's frequently
+ *                         misused
+ * \param max_alloc_bytes  Most memory to allocate, or 0 for no limit
+ * \param alloc            Memory (de)allocation function
+ * \param pw               Pointer to client-specific private data
+ *                         (may be NULL)
+ * \param parser           Pointer to location to receive parser instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if ::enc is unsupported
+ *
+ * Given a limit, the parser counts the memory allocated through ::alloc,
+ * as for the ::max_alloc_bytes member of HUBBUB_PARSER_LIMITS, which may
+ * change the limit later. Counting costs a header on each block, so a
+ * parser created without a limit passes ::alloc to its components as it
+ * is, and can't be given one afterwards.
+ */
+hubbub_error hubbub_parser_create_limited(const char *enc, bool fix_enc,
+		size_t max_alloc_bytes, hubbub_allocator_fn alloc, void *pw,
+		hubbub_parser **parser)
+{
 	hubbub_error error;
 	hubbub_parser *p;
 
@@ -57,35 +434,46 @@ hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 	if (p == NULL)
 		return HUBBUB_NOMEM;
 
-	/* If we have an encoding and we're permitted to fix up likely broken
-	 * ones, then attempt to do so. */
-	if (enc != NULL && fix_enc == true) {
-		uint16_t mibenum = parserutils_charset_mibenum_from_name(enc,
-				strlen(enc));
-
-		if (mibenum != 0) {
-			hubbub_charset_fix_charset(&mibenum);
+	p->alloc = alloc;
+	p->pw = pw;
+	p->allocated = sizeof(hubbub_parser);
+	p->max_alloc_bytes = max_alloc_bytes;
+	p->create_max_alloc_bytes = max_alloc_bytes;
 
-			enc = parserutils_charset_mibenum_to_name(mibenum);
-		}
+	if (max_alloc_bytes != 0) {
+		p->part_alloc = hubbub_parser_alloc;
+		p->part_pw = p;
+	} else {
+		p->part_alloc = alloc;
+		p->part_pw = pw;
 	}
 
-	perror = parserutils_inputstream_create(enc,
-		enc != NULL ? HUBBUB_CHARSET_CONFIDENT : HUBBUB_CHARSET_UNKNOWN,
-		hubbub_charset_extract, alloc, pw, &p->stream);
-	if (perror != PARSERUTILS_OK) {
+	p->preload_handler = NULL;
+	p->preload_pw = NULL;
+	p->preload = NULL;
+
+	p->bom = true;
+	p->carry_len = 0;
+
+	p->file.data = NULL;
+
+	error = hubbub_parser_create_stream(p, enc, fix_enc, &p->stream,
+			&p->utf8);
+	if (error != HUBBUB_OK) {
 		alloc(p, 0, pw);
-		return hubbub_error_from_parserutils_error(perror);
+		return error;
 	}
 
-	error = hubbub_tokeniser_create(p->stream, alloc, pw, &p->tok);
+	error = hubbub_tokeniser_create(p->stream, p->part_alloc, p->part_pw,
+			&p->tok);
 	if (error != HUBBUB_OK) {
 		parserutils_inputstream_destroy(p->stream);
 		alloc(p, 0, pw);
 		return error;
 	}
 
-	error = hubbub_treebuilder_create(p->tok, alloc, pw, &p->tb);
+	error = hubbub_treebuilder_create(p->tok, p->part_alloc, p->part_pw,
+			&p->tb);
 	if (error != HUBBUB_OK) {
 		hubbub_tokeniser_destroy(p->tok);
 		parserutils_inputstream_destroy(p->stream);
@@ -93,9 +481,6 @@ hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 		return error;
 	}
 
-	p->alloc = alloc;
-	p->pw = pw;
-
 	*parser = p;
 
 	return HUBBUB_OK;
@@ -112,17 +497,199 @@ hubbub_error hubbub_parser_destroy(hubbub_parser *parser)
 	if (parser == NULL)
 		return HUBBUB_BADPARM;
 
+	if (parser->preload != NULL)
+		hubbub_preload_scanner_destroy(parser->preload);
+
 	hubbub_treebuilder_destroy(parser->tb);
 
 	hubbub_tokeniser_destroy(parser->tok);
 
 	parserutils_inputstream_destroy(parser->stream);
 
+	hubbub_file_close(&parser->file);
+
 	parser->alloc(parser, 0, parser->pw);
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Return a hubbub parser to its initial state, to parse a new document
+ *
+ * \param parser   Parser instance to reset
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if ::enc is unsupported
+ *
+ * This is as destroying the parser and creating another, but keeps its
+ * options and the storage its tokeniser and treebuilder have grown, so
+ * parsing many documents with one parser allocates little after the
+ * first. When both the old and new documents are UTF-8, the input stream
+ * is kept too, and a document needing no more storage than those before
+ * is parsed without allocating at all. The references the treebuilder
+ * held to the old document's nodes are released, so a new document node
+ * must be given before building another tree. Snapshots taken before now
+ * may not be restored after.
+ *
+ * On failure, the parser is left as it was.
+ */
+hubbub_error hubbub_parser_reset(hubbub_parser *parser, const char *enc,
+		bool fix_enc)
+{
+	parserutils_inputstream *stream;
+	hubbub_error error;
+	bool utf8;
+
+	if (parser == NULL)
+		return HUBBUB_BADPARM;
+
+	hubbub_parser_fix_encoding(enc, fix_enc, &utf8);
+
+	if (parser->utf8 && utf8) {
+		/* UTF-8 input is put straight into the stream's decoded
+		 * buffer, so its raw buffer is empty and its charset is
+		 * still confidently UTF-8: it may simply be emptied. */
+		stream = parser->stream;
+	} else {
+		/* Otherwise, the stream has no means of forgetting what it
+		 * has detected and converted, so make another */
+		error = hubbub_parser_create_stream(parser, enc, fix_enc,
+				&stream, &utf8);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	hubbub_parser_end_preload(parser);
+
+	if (parser->tb != NULL)
+		hubbub_treebuilder_reset(parser->tb);
+
+	/* This gives any borrowed input back to the old stream */
+	hubbub_tokeniser_reset(parser->tok, stream);
+
+	if (stream == parser->stream) {
+		parserutils_buffer_discard(stream->utf8, 0,
+				stream->utf8->length);
+		stream->cursor = 0;
+		stream->had_eof = false;
+	} else {
+		parserutils_inputstream_destroy(parser->stream);
+		parser->stream = stream;
+	}
+
+	parser->utf8 = utf8;
+	parser->bom = true;
+	parser->carry_len = 0;
+
+	hubbub_file_close(&parser->file);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Return a hubbub parser's options to those it was created with
+ *
+ * \param parser  Parser instance to reset the options of
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * This drops every handler, and the client data given with it, and
+ * recreates the treebuilder if a token handler took its place. Call it
+ * after hubbub_parser_reset(), once the treebuilder has released the old
+ * document through the tree handler.
+ *
+ * On failure, the parser is left with neither a treebuilder nor a token
+ * handler, and is fit only to be destroyed.
+ */
+hubbub_error hubbub_parser_reset_options(hubbub_parser *parser)
+{
+	hubbub_tokeniser_optparams tokparams;
+	hubbub_treebuilder_optparams tbparams;
+	hubbub_error error;
+
+	if (parser == NULL)
+		return HUBBUB_BADPARM;
+
+	hubbub_parser_end_preload(parser);
+	parser->preload_handler = NULL;
+	parser->preload_pw = NULL;
+
+	parser->max_alloc_bytes = parser->create_max_alloc_bytes;
+
+	tokparams.error_handler.handler = NULL;
+	tokparams.error_handler.pw = NULL;
+	hubbub_tokeniser_setopt(parser->tok, HUBBUB_TOKENISER_ERROR_HANDLER,
+			&tokparams);
+
+	/* The batch was emptied by the reset, so there is nothing to flush */
+	tokparams.token_batch.handler = NULL;
+	tokparams.token_batch.tokens = NULL;
+	tokparams.token_batch.size = 0;
+	tokparams.token_batch.pw = NULL;
+	hubbub_tokeniser_setopt(parser->tok, HUBBUB_TOKENISER_TOKEN_BATCH,
+			&tokparams);
+
+	tokparams.token_filter = HUBBUB_TOKEN_MASK_ALL;
+	hubbub_tokeniser_setopt(parser->tok, HUBBUB_TOKENISER_TOKEN_FILTER,
+			&tokparams);
+
+	tokparams.coalesce_characters = false;
+	hubbub_tokeniser_setopt(parser->tok,
+			HUBBUB_TOKENISER_COALESCE_CHARACTERS, &tokparams);
+
+	tokparams.limits.max_token_bytes = 0;
+	tokparams.limits.max_attributes = 0;
+	hubbub_tokeniser_setopt(parser->tok, HUBBUB_TOKENISER_LIMITS,
+			&tokparams);
+
+	if (parser->tb != NULL) {
+		/* Destroying it now would throw away the storage it grew */
+		tbparams.error_handler.handler = NULL;
+		tbparams.error_handler.pw = NULL;
+		hubbub_treebuilder_setopt(parser->tb,
+				HUBBUB_TREEBUILDER_ERROR_HANDLER, &tbparams);
+
+		tbparams.tree_handler = NULL;
+		hubbub_treebuilder_setopt(parser->tb,
+				HUBBUB_TREEBUILDER_TREE_HANDLER, &tbparams);
+
+		tbparams.document_node = NULL;
+		hubbub_treebuilder_setopt(parser->tb,
+				HUBBUB_TREEBUILDER_DOCUMENT_NODE, &tbparams);
+
+		tbparams.enable_scripting = false;
+		hubbub_treebuilder_setopt(parser->tb,
+				HUBBUB_TREEBUILDER_ENABLE_SCRIPTING, &tbparams);
+
+		tbparams.enable_styling = false;
+		hubbub_treebuilder_setopt(parser->tb,
+				HUBBUB_TREEBUILDER_ENABLE_STYLING, &tbparams);
+
+		tbparams.max_depth = 0;
+		hubbub_treebuilder_setopt(parser->tb,
+				HUBBUB_TREEBUILDER_MAX_DEPTH, &tbparams);
+	} else {
+		/* A token handler displaced the treebuilder: creating
+		 * another makes it the tokeniser's token handler again */
+		tokparams.token_handler.handler = NULL;
+		tokparams.token_handler.pw = NULL;
+		hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TOKEN_HANDLER, &tokparams);
+
+		error = hubbub_treebuilder_create(parser->tok,
+				parser->part_alloc, parser->part_pw,
+				&parser->tb);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	return HUBBUB_OK;
+}
+
 /**
  * Configure a hubbub parser
  *
@@ -153,6 +720,59 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 				(hubbub_tokeniser_optparams *) params);
 		break;
 
+	case HUBBUB_PARSER_TOKEN_BATCH:
+		if (parser->tb != NULL) {
+			/* As for a token handler, the client is taking the
+			 * tokens for itself */
+			hubbub_treebuilder_destroy(parser->tb);
+			parser->tb = NULL;
+		}
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TOKEN_BATCH,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_TOKEN_FILTER:
+		/* The treebuilder needs to see every token */
+		if (parser->tb != NULL &&
+				params->token_filter != HUBBUB_TOKEN_MASK_ALL)
+			return HUBBUB_BADPARM;
+
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TOKEN_FILTER,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_LIMITS:
+	{
+		hubbub_tokeniser_optparams tokparams;
+
+		/* Only a parser created with a limit counts its memory */
+		if (params->limits.max_alloc_bytes != 0 &&
+				parser->part_alloc != hubbub_parser_alloc)
+			return HUBBUB_BADPARM;
+
+		tokparams.limits.max_token_bytes =
+				params->limits.max_token_bytes;
+		tokparams.limits.max_attributes =
+				params->limits.max_attributes;
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_LIMITS, &tokparams);
+
+		if (result == HUBBUB_OK && parser->tb != NULL) {
+			hubbub_treebuilder_optparams tbparams;
+
+			tbparams.max_depth = params->limits.max_depth;
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_MAX_DEPTH, &tbparams);
+		}
+
+		if (result == HUBBUB_OK)
+			parser->max_alloc_bytes =
+					params->limits.max_alloc_bytes;
+	}
+		break;
+
 	case HUBBUB_PARSER_ERROR_HANDLER:
 		/* The error handler does not cascade, so tell both the
 		 * treebuilder (if extant) and the tokeniser. */
@@ -175,9 +795,30 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		break;
 
 	case HUBBUB_PARSER_PAUSE:
+		/* The parse moves on, so what's ahead must be scanned
+		 * afresh when it next pauses */
+		if (params->pause_parse == false)
+			hubbub_parser_end_preload(parser);
+
 		result = hubbub_tokeniser_setopt(parser->tok,
 				HUBBUB_TOKENISER_PAUSE,
 				(hubbub_tokeniser_optparams *) params);
+
+		if (result == HUBBUB_PAUSED && parser->preload_handler != NULL)
+			hubbub_parser_preload(parser);
+		break;
+
+	case HUBBUB_PARSER_COALESCE_CHARACTERS:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_COALESCE_CHARACTERS,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_PRELOAD_HANDLER:
+		hubbub_parser_end_preload(parser);
+
+		parser->preload_handler = params->preload_handler.handler;
+		parser->preload_pw = params->preload_handler.pw;
 		break;
 
 	case HUBBUB_PARSER_TREE_HANDLER:
@@ -241,26 +882,74 @@ hubbub_error hubbub_parser_insert_chunk(hubbub_parser *parser,
 }
 
 /**
- * Pass a chunk of data to a hubbub parser for parsing
+ * Append data to a parser's input
  *
- * \param parser  Parser instance to use
- * \param data    Data to parse (encoded in the input charset)
+ * \param parser  Parser instance
+ * \param data    Data to append (encoded in the input charset)
  * \param len     Length, in bytes, of data
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
-hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
+static hubbub_error hubbub_parser_append(hubbub_parser *parser,
 		const uint8_t *data, size_t len)
 {
 	parserutils_error perror;
 	hubbub_error error;
 
-	if (parser == NULL || data == NULL)
-		return HUBBUB_BADPARM;
+	if (parser->utf8) {
+		/* Borrowed input mustn't be modified */
+		error = hubbub_tokeniser_own_input(parser->tok);
+		if (error != HUBBUB_OK)
+			return error;
+
+		return hubbub_parser_feed_utf8(parser, data, len);
+	}
 
 	perror = parserutils_inputstream_append(parser->stream, data, len);
 	if (perror != PARSERUTILS_OK)
 		return hubbub_error_from_parserutils_error(perror);
 
+	return HUBBUB_OK;
+}
+
+/**
+ * Mark the end of a parser's input
+ *
+ * \param parser  Parser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_parser_end_input(hubbub_parser *parser)
+{
+	parserutils_error perror;
+
+	/* Input which ends partway through a sequence ends with U+FFFD */
+	if (parser->carry_len > 0) {
+		perror = parserutils_buffer_append(parser->stream->utf8,
+				hubbub_parser_replacement,
+				sizeof(hubbub_parser_replacement));
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		parser->carry_len = 0;
+	}
+
+	perror = parserutils_inputstream_append(parser->stream, NULL, 0);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Tokenise as much of a parser's input as possible
+ *
+ * \param parser  Parser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_parser_run(hubbub_parser *parser)
+{
+	parserutils_error perror;
+	hubbub_error error;
+
 	error = hubbub_tokeniser_run(parser->tok);
 	if (error == HUBBUB_BADENCODING) {
 		/* Ok, we autodetected an encoding that we don't actually
@@ -280,12 +969,137 @@ hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
 		error = hubbub_tokeniser_run(parser->tok);
 	}
 
+	/* While the parse waits, look ahead for resources to fetch */
+	if (error == HUBBUB_PAUSED && parser->preload_handler != NULL)
+		hubbub_parser_preload(parser);
+
 	if (error != HUBBUB_OK)
 		return error;
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Pass a chunk of data to a hubbub parser for parsing
+ *
+ * \param parser  Parser instance to use
+ * \param data    Data to parse (encoded in the input charset)
+ * \param len     Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
+		const uint8_t *data, size_t len)
+{
+	hubbub_error error;
+
+	if (parser == NULL || data == NULL)
+		return HUBBUB_BADPARM;
+
+	error = hubbub_parser_append(parser, data, len);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return hubbub_parser_run(parser);
+}
+
+/**
+ * Pass the whole of a document to a hubbub parser for parsing
+ *
+ * \param parser  Parser instance to use
+ * \param data    Data to parse (encoded in the input charset)
+ * \param len     Length, in bytes, of data
+ * \param flags   Mask of hubbub_parser_buffer_flags
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This is as hubbub_parser_parse_chunk followed by
+ * hubbub_parser_completed, but where HUBBUB_PARSER_BUFFER_BORROW is given
+ * the data need not be copied: if it is known to be UTF-8, is valid, and
+ * nothing has been parsed before it, it is read in place. The data must
+ * then remain valid and unchanged until the parser is destroyed. Should
+ * anything be inserted into the input, the rest of it is copied.
+ *
+ * If the parse is paused, it may be resumed as usual; there is no need to
+ * call hubbub_parser_completed.
+ */
+hubbub_error hubbub_parser_parse_buffer(hubbub_parser *parser,
+		const uint8_t *data, size_t len, uint32_t flags)
+{
+	hubbub_error error;
+	bool borrowed = false;
+
+	if (parser == NULL || data == NULL)
+		return HUBBUB_BADPARM;
+
+	if ((flags & HUBBUB_PARSER_BUFFER_BORROW) && parser->utf8 &&
+			parser->bom && parser->carry_len == 0) {
+		const uint8_t *start = data;
+		size_t n = len;
+
+		/* A byte order mark is not part of the document */
+		if (n >= sizeof(hubbub_parser_bom) && memcmp(start,
+				hubbub_parser_bom,
+				sizeof(hubbub_parser_bom)) == 0) {
+			start += sizeof(hubbub_parser_bom);
+			n -= sizeof(hubbub_parser_bom);
+		}
+
+		/* Only valid input needs no repair */
+		if (hubbub_utf8_valid_length(start, n) == n &&
+				hubbub_tokeniser_borrow_input(parser->tok,
+						start, n) == HUBBUB_OK) {
+			parser->bom = false;
+			borrowed = true;
+		}
+	}
+
+	if (borrowed == false) {
+		error = hubbub_parser_append(parser, data, len);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	error = hubbub_parser_end_input(parser);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return hubbub_parser_run(parser);
+}
+
+/**
+ * Pass the whole of a document in a file to a hubbub parser for parsing
+ *
+ * \param parser  Parser instance to use
+ * \param path    Path of file to parse
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if a file has been parsed already,
+ *         HUBBUB_FILENOTFOUND if the file can't be opened,
+ *         appropriate error otherwise
+ *
+ * The file is mapped into memory where possible, and parsed as by
+ * hubbub_parser_parse_buffer, with HUBBUB_PARSER_BUFFER_BORROW. It is
+ * kept until the parser is destroyed.
+ */
+hubbub_error hubbub_parser_parse_file(hubbub_parser *parser,
+		const char *path)
+{
+	hubbub_error error;
+
+	if (parser == NULL || path == NULL)
+		return HUBBUB_BADPARM;
+
+	if (parser->file.data != NULL)
+		return HUBBUB_INVALID;
+
+	error = hubbub_file_open(&parser->file, path, parser->part_alloc,
+			parser->part_pw);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return hubbub_parser_parse_buffer(parser, parser->file.data,
+			parser->file.len, HUBBUB_PARSER_BUFFER_BORROW);
+}
+
 /**
  * Inform the parser that the last chunk of data has been parsed
  *
@@ -294,15 +1108,14 @@ hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
  */
 hubbub_error hubbub_parser_completed(hubbub_parser *parser)
 {
-	parserutils_error perror;
 	hubbub_error error;
 
 	if (parser == NULL)
 		return HUBBUB_BADPARM;
 
-	perror = parserutils_inputstream_append(parser->stream, NULL, 0);
-	if (perror != PARSERUTILS_OK)
-		return hubbub_error_from_parserutils_error(perror);
+	error = hubbub_parser_end_input(parser);
+	if (error != HUBBUB_OK)
+		return error;
 
 	error = hubbub_tokeniser_run(parser->tok);
 	if (error != HUBBUB_OK)
@@ -311,6 +1124,96 @@ hubbub_error hubbub_parser_completed(hubbub_parser *parser)
 	return HUBBUB_OK;
 }
 
+/**
+ * Take a snapshot of the tokenisation of a document
+ *
+ * \param parser    Parser instance
+ * \param snapshot  Pointer to location to receive snapshot
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * This lets a client tokenise ahead speculatively, while a script blocks
+ * the parse for instance, then return to where it was. Only the
+ * tokeniser's state is kept, so the client must be taking the tokens for
+ * itself: the treebuilder's can't be returned to.
+ *
+ * Until the snapshot is destroyed, the parser keeps the input it
+ * consumes, so that the snapshot may be restored. Snapshots may not be
+ * taken or restored from within a callback: a token handler should
+ * pause the parse instead.
+ */
+hubbub_error hubbub_parser_snapshot_create(hubbub_parser *parser,
+		hubbub_parser_snapshot **snapshot)
+{
+	hubbub_parser_snapshot *snap;
+	hubbub_error error;
+
+	if (parser == NULL || snapshot == NULL || parser->tb != NULL)
+		return HUBBUB_BADPARM;
+
+	snap = parser->part_alloc(NULL, sizeof(hubbub_parser_snapshot),
+			parser->part_pw);
+	if (snap == NULL)
+		return HUBBUB_NOMEM;
+
+	error = hubbub_tokeniser_snapshot_create(parser->tok, &snap->tok);
+	if (error != HUBBUB_OK) {
+		parser->part_alloc(snap, 0, parser->part_pw);
+		return error;
+	}
+
+	*snapshot = snap;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Return the tokenisation of a document to a snapshot
+ *
+ * \param parser    Parser instance
+ * \param snapshot  Snapshot of the parser, taken earlier
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if an earlier snapshot has been restored
+ *                        since this one was taken,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * Tokenising resumes from the snapshot once more data is parsed. Data
+ * inserted with hubbub_parser_insert_chunk() after this is tokenised
+ * first. The snapshot may be restored more than once.
+ */
+hubbub_error hubbub_parser_snapshot_restore(hubbub_parser *parser,
+		const hubbub_parser_snapshot *snapshot)
+{
+	if (parser == NULL || snapshot == NULL)
+		return HUBBUB_BADPARM;
+
+	hubbub_parser_end_preload(parser);
+
+	return hubbub_tokeniser_snapshot_restore(parser->tok, snapshot->tok);
+}
+
+/**
+ * Destroy a snapshot of the tokenisation of a document
+ *
+ * \param parser    Parser instance the snapshot was taken of
+ * \param snapshot  Snapshot to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_parser_snapshot_destroy(hubbub_parser *parser,
+		hubbub_parser_snapshot *snapshot)
+{
+	if (parser == NULL || snapshot == NULL)
+		return HUBBUB_BADPARM;
+
+	hubbub_tokeniser_snapshot_destroy(parser->tok, snapshot->tok);
+
+	parser->part_alloc(snapshot, 0, parser->part_pw);
+
+	return HUBBUB_OK;
+}
+
 /**
  * Read the document charset
  *
@@ -0,0 +1,16 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_parser_internal_h_
+#define hubbub_parser_internal_h_
+
+#include <hubbub/parser.h>
+
+/* Return a hubbub parser's options to those it was created with */
+hubbub_error hubbub_parser_reset_options(hubbub_parser *parser);
+
+#endif
+
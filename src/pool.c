@@ -0,0 +1,455 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+#if defined(_POSIX_THREADS) && _POSIX_THREADS > 0 && \
+		!defined(HUBBUB_POOL_NO_THREADS)
+#include <pthread.h>
+#define HUBBUB_POOL_PTHREADS 1
+#endif
+
+#include <hubbub/pool.h>
+
+#include "parser_internal.h"
+
+#ifdef HUBBUB_POOL_PTHREADS
+/**
+ * A thread's own idle parser
+ *
+ * Only the thread owning the cache touches it, but for the pool's creation
+ * and destruction, and the thread's exit, so no lock is needed to use it.
+ */
+typedef struct hubbub_parser_pool_cache {
+	hubbub_parser_pool *pool;	/**< Pool the cache belongs to */
+	hubbub_parser *parser;		/**< Idle parser, or NULL */
+	int32_t n_acquired;		/**< Parsers acquired less parsers
+					 * released by the thread */
+	struct hubbub_parser_pool_cache *next;	/**< Next in pool */
+} hubbub_parser_pool_cache;
+#endif
+
+/**
+ * Pool of parsers
+ *
+ * Each thread keeps the last parser it released for itself, and takes it
+ * back without locking when next it acquires one, as a server handling a
+ * request per thread will. Otherwise, idle parsers are kept on a shared
+ * stack, so the one most recently released, whose storage is likeliest
+ * still to be in cache, is the next acquired. The lock is held only to
+ * push or pop a pointer: creating, resetting and destroying parsers all
+ * happen outside it.
+ */
+struct hubbub_parser_pool {
+	char *enc;			/**< Source document encoding, or NULL
+					 * to autodetect */
+	bool fix_enc;			/**< Whether to fix up encoding */
+
+	hubbub_parser **idle;		/**< Stack of idle parsers */
+	uint32_t n_idle;		/**< Number of idle parsers */
+	uint32_t size;			/**< Most idle parsers to keep */
+	int32_t n_acquired;		/**< Number of parsers in use, less
+					 * those counted by thread caches */
+
+#ifdef HUBBUB_POOL_PTHREADS
+	pthread_mutex_t lock;		/**< Lock on the above, and on the
+					 * list of caches */
+
+	pthread_key_t key;		/**< Key to each thread's cache */
+	hubbub_parser_pool_cache *caches;	/**< List of caches */
+#endif
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client data */
+};
+
+static inline void hubbub_parser_pool_lock(hubbub_parser_pool *pool)
+{
+#ifdef HUBBUB_POOL_PTHREADS
+	pthread_mutex_lock(&pool->lock);
+#else
+	(void) pool;
+#endif
+}
+
+static inline void hubbub_parser_pool_unlock(hubbub_parser_pool *pool)
+{
+#ifdef HUBBUB_POOL_PTHREADS
+	pthread_mutex_unlock(&pool->lock);
+#else
+	(void) pool;
+#endif
+}
+
+#ifdef HUBBUB_POOL_PTHREADS
+/**
+ * Give back an exiting thread's idle parser to its pool
+ *
+ * \param pw  The thread's cache
+ *
+ * The cache itself stays on the pool's list, as its count of parsers
+ * acquired is still needed, and is freed with the pool.
+ */
+static void hubbub_parser_pool_thread_exit(void *pw)
+{
+	hubbub_parser_pool_cache *cache = pw;
+	hubbub_parser_pool *pool = cache->pool;
+	hubbub_parser *parser = cache->parser;
+
+	if (parser == NULL)
+		return;
+
+	cache->parser = NULL;
+
+	hubbub_parser_pool_lock(pool);
+	if (pool->n_idle < pool->size) {
+		pool->idle[pool->n_idle++] = parser;
+		parser = NULL;
+	}
+	hubbub_parser_pool_unlock(pool);
+
+	if (parser != NULL)
+		hubbub_parser_destroy(parser);
+}
+
+/**
+ * Find the calling thread's cache in a pool, creating it if need be
+ *
+ * \param pool    Pool to look in
+ * \param create  Whether to create the cache if there is none yet
+ * \return The cache, or NULL if there is none
+ */
+static hubbub_parser_pool_cache *hubbub_parser_pool_cache_get(
+		hubbub_parser_pool *pool, bool create)
+{
+	hubbub_parser_pool_cache *cache;
+
+	/* A pool which keeps no parsers keeps none per thread either */
+	if (pool->size == 0)
+		return NULL;
+
+	cache = pthread_getspecific(pool->key);
+	if (cache != NULL || create == false)
+		return cache;
+
+	cache = pool->alloc(NULL, sizeof(hubbub_parser_pool_cache), pool->pw);
+	if (cache == NULL)
+		return NULL;
+
+	cache->pool = pool;
+	cache->parser = NULL;
+	cache->n_acquired = 0;
+
+	if (pthread_setspecific(pool->key, cache) != 0) {
+		pool->alloc(cache, 0, pool->pw);
+		return NULL;
+	}
+
+	hubbub_parser_pool_lock(pool);
+	cache->next = pool->caches;
+	pool->caches = cache;
+	hubbub_parser_pool_unlock(pool);
+
+	return cache;
+}
+#endif
+
+/**
+ * Create a pool of parsers
+ *
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \param size     Number of parsers to create now, and the most to keep
+ *                 idle in the pool thereafter, besides one kept by each
+ *                 thread which has released a parser
+ * \param alloc    Memory (de)allocation function
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param pool     Pointer to location to receive pool instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if ::enc is unsupported
+ *
+ * Where the platform has POSIX threads, the pool may be shared between
+ * threads, and ::alloc must then be safe to call from any of them. Each
+ * parser is only ever used by one thread at a time, from its acquisition
+ * to its release. The pool must be destroyed only once every other
+ * thread is done with it.
+ */
+hubbub_error hubbub_parser_pool_create(const char *enc, bool fix_enc,
+		uint32_t size, hubbub_allocator_fn alloc, void *pw,
+		hubbub_parser_pool **pool)
+{
+	hubbub_parser_pool *p;
+	hubbub_error error;
+
+	if (alloc == NULL || pool == NULL ||
+			size > UINT32_MAX / sizeof(hubbub_parser *))
+		return HUBBUB_BADPARM;
+
+	p = alloc(NULL, sizeof(hubbub_parser_pool), pw);
+	if (p == NULL)
+		return HUBBUB_NOMEM;
+
+	p->enc = NULL;
+	p->fix_enc = fix_enc;
+	p->idle = NULL;
+	p->n_idle = 0;
+	p->size = size;
+	p->n_acquired = 0;
+	p->alloc = alloc;
+	p->pw = pw;
+
+#ifdef HUBBUB_POOL_PTHREADS
+	p->caches = NULL;
+
+	if (pthread_mutex_init(&p->lock, NULL) != 0) {
+		alloc(p, 0, pw);
+		return HUBBUB_NOMEM;
+	}
+
+	if (pthread_key_create(&p->key,
+			hubbub_parser_pool_thread_exit) != 0) {
+		pthread_mutex_destroy(&p->lock);
+		alloc(p, 0, pw);
+		return HUBBUB_NOMEM;
+	}
+#endif
+
+	if (enc != NULL) {
+		size_t len = strlen(enc) + 1;
+
+		p->enc = alloc(NULL, len, pw);
+		if (p->enc == NULL) {
+			hubbub_parser_pool_destroy(p);
+			return HUBBUB_NOMEM;
+		}
+
+		memcpy(p->enc, enc, len);
+	}
+
+	if (size > 0) {
+		p->idle = alloc(NULL, size * sizeof(hubbub_parser *), pw);
+		if (p->idle == NULL) {
+			hubbub_parser_pool_destroy(p);
+			return HUBBUB_NOMEM;
+		}
+	}
+
+	/* Have the parsers ready before the first document arrives */
+	while (p->n_idle < size) {
+		error = hubbub_parser_create(p->enc, p->fix_enc, alloc, pw,
+				&p->idle[p->n_idle]);
+		if (error != HUBBUB_OK) {
+			hubbub_parser_pool_destroy(p);
+			return error;
+		}
+
+		p->n_idle++;
+	}
+
+	*pool = p;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a pool of parsers
+ *
+ * \param pool  Pool to destroy
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if parsers taken from the pool are still in use
+ */
+hubbub_error hubbub_parser_pool_destroy(hubbub_parser_pool *pool)
+{
+	int32_t n_acquired;
+#ifdef HUBBUB_POOL_PTHREADS
+	hubbub_parser_pool_cache *cache, *next;
+#endif
+
+	if (pool == NULL)
+		return HUBBUB_BADPARM;
+
+	/* A parser may be released by another thread than acquired it */
+	n_acquired = pool->n_acquired;
+#ifdef HUBBUB_POOL_PTHREADS
+	for (cache = pool->caches; cache != NULL; cache = cache->next)
+		n_acquired += cache->n_acquired;
+#endif
+
+	if (n_acquired > 0)
+		return HUBBUB_INVALID;
+
+#ifdef HUBBUB_POOL_PTHREADS
+	/* No thread exiting after this gives its parser back */
+	pthread_key_delete(pool->key);
+
+	for (cache = pool->caches; cache != NULL; cache = next) {
+		next = cache->next;
+
+		if (cache->parser != NULL)
+			hubbub_parser_destroy(cache->parser);
+
+		pool->alloc(cache, 0, pool->pw);
+	}
+#endif
+
+	while (pool->n_idle > 0)
+		hubbub_parser_destroy(pool->idle[--pool->n_idle]);
+
+	if (pool->idle != NULL)
+		pool->alloc(pool->idle, 0, pool->pw);
+
+	if (pool->enc != NULL)
+		pool->alloc(pool->enc, 0, pool->pw);
+
+#ifdef HUBBUB_POOL_PTHREADS
+	pthread_mutex_destroy(&pool->lock);
+#endif
+
+	pool->alloc(pool, 0, pool->pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Take a parser from a pool, ready to parse a document
+ *
+ * \param pool    Pool to take parser from
+ * \param parser  Pointer to location to receive parser
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * The calling thread's own idle parser is taken if it has one, or else
+ * one from the pool's shared stack; otherwise, another is created.
+ * The parser is as newly created, with the default options, except that
+ * it keeps the storage it grew for the documents it parsed before. The
+ * parsers in a pool are therefore best all used alike.
+ */
+hubbub_error hubbub_parser_pool_acquire(hubbub_parser_pool *pool,
+		hubbub_parser **parser)
+{
+	hubbub_parser *p = NULL;
+	hubbub_error error;
+#ifdef HUBBUB_POOL_PTHREADS
+	hubbub_parser_pool_cache *cache;
+#endif
+
+	if (pool == NULL || parser == NULL)
+		return HUBBUB_BADPARM;
+
+#ifdef HUBBUB_POOL_PTHREADS
+	cache = hubbub_parser_pool_cache_get(pool, false);
+	if (cache != NULL && cache->parser != NULL) {
+		*parser = cache->parser;
+		cache->parser = NULL;
+		cache->n_acquired++;
+
+		return HUBBUB_OK;
+	}
+#endif
+
+	hubbub_parser_pool_lock(pool);
+	if (pool->n_idle > 0)
+		p = pool->idle[--pool->n_idle];
+	pool->n_acquired++;
+	hubbub_parser_pool_unlock(pool);
+
+	if (p == NULL) {
+		error = hubbub_parser_create(pool->enc, pool->fix_enc,
+				pool->alloc, pool->pw, &p);
+		if (error != HUBBUB_OK) {
+			hubbub_parser_pool_lock(pool);
+			pool->n_acquired--;
+			hubbub_parser_pool_unlock(pool);
+
+			return error;
+		}
+	}
+
+	*parser = p;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Give a parser back to the pool it was taken from
+ *
+ * \param pool    Pool parser was taken from
+ * \param parser  Parser to give back
+ * \return HUBBUB_OK on success, HUBBUB_BADPARM on bad parameters
+ *
+ * The parser is reset here, rather than when it is next acquired, so that
+ * the references its treebuilder holds to the document are released
+ * while the client's tree handler can still accept them. Its options are
+ * then returned to their defaults, so that nothing the client gave it,
+ * handlers and their data above all, is seen by the next to acquire it.
+ * It is kept by the calling thread if that has no idle parser of its
+ * own, or else goes on the pool's shared stack. If the pool already holds
+ * as many idle parsers as it keeps, or the parser can't be reset, it is
+ * destroyed instead.
+ */
+hubbub_error hubbub_parser_pool_release(hubbub_parser_pool *pool,
+		hubbub_parser *parser)
+{
+	bool keep = false;
+#ifdef HUBBUB_POOL_PTHREADS
+	hubbub_parser_pool_cache *cache;
+#endif
+
+	if (pool == NULL || parser == NULL)
+		return HUBBUB_BADPARM;
+
+	if (hubbub_parser_reset(parser, pool->enc, pool->fix_enc) !=
+			HUBBUB_OK) {
+		/* Destroying it releases the document all the same */
+		hubbub_parser_destroy(parser);
+		parser = NULL;
+	} else if (hubbub_parser_reset_options(parser) != HUBBUB_OK) {
+		hubbub_parser_destroy(parser);
+		parser = NULL;
+	}
+
+#ifdef HUBBUB_POOL_PTHREADS
+	cache = hubbub_parser_pool_cache_get(pool, true);
+	if (cache != NULL) {
+		cache->n_acquired--;
+
+		if (parser != NULL && cache->parser == NULL) {
+			cache->parser = parser;
+			return HUBBUB_OK;
+		}
+	}
+#endif
+
+	hubbub_parser_pool_lock(pool);
+#ifdef HUBBUB_POOL_PTHREADS
+	if (cache == NULL)
+		pool->n_acquired--;
+#else
+	assert(pool->n_acquired > 0);
+	pool->n_acquired--;
+#endif
+	if (parser != NULL && pool->n_idle < pool->size) {
+		pool->idle[pool->n_idle++] = parser;
+		keep = true;
+	}
+	hubbub_parser_pool_unlock(pool);
+
+	if (parser != NULL && keep == false)
+		hubbub_parser_destroy(parser);
+
+	return HUBBUB_OK;
+}
+
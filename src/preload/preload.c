@@ -0,0 +1,537 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <parserutils/utils/buffer.h>
+
+#include "preload/preload.h"
+#include "tokeniser/tokeniser.h"
+#include "utils/parserutilserror.h"
+#include "utils/string.h"
+#include "utils/utils.h"
+
+/**
+ * Preload scanner
+ *
+ * This tokenises a copy of the input buffered ahead of a paused parse,
+ * with a tokeniser of its own which yields only the tags it needs. Its
+ * storage is retained from one token to the next.
+ */
+struct hubbub_preload_scanner {
+	parserutils_inputstream *input;	/**< Copy of input being scanned */
+	hubbub_tokeniser *tok;		/**< Tokeniser for copy of input */
+	size_t copied;			/**< Bytes of input copied, counted
+					 * from the parse's cursor */
+
+	bool in_style;			/**< Whether in a style element */
+	parserutils_buffer *style;	/**< Text of current style element */
+
+	hubbub_preload_handler handler;	/**< Preload handling callback */
+	void *pw;			/**< Preload handler data */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *alloc_pw;			/**< Client private data */
+};
+
+/** Whether a byte is HTML whitespace */
+#define ISSPACE(c) \
+	((c) == 0x09 || (c) == 0x0a || (c) == 0x0c || (c) == 0x0d || \
+			(c) == 0x20)
+
+static hubbub_error hubbub_preload_token_handler(const hubbub_token *token,
+		void *pw);
+static hubbub_error hubbub_preload_set_filter(
+		hubbub_preload_scanner *scanner);
+
+/**
+ * Create a preload scanner
+ *
+ * \param handler   Preload handling callback
+ * \param pw        Preload handler data
+ * \param alloc     Memory (de)allocation function
+ * \param alloc_pw  Pointer to client-specific private data (may be NULL)
+ * \param scanner   Pointer to location to receive scanner instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_preload_scanner_create(hubbub_preload_handler handler,
+		void *pw, hubbub_allocator_fn alloc, void *alloc_pw,
+		hubbub_preload_scanner **scanner)
+{
+	hubbub_preload_scanner *s;
+	hubbub_tokeniser_optparams params;
+	parserutils_error perror;
+	hubbub_error error;
+
+	if (handler == NULL || alloc == NULL || scanner == NULL)
+		return HUBBUB_BADPARM;
+
+	s = alloc(NULL, sizeof(hubbub_preload_scanner), alloc_pw);
+	if (s == NULL)
+		return HUBBUB_NOMEM;
+
+	/* The input is copied once decoded, so is always UTF-8 */
+	perror = parserutils_inputstream_create("UTF-8",
+			HUBBUB_CHARSET_CONFIDENT, NULL, alloc, alloc_pw,
+			&s->input);
+	if (perror != PARSERUTILS_OK) {
+		alloc(s, 0, alloc_pw);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	perror = parserutils_buffer_create(alloc, alloc_pw, &s->style);
+	if (perror != PARSERUTILS_OK) {
+		parserutils_inputstream_destroy(s->input);
+		alloc(s, 0, alloc_pw);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	error = hubbub_tokeniser_create(s->input, alloc, alloc_pw, &s->tok);
+	if (error != HUBBUB_OK) {
+		parserutils_buffer_destroy(s->style);
+		parserutils_inputstream_destroy(s->input);
+		alloc(s, 0, alloc_pw);
+		return error;
+	}
+
+	s->copied = 0;
+	s->in_style = false;
+	s->handler = handler;
+	s->pw = pw;
+	s->alloc = alloc;
+	s->alloc_pw = alloc_pw;
+
+	params.token_handler.handler = hubbub_preload_token_handler;
+	params.token_handler.pw = s;
+	hubbub_tokeniser_setopt(s->tok, HUBBUB_TOKENISER_TOKEN_HANDLER,
+			&params);
+
+	params.coalesce_characters = true;
+	hubbub_tokeniser_setopt(s->tok, HUBBUB_TOKENISER_COALESCE_CHARACTERS,
+			&params);
+
+	hubbub_preload_set_filter(s);
+
+	*scanner = s;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a preload scanner
+ *
+ * \param scanner  The scanner instance to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_preload_scanner_destroy(hubbub_preload_scanner *scanner)
+{
+	if (scanner == NULL)
+		return HUBBUB_BADPARM;
+
+	hubbub_tokeniser_destroy(scanner->tok);
+
+	parserutils_buffer_destroy(scanner->style);
+
+	parserutils_inputstream_destroy(scanner->input);
+
+	scanner->alloc(scanner, 0, scanner->alloc_pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Scan the input buffered ahead of a paused parse
+ *
+ * \param scanner  Scanner instance
+ * \param input    Input stream of the parse
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Scanning picks up from where it left off, so the parse's input cursor
+ * must not have moved since the scanner was created. All the input the
+ * stream holds is decoded, which it would be in time anyway.
+ */
+hubbub_error hubbub_preload_scanner_scan(hubbub_preload_scanner *scanner,
+		parserutils_inputstream *input)
+{
+	parserutils_error perror;
+	const uint8_t *ptr;
+	size_t len, avail;
+
+	if (scanner == NULL || input == NULL)
+		return HUBBUB_BADPARM;
+
+	/* Have the stream decode everything it holds. Nothing refers into
+	 * it while the parse is paused, so it may move */
+	do {
+		perror = parserutils_inputstream_peek(input,
+				input->utf8->length - input->cursor,
+				&ptr, &len);
+	} while (perror == PARSERUTILS_OK);
+
+	avail = input->utf8->length - input->cursor;
+	if (avail > scanner->copied) {
+		perror = parserutils_inputstream_append(scanner->input,
+				input->utf8->data + input->cursor +
+						scanner->copied,
+				avail - scanner->copied);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		scanner->copied = avail;
+	}
+
+	return hubbub_tokeniser_run(scanner->tok);
+}
+
+/**
+ * Pass on a resource found by the scanner
+ *
+ * \param scanner  Scanner instance
+ * \param type     Type of resource
+ * \param url      Pointer to URL of resource
+ * \param len      Byte length of URL
+ * \param rel      Pointer to link's relationship, or NULL
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Whitespace around the URL is stripped, and empty URLs are ignored.
+ */
+static hubbub_error hubbub_preload_emit(hubbub_preload_scanner *scanner,
+		hubbub_preload_type type, const uint8_t *url, size_t len,
+		const hubbub_string *rel)
+{
+	hubbub_preload preload;
+
+	while (len > 0 && ISSPACE(url[0])) {
+		url++;
+		len--;
+	}
+
+	while (len > 0 && ISSPACE(url[len - 1]))
+		len--;
+
+	if (len == 0)
+		return HUBBUB_OK;
+
+	preload.type = type;
+	preload.url.ptr = url;
+	preload.url.len = len;
+	if (rel != NULL) {
+		preload.rel = *rel;
+	} else {
+		preload.rel.ptr = NULL;
+		preload.rel.len = 0;
+	}
+
+	return scanner->handler(&preload, scanner->pw);
+}
+
+/**
+ * Pass on the URLs of the candidate images in a srcset attribute
+ *
+ * \param scanner  Scanner instance
+ * \param srcset   Value of attribute
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_preload_srcset(hubbub_preload_scanner *scanner,
+		const hubbub_string *srcset)
+{
+	const uint8_t *pos = srcset->ptr;
+	const uint8_t *end = srcset->ptr + srcset->len;
+	hubbub_error error;
+
+	while (pos < end) {
+		const uint8_t *url;
+		size_t len;
+
+		while (pos < end && (ISSPACE(*pos) || *pos == ','))
+			pos++;
+
+		url = pos;
+		while (pos < end && ISSPACE(*pos) == false)
+			pos++;
+		len = pos - url;
+
+		if (len > 0 && url[len - 1] == ',') {
+			/* The URL runs up to the end of its candidate */
+			while (len > 0 && url[len - 1] == ',')
+				len--;
+		} else {
+			/* Skip the descriptors, which may contain commas
+			 * within parentheses */
+			bool in_parens = false;
+
+			while (pos < end && (in_parens || *pos != ',')) {
+				if (*pos == '(')
+					in_parens = true;
+				else if (*pos == ')')
+					in_parens = false;
+				pos++;
+			}
+		}
+
+		error = hubbub_preload_emit(scanner, HUBBUB_PRELOAD_IMAGE,
+				url, len, NULL);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Pass on the URLs of the @import rules in a style sheet
+ *
+ * \param scanner  Scanner instance
+ * \param css      Pointer to style sheet
+ * \param len      Byte length of style sheet
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_preload_imports(hubbub_preload_scanner *scanner,
+		const uint8_t *css, size_t len)
+{
+	const uint8_t *pos = css;
+	const uint8_t *end = css + len;
+	hubbub_error error;
+
+	while (pos < end) {
+		const uint8_t *url;
+		uint8_t close = 0;
+
+		if (end - pos >= 2 && pos[0] == '/' && pos[1] == '*') {
+			/* Skip comment */
+			for (pos += 2; end - pos >= 2; pos++) {
+				if (pos[0] == '*' && pos[1] == '/')
+					break;
+			}
+			if (end - pos < 2)
+				break;
+			pos += 2;
+			continue;
+		}
+
+		if (end - pos < (ptrdiff_t) SLEN("@import") ||
+				hubbub_string_match_ci(pos, SLEN("@import"),
+					(const uint8_t *) "@import",
+					SLEN("@import")) == false) {
+			pos++;
+			continue;
+		}
+
+		for (pos += SLEN("@import"); pos < end && ISSPACE(*pos); pos++)
+			;
+
+		if (end - pos >= (ptrdiff_t) SLEN("url(") &&
+				hubbub_string_match_ci(pos, SLEN("url("),
+					(const uint8_t *) "url(",
+					SLEN("url(")) == true) {
+			for (pos += SLEN("url("); pos < end && ISSPACE(*pos);
+					pos++)
+				;
+			close = ')';
+		}
+
+		if (pos < end && (*pos == '"' || *pos == '\'')) {
+			close = *pos++;
+		} else if (close == 0) {
+			/* Not a URL */
+			continue;
+		}
+
+		for (url = pos; pos < end && *pos != close; pos++) {
+			if (close == ')' && ISSPACE(*pos))
+				break;
+		}
+
+		/* A URL cut off by the end of the style sheet is left be */
+		if (pos == end)
+			break;
+
+		error = hubbub_preload_emit(scanner, HUBBUB_PRELOAD_IMPORT,
+				url, pos - url, NULL);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find the value of an attribute of a tag
+ *
+ * \param tag   Tag to look in
+ * \param name  Name of attribute, in lowercase
+ * \param len   Byte length of name
+ * \return Pointer to value, or NULL if the tag has no such attribute
+ */
+static const hubbub_string *hubbub_preload_attribute(const hubbub_tag *tag,
+		const char *name, size_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		const hubbub_attribute *attr = &tag->attributes[i];
+
+		if (hubbub_string_match(attr->name.ptr, attr->name.len,
+				(const uint8_t *) name, len))
+			return &attr->value;
+	}
+
+	return NULL;
+}
+
+/**
+ * Handle a start tag found by the scanner
+ *
+ * \param scanner  Scanner instance
+ * \param tag      Tag to handle
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_preload_start_tag(hubbub_preload_scanner *scanner,
+		const hubbub_tag *tag)
+{
+	hubbub_tokeniser_optparams params;
+	const hubbub_string *value;
+	hubbub_error error = HUBBUB_OK;
+
+	switch (tag->atom) {
+	case HUBBUB_ATOM_SCRIPT:
+		value = hubbub_preload_attribute(tag, "src", SLEN("src"));
+		if (value != NULL) {
+			error = hubbub_preload_emit(scanner,
+					HUBBUB_PRELOAD_SCRIPT,
+					value->ptr, value->len, NULL);
+		}
+		break;
+	case HUBBUB_ATOM_LINK:
+		value = hubbub_preload_attribute(tag, "href", SLEN("href"));
+		if (value != NULL) {
+			const hubbub_string *rel = hubbub_preload_attribute(
+					tag, "rel", SLEN("rel"));
+
+			error = hubbub_preload_emit(scanner,
+					HUBBUB_PRELOAD_LINK,
+					value->ptr, value->len, rel);
+		}
+		break;
+	case HUBBUB_ATOM_IMG:
+		value = hubbub_preload_attribute(tag, "src", SLEN("src"));
+		if (value != NULL) {
+			error = hubbub_preload_emit(scanner,
+					HUBBUB_PRELOAD_IMAGE,
+					value->ptr, value->len, NULL);
+		}
+
+		value = hubbub_preload_attribute(tag, "srcset",
+				SLEN("srcset"));
+		if (error == HUBBUB_OK && value != NULL)
+			error = hubbub_preload_srcset(scanner, value);
+		break;
+	case HUBBUB_ATOM_STYLE:
+		scanner->in_style = true;
+		parserutils_buffer_discard(scanner->style, 0,
+				scanner->style->length);
+		hubbub_preload_set_filter(scanner);
+		break;
+	default:
+		break;
+	}
+
+	/* Skip over the content of elements which aren't parsed as markup,
+	 * as the treebuilder would */
+	switch (tag->atom) {
+	case HUBBUB_ATOM_TEXTAREA:
+	case HUBBUB_ATOM_TITLE:
+		params.content_model.model = HUBBUB_CONTENT_MODEL_RCDATA;
+		break;
+	case HUBBUB_ATOM_IFRAME:
+	case HUBBUB_ATOM_NOEMBED:
+	case HUBBUB_ATOM_NOFRAMES:
+	case HUBBUB_ATOM_NOSCRIPT:
+	case HUBBUB_ATOM_SCRIPT:
+	case HUBBUB_ATOM_STYLE:
+	case HUBBUB_ATOM_XMP:
+		params.content_model.model = HUBBUB_CONTENT_MODEL_CDATA;
+		break;
+	case HUBBUB_ATOM_PLAINTEXT:
+		params.content_model.model = HUBBUB_CONTENT_MODEL_PLAINTEXT;
+		break;
+	default:
+		return error;
+	}
+
+	hubbub_tokeniser_setopt(scanner->tok, HUBBUB_TOKENISER_CONTENT_MODEL,
+			&params);
+
+	return error;
+}
+
+/**
+ * Handle a token found by the scanner
+ *
+ * \param token  Token to handle
+ * \param pw     Scanner instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_preload_token_handler(const hubbub_token *token, void *pw)
+{
+	hubbub_preload_scanner *scanner = pw;
+	parserutils_error perror;
+	hubbub_error error = HUBBUB_OK;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_START_TAG:
+		error = hubbub_preload_start_tag(scanner, &token->data.tag);
+		break;
+	case HUBBUB_TOKEN_END_TAG:
+		if (scanner->in_style &&
+				token->data.tag.atom == HUBBUB_ATOM_STYLE) {
+			scanner->in_style = false;
+			hubbub_preload_set_filter(scanner);
+
+			error = hubbub_preload_imports(scanner,
+					scanner->style->data,
+					scanner->style->length);
+		}
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		/* Only style sheets' text is let through */
+		perror = parserutils_buffer_append(scanner->style,
+				token->data.character.ptr,
+				token->data.character.len);
+		if (perror != PARSERUTILS_OK)
+			error = hubbub_error_from_parserutils_error(perror);
+		break;
+	default:
+		break;
+	}
+
+	return error;
+}
+
+/**
+ * Have the scanner's tokeniser yield only the tokens of interest
+ *
+ * \param scanner  Scanner instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Tags are always of interest, but text only within style elements.
+ */
+hubbub_error hubbub_preload_set_filter(hubbub_preload_scanner *scanner)
+{
+	hubbub_tokeniser_optparams params;
+
+	params.token_filter = HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_START_TAG) |
+			HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_END_TAG);
+	if (scanner->in_style)
+		params.token_filter |= HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_CHARACTER);
+
+	return hubbub_tokeniser_setopt(scanner->tok,
+			HUBBUB_TOKENISER_TOKEN_FILTER, &params);
+}
+
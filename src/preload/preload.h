@@ -0,0 +1,30 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_preload_preload_h_
+#define hubbub_preload_preload_h_
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/types.h>
+
+#include <parserutils/input/inputstream.h>
+
+typedef struct hubbub_preload_scanner hubbub_preload_scanner;
+
+/* Create a preload scanner */
+hubbub_error hubbub_preload_scanner_create(hubbub_preload_handler handler,
+		void *pw, hubbub_allocator_fn alloc, void *alloc_pw,
+		hubbub_preload_scanner **scanner);
+/* Destroy a preload scanner */
+hubbub_error hubbub_preload_scanner_destroy(hubbub_preload_scanner *scanner);
+
+/* Scan the input buffered ahead of a paused parse */
+hubbub_error hubbub_preload_scanner_scan(hubbub_preload_scanner *scanner,
+		parserutils_inputstream *input);
+
+#endif
+
@@ -0,0 +1,79 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <string.h>
+
+#include "utils/utils.h"
+#include "tokeniser/atoms.h"
+
+/** Slot in the perfect hash of element names */
+typedef struct hubbub_atom_slot {
+	const char *name;	/**< Lowercase name */
+	size_t len;		/**< Length of name, in bytes */
+	hubbub_atom atom;	/**< Atom for name */
+} hubbub_atom_slot;
+
+#include "atoms.inc"
+
+/** Fold an ASCII uppercase letter to lowercase */
+#define FOLD(c) ((uint8_t) ((c) | ((uint8_t) ((c) - 'A') < 26 ? 0x20 : 0)))
+
+/**
+ * Find the atom for an element name
+ *
+ * The name is looked up in a minimal perfect hash generated from
+ * build/Atoms by make-atoms.pl, so there is only one candidate to
+ * compare it against. ASCII letters are matched case-insensitively.
+ *
+ * \param name  Name to look up
+ * \param len   Length, in bytes, of name
+ * \return The corresponding atom, or HUBBUB_ATOM_UNKNOWN if none
+ */
+hubbub_atom hubbub_atom_from_name(const uint8_t *name, size_t len)
+{
+	const hubbub_atom_slot *slot;
+	uint32_t hash = 2166136261u;
+	uint32_t displacement;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		hash ^= FOLD(name[i]);
+		hash *= 16777619u;
+	}
+
+	displacement = atom_displacements[hash % ATOM_BUCKETS];
+
+	hash = (hash ^ (displacement & 0xff)) * 16777619u;
+	hash = (hash ^ (displacement >> 8)) * 16777619u;
+
+	slot = &atom_slots[hash % ATOM_SLOTS];
+
+	if (slot->len != len)
+		return HUBBUB_ATOM_UNKNOWN;
+
+	for (i = 0; i < len; i++) {
+		if (FOLD(name[i]) != (uint8_t) slot->name[i])
+			return HUBBUB_ATOM_UNKNOWN;
+	}
+
+	return slot->atom;
+}
+
+/**
+ * Retrieve the name of an atom
+ *
+ * \param atom  Atom to consider
+ * \return Pointer to lowercase name, or NULL for HUBBUB_ATOM_UNKNOWN
+ */
+const char *hubbub_atom_name(hubbub_atom atom)
+{
+	if ((size_t) atom >= N_ELEMENTS(atom_names))
+		return NULL;
+
+	return atom_names[atom];
+}
+
@@ -0,0 +1,22 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_tokeniser_atoms_h_
+#define hubbub_tokeniser_atoms_h_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/atoms.h>
+
+/* Find the atom for an element name */
+hubbub_atom hubbub_atom_from_name(const uint8_t *name, size_t len);
+
+/* Retrieve the name of an atom */
+const char *hubbub_atom_name(hubbub_atom atom);
+
+#endif
+
@@ -8,79 +8,72 @@
 #include "utils/utils.h"
 #include "tokeniser/entities.h"
 
-/** Node in our entity tree */
-typedef struct hubbub_entity_node {
-        /* Do not reorder this without fixing make-entities.pl */
-	uint8_t split;	/**< Data to split on */
-	int32_t lt;	/**< Subtree for data less than split */
-	int32_t eq;	/**< Subtree for data equal to split */
-	int32_t gt;	/**< Subtree for data greater than split */
-	uint32_t value;	/**< Data for this node */
-} hubbub_entity_node;
+/** State in our entity trie */
+typedef struct hubbub_entity_state {
+	uint16_t base;	/**< Index of children, less their character code,
+			 * or 0 if none. ENTITY_TERMINAL is set if this
+			 * state completes an entity. */
+	uint16_t check;	/**< Index of parent state, or 0 if unused */
+} hubbub_entity_state;
 
 #include "entities.inc"
 
 /**
- * Step-wise search for a key in our entity tree
+ * Advance a search for the longest entity over a span of input
  *
- * \param c        Character to look for
- * \param result   Pointer to location for result
+ * \param data     Span of input to search
+ * \param len      Length, in bytes, of span
  * \param context  Pointer to location for search context
- * \return HUBBUB_OK if key found,
- *         HUBBUB_NEEDDATA if more steps are required
- *         HUBBUB_INVALID if nothing matches
+ * \param used     Pointer to location to receive number of bytes consumed
+ * \param match    Pointer to location to receive length of longest match
+ * \param result   Pointer to location to receive codepoint of match
+ * \return HUBBUB_OK if the search is over,
+ *         HUBBUB_NEEDDATA if the whole span was consumed and further
+ *                         input may yet extend the match
  *
- * The value pointed to by ::context must be NULL for the first call.
- * Thereafter, pass in the same value as returned by the previous call.
+ * The value pointed to by ::context should be -1 for the first call.
+ * Thereafter, pass in the same value as returned by the previous call,
+ * along with the input following the bytes consumed so far.
  * The context is opaque to the caller and should not be inspected.
  *
- * The location pointed to by ::result will be set to NULL unless a match
- * is found.
+ * The length of the longest entity completed within the span, measured
+ * from its start, is stored in ::match, or 0 if none was. The location
+ * pointed to by ::result is only written if there was a match.
  */
-static hubbub_error hubbub_entity_tree_search_step(uint8_t c,
-		uint32_t *result, int32_t *context)
+hubbub_error hubbub_entities_search(const uint8_t *data, size_t len,
+		int32_t *context, size_t *used, size_t *match,
+		uint32_t *result)
 {
-	bool match = false;
-	int32_t p;
+	uint32_t s = (*context == -1) ? ENTITY_ROOT : (uint32_t) *context;
+	size_t i;
 
-	if (result == NULL || context == NULL)
-		return HUBBUB_BADPARM;
+	*match = 0;
 
-	if (*context == -1) {
-		p = dict_root;
-	} else {
-		p = *context;
-	}
+	for (i = 0; i < len; i++) {
+		uint32_t base = entity_states[s].base & ~ENTITY_TERMINAL;
+		uint32_t t;
 
-	while (p != -1) {
-		if (c < dict[p].split) {
-			p = dict[p].lt;
-		} else if (c == dict[p].split) {
-			if (dict[p].split == '\0') {
-				match = true;
-				p = -1;
-			} else if (dict[p].eq != -1 && dict[dict[p].eq].split == '\0') {
-				match = true;
-				*result = dict[dict[p].eq].value;
-				p = dict[p].eq;
-			} else if (dict[p].value != 0) {
-				match = true;
-				*result = dict[p].value;
-				p = dict[p].eq;
-			} else {
-				p = dict[p].eq;
-			}
+		/* Leaves have no children, so can't be extended */
+		if (base == 0)
+			break;
 
+		t = base + entity_codes[data[i]];
+		if (t == base || entity_states[t].check != s)
 			break;
-		} else {
-			p = dict[p].gt;
+
+		s = t;
+
+		if (entity_states[s].base & ENTITY_TERMINAL) {
+			*match = i + 1;
+			*result = entity_values[s];
 		}
 	}
 
-	*context = p;
+	*context = s;
+	*used = i;
 
-	return (match) ? HUBBUB_OK :
-			(p == -1) ? HUBBUB_INVALID : HUBBUB_NEEDDATA;
+	return (i == len && (entity_states[s].base & ~ENTITY_TERMINAL) != 0)
+			? HUBBUB_NEEDDATA : HUBBUB_OK;
 }
 
 /**
@@ -103,10 +96,19 @@ static hubbub_error hubbub_entity_tree_search_step(uint8_t c,
 hubbub_error hubbub_entities_search_step(uint8_t c, uint32_t *result,
 		int32_t *context)
 {
-	if (result == NULL)
+	size_t used, match;
+
+	if (result == NULL || context == NULL)
 		return HUBBUB_BADPARM;
 
-        *result = 0xFFFD;
-        
-	return hubbub_entity_tree_search_step(c, result, context);
+	*result = 0xFFFD;
+
+	hubbub_entities_search(&c, 1, context, &used, &match, result);
+
+	if (used == 0) {
+		*context = -1;
+		return HUBBUB_INVALID;
+	}
+
+	return (match != 0) ? HUBBUB_OK : HUBBUB_NEEDDATA;
 }
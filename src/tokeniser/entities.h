@@ -9,10 +9,16 @@
 #define hubbub_tokeniser_entities_h_
 
 #include <inttypes.h>
+#include <stddef.h>
 
 #include <hubbub/errors.h>
 #include <hubbub/functypes.h>
 
+/* Advance a search for the longest entity over a span of input */
+hubbub_error hubbub_entities_search(const uint8_t *data, size_t len,
+		int32_t *context, size_t *used, size_t *match,
+		uint32_t *result);
+
 /* Step-wise search for an entity in the dictionary */
 hubbub_error hubbub_entities_search_step(uint8_t c, uint32_t *result,
 		int32_t *context);
@@ -14,12 +14,19 @@
 #include <parserutils/charset/utf8.h>
 
 #include "utils/parserutilserror.h"
+#include "utils/scan.h"
 #include "utils/utils.h"
 
 #include "hubbub/errors.h"
+#include "tokeniser/atoms.h"
 #include "tokeniser/entities.h"
 #include "tokeniser/tokeniser.h"
 
+/* Use a table of label addresses for state dispatch, where available */
+#if defined(__GNUC__) && !defined(HUBBUB_TOKENISER_NO_COMPUTED_GOTO)
+#define HUBBUB_TOKENISER_COMPUTED_GOTO
+#endif
+
 /**
  * Table of mappings between Windows-1252 codepoints 128-159 and UCS4
  */
@@ -93,16 +100,72 @@ typedef enum hubbub_tokeniser_state {
 	STATE_NAMED_ENTITY
 } hubbub_tokeniser_state;
 
+/**
+ * Location of a string being collected for the current tag
+ *
+ * While a string is a verbatim run of the input, it is left where it is
+ * and recorded by its offset from the current input position. Once any
+ * of its characters has to be transformed, it is moved into the
+ * tokeniser's buffer, and recorded by its offset in that instead.
+ */
+typedef struct hubbub_tokeniser_strloc {
+	size_t offset;			/**< Offset of start of string */
+	bool in_input;			/**< Whether offset is into input */
+} hubbub_tokeniser_strloc;
+
+/**
+ * Locations of the name and value of an attribute of the current tag
+ */
+typedef struct hubbub_tokeniser_attrloc {
+	hubbub_tokeniser_strloc name;	/**< Location of name */
+	hubbub_tokeniser_strloc value;	/**< Location of value */
+} hubbub_tokeniser_attrloc;
+
+/**
+ * Block of storage for the data of batched tokens
+ *
+ * Data is never moved once it's in a block, so tokens can point at it
+ * while the rest of their batch is collected.
+ */
+typedef struct hubbub_tokeniser_arena_block {
+	struct hubbub_tokeniser_arena_block *next;	/**< Next block */
+	size_t size;			/**< Size of data, in bytes */
+	size_t used;			/**< Number of bytes of data in use */
+	uint8_t data[];			/**< Block data */
+} hubbub_tokeniser_arena_block;
+
+/** Smallest limit on the text of a token: the longest UTF-8 character */
+#define HUBBUB_TOKENISER_MIN_TOKEN_BYTES 4
+
+/** Minimum size of a block of batched token data */
+#define ARENA_BLOCK_SIZE (16 * 1024)
+
+/** Alignment of allocations from blocks of batched token data */
+#define ARENA_ALIGN (sizeof(void *))
+
 /**
  * Context for tokeniser
  */
 typedef struct hubbub_tokeniser_context {
 	size_t pending;				/**< Count of pending chars */
+	size_t token_bytes;			/**< Bytes of text kept for
+						 * the current token */
 
-	hubbub_string current_comment;		/**< Current comment text */
+	hubbub_string current_comment;		/**< Length of the current
+						 * comment's text while it
+						 * is still in the input */
 
 	hubbub_token_type current_tag_type;	/**< Type of current_tag */
 	hubbub_tag current_tag;			/**< Current tag */
+	hubbub_tokeniser_strloc name_loc;	/**< Location of tag name */
+	hubbub_tokeniser_attrloc *attr_locs;	/**< Locations of tag
+						 * attributes */
+	uint32_t attrs_alloc;			/**< Number of attributes
+						 * for which there is
+						 * space */
+	uint32_t *attr_sort;			/**< Space for sorting to
+						 * find duplicate attributes */
+	uint32_t attr_sort_size;		/**< Slots in attr_sort */
 	hubbub_doctype current_doctype;		/**< Current doctype */
 	hubbub_tokeniser_state prev_state;	/**< Previous state */
 
@@ -149,11 +212,9 @@ typedef struct hubbub_tokeniser_context {
 							 * called from */
 	} match_entity;				/**< Entity matching state */
 
-	struct {
-		uint32_t line;			/**< Current line of input */
-		uint32_t col;			/**< Current character in
-						 * line */
-	} position;				/**< Position in source data */
+	size_t markup_start;			/**< Offset of the '<' which
+						 * began the current tag,
+						 * comment or doctype */
 
 	uint32_t allowed_char;			/**< Used for quote matching */
 
@@ -169,23 +230,102 @@ struct hubbub_tokeniser {
 	bool escape_flag;		/**< Escape flag **/
 	bool process_cdata_section;	/**< Whether to process CDATA sections*/
 	bool paused; /**< flag for if parsing is currently paused */
+	bool coalesce_characters;	/**< Whether to normalise line breaks
+					 * and NULs in place, rather than
+					 * emitting separate tokens */
+	uint32_t token_filter;		/**< Mask of token types to emit */
+	size_t max_token_bytes;		/**< Most bytes of text to keep for
+					 * a token, or 0 for no limit */
+	uint32_t max_attributes;	/**< Most attributes to keep for a
+					 * tag, or 0 for no limit */
 
 	parserutils_inputstream *input;	/**< Input stream */
+	size_t offset;			/**< Offset of input cursor from
+					 * start of input */
 	parserutils_buffer *buffer;	/**< Input buffer */
 	parserutils_buffer *insert_buf; /**< Stream insertion buffer */
 
+	bool input_borrowed;		/**< Whether the input stream holds
+					 * the client's data in place of its
+					 * own decoded data */
+	uint8_t *owned_input;		/**< Input stream's own decoded data,
+					 * while borrowing */
+	size_t owned_allocated;		/**< Size, in bytes, of owned_input */
+
+	parserutils_buffer *journal;	/**< Input consumed since the oldest
+					 * snapshot was taken, or NULL */
+	uint32_t snapshots;		/**< Number of snapshots in use */
+	uint32_t generation;		/**< Number of times the tokeniser
+					 * has been reset */
+	bool journal_lost;		/**< Whether input has been left out
+					 * of the journal, for want of
+					 * memory */
+
+	hubbub_scan_set data_set[4];	/**< Bytes of interest in the data
+					 * state, indexed by content model */
+	hubbub_scan_set comment_set;	/**< Bytes of interest in comments */
+	hubbub_scan_set bogus_comment_set;	/**< Bytes of interest in
+						 * bogus comments */
+
 	hubbub_tokeniser_context context;	/**< Tokeniser context */
 
 	hubbub_token_handler token_handler;	/**< Token handling callback */
 	void *token_pw;				/**< Token handler data */
 
+	struct {
+		hubbub_token_batch_handler handler;	/**< Batch handling
+							 * callback */
+		void *pw;			/**< Batch handler data */
+		hubbub_token *tokens;		/**< Array of tokens to fill */
+		uint32_t size;			/**< Capacity of array */
+		uint32_t n_tokens;		/**< Number of tokens in array */
+
+		hubbub_tokeniser_arena_block *arena;	/**< Storage for token
+							 * data, or NULL */
+		hubbub_tokeniser_arena_block *current;	/**< Block being
+							 * allocated from */
+		hubbub_error error;		/**< Result of delivering a batch
+						 * on peeking the input, for
+						 * hubbub_tokeniser_run() */
+	} batch;				/**< Batched token delivery */
+
 	hubbub_error_handler error_handler;	/**< Error handling callback */
 	void *error_pw;				/**< Error handler data */
 
 	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
 	void *alloc_pw;			/**< Client private data */
+
+	size_t alloc_count;		/**< Number of allocations for
+					 * tag storage */
+};
+
+/**
+ * Snapshot of a tokeniser's state
+ *
+ * The block holding this is followed by the current tag's attributes and
+ * their locations, for each of which the context has a count, then by
+ * the contents of the tokeniser's buffer.
+ */
+struct hubbub_tokeniser_snapshot {
+	hubbub_tokeniser_state state;	/**< Tokeniser state */
+	hubbub_content_model content_model;	/**< Content model flag */
+	bool escape_flag;		/**< Escape flag */
+	bool process_cdata_section;	/**< Whether to process CDATA sections*/
+
+	size_t offset;			/**< Offset of input cursor */
+	uint32_t generation;		/**< Tokeniser's generation */
+
+	hubbub_tokeniser_context context;	/**< Tokeniser context, without
+						 * its storage */
+	size_t buffer_len;		/**< Length of buffer contents */
 };
 
+/** Number of attributes to make space for when a tag first has any */
+#define ATTRIBUTES_INITIAL 8
+
+/** Number of attributes above which duplicates are found by sorting */
+#define ATTRIBUTES_SORT_MIN 16
+
 static hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser);
 static hubbub_error hubbub_tokeniser_handle_character_reference_data(
 		hubbub_tokeniser *tokeniser);
@@ -266,8 +406,14 @@ static hubbub_error hubbub_tokeniser_handle_numbered_entity(
 static hubbub_error hubbub_tokeniser_handle_named_entity(
 		hubbub_tokeniser *tokeniser);
 
+static hubbub_error hubbub_tokeniser_reserve_attributes(
+		hubbub_tokeniser *tokeniser, uint32_t n);
+static hubbub_error hubbub_tokeniser_sort_duplicate_attributes(
+		hubbub_tokeniser *tokeniser, hubbub_attribute *attrs,
+		uint32_t *n_attributes);
+
 static inline hubbub_error emit_character_token(hubbub_tokeniser *tokeniser,
-		const hubbub_string *chars);
+		const hubbub_string *chars, size_t consumed);
 static inline hubbub_error emit_current_chars(hubbub_tokeniser *tokeniser);
 static inline hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser);
 static inline hubbub_error emit_current_comment(hubbub_tokeniser *tokeniser);
@@ -275,6 +421,11 @@ static inline hubbub_error emit_current_doctype(hubbub_tokeniser *tokeniser,
 		bool force_quirks);
 static hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 		hubbub_token *token);
+static hubbub_error hubbub_tokeniser_batch_token(hubbub_tokeniser *tokeniser,
+		const hubbub_token *token);
+static hubbub_error hubbub_tokeniser_flush_batch(hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_insert_pending(
+		hubbub_tokeniser *tokeniser);
 
 /**
  * Create a hubbub tokeniser
@@ -317,12 +468,39 @@ hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
 	tok->state = STATE_DATA;
 	tok->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
 
+	hubbub_scan_set_init(&tok->data_set[HUBBUB_CONTENT_MODEL_PCDATA],
+			(const uint8_t *) "&<\0\r", 4);
+	hubbub_scan_set_init(&tok->data_set[HUBBUB_CONTENT_MODEL_RCDATA],
+			(const uint8_t *) "&<->\0\r", 6);
+	hubbub_scan_set_init(&tok->data_set[HUBBUB_CONTENT_MODEL_CDATA],
+			(const uint8_t *) "<->\0\r", 5);
+	hubbub_scan_set_init(&tok->data_set[HUBBUB_CONTENT_MODEL_PLAINTEXT],
+			(const uint8_t *) "\0\r", 2);
+	hubbub_scan_set_init(&tok->comment_set,
+			(const uint8_t *) "-\0\r", 3);
+	hubbub_scan_set_init(&tok->bogus_comment_set,
+			(const uint8_t *) ">\0\r", 3);
+
 	tok->escape_flag = false;
 	tok->process_cdata_section = false;
+	tok->coalesce_characters = false;
+	tok->token_filter = HUBBUB_TOKEN_MASK_ALL;
+	tok->max_token_bytes = 0;
+	tok->max_attributes = 0;
 
 	tok->paused = false;
 
 	tok->input = input;
+	tok->offset = 0;
+
+	tok->input_borrowed = false;
+	tok->owned_input = NULL;
+	tok->owned_allocated = 0;
+
+	tok->journal = NULL;
+	tok->snapshots = 0;
+	tok->generation = 0;
+	tok->journal_lost = false;
 
 	tok->token_handler = NULL;
 	tok->token_pw = NULL;
@@ -330,9 +508,13 @@ hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
 	tok->error_handler = NULL;
 	tok->error_pw = NULL;
 
+	memset(&tok->batch, 0, sizeof(tok->batch));
+
 	tok->alloc = alloc;
 	tok->alloc_pw = pw;
 
+	tok->alloc_count = 0;
+
 	memset(&tok->context, 0, sizeof(hubbub_tokeniser_context));
 
 	*tokeniser = tok;
@@ -356,6 +538,36 @@ hubbub_error hubbub_tokeniser_destroy(hubbub_tokeniser *tokeniser)
 				0, tokeniser->alloc_pw);
 	}
 
+	if (tokeniser->context.attr_locs != NULL) {
+		tokeniser->alloc(tokeniser->context.attr_locs,
+				0, tokeniser->alloc_pw);
+	}
+
+	if (tokeniser->context.attr_sort != NULL) {
+		tokeniser->alloc(tokeniser->context.attr_sort,
+				0, tokeniser->alloc_pw);
+	}
+
+	while (tokeniser->batch.arena != NULL) {
+		hubbub_tokeniser_arena_block *next =
+				tokeniser->batch.arena->next;
+
+		tokeniser->alloc(tokeniser->batch.arena, 0,
+				tokeniser->alloc_pw);
+		tokeniser->batch.arena = next;
+	}
+
+	if (tokeniser->journal != NULL)
+		parserutils_buffer_destroy(tokeniser->journal);
+
+	/* Give the input stream its own data back, for it to free */
+	if (tokeniser->input_borrowed) {
+		tokeniser->input->utf8->data = tokeniser->owned_input;
+		tokeniser->input->utf8->length = 0;
+		tokeniser->input->utf8->allocated = tokeniser->owned_allocated;
+		tokeniser->input->cursor = 0;
+	}
+
 	parserutils_buffer_destroy(tokeniser->insert_buf);
 
 	parserutils_buffer_destroy(tokeniser->buffer);
@@ -365,6 +577,85 @@ hubbub_error hubbub_tokeniser_destroy(hubbub_tokeniser *tokeniser)
 	return HUBBUB_OK;
 }
 
+/**
+ * Return a hubbub tokeniser to its initial state, to tokenise a new input
+ *
+ * \param tokeniser  The tokeniser instance to reset
+ * \param input      Input stream to read from
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The tokeniser's options are kept, as is its storage, at the size it
+ * has grown to. Snapshots taken before now may not be restored after.
+ */
+hubbub_error hubbub_tokeniser_reset(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input)
+{
+	hubbub_tokeniser_context *ctx;
+	hubbub_tokeniser_arena_block *block;
+	hubbub_attribute *attrs;
+	hubbub_tokeniser_attrloc *locs;
+	uint32_t *attr_sort;
+	uint32_t attrs_alloc, attr_sort_size;
+
+	if (tokeniser == NULL || input == NULL)
+		return HUBBUB_BADPARM;
+
+	/* Give the old input stream its own data back */
+	if (tokeniser->input_borrowed) {
+		tokeniser->input->utf8->data = tokeniser->owned_input;
+		tokeniser->input->utf8->length = 0;
+		tokeniser->input->utf8->allocated = tokeniser->owned_allocated;
+		tokeniser->input->cursor = 0;
+
+		tokeniser->input_borrowed = false;
+		tokeniser->owned_input = NULL;
+		tokeniser->owned_allocated = 0;
+	}
+
+	tokeniser->state = STATE_DATA;
+	tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
+	tokeniser->escape_flag = false;
+	tokeniser->process_cdata_section = false;
+	tokeniser->paused = false;
+
+	tokeniser->input = input;
+	tokeniser->offset = 0;
+
+	tokeniser->buffer->length = 0;
+	tokeniser->insert_buf->length = 0;
+
+	if (tokeniser->journal != NULL)
+		tokeniser->journal->length = 0;
+	tokeniser->journal_lost = false;
+	tokeniser->generation++;
+
+	/* Anything batched belongs to the old input */
+	tokeniser->batch.n_tokens = 0;
+	tokeniser->batch.error = HUBBUB_OK;
+	for (block = tokeniser->batch.arena; block != NULL;
+			block = block->next)
+		block->used = 0;
+	tokeniser->batch.current = tokeniser->batch.arena;
+
+	/* Keep the storage for tags */
+	ctx = &tokeniser->context;
+	attrs = ctx->current_tag.attributes;
+	locs = ctx->attr_locs;
+	attrs_alloc = ctx->attrs_alloc;
+	attr_sort = ctx->attr_sort;
+	attr_sort_size = ctx->attr_sort_size;
+
+	memset(ctx, 0, sizeof(hubbub_tokeniser_context));
+
+	ctx->current_tag.attributes = attrs;
+	ctx->attr_locs = locs;
+	ctx->attrs_alloc = attrs_alloc;
+	ctx->attr_sort = attr_sort;
+	ctx->attr_sort_size = attr_sort_size;
+
+	return HUBBUB_OK;
+}
+
 /**
  * Configure a hubbub tokeniser
  *
@@ -406,6 +697,37 @@ hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 				err = hubbub_tokeniser_run(tokeniser);
 			}
 		}
+		break;
+	case HUBBUB_TOKENISER_COALESCE_CHARACTERS:
+		tokeniser->coalesce_characters = params->coalesce_characters;
+		break;
+	case HUBBUB_TOKENISER_TOKEN_BATCH:
+		if (params->token_batch.handler != NULL &&
+				(params->token_batch.tokens == NULL ||
+				params->token_batch.size == 0))
+			return HUBBUB_BADPARM;
+
+		/* Hand any tokens already batched to the old handler */
+		err = hubbub_tokeniser_flush_batch(tokeniser);
+
+		tokeniser->batch.handler = params->token_batch.handler;
+		tokeniser->batch.pw = params->token_batch.pw;
+		tokeniser->batch.tokens = params->token_batch.tokens;
+		tokeniser->batch.size = params->token_batch.size;
+		break;
+	case HUBBUB_TOKENISER_TOKEN_FILTER:
+		tokeniser->token_filter = params->token_filter;
+		break;
+	case HUBBUB_TOKENISER_LIMITS:
+		/* There must be room for any one character */
+		if (params->limits.max_token_bytes != 0 &&
+				params->limits.max_token_bytes <
+						HUBBUB_TOKENISER_MIN_TOKEN_BYTES)
+			return HUBBUB_BADPARM;
+
+		tokeniser->max_token_bytes = params->limits.max_token_bytes;
+		tokeniser->max_attributes = params->limits.max_attributes;
+		break;
 	}
 
 	return err;
@@ -437,9 +759,360 @@ hubbub_error hubbub_tokeniser_insert_chunk(hubbub_tokeniser *tokeniser,
 	return HUBBUB_OK;
 }
 
+/**
+ * Have the tokeniser read input in place, rather than from a copy
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       The rest of the input (valid UTF-8)
+ * \param len        Length, in bytes, of data
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the input stream holds unconsumed data
+ *
+ * The data is put in place of the input stream's decoded data, so must
+ * remain valid and unchanged until the tokeniser is destroyed. It must
+ * be the whole of the remaining input: the input stream has no undecoded
+ * data left, and none may be appended to it.
+ */
+hubbub_error hubbub_tokeniser_borrow_input(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len)
+{
+	parserutils_inputstream *input;
+
+	if (tokeniser == NULL || data == NULL)
+		return HUBBUB_BADPARM;
+
+	input = tokeniser->input;
+	if (tokeniser->input_borrowed || input->cursor != input->utf8->length)
+		return HUBBUB_INVALID;
+
+	tokeniser->owned_input = input->utf8->data;
+	tokeniser->owned_allocated = input->utf8->allocated;
+	tokeniser->input_borrowed = true;
+
+	input->utf8->data = (uint8_t *) data;
+	input->utf8->length = len;
+	input->utf8->allocated = len;
+	input->cursor = 0;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Have the tokeniser read input from a copy of its own
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Borrowed input is copied back into the input stream's own data, from
+ * the cursor on, so that it may be modified. Tokens already built from
+ * the borrowed data remain valid, as it is not freed.
+ */
+hubbub_error hubbub_tokeniser_own_input(hubbub_tokeniser *tokeniser)
+{
+	parserutils_buffer *utf8;
+	parserutils_error perror;
+	const uint8_t *data;
+	size_t len;
+
+	if (tokeniser == NULL)
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->input_borrowed == false)
+		return HUBBUB_OK;
+
+	utf8 = tokeniser->input->utf8;
+	data = utf8->data + tokeniser->input->cursor;
+	len = utf8->length - tokeniser->input->cursor;
+
+	utf8->data = tokeniser->owned_input;
+	utf8->length = 0;
+	utf8->allocated = tokeniser->owned_allocated;
+
+	perror = parserutils_buffer_append(utf8, data, len);
+	if (perror != PARSERUTILS_OK) {
+		/* Keep reading in place */
+		tokeniser->owned_input = utf8->data;
+		tokeniser->owned_allocated = utf8->allocated;
+
+		utf8->data = (uint8_t *) data - tokeniser->input->cursor;
+		utf8->length = tokeniser->input->cursor + len;
+		utf8->allocated = utf8->length;
+
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	tokeniser->input->cursor = 0;
+	tokeniser->owned_input = NULL;
+	tokeniser->owned_allocated = 0;
+	tokeniser->input_borrowed = false;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Retrieve the number of allocations a tokeniser has made for tag storage
+ *
+ * Storage for tags is retained from one to the next, so once it has
+ * grown to suit the input, this stops increasing.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return Number of calls made to the allocator for tag storage
+ */
+size_t hubbub_tokeniser_get_alloc_count(const hubbub_tokeniser *tokeniser)
+{
+	if (tokeniser == NULL)
+		return 0;
+
+	return tokeniser->alloc_count;
+}
+
+/**
+ * Take a snapshot of a tokeniser's state, so it may be returned to later
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param snapshot   Pointer to location to receive snapshot
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * The snapshot holds the tokeniser's state and the text it has collected
+ * for the current token. The input is not copied: rather, from now until
+ * the snapshot is destroyed, the tokeniser keeps what it consumes. This
+ * must not be called from within a callback.
+ */
+hubbub_error hubbub_tokeniser_snapshot_create(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_snapshot **snapshot)
+{
+	const hubbub_tokeniser_context *ctx;
+	hubbub_tokeniser_snapshot *snap;
+	hubbub_attribute *attrs;
+	hubbub_tokeniser_attrloc *locs;
+	uint32_t n_attrs;
+
+	if (tokeniser == NULL || snapshot == NULL)
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->journal == NULL) {
+		parserutils_error perror;
+
+		perror = parserutils_buffer_create(tokeniser->alloc,
+				tokeniser->alloc_pw, &tokeniser->journal);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
+
+	ctx = &tokeniser->context;
+	n_attrs = ctx->current_tag.n_attributes;
+
+	snap = tokeniser->alloc(NULL, sizeof(hubbub_tokeniser_snapshot) +
+			n_attrs * (sizeof(hubbub_attribute) +
+				sizeof(hubbub_tokeniser_attrloc)) +
+			tokeniser->buffer->length, tokeniser->alloc_pw);
+	if (snap == NULL)
+		return HUBBUB_NOMEM;
+
+	snap->state = tokeniser->state;
+	snap->content_model = tokeniser->content_model;
+	snap->escape_flag = tokeniser->escape_flag;
+	snap->process_cdata_section = tokeniser->process_cdata_section;
+	snap->offset = tokeniser->offset;
+	snap->generation = tokeniser->generation;
+
+	snap->context = *ctx;
+	snap->context.current_tag.attributes = NULL;
+	snap->context.attr_locs = NULL;
+	snap->context.attrs_alloc = 0;
+	snap->context.attr_sort = NULL;
+	snap->context.attr_sort_size = 0;
+
+	attrs = (hubbub_attribute *) (snap + 1);
+	locs = (hubbub_tokeniser_attrloc *) (attrs + n_attrs);
+	if (n_attrs > 0) {
+		memcpy(attrs, ctx->current_tag.attributes,
+				n_attrs * sizeof(hubbub_attribute));
+		memcpy(locs, ctx->attr_locs,
+				n_attrs * sizeof(hubbub_tokeniser_attrloc));
+	}
+
+	snap->buffer_len = tokeniser->buffer->length;
+	if (snap->buffer_len > 0) {
+		memcpy(locs + n_attrs, tokeniser->buffer->data,
+				snap->buffer_len);
+	}
+
+	tokeniser->snapshots++;
+
+	*snapshot = snap;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Return a tokeniser to the state in a snapshot
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param snapshot   Snapshot of the tokeniser, taken earlier
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the input since the snapshot is unknown,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * The input consumed since the snapshot was taken is put back ahead of
+ * the cursor, before any data inserted since, so tokenising resumes from
+ * where it was. The snapshot remains usable, but any taken after it are
+ * not. On failure, the tokeniser is unchanged. This must not be called
+ * from within a callback.
+ */
+hubbub_error hubbub_tokeniser_snapshot_restore(hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_snapshot *snapshot)
+{
+	hubbub_tokeniser_context *ctx;
+	parserutils_buffer *journal;
+	const hubbub_attribute *attrs;
+	const hubbub_tokeniser_attrloc *locs;
+	hubbub_attribute *cur_attrs;
+	hubbub_tokeniser_attrloc *cur_locs;
+	uint32_t *attr_sort;
+	uint32_t n_attrs, attrs_alloc, attr_sort_size;
+	size_t consumed, buffer_len;
+	parserutils_error perror;
+	hubbub_error err;
+
+	if (tokeniser == NULL || snapshot == NULL)
+		return HUBBUB_BADPARM;
+
+	journal = tokeniser->journal;
+	if (journal == NULL || snapshot->generation != tokeniser->generation ||
+			snapshot->offset > tokeniser->offset ||
+			tokeniser->offset - snapshot->offset > journal->length)
+		return HUBBUB_INVALID;
+
+	if (tokeniser->journal_lost)
+		return HUBBUB_NOMEM;
+
+	ctx = &tokeniser->context;
+	n_attrs = snapshot->context.current_tag.n_attributes;
+
+	err = hubbub_tokeniser_reserve_attributes(tokeniser, n_attrs);
+	if (err != HUBBUB_OK)
+		return err;
+
+	/* Putting back the input moves it, so batched tokens must be
+	 * delivered first */
+	if (tokeniser->batch.n_tokens > 0) {
+		err = hubbub_tokeniser_flush_batch(tokeniser);
+		if (err != HUBBUB_OK && err != HUBBUB_PAUSED)
+			return err;
+	}
+
+	err = hubbub_tokeniser_own_input(tokeniser);
+	if (err != HUBBUB_OK)
+		return err;
+
+	attrs = (const hubbub_attribute *) (snapshot + 1);
+	locs = (const hubbub_tokeniser_attrloc *) (attrs + n_attrs);
+
+	/* The snapshot's text follows the current token's, until the
+	 * input has been put back */
+	buffer_len = tokeniser->buffer->length;
+	if (snapshot->buffer_len > 0) {
+		perror = parserutils_buffer_append(tokeniser->buffer,
+				(const uint8_t *) (locs + n_attrs),
+				snapshot->buffer_len);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
+
+	consumed = tokeniser->offset - snapshot->offset;
+	if (consumed > 0) {
+		perror = parserutils_inputstream_insert(tokeniser->input,
+				journal->data + journal->length - consumed,
+				consumed);
+		if (perror != PARSERUTILS_OK) {
+			parserutils_buffer_discard(tokeniser->buffer,
+					buffer_len, snapshot->buffer_len);
+			return hubbub_error_from_parserutils_error(perror);
+		}
+
+		parserutils_buffer_discard(journal,
+				journal->length - consumed, consumed);
+	}
+
+	if (buffer_len > 0)
+		parserutils_buffer_discard(tokeniser->buffer, 0, buffer_len);
+
+	/* Keep the tokeniser's own storage for the current tag */
+	cur_attrs = ctx->current_tag.attributes;
+	cur_locs = ctx->attr_locs;
+	attrs_alloc = ctx->attrs_alloc;
+	attr_sort = ctx->attr_sort;
+	attr_sort_size = ctx->attr_sort_size;
+
+	*ctx = snapshot->context;
+
+	ctx->current_tag.attributes = cur_attrs;
+	ctx->attr_locs = cur_locs;
+	ctx->attrs_alloc = attrs_alloc;
+	ctx->attr_sort = attr_sort;
+	ctx->attr_sort_size = attr_sort_size;
+
+	if (n_attrs > 0) {
+		memcpy(cur_attrs, attrs, n_attrs * sizeof(hubbub_attribute));
+		memcpy(cur_locs, locs,
+				n_attrs * sizeof(hubbub_tokeniser_attrloc));
+	}
+
+	tokeniser->state = snapshot->state;
+	tokeniser->content_model = snapshot->content_model;
+	tokeniser->escape_flag = snapshot->escape_flag;
+	tokeniser->process_cdata_section = snapshot->process_cdata_section;
+	tokeniser->offset = snapshot->offset;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a snapshot of a tokeniser
+ *
+ * \param tokeniser  Tokeniser instance the snapshot was taken of
+ * \param snapshot   Snapshot to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Once no snapshots remain, the input consumed is no longer kept.
+ */
+hubbub_error hubbub_tokeniser_snapshot_destroy(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_snapshot *snapshot)
+{
+	if (tokeniser == NULL || snapshot == NULL)
+		return HUBBUB_BADPARM;
+
+	assert(tokeniser->snapshots > 0);
+
+	tokeniser->alloc(snapshot, 0, tokeniser->alloc_pw);
+
+	if (--tokeniser->snapshots == 0) {
+		parserutils_buffer_discard(tokeniser->journal, 0,
+				tokeniser->journal->length);
+		tokeniser->journal_lost = false;
+	}
+
+	return HUBBUB_OK;
+}
+
 /**
  * Process remaining data in the input stream
  *
+ * Where the compiler supports taking the address of a label, the state
+ * machine is driven through a table of label addresses: each state
+ * jumps straight to the code for the next, rather than returning to a
+ * switch shared by all. The states through which tags are tokenised
+ * first test for the states that usually follow them, and jump to those
+ * directly, so that markup dense with tags is tokenised with branches
+ * the processor predicts well. The compiler may merge the remaining
+ * indirect jumps into a few. Define HUBBUB_TOKENISER_NO_COMPUTED_GOTO to
+ * build the portable switch instead.
+ *
  * \param tokeniser  The tokeniser instance to invoke
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
@@ -447,181 +1120,314 @@ hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
 {
 	hubbub_error cont = HUBBUB_OK;
 
+#ifdef HUBBUB_TOKENISER_COMPUTED_GOTO
+#define dispatch_entry(x) [x] = __extension__ &&x
+	static const void *const dispatch[] = {
+		dispatch_entry(STATE_DATA),
+		dispatch_entry(STATE_CHARACTER_REFERENCE_DATA),
+		dispatch_entry(STATE_TAG_OPEN),
+		dispatch_entry(STATE_CLOSE_TAG_OPEN),
+		dispatch_entry(STATE_TAG_NAME),
+		dispatch_entry(STATE_BEFORE_ATTRIBUTE_NAME),
+		dispatch_entry(STATE_ATTRIBUTE_NAME),
+		dispatch_entry(STATE_AFTER_ATTRIBUTE_NAME),
+		dispatch_entry(STATE_BEFORE_ATTRIBUTE_VALUE),
+		dispatch_entry(STATE_ATTRIBUTE_VALUE_DQ),
+		dispatch_entry(STATE_ATTRIBUTE_VALUE_SQ),
+		dispatch_entry(STATE_ATTRIBUTE_VALUE_UQ),
+		dispatch_entry(STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE),
+		dispatch_entry(STATE_AFTER_ATTRIBUTE_VALUE_Q),
+		dispatch_entry(STATE_SELF_CLOSING_START_TAG),
+		dispatch_entry(STATE_BOGUS_COMMENT),
+		dispatch_entry(STATE_MARKUP_DECLARATION_OPEN),
+		dispatch_entry(STATE_MATCH_COMMENT),
+		dispatch_entry(STATE_COMMENT_START),
+		dispatch_entry(STATE_COMMENT_START_DASH),
+		dispatch_entry(STATE_COMMENT),
+		dispatch_entry(STATE_COMMENT_END_DASH),
+		dispatch_entry(STATE_COMMENT_END),
+		dispatch_entry(STATE_MATCH_DOCTYPE),
+		dispatch_entry(STATE_DOCTYPE),
+		dispatch_entry(STATE_BEFORE_DOCTYPE_NAME),
+		dispatch_entry(STATE_DOCTYPE_NAME),
+		dispatch_entry(STATE_AFTER_DOCTYPE_NAME),
+		dispatch_entry(STATE_MATCH_PUBLIC),
+		dispatch_entry(STATE_BEFORE_DOCTYPE_PUBLIC),
+		dispatch_entry(STATE_DOCTYPE_PUBLIC_DQ),
+		dispatch_entry(STATE_DOCTYPE_PUBLIC_SQ),
+		dispatch_entry(STATE_AFTER_DOCTYPE_PUBLIC),
+		dispatch_entry(STATE_MATCH_SYSTEM),
+		dispatch_entry(STATE_BEFORE_DOCTYPE_SYSTEM),
+		dispatch_entry(STATE_DOCTYPE_SYSTEM_DQ),
+		dispatch_entry(STATE_DOCTYPE_SYSTEM_SQ),
+		dispatch_entry(STATE_AFTER_DOCTYPE_SYSTEM),
+		dispatch_entry(STATE_BOGUS_DOCTYPE),
+		dispatch_entry(STATE_MATCH_CDATA),
+		dispatch_entry(STATE_CDATA_BLOCK),
+		dispatch_entry(STATE_NUMBERED_ENTITY),
+		dispatch_entry(STATE_NAMED_ENTITY)
+	};
+#undef dispatch_entry
+#endif
+
 	if (tokeniser == NULL)
 		return HUBBUB_BADPARM;
 
 	if (tokeniser->paused == true)
 		return HUBBUB_PAUSED;
 
+	/* Data inserted between tokens, since a snapshot was restored for
+	 * instance, goes at the cursor */
+	if (tokeniser->context.pending == 0) {
+		cont = hubbub_tokeniser_insert_pending(tokeniser);
+		if (cont != HUBBUB_OK)
+			return cont;
+	}
+
+#ifdef HUBBUB_TOKENISER_COMPUTED_GOTO
+#define dispatch() \
+		__extension__ ({ goto *dispatch[tokeniser->state]; })
+
+#define state_label(x) \
+		x:
+
+#define next_state() \
+		do { \
+			if (cont != HUBBUB_OK) \
+				goto done; \
+			dispatch(); \
+		} while (0)
+
+#define next_state_if(x) \
+		do { \
+			if (cont == HUBBUB_OK && tokeniser->state == x) \
+				goto x; \
+		} while (0)
+#else
+#define state_label(x) \
+		case x:
+
+#define next_state() \
+		break
+
+#define next_state_if(x) \
+		do { } while (0)
+#endif
+
 #if 0
 #define state(x) \
-		case x: \
+		state_label(x) \
 			printf( #x "\n");
 #else
 #define state(x) \
-		case x:
+		state_label(x)
 #endif
 
+#ifdef HUBBUB_TOKENISER_COMPUTED_GOTO
+	dispatch();
+#else
 	while (cont == HUBBUB_OK) {
 		switch (tokeniser->state) {
+#endif
 		state(STATE_DATA)
 			cont = hubbub_tokeniser_handle_data(tokeniser);
-			break;
+			next_state_if(STATE_TAG_OPEN);
+			next_state();
 		state(STATE_CHARACTER_REFERENCE_DATA)
 			cont = hubbub_tokeniser_handle_character_reference_data(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_TAG_OPEN)
 			cont = hubbub_tokeniser_handle_tag_open(tokeniser);
-			break;
+			next_state_if(STATE_TAG_NAME);
+			next_state_if(STATE_CLOSE_TAG_OPEN);
+			next_state();
 		state(STATE_CLOSE_TAG_OPEN)
 			cont = hubbub_tokeniser_handle_close_tag_open(
 					tokeniser);
-			break;
+			next_state_if(STATE_TAG_NAME);
+			next_state();
 		state(STATE_TAG_NAME)
 			cont = hubbub_tokeniser_handle_tag_name(tokeniser);
-			break;
+			next_state_if(STATE_DATA);
+			next_state_if(STATE_BEFORE_ATTRIBUTE_NAME);
+			next_state();
 		state(STATE_BEFORE_ATTRIBUTE_NAME)
 			cont = hubbub_tokeniser_handle_before_attribute_name(
 					tokeniser);
-			break;
+			next_state_if(STATE_ATTRIBUTE_NAME);
+			next_state();
 		state(STATE_ATTRIBUTE_NAME)
 			cont = hubbub_tokeniser_handle_attribute_name(
 					tokeniser);
-			break;
+			next_state_if(STATE_BEFORE_ATTRIBUTE_VALUE);
+			next_state();
 		state(STATE_AFTER_ATTRIBUTE_NAME)
 			cont = hubbub_tokeniser_handle_after_attribute_name(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_BEFORE_ATTRIBUTE_VALUE)
 			cont = hubbub_tokeniser_handle_before_attribute_value(
 					tokeniser);
-			break;
+			next_state_if(STATE_ATTRIBUTE_VALUE_DQ);
+			next_state();
 		state(STATE_ATTRIBUTE_VALUE_DQ)
 			cont = hubbub_tokeniser_handle_attribute_value_dq(
 					tokeniser);
-			break;
+			next_state_if(STATE_AFTER_ATTRIBUTE_VALUE_Q);
+			next_state();
 		state(STATE_ATTRIBUTE_VALUE_SQ)
 			cont = hubbub_tokeniser_handle_attribute_value_sq(
 					tokeniser);
-			break;
+			next_state_if(STATE_AFTER_ATTRIBUTE_VALUE_Q);
+			next_state();
 		state(STATE_ATTRIBUTE_VALUE_UQ)
 			cont = hubbub_tokeniser_handle_attribute_value_uq(
 					tokeniser);
-			break;
+			next_state_if(STATE_BEFORE_ATTRIBUTE_NAME);
+			next_state_if(STATE_DATA);
+			next_state();
 		state(STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE)
 			cont = hubbub_tokeniser_handle_character_reference_in_attribute_value(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_AFTER_ATTRIBUTE_VALUE_Q)
 			cont = hubbub_tokeniser_handle_after_attribute_value_q(
 					tokeniser);
-			break;
+			next_state_if(STATE_BEFORE_ATTRIBUTE_NAME);
+			next_state_if(STATE_DATA);
+			next_state();
 		state(STATE_SELF_CLOSING_START_TAG)
 			cont = hubbub_tokeniser_handle_self_closing_start_tag(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_BOGUS_COMMENT)
 			cont = hubbub_tokeniser_handle_bogus_comment(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_MARKUP_DECLARATION_OPEN)
 			cont = hubbub_tokeniser_handle_markup_declaration_open(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_MATCH_COMMENT)
 			cont = hubbub_tokeniser_handle_match_comment(
 					tokeniser);
-			break;
-		case STATE_COMMENT_START:
-		case STATE_COMMENT_START_DASH:
-		case STATE_COMMENT:
-		case STATE_COMMENT_END_DASH:
-		case STATE_COMMENT_END:
+			next_state();
+		state(STATE_COMMENT_START)
+		state(STATE_COMMENT_START_DASH)
+		state(STATE_COMMENT)
+		state(STATE_COMMENT_END_DASH)
+		state(STATE_COMMENT_END)
 			cont = hubbub_tokeniser_handle_comment(tokeniser);
-			break;
+			next_state();
 		state(STATE_MATCH_DOCTYPE)
 			cont = hubbub_tokeniser_handle_match_doctype(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_DOCTYPE)
 			cont = hubbub_tokeniser_handle_doctype(tokeniser);
-			break;
+			next_state();
 		state(STATE_BEFORE_DOCTYPE_NAME)
 			cont = hubbub_tokeniser_handle_before_doctype_name(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_DOCTYPE_NAME)
 			cont = hubbub_tokeniser_handle_doctype_name(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_AFTER_DOCTYPE_NAME)
 			cont = hubbub_tokeniser_handle_after_doctype_name(
 					tokeniser);
-			break;
+			next_state();
 
 		state(STATE_MATCH_PUBLIC)
 			cont = hubbub_tokeniser_handle_match_public(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_BEFORE_DOCTYPE_PUBLIC)
 			cont = hubbub_tokeniser_handle_before_doctype_public(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_DOCTYPE_PUBLIC_DQ)
 			cont = hubbub_tokeniser_handle_doctype_public_dq(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_DOCTYPE_PUBLIC_SQ)
 			cont = hubbub_tokeniser_handle_doctype_public_sq(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_AFTER_DOCTYPE_PUBLIC)
 			cont = hubbub_tokeniser_handle_after_doctype_public(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_MATCH_SYSTEM)
 			cont = hubbub_tokeniser_handle_match_system(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_BEFORE_DOCTYPE_SYSTEM)
 			cont = hubbub_tokeniser_handle_before_doctype_system(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_DOCTYPE_SYSTEM_DQ)
 			cont = hubbub_tokeniser_handle_doctype_system_dq(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_DOCTYPE_SYSTEM_SQ)
 			cont = hubbub_tokeniser_handle_doctype_system_sq(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_AFTER_DOCTYPE_SYSTEM)
 			cont = hubbub_tokeniser_handle_after_doctype_system(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_BOGUS_DOCTYPE)
 			cont = hubbub_tokeniser_handle_bogus_doctype(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_MATCH_CDATA)
 			cont = hubbub_tokeniser_handle_match_cdata(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_CDATA_BLOCK)
 			cont = hubbub_tokeniser_handle_cdata_block(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_NUMBERED_ENTITY)
 			cont = hubbub_tokeniser_handle_numbered_entity(
 					tokeniser);
-			break;
+			next_state();
 		state(STATE_NAMED_ENTITY)
 			cont = hubbub_tokeniser_handle_named_entity(
 					tokeniser);
-			break;
+			next_state();
+#ifndef HUBBUB_TOKENISER_COMPUTED_GOTO
 		}
 	}
+#else
+done:
+#undef dispatch
+#endif
+
+#undef state
+#undef state_label
+#undef next_state
+#undef next_state_if
+
+	/* A state stopped because delivering a batch failed, or paused */
+	if (tokeniser->batch.error != HUBBUB_OK) {
+		if (cont == HUBBUB_NEEDDATA || cont == HUBBUB_OK)
+			cont = tokeniser->batch.error;
+
+		tokeniser->batch.error = HUBBUB_OK;
+	}
+
+	/* Deliver what has been batched from the input so far */
+	if (tokeniser->batch.n_tokens > 0) {
+		hubbub_error err = hubbub_tokeniser_flush_batch(tokeniser);
+
+		if (cont == HUBBUB_NEEDDATA || cont == HUBBUB_OK)
+			cont = err;
+	}
 
 	return (cont == HUBBUB_NEEDDATA) ? HUBBUB_OK : cont;
 }
@@ -636,50 +1442,790 @@ hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
 
 #define START_BUF(str, cptr, length) \
 	do { \
-		parserutils_error perror; \
-		perror = parserutils_buffer_append(tokeniser->buffer, \
-				(uint8_t *) (cptr), (length)); \
-		if (perror != PARSERUTILS_OK) \
-			return hubbub_error_from_parserutils_error(perror); \
-		(str).len = (length); \
+		(str).len = 0; \
+		COLLECT_MS(str, cptr, length); \
 	} while (0)
 
 #define COLLECT(str, cptr, length) \
 	do { \
-		parserutils_error perror; \
 		assert(str.len != 0); \
-		perror = parserutils_buffer_append(tokeniser->buffer, \
-				(uint8_t *) (cptr), (length)); \
-		if (perror != PARSERUTILS_OK) \
-			return hubbub_error_from_parserutils_error(perror); \
-		(str).len += (length); \
+		COLLECT_MS(str, cptr, length); \
 	} while (0)
 
 #define COLLECT_MS(str, cptr, length) \
 	do { \
 		parserutils_error perror; \
+		size_t clen = hubbub_tokeniser_limit(tokeniser, \
+				(const uint8_t *) (cptr), (length)); \
 		perror = parserutils_buffer_append(tokeniser->buffer, \
-				(uint8_t *) (cptr), (length)); \
+				(uint8_t *) (cptr), clen); \
 		if (perror != PARSERUTILS_OK) \
 			return hubbub_error_from_parserutils_error(perror); \
-		(str).len += (length); \
+		(str).len += clen; \
+	} while (0)
+
+#define COLLECT_MS_LC(str, cptr, nbytes) \
+	do { \
+		uint8_t *lcptr; \
+		size_t lcstart = tokeniser->buffer->length; \
+		COLLECT_MS(str, cptr, nbytes); \
+		for (lcptr = tokeniser->buffer->data + lcstart; \
+				lcptr < tokeniser->buffer->data + \
+					tokeniser->buffer->length; lcptr++) { \
+			if ('A' <= *lcptr && *lcptr <= 'Z') \
+				*lcptr += 0x20; \
+		} \
+	} while (0)
+
+/*
+ * Macros for collecting the strings of the current tag, which refer to
+ * the input in place for as long as they can. (loc) is the string's
+ * hubbub_tokeniser_strloc. Input runs passed to the SPAN macros must
+ * start at the pending offset. A string's text already counts towards
+ * the limit on the token's size, so isn't limited again when migrated.
+ */
+
+#define MIGRATE_SPAN(str, loc) \
+	do { \
+		parserutils_inputstream *input = tokeniser->input; \
+		parserutils_error perror; \
+		if ((str).len == 0) { \
+			(loc).offset = tokeniser->buffer->length; \
+			(loc).in_input = false; \
+		} else if ((loc).in_input) { \
+			perror = parserutils_buffer_append(tokeniser->buffer, \
+					input->utf8->data + input->cursor + \
+					(loc).offset, (str).len); \
+			if (perror != PARSERUTILS_OK) \
+				return hubbub_error_from_parserutils_error( \
+						perror); \
+			(loc).offset = tokeniser->buffer->length - (str).len; \
+			(loc).in_input = false; \
+		} \
 	} while (0)
 
+#define COLLECT_SPAN(str, loc, cptr, length) \
+	do { \
+		if ((str).len == 0) { \
+			(loc).offset = tokeniser->context.pending; \
+			(loc).in_input = true; \
+			(str).len = hubbub_tokeniser_limit(tokeniser, \
+					(cptr), (length)); \
+		} else if ((loc).in_input && (loc).offset + (str).len == \
+				tokeniser->context.pending) { \
+			(str).len += hubbub_tokeniser_limit(tokeniser, \
+					(cptr), (length)); \
+		} else { \
+			MIGRATE_SPAN(str, loc); \
+			COLLECT_MS(str, cptr, length); \
+		} \
+	} while (0)
+
+#define COLLECT_SPAN_LC(str, loc, cptr, length) \
+	do { \
+		size_t lci; \
+		for (lci = 0; lci < (length); lci++) { \
+			if ('A' <= (cptr)[lci] && (cptr)[lci] <= 'Z') \
+				break; \
+		} \
+		if (lci == (length)) { \
+			COLLECT_SPAN(str, loc, cptr, length); \
+		} else { \
+			MIGRATE_SPAN(str, loc); \
+			COLLECT_MS_LC(str, cptr, length); \
+		} \
+	} while (0)
+
+#define COLLECT_COPY(str, loc, cptr, length) \
+	do { \
+		MIGRATE_SPAN(str, loc); \
+		COLLECT_MS(str, cptr, length); \
+	} while (0)
+
+#define ATTR_LOC(field) \
+	(tokeniser->context.attr_locs[ \
+			tokeniser->context.current_tag.n_attributes - 1].field)
+
+#define START_SPAN(str, loc, cptr, length) \
+	do { \
+		(str).len = 0; \
+		COLLECT_SPAN(str, loc, cptr, length); \
+	} while (0)
+
+#define START_COPY(str, loc, cptr, length) \
+	do { \
+		(str).len = 0; \
+		COLLECT_COPY(str, loc, cptr, length); \
+	} while (0)
+
+
+/**
+ * Determine whether the client wants tokens of a given type
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param type       Token type
+ * \return True if tokens of this type are to be emitted
+ */
+static inline bool hubbub_tokeniser_wants(const hubbub_tokeniser *tokeniser,
+		hubbub_token_type type)
+{
+	return (tokeniser->token_filter & HUBBUB_TOKEN_MASK(type)) != 0;
+}
+
+/**
+ * Limit data being added to the text of the current token
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       Data to add
+ * \param len        Length, in bytes, of data
+ * \return Length, in bytes, of the leading part of data to keep
+ *
+ * Once the token's text reaches the limit on its size, the rest is cut
+ * off, at a character boundary.
+ */
+static inline size_t hubbub_tokeniser_limit(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len)
+{
+	size_t room;
+
+	if (tokeniser->max_token_bytes == 0)
+		return len;
+
+	room = tokeniser->max_token_bytes > tokeniser->context.token_bytes
+			? tokeniser->max_token_bytes -
+				tokeniser->context.token_bytes
+			: 0;
+
+	if (len > room) {
+		size_t lead = room, clen;
+
+		/* Find the last character before the cut, which must be
+		 * dropped if it doesn't fit in full */
+		while (lead > 0 && (data[lead - 1] & 0xc0) == 0x80)
+			lead--;
+
+		if (lead > 0 && parserutils_charset_utf8_char_byte_length(
+				data + lead - 1, &clen) == PARSERUTILS_OK &&
+				lead - 1 + clen > room)
+			room = lead - 1;
+
+		len = room;
+	}
+
+	tokeniser->context.token_bytes += len;
+
+	return len;
+}
+
+/**
+ * Advance the input cursor, keeping track of its offset into the input
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param bytes      Number of bytes to advance by
+ *
+ * While there are snapshots to return to, the input advanced over is
+ * kept, as the input stream is free to discard it.
+ */
+static inline void hubbub_tokeniser_advance(hubbub_tokeniser *tokeniser,
+		size_t bytes)
+{
+	parserutils_inputstream *input = tokeniser->input;
+
+	if (tokeniser->snapshots > 0 && tokeniser->journal_lost == false &&
+			bytes > 0) {
+		if (parserutils_buffer_append(tokeniser->journal,
+				input->utf8->data + input->cursor,
+				bytes) != PARSERUTILS_OK)
+			tokeniser->journal_lost = true;
+	}
+
+	parserutils_inputstream_advance(input, bytes);
+	tokeniser->offset += bytes;
+}
+
+/**
+ * Move a string of the current tag out of the input into the buffer
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to move
+ * \param loc        Location of string
+ * \param at         Pointer to offset in buffer at which to put string,
+ *                   updated to that following it
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_release_string(
+		hubbub_tokeniser *tokeniser, const hubbub_string *str,
+		hubbub_tokeniser_strloc *loc, size_t *at)
+{
+	parserutils_inputstream *input = tokeniser->input;
+	parserutils_error perror;
+
+	if (loc->in_input == false)
+		return HUBBUB_OK;
+
+	perror = parserutils_buffer_insert(tokeniser->buffer, *at,
+			input->utf8->data + input->cursor + loc->offset,
+			str->len);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	loc->offset = *at;
+	loc->in_input = false;
+	*at += str->len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Move the strings of the current tag out of the input into the buffer
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * A string still being collected must stay at the end of the buffer to be
+ * added to, so those moved are put ahead of it. It's the tag's last.
+ */
+static hubbub_error hubbub_tokeniser_release_tag(hubbub_tokeniser *tokeniser)
+{
+	hubbub_tokeniser_context *ctx = &tokeniser->context;
+	hubbub_tag *ctag = &ctx->current_tag;
+	uint32_t last = ctag->n_attributes - 1;
+	hubbub_string *cur = NULL;
+	hubbub_tokeniser_strloc *cur_loc = NULL;
+	size_t at = tokeniser->buffer->length, start;
+	bool behind = false;
+	hubbub_error err;
+	uint32_t i;
+
+	if (tokeniser->state == STATE_TAG_NAME) {
+		cur = &ctag->name;
+		cur_loc = &ctx->name_loc;
+	} else if (tokeniser->state == STATE_ATTRIBUTE_NAME) {
+		cur = &ctag->attributes[last].name;
+		cur_loc = &ctx->attr_locs[last].name;
+	} else if (tokeniser->state == STATE_ATTRIBUTE_VALUE_DQ ||
+			tokeniser->state == STATE_ATTRIBUTE_VALUE_SQ ||
+			tokeniser->state == STATE_ATTRIBUTE_VALUE_UQ) {
+		cur = &ctag->attributes[last].value;
+		cur_loc = &ctx->attr_locs[last].value;
+	}
+
+	if (cur != NULL && cur_loc->in_input == false && cur->len > 0) {
+		at = cur_loc->offset;
+		behind = true;
+	}
+	start = at;
+
+	err = hubbub_tokeniser_release_string(tokeniser, &ctag->name,
+			&ctx->name_loc, &at);
+
+	for (i = 0; err == HUBBUB_OK && i < ctag->n_attributes; i++) {
+		err = hubbub_tokeniser_release_string(tokeniser,
+				&ctag->attributes[i].name,
+				&ctx->attr_locs[i].name, &at);
+		if (err == HUBBUB_OK)
+			err = hubbub_tokeniser_release_string(tokeniser,
+					&ctag->attributes[i].value,
+					&ctx->attr_locs[i].value, &at);
+	}
+
+	if (err != HUBBUB_OK)
+		return err;
+
+	/* Shift the string being collected past those put ahead of it */
+	if (behind)
+		cur_loc->offset += at - start;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Let go of the input consumed by the current token
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The text of the token kept in the input is moved to the buffer, and the
+ * cursor advanced to the pending offset, so that the input stream may
+ * discard what lies behind it. Only called from states whose offsets are
+ * all relative to the pending offset.
+ */
+static hubbub_error hubbub_tokeniser_release_token_input(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tokeniser_context *ctx = &tokeniser->context;
+	hubbub_string *text = &ctx->current_comment;
+	hubbub_error err;
+
+	switch (tokeniser->state) {
+	case STATE_BOGUS_COMMENT:
+	case STATE_COMMENT:
+		if (tokeniser->buffer->length == 0 && text->len > 0 &&
+				hubbub_tokeniser_wants(tokeniser,
+					HUBBUB_TOKEN_COMMENT)) {
+			parserutils_error perror = parserutils_buffer_append(
+					tokeniser->buffer,
+					tokeniser->input->utf8->data +
+						tokeniser->input->cursor,
+					text->len);
+			if (perror != PARSERUTILS_OK)
+				return hubbub_error_from_parserutils_error(
+						perror);
+		}
+		text->len = 0;
+		break;
+	case STATE_TAG_NAME:
+	case STATE_BEFORE_ATTRIBUTE_NAME:
+	case STATE_ATTRIBUTE_NAME:
+	case STATE_AFTER_ATTRIBUTE_NAME:
+	case STATE_BEFORE_ATTRIBUTE_VALUE:
+	case STATE_ATTRIBUTE_VALUE_DQ:
+	case STATE_ATTRIBUTE_VALUE_SQ:
+	case STATE_ATTRIBUTE_VALUE_UQ:
+	case STATE_AFTER_ATTRIBUTE_VALUE_Q:
+	case STATE_SELF_CLOSING_START_TAG:
+		err = hubbub_tokeniser_release_tag(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
+		break;
+	default:
+		/* A doctype's strings are always in the buffer */
+		break;
+	}
+
+	hubbub_tokeniser_advance(tokeniser, ctx->pending);
+	ctx->pending = 0;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Let go of the input consumed by the current token, once there's more of
+ * it than the token may keep
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Past the limit on the size of a token, its input is all discarded, so
+ * the input kept for a token that never ends is bounded by the limit.
+ */
+static inline hubbub_error hubbub_tokeniser_release_input(
+		hubbub_tokeniser *tokeniser)
+{
+	if (tokeniser->max_token_bytes == 0 ||
+			tokeniser->context.pending <=
+				tokeniser->max_token_bytes)
+		return HUBBUB_OK;
+
+	return hubbub_tokeniser_release_token_input(tokeniser);
+}
+
+#define RELEASE_INPUT() \
+	do { \
+		hubbub_error rerror = \
+				hubbub_tokeniser_release_input(tokeniser); \
+		if (rerror != HUBBUB_OK) \
+			return rerror; \
+	} while (0)
+
+/**
+ * Peek at the character at an offset from the input cursor
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param offset     Offset from the current input position, in bytes
+ * \param ptr        Pointer to location to receive pointer to character
+ * \param len        Pointer to location to receive length of character
+ * \return As for parserutils_inputstream_peek()
+ *
+ * Before the input stream decodes any more of the input, which may move
+ * what it has decoded already, any batched tokens referring to it are
+ * delivered. A character may only be incomplete in the last few bytes.
+ *
+ * If the batch handler fails, or pauses the tokeniser, PARSERUTILS_NEEDDATA
+ * is returned, so that the state handler stops where it may carry on from
+ * later, and hubbub_tokeniser_run() returns the handler's result.
+ */
+static inline parserutils_error hubbub_tokeniser_peek(
+		hubbub_tokeniser *tokeniser, size_t offset,
+		const uint8_t **ptr, size_t *len)
+{
+	parserutils_inputstream *input = tokeniser->input;
+
+	/* Nothing more is looked at until hubbub_tokeniser_run() returns */
+	if (tokeniser->batch.error != HUBBUB_OK)
+		return PARSERUTILS_NEEDDATA;
+
+	if (input->cursor + offset + 4 > input->utf8->length &&
+			tokeniser->batch.n_tokens > 0) {
+		hubbub_error err = hubbub_tokeniser_flush_batch(tokeniser);
+
+		if (err != HUBBUB_OK) {
+			tokeniser->batch.error = err;
+			return PARSERUTILS_NEEDDATA;
+		}
+	}
+
+	return parserutils_inputstream_peek(input, offset, ptr, len);
+}
+
+/**
+ * Peek at the run of decoded characters available at an offset
+ *
+ * Unlike parserutils_inputstream_peek(), which yields a single character,
+ * this yields all the data that the input stream holds contiguously from
+ * the given offset. The run always ends on a character boundary, so it
+ * may be scanned a byte at a time for ASCII delimiters.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param offset     Offset from the current input position, in bytes
+ * \param ptr        Pointer to location to receive start of run
+ * \param len        Pointer to location to receive length of run, in bytes
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NEEDDATA if more input is needed,
+ *         PARSERUTILS_EOF if the end of input has been reached,
+ *         appropriate error otherwise
+ */
+static inline parserutils_error hubbub_tokeniser_peek_span(
+		hubbub_tokeniser *tokeniser, size_t offset,
+		const uint8_t **ptr, size_t *len)
+{
+	parserutils_inputstream *input = tokeniser->input;
+	parserutils_error error;
+	size_t off = input->cursor + offset;
+
+	if (off < input->utf8->length) {
+		*ptr = input->utf8->data + off;
+		*len = input->utf8->length - off;
+		return PARSERUTILS_OK;
+	}
+
+	/* Nothing decoded at this offset yet: get the stream to refill
+	 * (which may move its buffer) and then report what it now holds */
+	error = hubbub_tokeniser_peek(tokeniser, offset, ptr, len);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	*len = input->utf8->length - (*ptr - input->utf8->data);
+
+	return PARSERUTILS_OK;
+}
+
+
+/**
+ * Count the bytes of a run of data that match a tag name
+ *
+ * The comparison is the same loose, case-insensitive one that has always
+ * been used for end tags in raw text: bytes match if they are equal once
+ * bit 5 is ignored.
+ *
+ * \param name  Tag name to compare against
+ * \param data  Data to compare
+ * \param len   Number of bytes to compare
+ * \return Number of leading bytes of data that match
+ */
+static inline size_t hubbub_tokeniser_match_tag_name(const uint8_t *name,
+		const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if ((name[i] & ~0x20) != (data[i] & ~0x20))
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * Find the length of the raw text at the current position
+ *
+ * In the RCDATA and CDATA content models, the only bytes that need the
+ * attention of the data state are a '<' which may open the end tag of
+ * the current element, an unescaped '&' in RCDATA, NUL and CR. The rest,
+ * including the "<!--" and "-->" which toggle the escape flag, are
+ * dealt with here a run at a time: the scan only stops at '<', '-',
+ * '>' and the above, and "</" is only reported once the last start
+ * tag's name has been seen to follow it. If character tokens have been
+ * filtered out, an '&' is no different from any other text.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return Number of bytes that may be collected as characters
+ */
+static size_t hubbub_tokeniser_scan_raw_text(hubbub_tokeniser *tokeniser)
+{
+	const hubbub_scan_set *set = &tokeniser->data_set[
+			hubbub_tokeniser_wants(tokeniser,
+					HUBBUB_TOKEN_CHARACTER) ?
+				tokeniser->content_model :
+				HUBBUB_CONTENT_MODEL_CDATA];
+	const uint8_t *name = tokeniser->context.last_start_tag_name;
+	size_t name_len = tokeniser->context.last_start_tag_len;
+	/* Pending characters precede the run in the input, which lets
+	 * the escape sequences be looked for across the run's start */
+	size_t before = tokeniser->context.pending;
+	const uint8_t *data;
+	size_t len, pos = 0;
+
+	if (hubbub_tokeniser_peek_span(tokeniser, before,
+			&data, &len) != PARSERUTILS_OK)
+		return 0;
+
+	while ((pos += hubbub_scan(set, data + pos, len - pos)) < len) {
+		size_t end;
+
+		switch (data[pos]) {
+		case '-':
+			if (tokeniser->escape_flag == false &&
+					before + pos >= 3 &&
+					memcmp(data + pos - 3, "<!--",
+						SLEN("<!--")) == 0)
+				tokeniser->escape_flag = true;
+			break;
+		case '>':
+			if (tokeniser->escape_flag == true &&
+					before + pos >= 2 &&
+					memcmp(data + pos - 2, "-->",
+						SLEN("-->")) == 0)
+				tokeniser->escape_flag = false;
+			break;
+		case '&':
+			/* Only in the RCDATA set */
+			if (tokeniser->escape_flag == false)
+				return pos;
+			break;
+		case '<':
+			if (tokeniser->escape_flag == true)
+				break;
+
+			/* Leave anything that can't be decided yet to the
+			 * tag open states */
+			end = pos + SLEN("</") + name_len;
+			if (pos + 1 == len || name_len == 0 || end >= len) {
+				if (pos + 1 == len || data[pos + 1] == '/')
+					return pos;
+				break;
+			}
+
+			if (data[pos + 1] != '/' ||
+					hubbub_tokeniser_match_tag_name(name,
+						data + pos + SLEN("</"),
+						name_len) != name_len)
+				break;
+
+			if (data[end] == '\t' || data[end] == '\n' ||
+					data[end] == '\f' || data[end] == ' ' ||
+					data[end] == '>' || data[end] == '/')
+				return pos;
+			break;
+		default:
+			/* NUL and CR */
+			return pos;
+		}
+
+		pos++;
+	}
+
+	return len;
+}
+
+
+/**
+ * Emit as much of a run of input as the current character token has room
+ * for, until the rest fits in the next
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param len        Pointer to length, in bytes, of run, which follows those
+ *                   pending, updated to the length of the rest on exit
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Character data isn't cut off at the limit on a token's size, but split
+ * into as many tokens as it takes, at character boundaries.
+ */
+static hubbub_error hubbub_tokeniser_split_chars(hubbub_tokeniser *tokeniser,
+		size_t *len)
+{
+	parserutils_inputstream *input = tokeniser->input;
+
+	while (true) {
+		const uint8_t *data = input->utf8->data + input->cursor +
+				tokeniser->context.pending;
+		size_t size = (tokeniser->buffer->length > 0) ?
+				tokeniser->buffer->length :
+				tokeniser->context.pending;
+		size_t room = (tokeniser->max_token_bytes > size) ?
+				tokeniser->max_token_bytes - size : 0;
+		hubbub_error err;
+
+		if (*len <= room)
+			break;
+
+		while (room > 0 && (data[room] & 0xc0) == 0x80)
+			room--;
+
+		if (room > 0 && tokeniser->buffer->length > 0) {
+			parserutils_error error = parserutils_buffer_append(
+					tokeniser->buffer, data, room);
+			if (error != PARSERUTILS_OK)
+				return hubbub_error_from_parserutils_error(
+						error);
+		}
+
+		tokeniser->context.pending += room;
+		*len -= room;
+
+		err = emit_current_chars(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Collect a run of input as character data
+ *
+ * Pending characters are normally left in the input and emitted from
+ * there. Once a line break or NUL has been normalised in the current run,
+ * though, the run is staged in the buffer instead, and the rest of the
+ * run must join it there.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param len        Length, in bytes, of run, which follows those pending
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_collect_chars(
+		hubbub_tokeniser *tokeniser, size_t len)
+{
+	parserutils_inputstream *input = tokeniser->input;
+
+	if (tokeniser->max_token_bytes != 0) {
+		hubbub_error err = hubbub_tokeniser_split_chars(tokeniser,
+				&len);
+		if (err != HUBBUB_OK)
+			return err;
+	}
+
+	if (tokeniser->buffer->length > 0) {
+		parserutils_error error = parserutils_buffer_append(
+				tokeniser->buffer, input->utf8->data +
+					input->cursor +
+					tokeniser->context.pending,
+				len);
+		if (error != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(error);
+	}
+
+	tokeniser->context.pending += len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Replace input with normalised data in the current run of characters
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       Data to substitute
+ * \param len        Length, in bytes, of data
+ * \param consumed   Length, in bytes, of the input it replaces
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_stage_chars(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len, size_t consumed)
+{
+	parserutils_inputstream *input = tokeniser->input;
+	parserutils_error error;
+
+	/* Start a new token if the data won't fit in the current one */
+	if (tokeniser->max_token_bytes != 0 &&
+			tokeniser->context.pending > 0 &&
+			(tokeniser->buffer->length > 0 ?
+				tokeniser->buffer->length :
+				tokeniser->context.pending) + len >
+			tokeniser->max_token_bytes) {
+		hubbub_error err = emit_current_chars(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
+	}
+
+	/* Move the run so far out of the input, if it's still there */
+	if (tokeniser->buffer->length == 0 &&
+			tokeniser->context.pending > 0) {
+		error = parserutils_buffer_append(tokeniser->buffer,
+				input->utf8->data + input->cursor,
+				tokeniser->context.pending);
+		if (error != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(error);
+	}
+
+	error = parserutils_buffer_append(tokeniser->buffer, data, len);
+	if (error != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(error);
+
+	tokeniser->context.pending += consumed;
+
+	return HUBBUB_OK;
+}
 
 /* this should always be called with an empty "chars" buffer */
 hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 {
 	parserutils_error error;
+	hubbub_error herror;
 	hubbub_token token;
 	const uint8_t *cptr;
 	size_t len;
+	bool skip = !hubbub_tokeniser_wants(tokeniser, HUBBUB_TOKEN_CHARACTER);
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
+	while ((error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len)) ==
 					PARSERUTILS_OK) {
 		const uint8_t c = *cptr;
+		size_t raw;
 
-		if (c == '&' &&
+		if ((tokeniser->content_model == HUBBUB_CONTENT_MODEL_RCDATA ||
+				tokeniser->content_model ==
+						HUBBUB_CONTENT_MODEL_CDATA) &&
+				(raw = hubbub_tokeniser_scan_raw_text(
+						tokeniser)) > 0) {
+			/* Raw text needing no special handling, which takes
+			 * care of the escape flag too */
+			herror = hubbub_tokeniser_collect_chars(tokeniser, raw);
+			if (herror != HUBBUB_OK)
+				return herror;
+		} else if (skip && (c != '<' || tokeniser->content_model ==
+				HUBBUB_CONTENT_MODEL_PLAINTEXT)) {
+			/* The characters won't be emitted, so references
+			 * needn't be decoded, nor line breaks and NULs
+			 * replaced: only a '<' matters */
+			herror = hubbub_tokeniser_collect_chars(tokeniser, len);
+			if (herror != HUBBUB_OK)
+				return herror;
+
+			/* Raw text is left to the scan above, for the sake of
+			 * the escape flag */
+			if (tokeniser->content_model ==
+						HUBBUB_CONTENT_MODEL_PCDATA ||
+					tokeniser->content_model ==
+						HUBBUB_CONTENT_MODEL_PLAINTEXT) {
+				error = hubbub_tokeniser_peek_span(tokeniser,
+						tokeniser->context.pending,
+						&cptr, &len);
+				if (error == PARSERUTILS_OK) {
+					const uint8_t *lt = NULL;
+
+					if (tokeniser->content_model ==
+						HUBBUB_CONTENT_MODEL_PCDATA)
+						lt = memchr(cptr, '<', len);
+
+					herror = hubbub_tokeniser_collect_chars(
+							tokeniser, lt != NULL ?
+							(size_t) (lt - cptr) :
+							len);
+					if (herror != HUBBUB_OK)
+						return herror;
+				}
+			}
+		} else if (c == '&' &&
 				(tokeniser->content_model == HUBBUB_CONTENT_MODEL_PCDATA ||
 				tokeniser->content_model == HUBBUB_CONTENT_MODEL_RCDATA) &&
 				tokeniser->escape_flag == false) {
@@ -688,28 +2234,6 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 			/* Don't eat the '&'; it'll be handled by entity
 			 * consumption */
 			break;
-		} else if (c == '-' &&
-				tokeniser->escape_flag == false &&
-				(tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_RCDATA ||
-				tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_CDATA) &&
-				tokeniser->context.pending >= 3) {
-			size_t ignore;
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending - 3,
-					&cptr,
-					&ignore);
-
-			assert(error == PARSERUTILS_OK);
-
-			if (strncmp((char *)cptr,
-					"<!--", SLEN("<!--")) == 0) {
-				tokeniser->escape_flag = true;
-			}
-
-			tokeniser->context.pending += len;
 		} else if (c == '<' && (tokeniser->content_model ==
 						HUBBUB_CONTENT_MODEL_PCDATA ||
 					((tokeniser->content_model ==
@@ -719,49 +2243,37 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 				tokeniser->escape_flag == false))) {
 			if (tokeniser->context.pending > 0) {
 				/* Emit any pending characters */
-				emit_current_chars(tokeniser);
+				herror = emit_current_chars(tokeniser);
+				if (herror != HUBBUB_OK)
+					return herror;
 			}
 
 			/* Buffer '<' */
 			tokeniser->context.pending = len;
+			tokeniser->context.markup_start = tokeniser->offset;
 			tokeniser->state = STATE_TAG_OPEN;
 			break;
-		} else if (c == '>' && tokeniser->escape_flag == true &&
-				(tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_RCDATA ||
-				tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_CDATA)) {
-			/* no need to check that there are enough characters,
-			 * since you can only run into this if the flag is
-			 * true in the first place, which requires four
-			 * characters. */
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending - 2,
-					&cptr,
-					&len);
-
-			assert(error == PARSERUTILS_OK);
-
-			if (strncmp((char *) cptr, "-->", SLEN("-->")) == 0) {
-				tokeniser->escape_flag = false;
-			}
-
-			tokeniser->context.pending += len;
+		} else if (c == '\0' && tokeniser->coalesce_characters) {
+			/* Replace it within the current run */
+			herror = hubbub_tokeniser_stage_chars(tokeniser,
+					u_fffd, sizeof(u_fffd), 1);
+			if (herror != HUBBUB_OK)
+				return herror;
 		} else if (c == '\0') {
 			if (tokeniser->context.pending > 0) {
 				/* Emit any pending characters */
-				emit_current_chars(tokeniser);
+				herror = emit_current_chars(tokeniser);
+				if (herror != HUBBUB_OK)
+					return herror;
 			}
 
-			/* Emit a replacement character */
-			emit_character_token(tokeniser, &u_fffd_str);
-
-			/* Advance past NUL */
-			parserutils_inputstream_advance(tokeniser->input, 1);
+			/* Emit a replacement character for the NUL */
+			herror = emit_character_token(tokeniser,
+					&u_fffd_str, 1);
+			if (herror != HUBBUB_OK)
+				return herror;
 		} else if (c == '\r') {
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(tokeniser,
 					tokeniser->context.pending + len,
 					&cptr,
 					&len);
@@ -771,21 +2283,57 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 				break;
 			}
 
+			if (tokeniser->coalesce_characters) {
+				/* Replace CR or CRLF with LF within the
+				 * current run */
+				herror = hubbub_tokeniser_stage_chars(
+						tokeniser, &lf, sizeof(lf),
+						(error == PARSERUTILS_EOF ||
+							*cptr != '\n') ?
+								1 : 1 + len);
+				if (herror != HUBBUB_OK)
+					return herror;
+
+				continue;
+			}
+
 			if (tokeniser->context.pending > 0) {
 				/* Emit any pending characters */
-				emit_current_chars(tokeniser);
+				herror = emit_current_chars(tokeniser);
+				if (herror != HUBBUB_OK)
+					return herror;
 			}
 
 			if (error == PARSERUTILS_EOF ||	*cptr != '\n') {
-				/* Emit newline */
-				emit_character_token(tokeniser, &lf_str);
+				/* Emit newline in place of the CR */
+				herror = emit_character_token(tokeniser,
+						&lf_str, 1);
+				if (herror != HUBBUB_OK)
+					return herror;
+			} else {
+				/* Advance over the CR of a CRLF */
+				hubbub_tokeniser_advance(tokeniser, 1);
 			}
-
-			/* Advance over */
-			parserutils_inputstream_advance(tokeniser->input, 1);
 		} else {
 			/* Just collect into buffer */
-			tokeniser->context.pending += len;
+			herror = hubbub_tokeniser_collect_chars(tokeniser, len);
+			if (herror != HUBBUB_OK)
+				return herror;
+
+			/* Along with the run of decoded characters following
+			 * this one that need no special handling */
+			error = hubbub_tokeniser_peek_span(tokeniser,
+					tokeniser->context.pending,
+					&cptr, &len);
+			if (error == PARSERUTILS_OK) {
+				herror = hubbub_tokeniser_collect_chars(
+						tokeniser, hubbub_scan(
+						&tokeniser->data_set[
+						tokeniser->content_model],
+						cptr, len));
+				if (herror != HUBBUB_OK)
+					return herror;
+			}
 		}
 	}
 
@@ -793,12 +2341,16 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 		(tokeniser->state != STATE_DATA || error == PARSERUTILS_EOF) &&
 			tokeniser->context.pending > 0) {
 		/* Emit any pending characters */
-		emit_current_chars(tokeniser);
+		herror = emit_current_chars(tokeniser);
+		if (herror != HUBBUB_OK)
+			return herror;
 	}
 
 	if (error == PARSERUTILS_EOF) {
 		token.type = HUBBUB_TOKEN_EOF;
-		hubbub_tokeniser_emit_token(tokeniser, &token);
+		herror = hubbub_tokeniser_emit_token(tokeniser, &token);
+		if (herror != HUBBUB_OK)
+			return herror;
 	}
 
 	if (error == PARSERUTILS_EOF) {
@@ -812,6 +2364,8 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 hubbub_error hubbub_tokeniser_handle_character_reference_data(
 		hubbub_tokeniser *tokeniser)
 {
+	hubbub_error err = HUBBUB_OK;
+
 	assert(tokeniser->context.pending == 0);
 
 	if (tokeniser->context.match_entity.complete == false) {
@@ -834,18 +2388,17 @@ hubbub_error hubbub_tokeniser_handle_character_reference_data(
 			token.data.character.ptr = utf8;
 			token.data.character.len = sizeof(utf8) - len;
 
-			hubbub_tokeniser_emit_token(tokeniser, &token);
-
 			/* +1 for ampersand */
-			parserutils_inputstream_advance(tokeniser->input,
+			tokeniser->context.pending =
 					tokeniser->context.match_entity.length
-							+ 1);
+							+ 1;
+
+			err = hubbub_tokeniser_emit_token(tokeniser, &token);
 		} else {
 			parserutils_error error;
 			const uint8_t *cptr = NULL;
 
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(tokeniser,
 					tokeniser->context.pending,
 					&cptr,
 					&len);
@@ -857,8 +2410,9 @@ hubbub_error hubbub_tokeniser_handle_character_reference_data(
 			token.data.character.ptr = cptr;
 			token.data.character.len = len;
 
-			hubbub_tokeniser_emit_token(tokeniser, &token);
-			parserutils_inputstream_advance(tokeniser->input, len);
+			tokeniser->context.pending = len;
+
+			err = hubbub_tokeniser_emit_token(tokeniser, &token);
 		}
 
 		/* Reset for next time */
@@ -867,7 +2421,7 @@ hubbub_error hubbub_tokeniser_handle_character_reference_data(
 		tokeniser->state = STATE_DATA;
 	}
 
-	return HUBBUB_OK;
+	return err;
 }
 
 /* this state always switches to another state straight away */
@@ -884,7 +2438,7 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 	assert(tokeniser->context.pending == 1);
 /*	assert(tokeniser->context.chars.ptr[0] == '<'); */
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -913,7 +2467,7 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 		tokeniser->state = STATE_DATA;
 	} else if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_PCDATA) {
 		if (c == '!') {
-			parserutils_inputstream_advance(tokeniser->input,
+			hubbub_tokeniser_advance(tokeniser,
 					SLEN("<!"));
 
 			tokeniser->context.pending = 0;
@@ -921,7 +2475,8 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 		} else if ('A' <= c && c <= 'Z') {
 			uint8_t lc = (c + 0x20);
 
-			START_BUF(ctag->name, &lc, len);
+			START_COPY(ctag->name, tokeniser->context.name_loc,
+					&lc, len);
 			ctag->n_attributes = 0;
 			tokeniser->context.current_tag_type =
 					HUBBUB_TOKEN_START_TAG;
@@ -930,7 +2485,8 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 
 			tokeniser->state = STATE_TAG_NAME;
 		} else if ('a' <= c && c <= 'z') {
-			START_BUF(ctag->name, cptr, len);
+			START_SPAN(ctag->name, tokeniser->context.name_loc,
+					cptr, len);
 			ctag->n_attributes = 0;
 			tokeniser->context.current_tag_type =
 					HUBBUB_TOKEN_START_TAG;
@@ -947,8 +2503,7 @@ hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
 			/** \todo parse error */
 
 			/* Cursor still at "<", need to advance past it */
-			parserutils_inputstream_advance(
-					tokeniser->input, SLEN("<"));
+			hubbub_tokeniser_advance(tokeniser, SLEN("<"));
 			tokeniser->context.pending = 0;
 
 			tokeniser->state = STATE_BOGUS_COMMENT;
@@ -986,24 +2541,36 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 		size_t start_tag_len =
 			tokeniser->context.last_start_tag_len;
 
-		while ((error = parserutils_inputstream_peek(tokeniser->input,
+		error = PARSERUTILS_OK;
+
+		/* Compare as much of the name as is available at once */
+		while (start_tag_len > 0 &&
+				(error = hubbub_tokeniser_peek_span(tokeniser,
 					ctx->pending +
 						ctx->close_tag_match.count,
 					&cptr,
 					&len)) == PARSERUTILS_OK) {
-			c = *cptr;
+			size_t want = start_tag_len -
+					ctx->close_tag_match.count;
+			size_t matched;
 
-			if ((start_tag_name[ctx->close_tag_match.count] & ~0x20)
-					!= (c & ~0x20)) {
-				break;
-			}
+			if (len > want)
+				len = want;
 
-			ctx->close_tag_match.count += len;
+			matched = hubbub_tokeniser_match_tag_name(
+					start_tag_name +
+						ctx->close_tag_match.count,
+					cptr, len);
+
+			ctx->close_tag_match.count += matched;
 
 			if (ctx->close_tag_match.count == start_tag_len) {
 				ctx->close_tag_match.match = true;
 				break;
 			}
+
+			if (matched < len)
+				break;
 		}
 
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
@@ -1011,8 +2578,7 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 		}
 
 		if (ctx->close_tag_match.match == true) {
-			error = parserutils_inputstream_peek(
-			 		tokeniser->input,
+			error = hubbub_tokeniser_peek(tokeniser,
 			 		ctx->pending +
 				 		ctx->close_tag_match.count,
 					&cptr,
@@ -1042,7 +2608,7 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 		 * following it */
 		tokeniser->state = STATE_DATA;
 	} else {
-		error = parserutils_inputstream_peek(tokeniser->input,
+		error = hubbub_tokeniser_peek(tokeniser,
 				tokeniser->context.pending, &cptr, &len);
 
 		if (error == PARSERUTILS_EOF) {
@@ -1059,8 +2625,8 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 
 		if ('A' <= c && c <= 'Z') {
 			uint8_t lc = (c + 0x20);
-			START_BUF(tokeniser->context.current_tag.name,
-					&lc, len);
+			START_COPY(tokeniser->context.current_tag.name,
+					tokeniser->context.name_loc, &lc, len);
 			tokeniser->context.current_tag.n_attributes = 0;
 
 			tokeniser->context.current_tag_type =
@@ -1070,8 +2636,8 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 
 			tokeniser->state = STATE_TAG_NAME;
 		} else if ('a' <= c && c <= 'z') {
-			START_BUF(tokeniser->context.current_tag.name,
-					cptr, len);
+			START_SPAN(tokeniser->context.current_tag.name,
+					tokeniser->context.name_loc, cptr, len);
 			tokeniser->context.current_tag.n_attributes = 0;
 
 			tokeniser->context.current_tag_type =
@@ -1085,7 +2651,7 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 			tokeniser->context.pending += len;
 
 			/* Now need to advance past "</>" */
-			parserutils_inputstream_advance(tokeniser->input,
+			hubbub_tokeniser_advance(tokeniser,
 					tokeniser->context.pending);
 			tokeniser->context.pending = 0;
 
@@ -1095,7 +2661,7 @@ hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
 			/** \todo parse error */
 
 			/* Cursor still at "</", need to advance past it */
-			parserutils_inputstream_advance(tokeniser->input,
+			hubbub_tokeniser_advance(tokeniser,
 					tokeniser->context.pending);
 			tokeniser->context.pending = 0;
 
@@ -1112,17 +2678,22 @@ hubbub_error hubbub_tokeniser_handle_tag_name(hubbub_tokeniser *tokeniser)
 {
 	hubbub_tag *ctag = &tokeniser->context.current_tag;
 
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	assert(tokeniser->context.pending > 0);
+	RELEASE_INPUT();
+
+	/* Nothing may be pending once released at the limit on the size of
+	 * the token */
+	assert(tokeniser->context.pending > 0 ||
+			tokeniser->max_token_bytes != 0);
 /*	assert(tokeniser->context.chars.ptr[0] == '<'); */
 	assert(ctag->name.len > 0);
 /*	assert(ctag->name.ptr); */
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1134,44 +2705,108 @@ hubbub_error hubbub_tokeniser_handle_tag_name(hubbub_tokeniser *tokeniser)
 		}
 	}
 
+	/* Collect the run of characters which don't end the name */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '\t' || c == '\n' || c == '\f' || c == ' ' ||
+				c == '\r' || c == '>' || c == '\0' ||
+				c == '/')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_SPAN_LC(ctag->name, tokeniser->context.name_loc,
+				cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_tag(tokeniser);
 	} else if (c == '\0') {
-		COLLECT(ctag->name, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '/') {
-		tokeniser->context.pending += len;
+		COLLECT_COPY(ctag->name, tokeniser->context.name_loc,
+				u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += 1;
+	} else /* c == '/' */ {
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
-	} else if ('A' <= c && c <= 'Z') {
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Begin a new attribute of the current tag
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param cptr       Pointer to first character of attribute name
+ * \param len        Length, in bytes, of character
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Attributes beyond the limit on their number are collected, in turn, in
+ * a spare slot after the last of those kept, and are discarded when the
+ * tag is emitted.
+ */
+static hubbub_error hubbub_tokeniser_begin_attribute(
+		hubbub_tokeniser *tokeniser, const uint8_t *cptr, size_t len)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_attribute *attr;
+	hubbub_tokeniser_attrloc *loc;
+	hubbub_error err;
+	uint8_t c = *cptr;
+
+	if (tokeniser->max_attributes != 0 &&
+			ctag->n_attributes > tokeniser->max_attributes)
+		ctag->n_attributes = tokeniser->max_attributes;
+
+	err = hubbub_tokeniser_reserve_attributes(tokeniser,
+			ctag->n_attributes + 1);
+	if (err != HUBBUB_OK)
+		return err;
+
+	attr = &ctag->attributes[ctag->n_attributes];
+	loc = &tokeniser->context.attr_locs[ctag->n_attributes];
+
+	if ('A' <= c && c <= 'Z') {
 		uint8_t lc = (c + 0x20);
-		COLLECT(ctag->name, &lc, len);
-		tokeniser->context.pending += len;
+		START_COPY(attr->name, loc->name, &lc, len);
+	} else if (c == '\0') {
+		START_COPY(attr->name, loc->name, u_fffd, sizeof(u_fffd));
 	} else {
-		COLLECT(ctag->name, cptr, len);
-		tokeniser->context.pending += len;
+		START_SPAN(attr->name, loc->name, cptr, len);
 	}
 
+	attr->ns = HUBBUB_NS_NULL;
+	attr->value.ptr = NULL;
+	attr->value.len = 0;
+	loc->value.offset = 0;
+	loc->value.in_input = true;
+
+	ctag->n_attributes++;
+
 	return HUBBUB_OK;
 }
 
 hubbub_error hubbub_tokeniser_handle_before_attribute_name(
 		hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1196,36 +2831,15 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_name(
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
 	} else {
-		hubbub_attribute *attr;
+		hubbub_error err;
 
 		if (c == '"' || c == '\'' || c == '=') {
 			/** \todo parse error */
 		}
 
-		attr = tokeniser->alloc(ctag->attributes,
-				(ctag->n_attributes + 1) *
-					sizeof(hubbub_attribute),
-				tokeniser->alloc_pw);
-		if (attr == NULL)
-			return HUBBUB_NOMEM;
-
-		ctag->attributes = attr;
-
-		if ('A' <= c && c <= 'Z') {
-			uint8_t lc = (c + 0x20);
-			START_BUF(attr[ctag->n_attributes].name, &lc, len);
-		} else if (c == '\0') {
-			START_BUF(attr[ctag->n_attributes].name,
-					u_fffd, sizeof(u_fffd));
-		} else {
-			START_BUF(attr[ctag->n_attributes].name, cptr, len);
-		}
-
-		attr[ctag->n_attributes].ns = HUBBUB_NS_NULL;
-		attr[ctag->n_attributes].value.ptr = NULL;
-		attr[ctag->n_attributes].value.len = 0;
-
-		ctag->n_attributes++;
+		err = hubbub_tokeniser_begin_attribute(tokeniser, cptr, len);
+		if (err != HUBBUB_OK)
+			return err;
 
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_ATTRIBUTE_NAME;
@@ -1238,14 +2852,19 @@ hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
 {
 	hubbub_tag *ctag = &tokeniser->context.current_tag;
 
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	assert(ctag->attributes[ctag->n_attributes - 1].name.len > 0);
+	RELEASE_INPUT();
+
+	/* The name may only be empty if cut off at the limit on the size
+	 * of the token */
+	assert(ctag->attributes[ctag->n_attributes - 1].name.len > 0 ||
+			tokeniser->max_token_bytes != 0);
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1257,34 +2876,42 @@ hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
 		}
 	}
 
+	/* Collect the run of characters which don't end the name */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '\t' || c == '\n' || c == '\f' || c == ' ' ||
+				c == '\r' || c == '=' || c == '>' ||
+				c == '/' || c == '\0')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_SPAN_LC(ctag->attributes[ctag->n_attributes - 1].name,
+				ATTR_LOC(name), cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_AFTER_ATTRIBUTE_NAME;
 	} else if (c == '=') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_BEFORE_ATTRIBUTE_VALUE;
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_tag(tokeniser);
 	} else if (c == '/') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
-	} else if (c == '\0') {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
-				u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if ('A' <= c && c <= 'Z') {
-		uint8_t lc = (c + 0x20);
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
-				&lc, len);
-		tokeniser->context.pending += len;
-	} else {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
-				cptr, len);
-		tokeniser->context.pending += len;
+	} else /* c == '\0' */ {
+		COLLECT_COPY(ctag->attributes[ctag->n_attributes - 1].name,
+				ATTR_LOC(name), u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += 1;
 	}
 
 	return HUBBUB_OK;
@@ -1293,14 +2920,14 @@ hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
 hubbub_error hubbub_tokeniser_handle_after_attribute_name(
 		hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1326,38 +2953,17 @@ hubbub_error hubbub_tokeniser_handle_after_attribute_name(
 		return emit_current_tag(tokeniser);
 	} else if (c == '/') {
 		tokeniser->context.pending += len;
-		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
-	} else {
-		hubbub_attribute *attr;
-
-		if (c == '"' || c == '\'') {
-			/** \todo parse error */
-		}
-
-		attr = tokeniser->alloc(ctag->attributes,
-				(ctag->n_attributes + 1) *
-					sizeof(hubbub_attribute),
-				tokeniser->alloc_pw);
-		if (attr == NULL)
-			return HUBBUB_NOMEM;
-
-		ctag->attributes = attr;
-
-		if ('A' <= c && c <= 'Z') {
-			uint8_t lc = (c + 0x20);
-			START_BUF(attr[ctag->n_attributes].name, &lc, len);
-		} else if (c == '\0') {
-			START_BUF(attr[ctag->n_attributes].name,
-					u_fffd, sizeof(u_fffd));
-		} else {
-			START_BUF(attr[ctag->n_attributes].name, cptr, len);
-		}
+		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+	} else {
+		hubbub_error err;
 
-		attr[ctag->n_attributes].ns = HUBBUB_NS_NULL;
-		attr[ctag->n_attributes].value.ptr = NULL;
-		attr[ctag->n_attributes].value.len = 0;
+		if (c == '"' || c == '\'') {
+			/** \todo parse error */
+		}
 
-		ctag->n_attributes++;
+		err = hubbub_tokeniser_begin_attribute(tokeniser, cptr, len);
+		if (err != HUBBUB_OK)
+			return err;
 
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_ATTRIBUTE_NAME;
@@ -1377,7 +2983,9 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_value(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1410,8 +3018,8 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_value(
 		tokeniser->state = STATE_DATA;
 		return emit_current_tag(tokeniser);
 	} else if (c == '\0') {
-		START_BUF(ctag->attributes[ctag->n_attributes - 1].value,
-				u_fffd, sizeof(u_fffd));
+		START_COPY(ctag->attributes[ctag->n_attributes - 1].value,
+				ATTR_LOC(value), u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
 	} else {
@@ -1419,8 +3027,8 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_value(
 			/** \todo parse error */
 		}
 
-		START_BUF(ctag->attributes[ctag->n_attributes - 1].value,
-				cptr, len);
+		START_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				ATTR_LOC(value), cptr, len);
 
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
@@ -1434,12 +3042,14 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 {
 	hubbub_tag *ctag = &tokeniser->context.current_tag;
 
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1451,10 +3061,25 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 		}
 	}
 
+	/* Collect the run of characters which need no special handling */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '"' || c == '&' || c == '\0' || c == '\r')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				ATTR_LOC(value), cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '"') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_AFTER_ATTRIBUTE_VALUE_Q;
 	} else if (c == '&') {
 		tokeniser->context.prev_state = tokeniser->state;
@@ -1462,30 +3087,25 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 		tokeniser->context.allowed_char = '"';
 		/* Don't eat the '&'; it'll be handled by entity consumption */
 	} else if (c == '\0') {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
-				u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending + len,
+		COLLECT_COPY(ctag->attributes[ctag->n_attributes - 1].value,
+				ATTR_LOC(value), u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += 1;
+	} else /* c == '\r' */ {
+		error = hubbub_tokeniser_peek(tokeniser,
+				tokeniser->context.pending + 1,
 				&cptr,
 				&len);
 
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
 			return hubbub_error_from_parserutils_error(error);
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(ctag->attributes[
+			COLLECT_COPY(ctag->attributes[
 					ctag->n_attributes - 1].value,
-					&lf, sizeof(lf));
+					ATTR_LOC(value), &lf, sizeof(lf));
 		}
 
 		/* Consume '\r' */
 		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
-				cptr, len);
-		tokeniser->context.pending += len;
 	}
 
 	return HUBBUB_OK;
@@ -1496,12 +3116,14 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 {
 	hubbub_tag *ctag = &tokeniser->context.current_tag;
 
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1513,10 +3135,25 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 		}
 	}
 
+	/* Collect the run of characters which need no special handling */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '\'' || c == '&' || c == '\0' || c == '\r')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				ATTR_LOC(value), cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '\'') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_AFTER_ATTRIBUTE_VALUE_Q;
 	} else if (c == '&') {
 		tokeniser->context.prev_state = tokeniser->state;
@@ -1524,30 +3161,25 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 		tokeniser->context.allowed_char = '\'';
 		/* Don't eat the '&'; it'll be handled by entity consumption */
 	} else if (c == '\0') {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
-				u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending + len,
+		COLLECT_COPY(ctag->attributes[ctag->n_attributes - 1].value,
+				ATTR_LOC(value), u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += 1;
+	} else /* c == '\r' */ {
+		error = hubbub_tokeniser_peek(tokeniser,
+				tokeniser->context.pending + 1,
 				&cptr,
 				&len);
 
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
 			return hubbub_error_from_parserutils_error(error);
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(ctag->attributes[
+			COLLECT_COPY(ctag->attributes[
 					ctag->n_attributes - 1].value,
-					&lf, sizeof(lf));
+					ATTR_LOC(value), &lf, sizeof(lf));
 		}
 
-		/* Consume \r */
+		/* Consume '\r' */
 		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
-				cptr, len);
-		tokeniser->context.pending += len;
 	}
 
 	return HUBBUB_OK;
@@ -1559,11 +3191,13 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_uq(
 	hubbub_tag *ctag = &tokeniser->context.current_tag;
 	uint8_t c;
 
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1578,31 +3212,47 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_uq(
 	c = *cptr;
 
 	assert(c == '&' ||
-		ctag->attributes[ctag->n_attributes - 1].value.len >= 1);
+		ctag->attributes[ctag->n_attributes - 1].value.len >= 1 ||
+		tokeniser->max_token_bytes != 0);
+
+	/* Collect the run of characters which need no special handling */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '\t' || c == '\n' || c == '\f' || c == ' ' ||
+				c == '\r' || c == '&' || c == '>' ||
+				c == '\0')
+			break;
+
+		if (c == '"' || c == '\'' || c == '=') {
+			/** \todo parse error */
+		}
+	}
+
+	if (run > 0) {
+		COLLECT_SPAN(ctag->attributes[ctag->n_attributes - 1].value,
+				ATTR_LOC(value), cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
+	c = *cptr;
 
 	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
 	} else if (c == '&') {
 		tokeniser->context.prev_state = tokeniser->state;
 		tokeniser->state = STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE;
 		/* Don't eat the '&'; it'll be handled by entity consumption */
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_tag(tokeniser);
-	} else if (c == '\0') {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].value,
-				u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else {
-		if (c == '"' || c == '\'' || c == '=') {
-			/** \todo parse error */
-		}
-
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].value,
-				cptr, len);
-		tokeniser->context.pending += len;
+	} else /* c == '\0' */ {
+		COLLECT_COPY(ctag->attributes[ctag->n_attributes - 1].value,
+				ATTR_LOC(value), u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += 1;
 	}
 
 	return HUBBUB_OK;
@@ -1628,7 +3278,8 @@ hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
 				tokeniser->context.match_entity.codepoint,
 				&utf8ptr, &len);
 
-			COLLECT_MS(attr->value, utf8, sizeof(utf8) - len);
+			COLLECT_COPY(attr->value, ATTR_LOC(value),
+					utf8, sizeof(utf8) - len);
 
 			/* +1 for the ampersand */
 			tokeniser->context.pending +=
@@ -1639,8 +3290,7 @@ hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
 			const uint8_t *cptr = NULL;
 			parserutils_error error;
 
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(tokeniser,
 					tokeniser->context.pending, 
 					&cptr,
 					&len);
@@ -1650,7 +3300,7 @@ hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
 			}
 
 			/* Insert the ampersand */
-			COLLECT_MS(attr->value, cptr, len);
+			COLLECT_SPAN(attr->value, ATTR_LOC(value), cptr, len);
 			tokeniser->context.pending += len;
 		}
 
@@ -1673,7 +3323,9 @@ hubbub_error hubbub_tokeniser_handle_after_attribute_value_q(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1715,7 +3367,9 @@ hubbub_error hubbub_tokeniser_handle_self_closing_start_tag(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1743,15 +3397,85 @@ hubbub_error hubbub_tokeniser_handle_self_closing_start_tag(
 	return HUBBUB_OK;
 }
 
+/**
+ * Append data that isn't in the input to the current comment's text
+ *
+ * Any text which was left in the input is copied to the buffer first,
+ * as the two no longer agree.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       Data to append
+ * \param len        Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_comment_append(
+		hubbub_tokeniser *tokeniser, const uint8_t *data, size_t len)
+{
+	hubbub_string *text = &tokeniser->context.current_comment;
+	parserutils_error error;
+
+	/* The text of a comment that won't be emitted isn't needed */
+	if (hubbub_tokeniser_wants(tokeniser, HUBBUB_TOKEN_COMMENT) == false)
+		return HUBBUB_OK;
+
+	if (tokeniser->buffer->length == 0 && text->len > 0) {
+		error = parserutils_buffer_append(tokeniser->buffer,
+				tokeniser->input->utf8->data +
+					tokeniser->input->cursor,
+				text->len);
+		if (error != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(error);
+	}
+
+	error = parserutils_buffer_append(tokeniser->buffer, data,
+			hubbub_tokeniser_limit(tokeniser, data, len));
+
+	return hubbub_error_from_parserutils_error(error);
+}
+
+/**
+ * Add a run of input to the current comment's text
+ *
+ * For as long as a comment's text is the same as the input from the
+ * current position, it is left there and only its length is kept. It's
+ * only copied to the buffer once they differ: when a NUL or CR has been
+ * replaced, for instance.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param offset     Offset of run from the current input position
+ * \param len        Length, in bytes, of run
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_comment_collect(
+		hubbub_tokeniser *tokeniser, size_t offset, size_t len)
+{
+	hubbub_string *text = &tokeniser->context.current_comment;
+
+	if (tokeniser->buffer->length == 0 && offset == text->len) {
+		text->len += hubbub_tokeniser_limit(tokeniser,
+				tokeniser->input->utf8->data +
+					tokeniser->input->cursor + offset,
+				len);
+		return HUBBUB_OK;
+	}
+
+	return hubbub_tokeniser_comment_append(tokeniser,
+			tokeniser->input->utf8->data +
+				tokeniser->input->cursor + offset,
+			len);
+}
+
 /* this state expects tokeniser->context.chars to be empty on first entry */
 hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
 {
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1763,22 +3487,41 @@ hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
 		}
 	}
 
+	/* Collect the run of comment text, which is everything up to the
+	 * '>' if the comment won't be emitted */
+	if (hubbub_tokeniser_wants(tokeniser, HUBBUB_TOKEN_COMMENT)) {
+		run = hubbub_scan(&tokeniser->bogus_comment_set, cptr, len);
+	} else {
+		const uint8_t *gt = memchr(cptr, '>', len);
+
+		run = (gt != NULL) ? (size_t) (gt - cptr) : len;
+	}
+
+	if (run > 0) {
+		hubbub_error herror = hubbub_tokeniser_comment_collect(
+				tokeniser, tokeniser->context.pending, run);
+		if (herror != HUBBUB_OK)
+			return herror;
+
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_comment(tokeniser);
 	} else if (c == '\0') {
-		error = parserutils_buffer_append(tokeniser->buffer,
-				u_fffd, sizeof(u_fffd));
-		if (error != PARSERUTILS_OK)
-			return hubbub_error_from_parserutils_error(error);
+		hubbub_error herror = hubbub_tokeniser_comment_append(
+				tokeniser, u_fffd, sizeof(u_fffd));
+		if (herror != HUBBUB_OK)
+			return herror;
 
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		tokeniser->context.pending += 1;
+	} else /* c == '\r' */ {
+		error = hubbub_tokeniser_peek(tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -1786,21 +3529,12 @@ hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
 			return hubbub_error_from_parserutils_error(error);
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			error = parserutils_buffer_append(tokeniser->buffer,
-					&lf, sizeof(lf));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
+			hubbub_error herror = hubbub_tokeniser_comment_append(
+					tokeniser, &lf, sizeof(lf));
+			if (herror != HUBBUB_OK)
+				return herror;
 		}
-		tokeniser->context.pending += len;
-	} else {
-		error = parserutils_buffer_append(tokeniser->buffer,
-				(uint8_t *) cptr, len);
-		if (error != PARSERUTILS_OK)
-			return hubbub_error_from_parserutils_error(error);
-
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 	}
 
 	return HUBBUB_OK;
@@ -1817,7 +3551,7 @@ hubbub_error hubbub_tokeniser_handle_markup_declaration_open(
 
 	assert(tokeniser->context.pending == 0);
 
-	error = parserutils_inputstream_peek(tokeniser->input, 0, &cptr, &len);
+	error = hubbub_tokeniser_peek(tokeniser, 0, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
@@ -1855,7 +3589,7 @@ hubbub_error hubbub_tokeniser_handle_match_comment(hubbub_tokeniser *tokeniser)
 	const uint8_t *cptr;
 	parserutils_error error;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1872,7 +3606,7 @@ hubbub_error hubbub_tokeniser_handle_match_comment(hubbub_tokeniser *tokeniser)
 	tokeniser->context.pending = tokeniser->context.current_comment.len = 0;
 
 	if (*cptr == '-') {
-		parserutils_inputstream_advance(tokeniser->input, SLEN("--"));
+		hubbub_tokeniser_advance(tokeniser, SLEN("--"));
 		tokeniser->state = STATE_COMMENT_START;
 	} else {
 		tokeniser->state = STATE_BOGUS_COMMENT;
@@ -1887,9 +3621,16 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
+	hubbub_error herror = HUBBUB_OK;
+	bool keep;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	/* Of the comment states, only this one doesn't look back at dashes
+	 * already consumed */
+	if (tokeniser->state == STATE_COMMENT)
+		RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser, 
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -1902,7 +3643,40 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 	}
 
 	c = *cptr;
+	keep = hubbub_tokeniser_wants(tokeniser, HUBBUB_TOKEN_COMMENT);
+
+	if (tokeniser->state == STATE_COMMENT && c != '-' &&
+			((c != '\0' && c != '\r') || keep == false)) {
+		size_t run;
+
+		/* Collect this character along with the run of comment
+		 * text following it, which is everything up to the next
+		 * '-' if the comment won't be emitted */
+		error = hubbub_tokeniser_peek_span(tokeniser,
+				tokeniser->context.pending, &cptr, &len);
+		assert(error == PARSERUTILS_OK);
 
+		if (keep) {
+			run = hubbub_scan(&tokeniser->comment_set, cptr, len);
+		} else {
+			const uint8_t *dash = memchr(cptr, '-', len);
+
+			run = (dash != NULL) ? (size_t) (dash - cptr) : len;
+		}
+
+		herror = hubbub_tokeniser_comment_collect(tokeniser,
+				tokeniser->context.pending, run);
+		if (herror != HUBBUB_OK)
+			return herror;
+
+		tokeniser->context.pending += run;
+
+		return HUBBUB_OK;
+	}
+
+	/* Dashes are only added to the text once it's clear they don't end
+	 * the comment, but they're still those of the input, a character
+	 * or two back */
 	if (c == '>' && (tokeniser->state == STATE_COMMENT_START_DASH ||
 			tokeniser->state == STATE_COMMENT_START ||
 			tokeniser->state == STATE_COMMENT_END)) {
@@ -1921,44 +3695,32 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 		} else if (tokeniser->state == STATE_COMMENT_END_DASH) {
 			tokeniser->state = STATE_COMMENT_END;
 		} else if (tokeniser->state == STATE_COMMENT_END) {
-			error = parserutils_buffer_append(tokeniser->buffer,
-					(uint8_t *) "-", SLEN("-"));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
+			herror = hubbub_tokeniser_comment_collect(tokeniser,
+					tokeniser->context.pending - 2, 1);
+			if (herror != HUBBUB_OK)
+				return herror;
 		}
 
 		tokeniser->context.pending += len;
 	} else {
 		if (tokeniser->state == STATE_COMMENT_START_DASH ||
 				tokeniser->state == STATE_COMMENT_END_DASH) {
-			error = parserutils_buffer_append(tokeniser->buffer,
-					(uint8_t *) "-", SLEN("-"));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
+			herror = hubbub_tokeniser_comment_collect(tokeniser,
+					tokeniser->context.pending - 1, 1);
 		} else if (tokeniser->state == STATE_COMMENT_END) {
-			error = parserutils_buffer_append(tokeniser->buffer,
-					(uint8_t *) "--", SLEN("--"));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
+			herror = hubbub_tokeniser_comment_collect(tokeniser,
+					tokeniser->context.pending - 2, 2);
 		}
 
+		if (herror != HUBBUB_OK)
+			return herror;
+
 		if (c == '\0') {
-			error = parserutils_buffer_append(tokeniser->buffer,
+			herror = hubbub_tokeniser_comment_append(tokeniser,
 					u_fffd, sizeof(u_fffd));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
 		} else if (c == '\r') {
 			size_t next_len;
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
+			error = hubbub_tokeniser_peek(tokeniser,
 					tokeniser->context.pending + len,
 					&cptr,
 					&next_len);
@@ -1967,23 +3729,17 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 				return hubbub_error_from_parserutils_error(
 						error);
 			} else if (error != PARSERUTILS_EOF && *cptr != '\n') {
-				error = parserutils_buffer_append(
-						tokeniser->buffer,
-						&lf, sizeof(lf));
-				if (error != PARSERUTILS_OK) {
-					return hubbub_error_from_parserutils_error(
-							error);
-				}
+				herror = hubbub_tokeniser_comment_append(
+						tokeniser, &lf, sizeof(lf));
 			}
 		} else {
-			error = parserutils_buffer_append(tokeniser->buffer, 
-					cptr, len);
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
+			herror = hubbub_tokeniser_comment_collect(tokeniser,
+					tokeniser->context.pending, len);
 		}
 
+		if (herror != HUBBUB_OK)
+			return herror;
+
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_COMMENT;
 	}
@@ -2004,7 +3760,7 @@ hubbub_error hubbub_tokeniser_handle_match_doctype(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.match_doctype.count, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2033,7 +3789,7 @@ hubbub_error hubbub_tokeniser_handle_match_doctype(hubbub_tokeniser *tokeniser)
 
 	if (tokeniser->context.match_doctype.count == DOCTYPE_LEN) {
 		/* Skip over the DOCTYPE bit */
-		parserutils_inputstream_advance(tokeniser->input,
+		hubbub_tokeniser_advance(tokeniser,
 				tokeniser->context.pending);
 
 		memset(&tokeniser->context.current_doctype, 0,
@@ -2042,7 +3798,12 @@ hubbub_error hubbub_tokeniser_handle_match_doctype(hubbub_tokeniser *tokeniser)
 		tokeniser->context.current_doctype.system_missing = true;
 		tokeniser->context.pending = 0;
 
-		tokeniser->state = STATE_DOCTYPE;
+		/* Every doctype state ends the doctype at the next '>', so
+		 * one that won't be emitted can just be skipped to there */
+		if (hubbub_tokeniser_wants(tokeniser, HUBBUB_TOKEN_DOCTYPE))
+			tokeniser->state = STATE_DOCTYPE;
+		else
+			tokeniser->state = STATE_BOGUS_DOCTYPE;
 	}
 
 	tokeniser->context.match_doctype.count++;
@@ -2060,7 +3821,7 @@ hubbub_error hubbub_tokeniser_handle_doctype(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2092,7 +3853,9 @@ hubbub_error hubbub_tokeniser_handle_before_doctype_name(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2137,12 +3900,14 @@ hubbub_error hubbub_tokeniser_handle_before_doctype_name(
 hubbub_error hubbub_tokeniser_handle_doctype_name(hubbub_tokeniser *tokeniser)
 {
 	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2154,25 +3919,33 @@ hubbub_error hubbub_tokeniser_handle_doctype_name(hubbub_tokeniser *tokeniser)
 		}
 	}
 
+	/* Collect the run of characters which don't end the name */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '\t' || c == '\n' || c == '\f' || c == ' ' ||
+				c == '\r' || c == '>' || c == '\0')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_MS_LC(cdoc->name, cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_AFTER_DOCTYPE_NAME;
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_doctype(tokeniser, false);
-	} else if (c == '\0') {
+	} else /* c == '\0' */ {
 		COLLECT(cdoc->name, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if ('A' <= c && c <= 'Z') {
-		uint8_t lc = c + 0x20;
-		COLLECT(cdoc->name, &lc, len);
-		tokeniser->context.pending += len;
-	} else {
-		COLLECT(cdoc->name, cptr, len);
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 	}
 
 	return HUBBUB_OK;
@@ -2186,7 +3959,9 @@ hubbub_error hubbub_tokeniser_handle_after_doctype_name(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2230,7 +4005,7 @@ hubbub_error hubbub_tokeniser_handle_match_public(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2276,7 +4051,9 @@ hubbub_error hubbub_tokeniser_handle_before_doctype_public(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2316,12 +4093,14 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_dq(
 		hubbub_tokeniser *tokeniser)
 {
 	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2333,21 +4112,34 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_dq(
 		}
 	}
 
+	/* Collect the run of characters which need no special handling */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '"' || c == '>' || c == '\0' || c == '\r')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_MS(cdoc->public_id, cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '"') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_AFTER_DOCTYPE_PUBLIC;
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_doctype(tokeniser, true);
 	} else if (c == '\0') {
 		COLLECT_MS(cdoc->public_id, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		tokeniser->context.pending += 1;
+	} else /* c == '\r' */ {
+		error = hubbub_tokeniser_peek(tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -2360,10 +4152,6 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_dq(
 
 		/* Collect '\r' */
 		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(cdoc->public_id, cptr, len);
-
-		tokeniser->context.pending += len;
 	}
 
 	return HUBBUB_OK;
@@ -2373,12 +4161,14 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_sq(
 		hubbub_tokeniser *tokeniser)
 {
 	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2390,21 +4180,34 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_sq(
 		}
 	}
 
+	/* Collect the run of characters which need no special handling */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '\'' || c == '>' || c == '\0' || c == '\r')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_MS(cdoc->public_id, cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '\'') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_AFTER_DOCTYPE_PUBLIC;
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_doctype(tokeniser, true);
 	} else if (c == '\0') {
 		COLLECT_MS(cdoc->public_id, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		tokeniser->context.pending += 1;
+	} else /* c == '\r' */ {
+		error = hubbub_tokeniser_peek(tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -2414,12 +4217,9 @@ hubbub_error hubbub_tokeniser_handle_doctype_public_sq(
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
 			COLLECT_MS(cdoc->public_id, &lf, sizeof(lf));
 		}
-	
+
 		/* Collect '\r' */
 		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(cdoc->public_id, cptr, len);
-		tokeniser->context.pending += len;
 	}
 
 	return HUBBUB_OK;
@@ -2435,7 +4235,9 @@ hubbub_error hubbub_tokeniser_handle_after_doctype_public(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2485,7 +4287,7 @@ hubbub_error hubbub_tokeniser_handle_match_system(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK){
@@ -2531,7 +4333,9 @@ hubbub_error hubbub_tokeniser_handle_before_doctype_system(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2573,12 +4377,14 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_dq(
 		hubbub_tokeniser *tokeniser)
 {
 	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2590,21 +4396,34 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_dq(
 		}
 	}
 
+	/* Collect the run of characters which need no special handling */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '"' || c == '>' || c == '\0' || c == '\r')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_MS(cdoc->system_id, cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '"') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_AFTER_DOCTYPE_SYSTEM;
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_doctype(tokeniser, true);
 	} else if (c == '\0') {
-		COLLECT_MS(cdoc->system_id, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		COLLECT_MS(cdoc->system_id, u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += 1;
+	} else /* c == '\r' */ {
+		error = hubbub_tokeniser_peek(tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -2617,9 +4436,6 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_dq(
 
 		/* Collect '\r' */
 		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(cdoc->system_id, cptr, len);
-		tokeniser->context.pending += len;
 	}
 
 	return HUBBUB_OK;
@@ -2629,12 +4445,14 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_sq(
 		hubbub_tokeniser *tokeniser)
 {
 	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
+	size_t len, run;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2646,21 +4464,34 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_sq(
 		}
 	}
 
+	/* Collect the run of characters which need no special handling */
+	for (run = 0; run < len; run++) {
+		c = cptr[run];
+
+		if (c == '\'' || c == '>' || c == '\0' || c == '\r')
+			break;
+	}
+
+	if (run > 0) {
+		COLLECT_MS(cdoc->system_id, cptr, run);
+		tokeniser->context.pending += run;
+		return HUBBUB_OK;
+	}
+
 	c = *cptr;
 
 	if (c == '\'') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_AFTER_DOCTYPE_SYSTEM;
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_doctype(tokeniser, true);
 	} else if (c == '\0') {
 		COLLECT_MS(cdoc->system_id, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		tokeniser->context.pending += 1;
+	} else /* c == '\r' */ {
+		error = hubbub_tokeniser_peek(tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -2673,9 +4504,6 @@ hubbub_error hubbub_tokeniser_handle_doctype_system_sq(
 
 		/* Collect '\r' */
 		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(cdoc->system_id, cptr, len);
-		tokeniser->context.pending += len;
 	}
 
 	return HUBBUB_OK;
@@ -2689,7 +4517,9 @@ hubbub_error hubbub_tokeniser_handle_after_doctype_system(
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2719,12 +4549,13 @@ hubbub_error hubbub_tokeniser_handle_after_doctype_system(
 
 hubbub_error hubbub_tokeniser_handle_bogus_doctype(hubbub_tokeniser *tokeniser)
 {
-	size_t len;
-	const uint8_t *cptr;
+	size_t len, run;
+	const uint8_t *cptr, *gt;
 	parserutils_error error;
-	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	RELEASE_INPUT();
+
+	error = hubbub_tokeniser_peek_span(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2736,10 +4567,14 @@ hubbub_error hubbub_tokeniser_handle_bogus_doctype(hubbub_tokeniser *tokeniser)
 		}
 	}
 
-	c = *cptr;
-	tokeniser->context.pending += len;
+	/* Skip everything up to the closing '>' */
+	gt = memchr(cptr, '>', len);
+	run = (gt != NULL) ? (size_t) (gt - cptr) : len;
 
-	if (c == '>') {
+	tokeniser->context.pending += run;
+
+	if (run < len) {
+		tokeniser->context.pending += 1;
 		tokeniser->state = STATE_DATA;
 		return emit_current_doctype(tokeniser, false);
 	}
@@ -2759,7 +4594,7 @@ hubbub_error hubbub_tokeniser_handle_match_cdata(hubbub_tokeniser *tokeniser)
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2788,7 +4623,7 @@ hubbub_error hubbub_tokeniser_handle_match_cdata(hubbub_tokeniser *tokeniser)
 	tokeniser->context.pending += len;
 
 	if (tokeniser->context.match_cdata.count == CDATA_LEN) {
-		parserutils_inputstream_advance(tokeniser->input,
+		hubbub_tokeniser_advance(tokeniser,
 				tokeniser->context.match_cdata.count + len);
 		tokeniser->context.pending = 0;
 		tokeniser->context.match_cdata.end = 0;
@@ -2809,9 +4644,10 @@ hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
+	hubbub_error herror = HUBBUB_OK;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2834,26 +4670,25 @@ hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 		tokeniser->context.pending -= 2;
 
 		/* Emit any pending characters */
-		emit_current_chars(tokeniser);
+		herror = emit_current_chars(tokeniser);
 
 		/* Now move past the "]]>" bit */
-		parserutils_inputstream_advance(tokeniser->input, SLEN("]]>"));
+		hubbub_tokeniser_advance(tokeniser, SLEN("]]>"));
 
 		tokeniser->state = STATE_DATA;
 	} else if (c == '\0') {
 		if (tokeniser->context.pending > 0) {
 			/* Emit any pending characters */
-			emit_current_chars(tokeniser);
+			herror = emit_current_chars(tokeniser);
+			if (herror != HUBBUB_OK)
+				return herror;
 		}
 
 		/* Perform NUL-byte replacement */
-		emit_character_token(tokeniser, &u_fffd_str);
-
-		parserutils_inputstream_advance(tokeniser->input, len);
+		herror = emit_character_token(tokeniser, &u_fffd_str, len);
 		tokeniser->context.match_cdata.end = 0;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(tokeniser,
 				tokeniser->context.pending + len,
 				&cptr,
 				&len);
@@ -2864,23 +4699,34 @@ hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 
 		if (tokeniser->context.pending > 0) {
 			/* Emit any pending characters */
-			emit_current_chars(tokeniser);
+			herror = emit_current_chars(tokeniser);
+			if (herror != HUBBUB_OK)
+				return herror;
 		}
 
 		if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			/* Emit newline */
-			emit_character_token(tokeniser, &lf_str);
+			/* Emit newline in place of the CR */
+			herror = emit_character_token(tokeniser, &lf_str, 1);
+		} else {
+			/* Advance over the CR of a CRLF */
+			hubbub_tokeniser_advance(tokeniser, 1);
 		}
-
-		/* Advance over \r */
-		parserutils_inputstream_advance(tokeniser->input, 1);
 		tokeniser->context.match_cdata.end = 0;
 	} else {
+		if (tokeniser->max_token_bytes != 0 &&
+				tokeniser->context.pending + len >
+					tokeniser->max_token_bytes) {
+			/* Start a new token for the rest of the section */
+			herror = emit_current_chars(tokeniser);
+			if (herror != HUBBUB_OK)
+				return herror;
+		}
+
 		tokeniser->context.pending += len;
 		tokeniser->context.match_cdata.end = 0;
 	}
 
-	return HUBBUB_OK;
+	return herror;
 }
 
 
@@ -2895,7 +4741,7 @@ hubbub_error hubbub_tokeniser_consume_character_reference(
 	uint8_t c;
 	size_t off;
 
-	error = parserutils_inputstream_peek(tokeniser->input, pos, 
+	error = hubbub_tokeniser_peek(tokeniser, pos, 
 			&cptr, &len);
 
 	/* We should always start on an ampersand */
@@ -2905,7 +4751,7 @@ hubbub_error hubbub_tokeniser_consume_character_reference(
 	off = pos + len;
 
 	/* Look at the character after the ampersand */
-	error = parserutils_inputstream_peek(tokeniser->input, off, 
+	error = hubbub_tokeniser_peek(tokeniser, off, 
 			&cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
@@ -2961,7 +4807,7 @@ hubbub_error hubbub_tokeniser_handle_numbered_entity(
 	const uint8_t *cptr;
 	parserutils_error error;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			ctx->match_entity.offset + ctx->match_entity.length,
 			&cptr, &len);
 
@@ -2979,7 +4825,7 @@ hubbub_error hubbub_tokeniser_handle_numbered_entity(
 		}
 	}
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
+	while ((error = hubbub_tokeniser_peek(tokeniser,
 			ctx->match_entity.offset + ctx->match_entity.length,
 			&cptr, &len)) == PARSERUTILS_OK) {
 		uint8_t c = *cptr;
@@ -3064,36 +4910,30 @@ hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
 	const uint8_t *cptr;
 	parserutils_error error;
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
+	/* Match over whole runs of input at a time; the search only asks
+	 * for more if the run ended before the longest match could be
+	 * determined */
+	while ((error = hubbub_tokeniser_peek_span(tokeniser,
 			ctx->match_entity.offset +
 					ctx->match_entity.poss_length,
 			&cptr, &len)) == PARSERUTILS_OK) {
+		size_t used, match;
 		uint32_t cp;
 
-		uint8_t c = *cptr;
-		hubbub_error error;
-
-		if (c > 0x7F) {
-			/* Entity names are ASCII only */
-			break;
-		}
-
-		error = hubbub_entities_search_step(c, &cp,
-				&ctx->match_entity.context);
-		if (error == HUBBUB_OK) {
+		hubbub_error found = hubbub_entities_search(cptr, len,
+				&ctx->match_entity.context, &used, &match, &cp);
+		if (match > 0) {
 			/* Had a match - store it for later */
 			ctx->match_entity.codepoint = cp;
-
 			ctx->match_entity.length =
-					ctx->match_entity.poss_length + len;
-			ctx->match_entity.poss_length =
-					ctx->match_entity.length;
-		} else if (error == HUBBUB_INVALID) {
+					ctx->match_entity.poss_length + match;
+		}
+
+		ctx->match_entity.poss_length += used;
+
+		if (found == HUBBUB_OK) {
 			/* No further matches - use last found */
 			break;
-		} else {
-			/* Need more data */
-			ctx->match_entity.poss_length += len;
 		}
 	}
 
@@ -3103,7 +4943,7 @@ hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
 
 	if (ctx->match_entity.length > 0) {
 		uint8_t c;
-		error = parserutils_inputstream_peek(tokeniser->input,
+		error = hubbub_tokeniser_peek(tokeniser,
 				ctx->match_entity.offset + 
 					ctx->match_entity.length - 1,
 				&cptr, &len);
@@ -3117,7 +4957,7 @@ hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
 		if ((tokeniser->context.match_entity.return_state ==
 				STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE) &&
 				c != ';') {
-			error = parserutils_inputstream_peek(tokeniser->input,
+			error = hubbub_tokeniser_peek(tokeniser,
 					ctx->match_entity.offset +
 						ctx->match_entity.length,
 					&cptr, &len);
@@ -3157,17 +4997,180 @@ hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
 /*** Token emitting bits ***/
 
 /**
- * Emit a character token.
+ * Ensure there is space for a number of attributes on the current tag
+ *
+ * The attribute storage is kept for subsequent tags and only ever grows,
+ * doubling in size each time, so a document's tags are soon all
+ * accommodated without further allocation.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param n          Number of attributes to make space for
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_tokeniser_reserve_attributes(hubbub_tokeniser *tokeniser,
+		uint32_t n)
+{
+	hubbub_tokeniser_context *ctx = &tokeniser->context;
+	hubbub_attribute *attrs;
+	hubbub_tokeniser_attrloc *locs;
+	uint32_t alloc;
+
+	if (n <= ctx->attrs_alloc)
+		return HUBBUB_OK;
+
+	alloc = (ctx->attrs_alloc == 0) ? ATTRIBUTES_INITIAL
+			: ctx->attrs_alloc * 2;
+	while (alloc < n)
+		alloc *= 2;
+
+	attrs = tokeniser->alloc(ctx->current_tag.attributes,
+			alloc * sizeof(hubbub_attribute), tokeniser->alloc_pw);
+	if (attrs == NULL)
+		return HUBBUB_NOMEM;
+
+	ctx->current_tag.attributes = attrs;
+	tokeniser->alloc_count++;
+
+	locs = tokeniser->alloc(ctx->attr_locs,
+			alloc * sizeof(hubbub_tokeniser_attrloc),
+			tokeniser->alloc_pw);
+	if (locs == NULL)
+		return HUBBUB_NOMEM;
+
+	ctx->attr_locs = locs;
+	tokeniser->alloc_count++;
+
+	ctx->attrs_alloc = alloc;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Compare the names of two attributes
+ *
+ * \param a  First name
+ * \param b  Second name
+ * \return <0, 0 or >0 as ::a sorts before, with or after ::b
+ */
+static inline int hubbub_tokeniser_compare_names(const hubbub_string *a,
+		const hubbub_string *b)
+{
+	int cmp = memcmp(a->ptr, b->ptr, a->len < b->len ? a->len : b->len);
+
+	if (cmp != 0)
+		return cmp;
+
+	return (a->len > b->len) - (a->len < b->len);
+}
+
+/**
+ * Discard duplicate attributes from a tag, in O(n log n) time
+ *
+ * The first of any attributes with the same name is kept, and the
+ * remainder are discarded, preserving the order of those kept. The
+ * attributes' indices are merge sorted by name, so that duplicates are
+ * adjacent, which bounds the time taken whatever the names are: unlike a
+ * hash table, there is no input which degrades it. The space for sorting
+ * is retained for subsequent tags and only ever grows.
+ *
+ * \param tokeniser     Tokeniser instance
+ * \param attrs         Array of attributes, with pointers set
+ * \param n_attributes  Pointer to number of attributes, updated on exit
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_tokeniser_sort_duplicate_attributes(
+		hubbub_tokeniser *tokeniser, hubbub_attribute *attrs,
+		uint32_t *n_attributes)
+{
+	hubbub_tokeniser_context *ctx = &tokeniser->context;
+	uint32_t size = ATTRIBUTES_SORT_MIN * 2;
+	uint32_t *from, *to, *swap;
+	uint32_t n = *n_attributes;
+	uint32_t width, i, j, k, lo, mid, hi;
+
+	/* Two runs of n indices, to merge from one into the other */
+	while (size < n * 2)
+		size *= 2;
+
+	if (size > ctx->attr_sort_size) {
+		uint32_t *space = tokeniser->alloc(ctx->attr_sort,
+				size * sizeof(uint32_t), tokeniser->alloc_pw);
+		if (space == NULL)
+			return HUBBUB_NOMEM;
+
+		ctx->attr_sort = space;
+		ctx->attr_sort_size = size;
+		tokeniser->alloc_count++;
+	}
+
+	from = ctx->attr_sort;
+	to = ctx->attr_sort + n;
+
+	for (i = 0; i < n; i++)
+		from[i] = i;
+
+	/* Bottom-up merge sort. It is stable, so the first of any run of
+	 * equal names is the one which came first in the tag. */
+	for (width = 1; width < n; width *= 2) {
+		for (lo = 0; lo < n; lo += 2 * width) {
+			mid = lo + width < n ? lo + width : n;
+			hi = mid + width < n ? mid + width : n;
+
+			for (i = lo, j = mid, k = lo; k < hi; k++) {
+				if (i < mid && (j >= hi ||
+						hubbub_tokeniser_compare_names(
+						&attrs[from[i]].name,
+						&attrs[from[j]].name) <= 0))
+					to[k] = from[i++];
+				else
+					to[k] = from[j++];
+			}
+		}
+
+		swap = from;
+		from = to;
+		to = swap;
+	}
+
+	/* Mark, by index, which attributes to discard */
+	for (k = 0; k < n; k++) {
+		to[from[k]] = (k > 0 && hubbub_tokeniser_compare_names(
+				&attrs[from[k - 1]].name,
+				&attrs[from[k]].name) == 0);
+	}
+
+	for (i = 0, j = 0; i < n; i++) {
+		if (to[i])
+			continue;
+
+		if (j != i)
+			attrs[j] = attrs[i];
+
+		j++;
+	}
+
+	*n_attributes = j;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Emit a character token in place of some of the input.
  *
  * \param tokeniser	Tokeniser instance
  * \param chars		Pointer to hubbub_string to emit
+ * \param consumed	Number of bytes of input the characters replace
  * \return	true
  */
 hubbub_error emit_character_token(hubbub_tokeniser *tokeniser,
-		const hubbub_string *chars)
+		const hubbub_string *chars, size_t consumed)
 {
 	hubbub_token token;
 
+	/* Emitting the token advances over the input it replaces */
+	assert(tokeniser->context.pending == 0);
+	tokeniser->context.pending = consumed;
+
 	token.type = HUBBUB_TOKEN_CHARACTER;
 	token.data.character = *chars;
 
@@ -3190,13 +5193,20 @@ hubbub_error emit_current_chars(hubbub_tokeniser *tokeniser)
 	/* Calling this with nothing to output is a probable bug */
 	assert(tokeniser->context.pending > 0);
 
-	error = parserutils_inputstream_peek(tokeniser->input, 0, &cptr, &len);
+	error = hubbub_tokeniser_peek(tokeniser, 0, &cptr, &len);
 	if (error != PARSERUTILS_OK)
 		return hubbub_error_from_parserutils_error(error);
 
 	token.type = HUBBUB_TOKEN_CHARACTER;
-	token.data.character.ptr = cptr;
-	token.data.character.len = tokeniser->context.pending;
+
+	if (tokeniser->buffer->length > 0) {
+		/* The run has been staged, having been normalised */
+		token.data.character.ptr = tokeniser->buffer->data;
+		token.data.character.len = tokeniser->buffer->length;
+	} else {
+		token.data.character.ptr = cptr;
+		token.data.character.len = tokeniser->context.pending;
+	}
 
 	return hubbub_tokeniser_emit_token(tokeniser, &token);
 }
@@ -3213,7 +5223,8 @@ hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser)
 	hubbub_token token;
 	uint32_t n_attributes;
 	hubbub_attribute *attrs;
-	uint8_t *ptr;
+	const hubbub_tokeniser_attrloc *locs;
+	const uint8_t *input;
 	uint32_t i, j;
 
 	/* Emit current tag */
@@ -3225,57 +5236,92 @@ hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser)
 	n_attributes = token.data.tag.n_attributes;
 	attrs = token.data.tag.attributes;
 
-	/* Set pointers correctly... */
-	ptr = tokeniser->buffer->data;
-	token.data.tag.name.ptr = tokeniser->buffer->data;
-	ptr += token.data.tag.name.len;
+	/* Drop those beyond the limit, which shared the spare slot */
+	if (tokeniser->max_attributes != 0 &&
+			n_attributes > tokeniser->max_attributes)
+		n_attributes = tokeniser->max_attributes;
+
+	/* Of a tag that won't be emitted, only the name is needed */
+	if (hubbub_tokeniser_wants(tokeniser, token.type) == false)
+		n_attributes = 0;
+
+	locs = tokeniser->context.attr_locs;
+
+	/* Set pointers correctly, into the input or the buffer... */
+	input = tokeniser->input->utf8->data + tokeniser->input->cursor;
+
+#define LOCATE(loc) \
+	(((loc).in_input ? input : tokeniser->buffer->data) + (loc).offset)
+
+	token.data.tag.name.ptr = LOCATE(tokeniser->context.name_loc);
+	token.data.tag.atom = hubbub_atom_from_name(token.data.tag.name.ptr,
+			token.data.tag.name.len);
 
 	for (i = 0; i < n_attributes; i++) {
-		attrs[i].name.ptr = ptr;
-		ptr += attrs[i].name.len;
-		attrs[i].value.ptr = ptr;
-		ptr += attrs[i].value.len;
+		attrs[i].name.ptr = LOCATE(locs[i].name);
+		attrs[i].value.ptr = LOCATE(locs[i].value);
+	}
+
+#undef LOCATE
+
+	/* Drop any attributes whose names were cut off entirely at the
+	 * limit on the size of the token */
+	if (tokeniser->max_token_bytes != 0) {
+		for (i = 0, j = 0; i < n_attributes; i++) {
+			if (attrs[i].name.len > 0)
+				attrs[j++] = attrs[i];
+		}
+
+		n_attributes = j;
 	}
 
 
 	/* Discard duplicate attributes */
-	for (i = 0; i < n_attributes; i++) {
-		for (j = 0; j < n_attributes; j++) {
-			uint32_t move;
-
-			if (j == i ||
-				attrs[i].name.len !=
-						attrs[j].name.len ||
-				strncmp((char *) attrs[i].name.ptr,
-					(char *) attrs[j].name.ptr,
-					attrs[i].name.len) != 0) {
-				/* Attributes don't match */
-				continue;
-			}
+	if (n_attributes > ATTRIBUTES_SORT_MIN) {
+		err = hubbub_tokeniser_sort_duplicate_attributes(tokeniser,
+				attrs, &n_attributes);
+		if (err != HUBBUB_OK)
+			return err;
+	} else {
+		/* Few enough to compare pairwise */
+		for (i = 0; i < n_attributes; i++) {
+			for (j = 0; j < n_attributes; j++) {
+				uint32_t move;
+
+				if (j == i ||
+					attrs[i].name.len !=
+							attrs[j].name.len ||
+					strncmp((char *) attrs[i].name.ptr,
+						(char *) attrs[j].name.ptr,
+						attrs[i].name.len) != 0) {
+					/* Attributes don't match */
+					continue;
+				}
 
-			assert(i < j);
+				assert(i < j);
 
-			/* Calculate amount to move */
-			move = (n_attributes - 1 - j) *
-					sizeof(hubbub_attribute);
+				/* Calculate amount to move */
+				move = (n_attributes - 1 - j) *
+						sizeof(hubbub_attribute);
 
-			if (move > 0) {
-				memmove(&attrs[j],&attrs[j+1], move);
-			}
+				if (move > 0) {
+					memmove(&attrs[j],&attrs[j+1], move);
+				}
 
-			/* We've deleted an item, so we need to 
-			 * reprocess this index */
-			j--;
+				/* We've deleted an item, so we need to 
+				 * reprocess this index */
+				j--;
 
-			/* And reduce the number of attributes */
-			n_attributes--;
+				/* And reduce the number of attributes */
+				n_attributes--;
+			}
 		}
 	}
 
 	token.data.tag.n_attributes = n_attributes;
 
-	err = hubbub_tokeniser_emit_token(tokeniser, &token);
-
+	/* The name may refer to the input, which emitting the token
+	 * advances past, so take a copy of it first */
 	if (token.type == HUBBUB_TOKEN_START_TAG) {
 		/* Save start tag name for R?CDATA */
 		if (token.data.tag.name.len <
@@ -3289,7 +5335,11 @@ hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser)
 			tokeniser->context.last_start_tag_name[0] = '\0';
 			tokeniser->context.last_start_tag_len = 0;
 		}
-	} else /* if (token->type == HUBBUB_TOKEN_END_TAG) */ {
+	}
+
+	err = hubbub_tokeniser_emit_token(tokeniser, &token);
+
+	if (token.type == HUBBUB_TOKEN_END_TAG) {
 		/* Reset content model after R?CDATA elements */
 		tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
 	}
@@ -3311,8 +5361,19 @@ hubbub_error emit_current_comment(hubbub_tokeniser *tokeniser)
 	hubbub_token token;
 
 	token.type = HUBBUB_TOKEN_COMMENT;
-	token.data.comment.ptr = tokeniser->buffer->data;
-	token.data.comment.len = tokeniser->buffer->length;
+
+	if (tokeniser->buffer->length > 0) {
+		token.data.comment.ptr = tokeniser->buffer->data;
+		token.data.comment.len = tokeniser->buffer->length;
+	} else {
+		/* The text is still where it was found in the input */
+		token.data.comment.ptr = tokeniser->input->utf8->data +
+				tokeniser->input->cursor;
+		token.data.comment.len =
+				tokeniser->context.current_comment.len;
+	}
+
+	tokeniser->context.current_comment.len = 0;
 
 	return hubbub_tokeniser_emit_token(tokeniser, &token);
 }
@@ -3352,6 +5413,277 @@ hubbub_error emit_current_doctype(hubbub_tokeniser *tokeniser,
 	return hubbub_tokeniser_emit_token(tokeniser, &token);
 }
 
+/**
+ * Allocate storage for the data of a batched token
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param len        Number of bytes required
+ * \return Pointer to storage, or NULL on memory exhaustion
+ *
+ * Storage is retained, for reuse, once its batch has been delivered.
+ */
+static void *hubbub_tokeniser_arena_alloc(hubbub_tokeniser *tokeniser,
+		size_t len)
+{
+	hubbub_tokeniser_arena_block *block = tokeniser->batch.current;
+	hubbub_tokeniser_arena_block *prev = NULL;
+	void *ptr;
+
+	len = (len + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	while (block != NULL && block->size - block->used < len) {
+		prev = block;
+		block = block->next;
+	}
+
+	if (block == NULL) {
+		size_t size = len > ARENA_BLOCK_SIZE ? len : ARENA_BLOCK_SIZE;
+
+		block = tokeniser->alloc(NULL,
+				sizeof(hubbub_tokeniser_arena_block) + size,
+				tokeniser->alloc_pw);
+		if (block == NULL)
+			return NULL;
+
+		block->next = NULL;
+		block->size = size;
+		block->used = 0;
+
+		if (prev != NULL)
+			prev->next = block;
+		else
+			tokeniser->batch.arena = block;
+	}
+
+	ptr = block->data + block->used;
+	block->used += len;
+
+	tokeniser->batch.current = block;
+
+	return ptr;
+}
+
+/**
+ * Determine how much storage a string of a batched token needs
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to consider
+ * \return Number of bytes required
+ *
+ * Strings in the decoded input are left there, as it's not moved until
+ * the batch has been delivered; anything else needs a copy.
+ */
+static inline size_t hubbub_tokeniser_batch_size(
+		const hubbub_tokeniser *tokeniser, const hubbub_string *str)
+{
+	uintptr_t input = (uintptr_t) tokeniser->input->utf8->data;
+	uintptr_t ptr = (uintptr_t) str->ptr;
+
+	if (ptr >= input && ptr - input < tokeniser->input->utf8->length)
+		return 0;
+
+	return str->len;
+}
+
+/**
+ * Copy a string of a batched token into the storage for the token's data,
+ * if it needs it
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to copy, updated to refer to the copy
+ * \param data       Pointer to location of next free byte of storage,
+ *                   updated
+ */
+static inline void hubbub_tokeniser_batch_string(
+		const hubbub_tokeniser *tokeniser, hubbub_string *str,
+		uint8_t **data)
+{
+	size_t len = hubbub_tokeniser_batch_size(tokeniser, str);
+
+	if (len > 0) {
+		memcpy(*data, str->ptr, len);
+		str->ptr = *data;
+		*data += len;
+	}
+}
+
+/**
+ * Add a token to the current batch, delivering the batch if need be
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param token      Token to add
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Any of the token's data that is not in the input, including its array
+ * of attributes, will have been reused by the time the batch is
+ * delivered, so it is copied into a single allocation which lasts until
+ * then.
+ */
+hubbub_error hubbub_tokeniser_batch_token(hubbub_tokeniser *tokeniser,
+		const hubbub_token *token)
+{
+	hubbub_token *copy = &tokeniser->batch.tokens[
+			tokeniser->batch.n_tokens];
+	hubbub_attribute *attrs = NULL;
+	size_t attrs_size = 0, size = 0;
+	uint8_t *data;
+	uint32_t i;
+
+	*copy = *token;
+
+	/* Work out how much storage the token's data needs */
+	switch (copy->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		size = hubbub_tokeniser_batch_size(tokeniser,
+				&copy->data.doctype.name);
+		if (copy->data.doctype.public_missing == false)
+			size += hubbub_tokeniser_batch_size(tokeniser,
+					&copy->data.doctype.public_id);
+		if (copy->data.doctype.system_missing == false)
+			size += hubbub_tokeniser_batch_size(tokeniser,
+					&copy->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		/* The attributes go first, so they're aligned */
+		attrs_size = copy->data.tag.n_attributes *
+				sizeof(hubbub_attribute);
+		size = attrs_size + hubbub_tokeniser_batch_size(tokeniser,
+				&copy->data.tag.name);
+		for (i = 0; i < copy->data.tag.n_attributes; i++) {
+			const hubbub_attribute *attr =
+					&token->data.tag.attributes[i];
+
+			size += hubbub_tokeniser_batch_size(tokeniser,
+					&attr->name) +
+				hubbub_tokeniser_batch_size(tokeniser,
+					&attr->value);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		size = hubbub_tokeniser_batch_size(tokeniser,
+				&copy->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		size = hubbub_tokeniser_batch_size(tokeniser,
+				&copy->data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	if (size > 0) {
+		data = hubbub_tokeniser_arena_alloc(tokeniser, size);
+		if (data == NULL)
+			return HUBBUB_NOMEM;
+
+		if (attrs_size > 0) {
+			attrs = (hubbub_attribute *) (void *) data;
+			memcpy(attrs, token->data.tag.attributes, attrs_size);
+			copy->data.tag.attributes = attrs;
+			data += attrs_size;
+		}
+
+		switch (copy->type) {
+		case HUBBUB_TOKEN_DOCTYPE:
+			hubbub_tokeniser_batch_string(tokeniser,
+					&copy->data.doctype.name, &data);
+			if (copy->data.doctype.public_missing == false)
+				hubbub_tokeniser_batch_string(tokeniser,
+					&copy->data.doctype.public_id, &data);
+			if (copy->data.doctype.system_missing == false)
+				hubbub_tokeniser_batch_string(tokeniser,
+					&copy->data.doctype.system_id, &data);
+			break;
+		case HUBBUB_TOKEN_START_TAG:
+		case HUBBUB_TOKEN_END_TAG:
+			hubbub_tokeniser_batch_string(tokeniser,
+					&copy->data.tag.name, &data);
+			for (i = 0; i < copy->data.tag.n_attributes; i++) {
+				hubbub_tokeniser_batch_string(tokeniser,
+						&attrs[i].name, &data);
+				hubbub_tokeniser_batch_string(tokeniser,
+						&attrs[i].value, &data);
+			}
+			break;
+		case HUBBUB_TOKEN_COMMENT:
+			hubbub_tokeniser_batch_string(tokeniser,
+					&copy->data.comment, &data);
+			break;
+		case HUBBUB_TOKEN_CHARACTER:
+			hubbub_tokeniser_batch_string(tokeniser,
+					&copy->data.character, &data);
+			break;
+		case HUBBUB_TOKEN_EOF:
+			break;
+		}
+	}
+
+	tokeniser->batch.n_tokens++;
+
+	if (tokeniser->batch.n_tokens == tokeniser->batch.size)
+		return hubbub_tokeniser_flush_batch(tokeniser);
+
+	/* The handler may want to change the content model, or whether
+	 * CDATA sections are processed, on seeing one of these, which it
+	 * must do before the tokeniser carries on */
+	if (copy->type == HUBBUB_TOKEN_START_TAG) {
+		switch (copy->data.tag.atom) {
+		case HUBBUB_ATOM_IFRAME:
+		case HUBBUB_ATOM_MATH:
+		case HUBBUB_ATOM_NOEMBED:
+		case HUBBUB_ATOM_NOFRAMES:
+		case HUBBUB_ATOM_NOSCRIPT:
+		case HUBBUB_ATOM_PLAINTEXT:
+		case HUBBUB_ATOM_SCRIPT:
+		case HUBBUB_ATOM_STYLE:
+		case HUBBUB_ATOM_SVG:
+		case HUBBUB_ATOM_TEXTAREA:
+		case HUBBUB_ATOM_TITLE:
+		case HUBBUB_ATOM_XMP:
+			return hubbub_tokeniser_flush_batch(tokeniser);
+		default:
+			break;
+		}
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Deliver the current batch of tokens, if there are any
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_flush_batch(hubbub_tokeniser *tokeniser)
+{
+	hubbub_tokeniser_arena_block *block;
+	uint32_t n_tokens = tokeniser->batch.n_tokens;
+	hubbub_error err;
+
+	if (n_tokens == 0)
+		return HUBBUB_OK;
+
+	/* Empty the batch first, in case the handler reconfigures us */
+	tokeniser->batch.n_tokens = 0;
+
+	err = tokeniser->batch.handler(tokeniser->batch.tokens, n_tokens,
+			tokeniser->batch.pw);
+
+	/* The batch's data is finished with, so its storage can be reused */
+	for (block = tokeniser->batch.arena; block != NULL;
+			block = block->next)
+		block->used = 0;
+
+	tokeniser->batch.current = tokeniser->batch.arena;
+
+	if (err == HUBBUB_PAUSED)
+		tokeniser->paused = true;
+
+	return err;
+}
+
 /**
  * Emit a token, performing sanity checks if necessary
  *
@@ -3361,7 +5693,7 @@ hubbub_error emit_current_doctype(hubbub_tokeniser *tokeniser,
 hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 		hubbub_token *token)
 {
-	hubbub_error err = HUBBUB_OK;
+	hubbub_error err = HUBBUB_OK, ierr;
 
 	assert(tokeniser != NULL);
 	assert(token != NULL);
@@ -3409,8 +5741,22 @@ hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 	}
 #endif
 
-	/* Emit the token */
-	if (tokeniser->token_handler) {
+	/* Locate the token in the input. Markup may have been advanced over
+	 * in part already, but characters are always at the cursor */
+	if (token->type == HUBBUB_TOKEN_CHARACTER ||
+			token->type == HUBBUB_TOKEN_EOF) {
+		token->start = tokeniser->offset;
+	} else {
+		token->start = tokeniser->context.markup_start;
+	}
+	token->end = tokeniser->offset + tokeniser->context.pending;
+
+	/* Emit the token, unless the client has filtered it out */
+	if (hubbub_tokeniser_wants(tokeniser, token->type) == false) {
+		/* The token is passed over, as if it had been handled */
+	} else if (tokeniser->batch.handler != NULL) {
+		err = hubbub_tokeniser_batch_token(tokeniser, token);
+	} else if (tokeniser->token_handler) {
 		err = tokeniser->token_handler(token, tokeniser->token_pw);
 	}
 
@@ -3419,21 +5765,19 @@ hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 		parserutils_buffer_discard(tokeniser->buffer, 0,
 				tokeniser->buffer->length);
 	}
+	tokeniser->context.token_bytes = 0;
 
 	/* Advance the pointer */
 	if (tokeniser->context.pending) {
-		parserutils_inputstream_advance(tokeniser->input,
+		hubbub_tokeniser_advance(tokeniser,
 				tokeniser->context.pending);
 		tokeniser->context.pending = 0;
 	}
 
-	if (tokeniser->insert_buf->length > 0) {
-		parserutils_inputstream_insert(tokeniser->input,
-				tokeniser->insert_buf->data,
-				tokeniser->insert_buf->length);
-		parserutils_buffer_discard(tokeniser->insert_buf, 0,
-				tokeniser->insert_buf->length);
-	}
+	/* Delivering the batch before inserting may fail, or pause */
+	ierr = hubbub_tokeniser_insert_pending(tokeniser);
+	if (err == HUBBUB_OK)
+		err = ierr;
 
 	/* Ensure callback can pause the tokenise */
 	if (err == HUBBUB_PAUSED) {
@@ -3442,3 +5786,39 @@ hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 
 	return err;
 }
+
+/**
+ * Insert any data the client has inserted into the input stream
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success,
+ *         the batch handler's result if it fails or pauses the tokeniser
+ *
+ * The data is inserted even if the batch handler fails, as the batch has
+ * been dealt with either way.
+ */
+hubbub_error hubbub_tokeniser_insert_pending(hubbub_tokeniser *tokeniser)
+{
+	hubbub_error err = HUBBUB_OK;
+
+	if (tokeniser->insert_buf->length == 0)
+		return HUBBUB_OK;
+
+	/* Inserting moves the input, so batched tokens must be
+	 * delivered first */
+	if (tokeniser->batch.n_tokens > 0)
+		err = hubbub_tokeniser_flush_batch(tokeniser);
+
+	/* Borrowed input can't be modified; if it can't be copied either,
+	 * the data stays pending until later */
+	if (hubbub_tokeniser_own_input(tokeniser) != HUBBUB_OK)
+		return err;
+
+	parserutils_inputstream_insert(tokeniser->input,
+			tokeniser->insert_buf->data,
+			tokeniser->insert_buf->length);
+	parserutils_buffer_discard(tokeniser->insert_buf, 0,
+			tokeniser->insert_buf->length);
+
+	return err;
+}
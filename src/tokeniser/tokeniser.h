@@ -19,6 +19,8 @@
 
 typedef struct hubbub_tokeniser hubbub_tokeniser;
 
+typedef struct hubbub_tokeniser_snapshot hubbub_tokeniser_snapshot;
+
 /**
  * Hubbub tokeniser option types
  */
@@ -27,7 +29,11 @@ typedef enum hubbub_tokeniser_opttype {
 	HUBBUB_TOKENISER_ERROR_HANDLER,
 	HUBBUB_TOKENISER_CONTENT_MODEL,
 	HUBBUB_TOKENISER_PROCESS_CDATA,
-	HUBBUB_TOKENISER_PAUSE
+	HUBBUB_TOKENISER_PAUSE,
+	HUBBUB_TOKENISER_COALESCE_CHARACTERS,
+	HUBBUB_TOKENISER_TOKEN_BATCH,
+	HUBBUB_TOKENISER_TOKEN_FILTER,
+	HUBBUB_TOKENISER_LIMITS
 } hubbub_tokeniser_opttype;
 
 /**
@@ -51,6 +57,29 @@ typedef union hubbub_tokeniser_optparams {
 	bool process_cdata;		/**< Whether to process CDATA sections*/
 
 	bool pause_parse;		/**< Pause parsing */
+
+	bool coalesce_characters;	/**< Whether to emit runs of text
+					 * with line breaks and NULs in as
+					 * single character tokens */
+
+	struct {
+		hubbub_token_batch_handler handler;
+		hubbub_token *tokens;
+		uint32_t size;
+		void *pw;
+	} token_batch;			/**< Batched token handling callback,
+					 * with array of ::size tokens to
+					 * fill for it */
+
+	uint32_t token_filter;		/**< Mask of the token types to
+					 * emit, from HUBBUB_TOKEN_MASK() */
+
+	struct {
+		size_t max_token_bytes;
+		uint32_t max_attributes;
+	} limits;			/**< Most bytes of text and
+					 * attributes in a token, or 0 for
+					 * no limit */
 } hubbub_tokeniser_optparams;
 
 /* Create a hubbub tokeniser */
@@ -60,6 +89,10 @@ hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
 /* Destroy a hubbub tokeniser */
 hubbub_error hubbub_tokeniser_destroy(hubbub_tokeniser *tokeniser);
 
+/* Return a hubbub tokeniser to its initial state */
+hubbub_error hubbub_tokeniser_reset(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input);
+
 /* Configure a hubbub tokeniser */
 hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 		hubbub_tokeniser_opttype type,
@@ -69,6 +102,25 @@ hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 hubbub_error hubbub_tokeniser_insert_chunk(hubbub_tokeniser *tokeniser,
 		const uint8_t *data, size_t len);
 
+/* Have the tokeniser read input in place, rather than from a copy */
+hubbub_error hubbub_tokeniser_borrow_input(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len);
+/* Have the tokeniser read input from a copy of its own */
+hubbub_error hubbub_tokeniser_own_input(hubbub_tokeniser *tokeniser);
+
+/* Take a snapshot of a tokeniser's state */
+hubbub_error hubbub_tokeniser_snapshot_create(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_snapshot **snapshot);
+/* Return a tokeniser to the state in a snapshot */
+hubbub_error hubbub_tokeniser_snapshot_restore(hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_snapshot *snapshot);
+/* Destroy a snapshot of a tokeniser */
+hubbub_error hubbub_tokeniser_snapshot_destroy(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_snapshot *snapshot);
+
+/* Retrieve the number of allocations a tokeniser has made for tag storage */
+size_t hubbub_tokeniser_get_alloc_count(const hubbub_tokeniser *tokeniser);
+
 /* Process remaining data in the input stream */
 hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser);
 
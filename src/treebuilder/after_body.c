@@ -72,8 +72,8 @@ hubbub_error handle_after_body(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -87,8 +87,8 @@ hubbub_error handle_after_body(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == HTML) {
 			/** \todo fragment case */
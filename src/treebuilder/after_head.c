@@ -42,8 +42,8 @@ hubbub_error handle_after_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -91,8 +91,8 @@ hubbub_error handle_after_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == HTML || type == BODY || type == BR) {
 			err = HUBBUB_REPROCESS;
@@ -115,6 +115,7 @@ hubbub_error handle_after_head(hubbub_treebuilder *treebuilder,
 			tag.ns = HUBBUB_NS_HTML;
 			tag.name.ptr = (const uint8_t *) "body";
 			tag.name.len = SLEN("body");
+			tag.atom = HUBBUB_ATOM_BODY;
 
 			tag.n_attributes = 0;
 			tag.attributes = NULL;
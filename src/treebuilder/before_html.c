@@ -41,8 +41,8 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == HTML) {
 			handled = true;
@@ -74,6 +74,7 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 			tag.ns = HUBBUB_NS_HTML;
 			tag.name.ptr = (const uint8_t *) "html";
 			tag.name.len = SLEN("html");
+			tag.atom = HUBBUB_ATOM_HTML;
 
 			tag.n_attributes = 0;
 			tag.attributes = NULL;
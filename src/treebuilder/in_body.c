@@ -16,12 +16,10 @@
 #undef DEBUG_IN_BODY
 
 /**
- * Bookmark for formatting list. Used in adoption agency
+ * Bookmark for formatting list, used in adoption agency: the index of the
+ * entry before which to insert, counting the formatting element's entry
  */
-typedef struct bookmark {
-	formatting_list_entry *prev;	/**< Previous entry */
-	formatting_list_entry *next;	/**< Next entry */
-} bookmark;
+typedef uint32_t bookmark;
 
 static hubbub_error process_character(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token);
@@ -248,8 +246,8 @@ hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
 	hubbub_error err = HUBBUB_OK;
-	element_type type = element_type_from_name(treebuilder,
-			&token->data.tag.name);
+	element_type type = element_type_from_atom(treebuilder,
+			token->data.tag.atom);
 
 	if (type == HTML) {
 		err = process_html_in_body(treebuilder, token);
@@ -417,8 +415,8 @@ hubbub_error process_end_tag(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
 	hubbub_error err = HUBBUB_OK;
-	element_type type = element_type_from_name(treebuilder,
-			&token->data.tag.name);
+	element_type type = element_type_from_atom(treebuilder,
+			token->data.tag.atom);
 
 	if (type == BODY) {
 		err = process_0body_in_body(treebuilder);
@@ -778,13 +776,13 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 		entry2 = aa_find_formatting_element(treebuilder, A);
 
 		/* Remove from formatting list, if it's still there */
-		if (entry2 == entry && entry2->details.node == node) {
+		if (entry2 != NULL && entry2->details.node == node) {
 			hubbub_ns ons;
 			element_type otype;
 			void *onode;
 			uint32_t oindex;
 
-			err = formatting_list_remove(treebuilder, entry,
+			err = formatting_list_remove(treebuilder, entry2,
 					&ons, &otype, &onode, &oindex);
 			assert(err == HUBBUB_OK);
 
@@ -1127,6 +1125,7 @@ hubbub_error process_image_in_body(hubbub_treebuilder *treebuilder,
 	tag.ns = HUBBUB_NS_HTML;
 	tag.name.ptr = (const uint8_t *) "img";
 	tag.name.len = SLEN("img");
+	tag.atom = HUBBUB_ATOM_IMG;
 
 	tag.n_attributes = token->data.tag.n_attributes;
 	tag.attributes = token->data.tag.attributes;
@@ -1203,6 +1202,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <form> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "form";
 	dummy.data.tag.name.len = SLEN("form");
+	dummy.data.tag.atom = HUBBUB_ATOM_FORM;
 
 	dummy.data.tag.n_attributes = action != NULL ? 1 : 0;
 	dummy.data.tag.attributes = action;
@@ -1216,6 +1216,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <hr> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "hr";
 	dummy.data.tag.name.len = SLEN("hr");
+	dummy.data.tag.atom = HUBBUB_ATOM_HR;
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1228,6 +1229,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <p> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "p";
 	dummy.data.tag.name.len = SLEN("p");
+	dummy.data.tag.atom = HUBBUB_ATOM_P;
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1240,6 +1242,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <label> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "label";
 	dummy.data.tag.name.len = SLEN("label");
+	dummy.data.tag.atom = HUBBUB_ATOM_LABEL;
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1272,6 +1275,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	dummy.data.tag.ns = HUBBUB_NS_HTML;
 	dummy.data.tag.name.ptr = (const uint8_t *) "input";
 	dummy.data.tag.name.len = SLEN("input");
+	dummy.data.tag.atom = HUBBUB_ATOM_INPUT;
 
 	dummy.data.tag.n_attributes = n_attrs;
 	dummy.data.tag.attributes = attrs;
@@ -1305,6 +1309,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <hr> was seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "hr";
 	dummy.data.tag.name.len = SLEN("hr");
+	dummy.data.tag.atom = HUBBUB_ATOM_HR;
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1547,13 +1552,15 @@ hubbub_error process_0p_in_body(hubbub_treebuilder *treebuilder)
 		popped++;
 	}
 
-	if (popped == 0) {
+	/* The implied p element is left out if there's no room for it */
+	if (popped == 0 && element_stack_has_room(treebuilder, 1)) {
 		hubbub_token dummy;
 
 		dummy.type = HUBBUB_TOKEN_START_TAG;
 		dummy.data.tag.ns = HUBBUB_NS_HTML;
 		dummy.data.tag.name.ptr = (const uint8_t *) "p";
 		dummy.data.tag.name.len = SLEN("p");
+		dummy.data.tag.atom = HUBBUB_ATOM_P;
 		dummy.data.tag.n_attributes = 0;
 		dummy.data.tag.attributes = NULL;
 
@@ -1712,8 +1719,7 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		common_ancestor = formatting_element - 1;
 
 		/* 5 */
-		bookmark.prev = entry->prev;
-		bookmark.next = entry->next;
+		bookmark = entry - treebuilder->context.formatting_list;
 
 		/* 6 */
 		err = aa_find_bookmark_location_reparenting_misnested(
@@ -1747,20 +1753,18 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		 * previously using, then have it take the place of the other
 		 * one in the formatting list and stack. */
 		if (reparented != stack[last_node].node) {
-			struct formatting_list_entry *node_entry;
-			for (node_entry = treebuilder->context.formatting_list_end;
-					node_entry != NULL; 
-					node_entry = node_entry->prev) {
-				if (node_entry->stack_index == last_node) {
-					treebuilder->tree_handler->ref_node(
-						treebuilder->tree_handler->ctx,
-						reparented);
-					node_entry->details.node = reparented;
-					treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						stack[last_node].node);
-					break;
-				}
+			formatting_list_entry *node_entry =
+					formatting_list_find(treebuilder,
+							last_node);
+
+			if (node_entry != NULL) {
+				treebuilder->tree_handler->ref_node(
+					treebuilder->tree_handler->ctx,
+					reparented);
+				node_entry->details.node = reparented;
+				treebuilder->tree_handler->unref_node(
+					treebuilder->tree_handler->ctx,
+					stack[last_node].node);
 			}
 			/* Already have enough references, so don't need to 
 			 * explicitly reference it here. */
@@ -1825,7 +1829,18 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		stack[furthest_block + 1].type = entry->details.type;
 		stack[furthest_block + 1].node = clone_appended;
 
+		treebuilder->context.element_counts[entry->details.type]++;
+
+		/* Furthest block has moved down a slot, so elements above
+		 * it whose scope it bounds must be told */
+		element_stack_update_scope(treebuilder, furthest_block + 1,
+				treebuilder->context.current_node);
+
 		/* 11 */
+		if (bookmark > (uint32_t) (entry -
+				treebuilder->context.formatting_list))
+			bookmark--;
+
 		err = formatting_list_remove(treebuilder, entry,
 				&ons, &otype, &onode, &oindex);
 		assert(err == HUBBUB_OK);
@@ -1833,8 +1848,7 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		treebuilder->tree_handler->unref_node(
 				treebuilder->tree_handler->ctx,	onode);
 
-		err = formatting_list_insert(treebuilder,
-				bookmark.prev, bookmark.next,
+		err = formatting_list_insert(treebuilder, bookmark,
 				ons, otype, clone_appended, furthest_block + 1);
 		if (err != HUBBUB_OK) {
 			treebuilder->tree_handler->unref_node(
@@ -1843,6 +1857,8 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 			return err;
 		}
 
+		assert(element_stack_check_scope(treebuilder));
+
 		/* 13 */
 	}
 }
@@ -1908,22 +1924,33 @@ hubbub_error aa_find_and_validate_formatting_element(
 formatting_list_entry *aa_find_formatting_element(
 		hubbub_treebuilder *treebuilder, element_type type)
 {
-	formatting_list_entry *entry;
+	formatting_list_entry *list = treebuilder->context.formatting_list;
+	uint32_t i = treebuilder->context.formatting_list_len;
+
+	/* Formatting elements are chained by type, so the last one of this
+	 * type is found directly; it is out of scope if before a marker. */
+	if (is_formatting_element(type)) {
+		i = treebuilder->context.formatting_last[type - A];
+
+		if (i == 0 || i < treebuilder->context.formatting_last[
+				FORMATTING_MARKERS])
+			return NULL;
+
+		return &list[i - 1];
+	}
 
-	for (entry = treebuilder->context.formatting_list_end;
-			entry != NULL; entry = entry->prev) {
+	while (i > 0) {
+		i--;
 
 		/* Assumption: HTML and TABLE elements are not in the list */
-		if (is_scoping_element(entry->details.type) ||
-				entry->details.type == type)
+		if (is_scoping_element(list[i].details.type))
 			break;
-	}
 
-	/* Check if we stopped on a marker, rather than a formatting element */
-	if (entry != NULL && is_scoping_element(entry->details.type))
-		entry = NULL;
+		if (list[i].details.type == type)
+			return &list[i];
+	}
 
-	return entry;
+	return NULL;
 }
 
 /**
@@ -2032,12 +2059,7 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 		node--;
 
 		/* ii */
-		for (node_entry = treebuilder->context.formatting_list_end;
-				node_entry != NULL;
-				node_entry = node_entry->prev) {
-			if (node_entry->stack_index == node)
-				break;
-		}
+		node_entry = formatting_list_find(treebuilder, node);
 
 		/* Node is not in list of active formatting elements */
 		if (node_entry == NULL) {
@@ -2063,8 +2085,8 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 
 		/* iv */
 		if (last == fb) {
-			bookmark->prev = node_entry;
-			bookmark->next = node_entry->next;
+			*bookmark = (node_entry -
+					treebuilder->context.formatting_list) + 1;
 		}
 
 		/* v */
@@ -2086,20 +2108,16 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 		 * previously using, then have it take the place of the other
 		 * one in the formatting list and stack. */
 		if (reparented != stack[last].node) {
-			for (node_entry = 
-				treebuilder->context.formatting_list_end;
-					node_entry != NULL; 
-					node_entry = node_entry->prev) {
-				if (node_entry->stack_index == last) {
-					treebuilder->tree_handler->ref_node(
-						treebuilder->tree_handler->ctx,
-						reparented);
-					node_entry->details.node = reparented;
-					treebuilder->tree_handler->unref_node(
-						treebuilder->tree_handler->ctx,
-						stack[last].node);
-					break;
-				}
+			node_entry = formatting_list_find(treebuilder, last);
+
+			if (node_entry != NULL) {
+				treebuilder->tree_handler->ref_node(
+					treebuilder->tree_handler->ctx,
+					reparented);
+				node_entry->details.node = reparented;
+				treebuilder->tree_handler->unref_node(
+					treebuilder->tree_handler->ctx,
+					stack[last].node);
 			}
 			/* Already have enough references, so don't need to 
 			 * explicitly reference it here. */
@@ -2147,13 +2165,11 @@ hubbub_error aa_remove_element_stack_item(hubbub_treebuilder *treebuilder,
 				(is_scoping_element(stack[n].type) &&
 				stack[n].type != HTML &&
 				stack[n].type != TABLE)) {
-			formatting_list_entry *e;
+			formatting_list_entry *e =
+					formatting_list_find(treebuilder, n);
 
-			for (e = treebuilder->context.formatting_list_end;
-					e != NULL; e = e->prev) {
-				if (e->stack_index == n)
-					e->stack_index--;
-			}
+			if (e != NULL)
+				e->stack_index--;
 		}
 	}
 
@@ -2161,10 +2177,14 @@ hubbub_error aa_remove_element_stack_item(hubbub_treebuilder *treebuilder,
 	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
 					stack[index].node);
 
+	treebuilder->context.element_counts[stack[index].type]--;
+
 	/* Now, shuffle the stack up one, removing node in the process */
 	memmove(&stack[index], &stack[index + 1],
 			(limit - index) * sizeof(element_context));
 
+	element_stack_update_scope(treebuilder, index, limit - 1);
+
 	return HUBBUB_OK;
 }
 
@@ -2349,6 +2369,7 @@ hubbub_error process_0br_in_body(hubbub_treebuilder *treebuilder)
 	tag.ns = HUBBUB_NS_HTML;
 	tag.name.ptr = (const uint8_t *) "br";
 	tag.name.len = SLEN("br");
+	tag.atom = HUBBUB_ATOM_BR;
 
 	tag.n_attributes = 0;
 	tag.attributes = NULL;
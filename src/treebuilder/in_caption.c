@@ -30,8 +30,8 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == CAPTION || type == COL || type == COLGROUP ||
 				type == TBODY || type == TD || type == TFOOT ||
@@ -46,8 +46,8 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == CAPTION) {
 			handled = true;
@@ -68,8 +68,8 @@ hubbub_error handle_in_cell(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == CAPTION || type == COL ||
 				type == COLGROUP || type == TBODY || 
@@ -85,8 +85,8 @@ hubbub_error handle_in_cell(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == TH || type == TD) {
 			if (element_in_scope(treebuilder, type, true)) {
@@ -410,8 +410,8 @@ hubbub_error handle_in_foreign_content(hubbub_treebuilder *treebuilder,
 				treebuilder->context.current_node].ns;
 
 		element_type cur_node = current_node(treebuilder);
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (cur_node_ns == HUBBUB_NS_HTML ||
 			(cur_node_ns == HUBBUB_NS_MATHML &&
@@ -29,7 +29,6 @@
 static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
-	static uint16_t utf16, utf16be, utf16le;
 	uint16_t charset_enc = 0;
 	uint16_t content_type_enc = 0;
 	size_t i;
@@ -44,17 +43,6 @@ static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 	if (treebuilder->tree_handler->encoding_change == NULL)
 		return err;
 
-	/* Grab UTF-16 MIBenums */
-	if (utf16 == 0) {
-		utf16 = parserutils_charset_mibenum_from_name(
-				"utf-16", SLEN("utf-16"));
-		utf16be = parserutils_charset_mibenum_from_name(
-				"utf-16be", SLEN("utf-16be"));
-		utf16le = parserutils_charset_mibenum_from_name(
-				"utf-16le", SLEN("utf-16le"));
-		assert(utf16 != 0 && utf16be != 0 && utf16le != 0);
-	}
-
 	for (i = 0; i < token->data.tag.n_attributes; i++) {
 		hubbub_attribute *attr = &token->data.tag.attributes[i];
 
@@ -84,10 +72,10 @@ static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 		hubbub_charset_fix_charset(&charset_enc);
 
 		/* Change UTF-16 to UTF-8 */
-		if (charset_enc == utf16le || charset_enc == utf16be ||
-				charset_enc == utf16) {
-			charset_enc = parserutils_charset_mibenum_from_name(
-					"UTF-8", SLEN("UTF-8"));
+		if (charset_enc == treebuilder->utf16le ||
+				charset_enc == treebuilder->utf16be ||
+				charset_enc == treebuilder->utf16) {
+			charset_enc = treebuilder->utf8;
 		}
 
 		name = parserutils_charset_mibenum_to_name(charset_enc);
@@ -127,8 +115,8 @@ hubbub_error handle_in_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -170,8 +158,8 @@ hubbub_error handle_in_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == HEAD) {
 			handled = true;
@@ -83,8 +83,8 @@ hubbub_error handle_in_row(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == TH || type == TD) {
 			table_clear_stack(treebuilder);
@@ -133,8 +133,8 @@ hubbub_error handle_in_row(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == TR) {
 			/* We're done with this token, but act_as_if_end_tag_tr 
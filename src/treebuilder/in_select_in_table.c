@@ -29,8 +29,8 @@ hubbub_error handle_in_select_in_table(hubbub_treebuilder *treebuilder,
 
 	if (token->type == HUBBUB_TOKEN_END_TAG ||
 			token->type == HUBBUB_TOKEN_START_TAG) {
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == CAPTION || type == TABLE || type == TBODY ||
 				type == TFOOT || type == THEAD || type == TR ||
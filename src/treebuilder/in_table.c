@@ -99,8 +99,8 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 		bool tainted = treebuilder->context.element_stack[
 					current_table(treebuilder)
 					].tainted;
@@ -136,7 +136,9 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				uint32_t index;
 
 				formatting_list_remove(treebuilder,
-					treebuilder->context.formatting_list_end,
+					&treebuilder->context.formatting_list[
+					treebuilder->context.
+						formatting_list_len - 1],
 					&ns, &type, &node, &index);
 
 				treebuilder->tree_handler->unref_node(
@@ -155,6 +157,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				/* Insert colgroup and reprocess */
 				tag.name.ptr = (const uint8_t *) "colgroup";
 				tag.name.len = SLEN("colgroup");
+				tag.atom = HUBBUB_ATOM_COLGROUP;
 				tag.n_attributes = 0;
 				tag.attributes = NULL;
 
@@ -177,6 +180,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				/* Insert tbody and reprocess */
 				tag.name.ptr = (const uint8_t *) "tbody";
 				tag.name.len = SLEN("tbody");
+				tag.atom = HUBBUB_ATOM_TBODY;
 				tag.n_attributes = 0;
 				tag.attributes = NULL;
 
@@ -211,8 +215,8 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_atom(treebuilder,
+				token->data.tag.atom);
 
 		if (type == TABLE) {
 			/** \todo fragment case */
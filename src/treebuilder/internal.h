@@ -10,6 +10,13 @@
 
 #include "treebuilder/treebuilder.h"
 
+/**
+ * Result of inserting an element that would be pushed beyond the limit on
+ * the depth of the stack of open elements. The element is left out, and
+ * the rest of the token ignored.
+ */
+#define HUBBUB_TREEBUILDER_TOO_DEEP ((hubbub_error) (HUBBUB_UNKNOWN + 1))
+
 typedef enum
 {
 /* Special */
@@ -52,6 +59,18 @@ typedef struct element_context
 					 * instead of the current node." */
 
 	void *node;			/**< Node pointer */
+
+	uint32_t formatting;		/**< Index, plus one, of the entry in
+					 * the formatting list for this slot,
+					 * if still valid (only for the stack,
+					 * see formatting_list_find) */
+
+	uint32_t scope;			/**< Index of the nearest element at
+					 * or below this slot that bounds
+					 * scope, or 0 (only for the stack) */
+	uint32_t table_scope;		/**< Index of the nearest TABLE at or
+					 * below this slot, or 0 (only for
+					 * the stack) */
 } element_context;
 
 /**
@@ -63,10 +82,16 @@ typedef struct formatting_list_entry
 
 	uint32_t stack_index;		/**< Index into element stack */
 
-	struct formatting_list_entry *prev;	/**< Previous in list */
-	struct formatting_list_entry *next;	/**< Next in list */
+	uint32_t prev;			/**< Index, plus one, of the previous
+					 * entry of the same formatting type,
+					 * or the previous marker, or 0 */
 } formatting_list_entry;
 
+/** Chain of markers in the formatting list, after one for each type */
+#define FORMATTING_MARKERS (U - A + 1)
+/** Number of chains through the formatting list */
+#define FORMATTING_CHAINS (FORMATTING_MARKERS + 1)
+
 /**
  * Context for a tree builder
  */
@@ -79,11 +104,22 @@ typedef struct hubbub_treebuilder_context
 	element_context *element_stack;	/**< Stack of open elements */
 	uint32_t stack_alloc;		/**< Number of stack slots allocated */
 	uint32_t current_node;		/**< Index of current node in stack */
+	uint32_t max_depth;		/**< Most elements to have open at
+					 * once, or 0 for no limit */
+	uint32_t element_counts[UNKNOWN + 1];	/**< Number of elements on
+						 * the stack of each type,
+						 * excluding the root */
 
+#define FORMATTING_LIST_CHUNK 32
 	formatting_list_entry *formatting_list;	/**< List of active formatting 
-						 * elements */
-	formatting_list_entry *formatting_list_end;	/**< End of active 
-							 * formatting list */
+						 * elements, oldest first */
+	uint32_t formatting_list_len;	/**< Number of entries in list */
+	uint32_t formatting_list_alloc;	/**< Number of entries allocated */
+	uint32_t formatting_last[FORMATTING_CHAINS];	/**< Index, plus one,
+						 * of the last entry in list
+						 * of each formatting type,
+						 * and of the last marker,
+						 * or 0 if there is none */
 
 	void *head_element;		/**< Pointer to HEAD element */
 
@@ -127,6 +163,11 @@ struct hubbub_treebuilder
 
 	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
 	void *alloc_pw;			/**< Client private data */
+
+	uint16_t utf8;			/**< MIBenum of UTF-8 */
+	uint16_t utf16;			/**< MIBenum of UTF-16 */
+	uint16_t utf16be;		/**< MIBenum of UTF-16BE */
+	uint16_t utf16le;		/**< MIBenum of UTF-16LE */
 };
 
 hubbub_error hubbub_treebuilder_token_handler(
@@ -158,14 +199,15 @@ hubbub_error append_text(hubbub_treebuilder *treebuilder,
 hubbub_error complete_script(hubbub_treebuilder *treebuilder);
 hubbub_error complete_style(hubbub_treebuilder *treebuilder);
 
-element_type element_type_from_name(hubbub_treebuilder *treebuilder,
-		const hubbub_string *tag_name);
+element_type element_type_from_atom(hubbub_treebuilder *treebuilder,
+		hubbub_atom atom);
 
 bool is_special_element(element_type type);
 bool is_scoping_element(element_type type);
 bool is_formatting_element(element_type type);
 bool is_phrasing_element(element_type type);
 
+bool element_stack_has_room(hubbub_treebuilder *treebuilder, uint32_t n);
 hubbub_error element_stack_push(hubbub_treebuilder *treebuilder,
 		hubbub_ns ns, element_type type, void *node);
 hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
@@ -175,6 +217,8 @@ hubbub_error element_stack_pop_until(hubbub_treebuilder *treebuilder,
 hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder, 
 		uint32_t index, hubbub_ns *ns, element_type *type, 
 		void **removed);
+void element_stack_update_scope(hubbub_treebuilder *treebuilder,
+		uint32_t from, uint32_t to);
 uint32_t current_table(hubbub_treebuilder *treebuilder);
 element_type current_node(hubbub_treebuilder *treebuilder);
 element_type prev_node(hubbub_treebuilder *treebuilder);
@@ -183,7 +227,7 @@ hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
 		hubbub_ns ns, element_type type, void *node, 
 		uint32_t stack_index);
 hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *prev, formatting_list_entry *next,
+		uint32_t index,
 		hubbub_ns ns, element_type type, void *node, 
 		uint32_t stack_index);
 hubbub_error formatting_list_remove(hubbub_treebuilder *treebuilder,
@@ -196,6 +240,8 @@ hubbub_error formatting_list_replace(hubbub_treebuilder *treebuilder,
 		uint32_t stack_index,
 		hubbub_ns *ons, element_type *otype, void **onode, 
 		uint32_t *ostack_index);
+formatting_list_entry *formatting_list_find(hubbub_treebuilder *treebuilder,
+		uint32_t stack_index);
 
 /* in_foreign_content.c */
 void adjust_mathml_attributes(hubbub_treebuilder *treebuilder, hubbub_tag *tag);
@@ -215,6 +261,7 @@ hubbub_error aa_insert_into_foster_parent(hubbub_treebuilder *treebuilder,
 
 void element_stack_dump(hubbub_treebuilder *treebuilder, FILE *fp);
 void formatting_list_dump(hubbub_treebuilder *treebuilder, FILE *fp);
+bool element_stack_check_scope(hubbub_treebuilder *treebuilder);
 
 const char *element_type_to_name(element_type type);
 
@@ -10,75 +10,76 @@
 
 #include <stdio.h>
 
+#include <parserutils/charset/mibenum.h>
+
 #include "treebuilder/modes.h"
 #include "treebuilder/internal.h"
 #include "treebuilder/treebuilder.h"
+#include "tokeniser/atoms.h"
 #include "utils/utils.h"
 #include "utils/string.h"
 
 
-#define S(x)   x, SLEN(x)
-
-static const struct {
-	const char *name;
-	size_t len;
-	element_type type;
-} name_type_map[] = {
-	{ S("address"), ADDRESS },	{ S("area"), AREA },
-	{ S("base"), BASE },		{ S("basefont"), BASEFONT },
-	{ S("bgsound"), BGSOUND },	{ S("blockquote"), BLOCKQUOTE },
-	{ S("body"), BODY },		{ S("br"), BR },
-	{ S("center"), CENTER },	{ S("col"), COL },
-	{ S("colgroup"), COLGROUP },	{ S("dd"), DD },
-	{ S("dir"), DIR },		{ S("div"), DIV },
-	{ S("dl"), DL },		{ S("dt"), DT },
-	{ S("embed"), EMBED },		{ S("fieldset"), FIELDSET },
-	{ S("form"), FORM },		{ S("frame"), FRAME },
-	{ S("frameset"), FRAMESET },	{ S("h1"), H1 },
-	{ S("h2"), H2 },		{ S("h3"), H3 },
-	{ S("h4"), H4 },		{ S("h5"), H5 },
-	{ S("h6"), H6 },		{ S("head"), HEAD },
-	{ S("hr"), HR },		{ S("iframe"), IFRAME },
-	{ S("image"), IMAGE },		{ S("img"), IMG },
-	{ S("input"), INPUT },		{ S("isindex"), ISINDEX },
-	{ S("li"), LI },		{ S("link"), LINK },
-	{ S("listing"), LISTING },
-	{ S("menu"), MENU },
-	{ S("meta"), META },		{ S("noembed"), NOEMBED },
-	{ S("noframes"), NOFRAMES },	{ S("noscript"), NOSCRIPT },
-	{ S("ol"), OL },		{ S("optgroup"), OPTGROUP },
-	{ S("option"), OPTION },	{ S("output"), OUTPUT },
-	{ S("p"), P },			{ S("param"), PARAM },
-	{ S("plaintext"), PLAINTEXT },	{ S("pre"), PRE },
-	{ S("script"), SCRIPT },	{ S("select"), SELECT },
-	{ S("spacer"), SPACER },	{ S("style"), STYLE },
- 	{ S("tbody"), TBODY },		{ S("textarea"), TEXTAREA },
-	{ S("tfoot"), TFOOT },		{ S("thead"), THEAD },
-	{ S("title"), TITLE },		{ S("tr"), TR },
-	{ S("ul"), UL },		{ S("wbr"), WBR },
-	{ S("applet"), APPLET },	{ S("button"), BUTTON },
-	{ S("caption"), CAPTION },	{ S("html"), HTML },
-	{ S("marquee"), MARQUEE },	{ S("object"), OBJECT },
-	{ S("table"), TABLE },		{ S("td"), TD },
-	{ S("th"), TH },
-	{ S("a"), A },			{ S("b"), B },
-	{ S("big"), BIG },		{ S("em"), EM },
-	{ S("font"), FONT },		{ S("i"), I },
-	{ S("nobr"), NOBR },		{ S("s"), S },
-	{ S("small"), SMALL },		{ S("strike"), STRIKE },
-	{ S("strong"), STRONG },	{ S("tt"), TT },
-	{ S("u"), U },			{ S("xmp"), XMP },
-
-	{ S("math"), MATH },		{ S("mglyph"), MGLYPH },
-	{ S("malignmark"), MALIGNMARK },
-	{ S("mi"), MI },		{ S("mo"), MO },
-	{ S("mn"), MN },		{ S("ms"), MS },
-	{ S("mtext"), MTEXT },		{ S("annotation-xml"), ANNOTATION_XML },
-
-	{ S("svg"), SVG },		{ S("desc"), DESC },
-	{ S("foreignobject"), FOREIGNOBJECT },
+/**
+ * Map from atom to element type. Entries hold the type plus one, so that
+ * atoms with no type of their own are left zero, and map to UNKNOWN.
+ */
+#define T(atom, type)   [HUBBUB_ATOM_##atom] = (type) + 1
+
+static const uint8_t atom_type_map[] = {
+	T(ADDRESS, ADDRESS),	T(AREA, AREA),
+	T(BASE, BASE),		T(BASEFONT, BASEFONT),
+	T(BGSOUND, BGSOUND),	T(BLOCKQUOTE, BLOCKQUOTE),
+	T(BODY, BODY),		T(BR, BR),
+	T(CENTER, CENTER),	T(COL, COL),
+	T(COLGROUP, COLGROUP),	T(DD, DD),
+	T(DIR, DIR),		T(DIV, DIV),
+	T(DL, DL),		T(DT, DT),
+	T(EMBED, EMBED),	T(FIELDSET, FIELDSET),
+	T(FORM, FORM),		T(FRAME, FRAME),
+	T(FRAMESET, FRAMESET),	T(H1, H1),
+	T(H2, H2),		T(H3, H3),
+	T(H4, H4),		T(H5, H5),
+	T(H6, H6),		T(HEAD, HEAD),
+	T(HR, HR),		T(IFRAME, IFRAME),
+	T(IMAGE, IMAGE),	T(IMG, IMG),
+	T(INPUT, INPUT),	T(ISINDEX, ISINDEX),
+	T(LI, LI),		T(LINK, LINK),
+	T(LISTING, LISTING),	T(MENU, MENU),
+	T(META, META),		T(NOEMBED, NOEMBED),
+	T(NOFRAMES, NOFRAMES),	T(NOSCRIPT, NOSCRIPT),
+	T(OL, OL),		T(OPTGROUP, OPTGROUP),
+	T(OPTION, OPTION),	T(OUTPUT, OUTPUT),
+	T(P, P),		T(PARAM, PARAM),
+	T(PLAINTEXT, PLAINTEXT),	T(PRE, PRE),
+	T(SCRIPT, SCRIPT),	T(SELECT, SELECT),
+	T(SPACER, SPACER),	T(STYLE, STYLE),
+	T(TBODY, TBODY),	T(TEXTAREA, TEXTAREA),
+	T(TFOOT, TFOOT),	T(THEAD, THEAD),
+	T(TITLE, TITLE),	T(TR, TR),
+	T(UL, UL),		T(WBR, WBR),
+	T(APPLET, APPLET),	T(BUTTON, BUTTON),
+	T(CAPTION, CAPTION),	T(HTML, HTML),
+	T(MARQUEE, MARQUEE),	T(OBJECT, OBJECT),
+	T(TABLE, TABLE),	T(TD, TD),
+	T(TH, TH),		T(A, A),
+	T(B, B),		T(BIG, BIG),
+	T(EM, EM),		T(FONT, FONT),
+	T(I, I),		T(NOBR, NOBR),
+	T(S, S),		T(SMALL, SMALL),
+	T(STRIKE, STRIKE),	T(STRONG, STRONG),
+	T(TT, TT),		T(U, U),
+	T(XMP, XMP),		T(MATH, MATH),
+	T(MGLYPH, MGLYPH),	T(MALIGNMARK, MALIGNMARK),
+	T(MI, MI),		T(MO, MO),
+	T(MN, MN),		T(MS, MS),
+	T(MTEXT, MTEXT),	T(ANNOTATION_XML, ANNOTATION_XML),
+	T(SVG, SVG),		T(DESC, DESC),
+	T(FOREIGNOBJECT, FOREIGNOBJECT),
 };
 
+#undef T
+
 static bool is_form_associated(element_type type);
 
 /**
@@ -122,6 +123,8 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 		return HUBBUB_NOMEM;
 	}
 	tb->context.stack_alloc = ELEMENT_STACK_CHUNK;
+	memset(tb->context.element_stack, 0,
+			ELEMENT_STACK_CHUNK * sizeof(element_context));
 	/* We rely on HTML not being equal to zero to determine
 	 * if the first item in the stack is in use. Assert this here. */
 	assert(HTML != 0);
@@ -136,6 +139,19 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 	tb->alloc = alloc;
 	tb->alloc_pw = pw;
 
+	/* Look up the encodings meta tags may name once, here, rather than
+	 * in a shared cache, so that parsers may run on many threads */
+	tb->utf8 = parserutils_charset_mibenum_from_name(
+			"UTF-8", SLEN("UTF-8"));
+	tb->utf16 = parserutils_charset_mibenum_from_name(
+			"UTF-16", SLEN("UTF-16"));
+	tb->utf16be = parserutils_charset_mibenum_from_name(
+			"UTF-16BE", SLEN("UTF-16BE"));
+	tb->utf16le = parserutils_charset_mibenum_from_name(
+			"UTF-16LE", SLEN("UTF-16LE"));
+	assert(tb->utf8 != 0 && tb->utf16 != 0 &&
+			tb->utf16be != 0 && tb->utf16le != 0);
+
 	tokparams.token_handler.handler = hubbub_treebuilder_token_handler;
 	tokparams.token_handler.pw = tb;
 
@@ -153,26 +169,14 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 }
 
 /**
- * Destroy a hubbub treebuilder
+ * Release a treebuilder's references to nodes, and its formatting list
  *
- * \param treebuilder  The treebuilder instance to destroy
- * \return HUBBUB_OK on success, appropriate error otherwise
+ * \param treebuilder  The treebuilder instance
  */
-hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder)
+static void hubbub_treebuilder_release(hubbub_treebuilder *treebuilder)
 {
-	formatting_list_entry *entry, *next;
-	hubbub_tokeniser_optparams tokparams;
-
-	if (treebuilder == NULL)
-		return HUBBUB_BADPARM;
-
-	tokparams.token_handler.handler = NULL;
-	tokparams.token_handler.pw = NULL;
-
-	hubbub_tokeniser_setopt(treebuilder->tokeniser,
-			HUBBUB_TOKENISER_TOKEN_HANDLER, &tokparams);
+	uint32_t i;
 
-	/* Clean up context */
 	if (treebuilder->tree_handler != NULL) {
 		uint32_t n;
 
@@ -206,21 +210,51 @@ hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder)
 				treebuilder->context.element_stack[0].node);
 		}
 	}
-	treebuilder->alloc(treebuilder->context.element_stack, 0,
-			treebuilder->alloc_pw);
-	treebuilder->context.element_stack = NULL;
-
-	for (entry = treebuilder->context.formatting_list; entry != NULL;
-			entry = next) {
-		next = entry->next;
 
+	for (i = 0; i < treebuilder->context.formatting_list_len; i++) {
 		if (treebuilder->tree_handler != NULL) {
 			treebuilder->tree_handler->unref_node(
 					treebuilder->tree_handler->ctx,
-					entry->details.node);
+					treebuilder->context.formatting_list[
+						i].details.node);
 		}
+	}
+
+	treebuilder->context.formatting_list_len = 0;
+	memset(treebuilder->context.formatting_last, 0,
+			sizeof(treebuilder->context.formatting_last));
+}
+
+/**
+ * Destroy a hubbub treebuilder
+ *
+ * \param treebuilder  The treebuilder instance to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder)
+{
+	hubbub_tokeniser_optparams tokparams;
+
+	if (treebuilder == NULL)
+		return HUBBUB_BADPARM;
+
+	tokparams.token_handler.handler = NULL;
+	tokparams.token_handler.pw = NULL;
+
+	hubbub_tokeniser_setopt(treebuilder->tokeniser,
+			HUBBUB_TOKENISER_TOKEN_HANDLER, &tokparams);
 
-		treebuilder->alloc(entry, 0, treebuilder->alloc_pw);
+	/* Clean up context */
+	hubbub_treebuilder_release(treebuilder);
+
+	treebuilder->alloc(treebuilder->context.element_stack, 0,
+			treebuilder->alloc_pw);
+	treebuilder->context.element_stack = NULL;
+
+	if (treebuilder->context.formatting_list != NULL) {
+		treebuilder->alloc(treebuilder->context.formatting_list, 0,
+				treebuilder->alloc_pw);
+		treebuilder->context.formatting_list = NULL;
 	}
 
 	treebuilder->alloc(treebuilder, 0, treebuilder->alloc_pw);
@@ -228,6 +262,58 @@ hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder)
 	return HUBBUB_OK;
 }
 
+/**
+ * Return a hubbub treebuilder to its initial state, to build a new tree
+ *
+ * \param treebuilder  The treebuilder instance to reset
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The references held to the old tree's nodes are released, including
+ * that to the document node, so a new document node must be given before
+ * the next tree is built. Options are kept, as are the element stack and
+ * the formatting list, at the sizes they have grown to.
+ */
+hubbub_error hubbub_treebuilder_reset(hubbub_treebuilder *treebuilder)
+{
+	hubbub_treebuilder_context *ctx;
+	element_context *element_stack;
+	formatting_list_entry *formatting_list;
+	uint32_t stack_alloc, formatting_list_alloc, max_depth;
+	bool enable_scripting, enable_styling;
+
+	if (treebuilder == NULL)
+		return HUBBUB_BADPARM;
+
+	hubbub_treebuilder_release(treebuilder);
+
+	ctx = &treebuilder->context;
+	element_stack = ctx->element_stack;
+	stack_alloc = ctx->stack_alloc;
+	formatting_list = ctx->formatting_list;
+	formatting_list_alloc = ctx->formatting_list_alloc;
+	max_depth = ctx->max_depth;
+	enable_scripting = ctx->enable_scripting;
+	enable_styling = ctx->enable_styling;
+
+	memset(ctx, 0, sizeof(hubbub_treebuilder_context));
+	ctx->mode = INITIAL;
+
+	ctx->element_stack = element_stack;
+	ctx->stack_alloc = stack_alloc;
+	ctx->element_stack[0].type = (element_type) 0;
+	ctx->formatting_list = formatting_list;
+	ctx->formatting_list_alloc = formatting_list_alloc;
+	ctx->max_depth = max_depth;
+
+	ctx->enable_scripting = enable_scripting;
+	ctx->enable_styling = enable_styling;
+
+	ctx->strip_leading_lr = false;
+	ctx->frameset_ok = true;
+
+	return HUBBUB_OK;
+}
+
 /**
  * Configure a hubbub treebuilder
  *
@@ -262,6 +348,9 @@ hubbub_error hubbub_treebuilder_setopt(hubbub_treebuilder *treebuilder,
 		treebuilder->context.enable_styling =
 				params->enable_styling;
 		break;
+	case HUBBUB_TREEBUILDER_MAX_DEPTH:
+		treebuilder->context.max_depth = params->max_depth;
+		break;
 	}
 
 	return HUBBUB_OK;
@@ -367,6 +456,10 @@ hubbub_error hubbub_treebuilder_token_handler(const hubbub_token *token,
 		}
 	}
 
+	/* An element left out for want of room isn't an error */
+	if (err == HUBBUB_TREEBUILDER_TOO_DEEP)
+		err = HUBBUB_OK;
+
 	return err;
 }
 
@@ -479,7 +572,7 @@ hubbub_error parse_generic_rcdata(hubbub_treebuilder *treebuilder,
 	element_type type;
 	hubbub_tokeniser_optparams params;
 
-	type = element_type_from_name(treebuilder, &token->data.tag.name);
+	type = element_type_from_atom(treebuilder, token->data.tag.atom);
 
 	error = insert_element(treebuilder, &token->data.tag, true);
 	if (error != HUBBUB_OK)
@@ -511,37 +604,30 @@ hubbub_error parse_generic_rcdata(hubbub_treebuilder *treebuilder,
 uint32_t element_in_scope(hubbub_treebuilder *treebuilder,
 		element_type type, bool in_table)
 {
-	uint32_t node;
+	element_context *stack = treebuilder->context.element_stack;
+	uint32_t node, boundary;
 
-	if (treebuilder->context.element_stack == NULL)
+	if (stack == NULL)
 		return 0;
 
 	assert((signed) treebuilder->context.current_node >= 0);
 
-	for (node = treebuilder->context.current_node; node > 0; node--) {
-		hubbub_ns node_ns =
-				treebuilder->context.element_stack[node].ns;
-		element_type node_type =
-				treebuilder->context.element_stack[node].type;
-
-		if (node_type == type)
-			return node;
+	/* Nothing to look for if no element of this type is open */
+	if (treebuilder->context.element_counts[type] == 0)
+		return 0;
 
-		if (node_type == TABLE)
-			break;
+	node = treebuilder->context.current_node;
+	boundary = in_table ? stack[node].table_scope : stack[node].scope;
 
-		/* The list of element types given in the spec here are the
-		 * scoping elements excluding TABLE and HTML. TABLE is handled
-		 * in the previous conditional and HTML should only occur
-		 * as the first node in the stack, which is never processed
-		 * in this loop. */
-		if (!in_table && (is_scoping_element(node_type) ||
-				(node_type == FOREIGNOBJECT &&
-						node_ns == HUBBUB_NS_SVG))) {
-			break;
-		}
+	for (; node > boundary; node--) {
+		if (stack[node].type == type)
+			return node;
 	}
 
+	/* The element bounding scope may itself be the one sought */
+	if (node > 0 && stack[node].type == type)
+		return node;
+
 	return 0;
 }
 
@@ -550,42 +636,48 @@ uint32_t element_in_scope(hubbub_treebuilder *treebuilder,
  *
  * \param treebuilder  Treebuilder instance containing list
  * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * If there is a limit on the number of open elements, reconstruction
+ * stops short of it, leaving room for an element being inserted. Those
+ * elements not reopened are left in the list, to be reopened once there
+ * is room.
  */
 hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 {
 	hubbub_error error = HUBBUB_OK;
-	formatting_list_entry *entry, *initial_entry;
+	formatting_list_entry *list = treebuilder->context.formatting_list;
+	uint32_t len = treebuilder->context.formatting_list_len;
+	uint32_t i, initial, end;
 	uint32_t sp = treebuilder->context.current_node;
 
-	if (treebuilder->context.formatting_list == NULL)
+	if (len == 0)
 		return HUBBUB_OK;
 
-	entry = treebuilder->context.formatting_list_end;
+	i = len - 1;
 
 	/* Assumption: HTML and TABLE elements are not inserted into the list */
-	if (is_scoping_element(entry->details.type) || entry->stack_index != 0)
+	if (is_scoping_element(list[i].details.type) ||
+			list[i].stack_index != 0)
 		return HUBBUB_OK;
 
-	while (entry->prev != NULL) {
-		entry = entry->prev;
-
-		if (is_scoping_element(entry->details.type) ||
-				entry->stack_index != 0) {
-			entry = entry->next;
-			break;
-		}
-	}
+	while (i > 0 && !is_scoping_element(list[i - 1].details.type) &&
+			list[i - 1].stack_index == 0)
+		i--;
 
 	/* Save initial entry for later */
-	initial_entry = entry;
+	initial = i;
 
 	/* Process formatting list entries, cloning nodes and
 	 * inserting them into the DOM and element stack */
-	while (entry != NULL) {
+	for (; i < len; i++) {
+		formatting_list_entry *entry = &list[i];
 		void *clone, *appended;
 		bool foster;
 		element_type type = current_node(treebuilder);
 
+		if (element_stack_has_room(treebuilder, 2) == false)
+			break;
+
 		error = treebuilder->tree_handler->clone_node(
 				treebuilder->tree_handler->ctx,
 				entry->details.node,
@@ -630,12 +722,13 @@ hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 
 			goto cleanup;
 		}
-
-		entry = entry->next;
 	}
 
+	end = i;
+
 	/* Now, replace the formatting list entries */
-	for (entry = initial_entry; entry != NULL; entry = entry->next) {
+	for (i = initial; i != end; i++) {
+		formatting_list_entry *entry = &list[i];
 		void *node;
 		hubbub_ns prev_ns;
 		element_type prev_type;
@@ -727,10 +820,12 @@ hubbub_error remove_node_from_dom(hubbub_treebuilder *treebuilder, void *node)
  */
 void clear_active_formatting_list_to_marker(hubbub_treebuilder *treebuilder)
 {
-	formatting_list_entry *entry;
 	bool done = false;
 
-	while ((entry = treebuilder->context.formatting_list_end) != NULL) {
+	while (treebuilder->context.formatting_list_len > 0) {
+		formatting_list_entry *entry = &treebuilder->context.
+				formatting_list[
+				treebuilder->context.formatting_list_len - 1];
 		hubbub_ns ns;
 		element_type type;
 		void *node;
@@ -758,7 +853,10 @@ void clear_active_formatting_list_to_marker(hubbub_treebuilder *treebuilder)
  * \param treebuilder  The treebuilder instance
  * \param tag          The element to insert
  * \param push         Whether to push the element onto the stack
- * \return HUBBUB_OK on success, appropriate error otherwise.
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_TREEBUILDER_TOO_DEEP if the element would be pushed
+ *         beyond the limit on the depth of the stack, and so is left out,
+ *         appropriate error otherwise.
  */
 hubbub_error insert_element(hubbub_treebuilder *treebuilder,
 		const hubbub_tag *tag, bool push)
@@ -767,6 +865,9 @@ hubbub_error insert_element(hubbub_treebuilder *treebuilder,
 	hubbub_error error;
 	void *node, *appended;
 
+	if (push && element_stack_has_room(treebuilder, 1) == false)
+		return HUBBUB_TREEBUILDER_TOO_DEEP;
+
 	error = treebuilder->tree_handler->create_element(
 			treebuilder->tree_handler->ctx, tag, &node);
 	if (error != HUBBUB_OK)
@@ -792,7 +893,7 @@ hubbub_error insert_element(hubbub_treebuilder *treebuilder,
 	if (error != HUBBUB_OK)
 		return error;
 
-	type = element_type_from_name(treebuilder, &tag->name);
+	type = element_type_from_atom(treebuilder, tag->atom);
 	if (treebuilder->context.form_element != NULL &&
 			is_form_associated(type)) {
 		/* Consideration of @form is left to the client */
@@ -822,6 +923,9 @@ hubbub_error insert_element(hubbub_treebuilder *treebuilder,
 					appended);
 			return error;
 		}
+
+		assert(!treebuilder->context.in_table_foster ||
+				element_stack_check_scope(treebuilder));
 	} else {
 		treebuilder->tree_handler->unref_node(
 				treebuilder->tree_handler->ctx, appended);
@@ -876,6 +980,9 @@ void reset_insertion_mode(hubbub_treebuilder *treebuilder)
 	uint32_t node;
 	element_context *stack = treebuilder->context.element_stack;
 
+	/* Callers have just popped elements, perhaps many at once */
+	assert(element_stack_check_scope(treebuilder));
+
 	/** \todo fragment parsing algorithm */
 
 	for (node = treebuilder->context.current_node; node > 0; node--) {
@@ -1005,33 +1112,22 @@ hubbub_error append_text(hubbub_treebuilder *treebuilder,
 }
 
 /**
- * Convert an element name into an element type
+ * Convert an element name's atom into an element type
  *
  * \param treebuilder  The treebuilder instance
- * \param tag_name     The tag name to consider
+ * \param atom         The atom to consider
  * \return The corresponding element type
  */
-element_type element_type_from_name(hubbub_treebuilder *treebuilder,
-		const hubbub_string *tag_name)
+element_type element_type_from_atom(hubbub_treebuilder *treebuilder,
+		hubbub_atom atom)
 {
-	const uint8_t *name = tag_name->ptr;
-	size_t len = tag_name->len;
-	uint32_t i;
-
 	UNUSED(treebuilder);
 
-	/** \todo optimise this */
-
-	for (i = 0; i < N_ELEMENTS(name_type_map); i++) {
-		if (name_type_map[i].len != len)
-			continue;
-
-		if (strncasecmp(name_type_map[i].name,
-				(const char *) name, len) == 0)
-			return name_type_map[i].type;
-	}
+	if ((size_t) atom >= N_ELEMENTS(atom_type_map) ||
+			atom_type_map[atom] == 0)
+		return UNKNOWN;
 
-	return UNKNOWN;
+	return (element_type) (atom_type_map[atom] - 1);
 }
 
 /**
@@ -1091,6 +1187,20 @@ bool is_form_associated(element_type type)
 			type == OUTPUT;
 }
 
+/**
+ * Determine whether elements may be pushed onto the stack of open elements
+ *
+ * \param treebuilder  The treebuilder instance containing the stack
+ * \param n            The number of elements to push
+ * \return True if as many elements may be open at once, false otherwise
+ */
+bool element_stack_has_room(hubbub_treebuilder *treebuilder, uint32_t n)
+{
+	return treebuilder->context.max_depth == 0 ||
+			treebuilder->context.current_node + 1 + n <=
+				treebuilder->context.max_depth;
+}
+
 /**
  * Push an element onto the stack of open elements
  *
@@ -1116,6 +1226,9 @@ hubbub_error element_stack_push(hubbub_treebuilder *treebuilder,
 		if (temp == NULL)
 			return HUBBUB_NOMEM;
 
+		memset(temp + treebuilder->context.stack_alloc, 0,
+				ELEMENT_STACK_CHUNK * sizeof(element_context));
+
 		treebuilder->context.element_stack = temp;
 		treebuilder->context.stack_alloc += ELEMENT_STACK_CHUNK;
 	}
@@ -1124,6 +1237,9 @@ hubbub_error element_stack_push(hubbub_treebuilder *treebuilder,
 	treebuilder->context.element_stack[slot].type = type;
 	treebuilder->context.element_stack[slot].node = node;
 
+	treebuilder->context.element_counts[type]++;
+	element_stack_update_scope(treebuilder, slot, slot);
+
 	treebuilder->context.current_node = slot;
 
 	return HUBBUB_OK;
@@ -1143,7 +1259,6 @@ hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
 {
 	element_context *stack = treebuilder->context.element_stack;
 	uint32_t slot = treebuilder->context.current_node;
-	formatting_list_entry *entry;
 
 	/* We're popping a table, find previous */
 	if (stack[slot].type == TABLE) {
@@ -1158,22 +1273,22 @@ hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
 			(is_scoping_element(stack[slot].type) &&
 			stack[slot].type != HTML &&
 			stack[slot].type != TABLE)) {
-		/* Find occurrences of the node we're about to pop in the list
-		 * of active formatting elements. We need to invalidate their
-		 * stack index information. */
-		for (entry = treebuilder->context.formatting_list_end;
-				entry != NULL; entry = entry->prev) {
-			/** \todo Can we optimise this?
-			 * (i.e. by not traversing the entire list) */
-			if (entry->stack_index == slot)
-				entry->stack_index = 0;
-		}
+		/* Find the node we're about to pop in the list of active
+		 * formatting elements. We need to invalidate its stack
+		 * index information. */
+		formatting_list_entry *entry =
+				formatting_list_find(treebuilder, slot);
+
+		if (entry != NULL)
+			entry->stack_index = 0;
 	}
 
 	*ns = stack[slot].ns;
 	*type = stack[slot].type;
 	*node = stack[slot].node;
 
+	treebuilder->context.element_counts[stack[slot].type]--;
+
 	/** \todo reduce allocated stack size once there's enough free */
 
 	treebuilder->context.current_node = slot - 1;
@@ -1235,13 +1350,11 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 				(is_scoping_element(stack[n].type) &&
 				stack[n].type != HTML &&
 				stack[n].type != TABLE)) {
-			formatting_list_entry *e;
+			formatting_list_entry *e =
+					formatting_list_find(treebuilder, n);
 
-			for (e = treebuilder->context.formatting_list_end;
-					e != NULL; e = e->prev) {
-				if (e->stack_index == n)
-					e->stack_index--;
-			}
+			if (e != NULL)
+				e->stack_index--;
 		}
 	}
 
@@ -1249,6 +1362,8 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 	*type = stack[index].type;
 	*removed = stack[index].node;
 
+	treebuilder->context.element_counts[stack[index].type]--;
+
 	/* Now, shuffle the stack up one, removing node in the process */
 	if (index < treebuilder->context.current_node) {
 		memmove(&stack[index], &stack[index + 1],
@@ -1258,24 +1373,58 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 
 	treebuilder->context.current_node--;
 
+	/* The elements moved may have had scope bounded by that removed */
+	element_stack_update_scope(treebuilder, index,
+			treebuilder->context.current_node);
+
 	return HUBBUB_OK;
 }
 
 /**
- * Find the stack index of the current table.
+ * Record, for slots of the stack of open elements, the elements bounding
+ * scope at or below them
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param from         Index of first slot to update, which must not be 0
+ * \param to           Index of last slot to update
+ *
+ * Slots below ::from must already be up to date.
  */
-uint32_t current_table(hubbub_treebuilder *treebuilder)
+void element_stack_update_scope(hubbub_treebuilder *treebuilder,
+		uint32_t from, uint32_t to)
 {
 	element_context *stack = treebuilder->context.element_stack;
-	size_t t;
 
-	for (t = treebuilder->context.current_node; t != 0; t--) {
-		if (stack[t].type == TABLE)
-			return t;
+	assert(from > 0);
+
+	for (; from <= to; from++) {
+		element_type type = stack[from].type;
+
+		/* The list of element types given in the spec here are the
+		 * scoping elements, including TABLE. HTML should only occur
+		 * as the first node in the stack, which is never updated. */
+		if (is_scoping_element(type) || (type == FOREIGNOBJECT &&
+				stack[from].ns == HUBBUB_NS_SVG))
+			stack[from].scope = from;
+		else
+			stack[from].scope = stack[from - 1].scope;
+
+		if (type == TABLE)
+			stack[from].table_scope = from;
+		else
+			stack[from].table_scope = stack[from - 1].table_scope;
 	}
+}
 
-	/* fragment case */
-	return 0;
+/**
+ * Find the stack index of the current table.
+ */
+uint32_t current_table(hubbub_treebuilder *treebuilder)
+{
+	element_context *stack = treebuilder->context.element_stack;
+
+	/* 0 in the fragment case */
+	return stack[treebuilder->context.current_node].table_scope;
 }
 
 /**
@@ -1308,50 +1457,168 @@ element_type prev_node(hubbub_treebuilder *treebuilder)
 
 
 /**
- * Append an element to the end of the list of active formatting elements
+ * Find the entry in the list of active formatting elements for a stack slot
  *
  * \param treebuilder  Treebuilder instance containing list
- * \param ns           Namespace of node being inserted
- * \param type         Type of node being inserted
- * \param node         Node being inserted
  * \param stack_index  Index into stack of open elements
- * \return HUBBUB_OK on success, appropriate error otherwise
+ * \return Pointer to entry, or NULL if the slot has none
+ *
+ * The returned pointer is only valid until the list is next modified.
  */
-hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
-		hubbub_ns ns, element_type type, void *node,
+formatting_list_entry *formatting_list_find(hubbub_treebuilder *treebuilder,
 		uint32_t stack_index)
 {
-	formatting_list_entry *entry;
+	uint32_t link;
 
-	entry = treebuilder->alloc(NULL, sizeof(formatting_list_entry),
-			treebuilder->alloc_pw);
-	if (entry == NULL)
-		return HUBBUB_NOMEM;
+	if (stack_index == 0)
+		return NULL;
 
-	entry->details.ns = ns;
-	entry->details.type = type;
-	entry->details.node = node;
-	entry->stack_index = stack_index;
+	/* The slot's link may be stale, if the element it was made for
+	 * has since been popped or its entry removed, so check it */
+	link = treebuilder->context.element_stack[stack_index].formatting;
+	if (link == 0 || link > treebuilder->context.formatting_list_len ||
+			treebuilder->context.formatting_list[link - 1].
+				stack_index != stack_index)
+		return NULL;
+
+	return &treebuilder->context.formatting_list[link - 1];
+}
+
+/**
+ * Point the stack slot of entries in the formatting list back at them
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param from         Index of first entry to link
+ * \param to           Index after last entry to link
+ */
+static void formatting_list_link(hubbub_treebuilder *treebuilder,
+		uint32_t from, uint32_t to)
+{
+	formatting_list_entry *list = treebuilder->context.formatting_list;
 
-	entry->prev = treebuilder->context.formatting_list_end;
-	entry->next = NULL;
+	for (; from < to; from++) {
+		if (list[from].stack_index != 0) {
+			treebuilder->context.element_stack[
+					list[from].stack_index].formatting =
+					from + 1;
+		}
+	}
+}
+
+/**
+ * Find which chain through the formatting list an entry belongs on
+ *
+ * \param type  Type of the entry's element
+ * \return Index of chain, or FORMATTING_CHAINS if it belongs on none
+ */
+static inline uint32_t formatting_list_chain(element_type type)
+{
+	if (is_formatting_element(type))
+		return type - A;
+
+	/* Assumption: HTML and TABLE elements are not in the list */
+	if (is_scoping_element(type))
+		return FORMATTING_MARKERS;
+
+	return FORMATTING_CHAINS;
+}
+
+/**
+ * Add an entry in the formatting list to the chain of its type
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param index        Index of entry, whose neighbours are already chained
+ */
+static void formatting_list_chain_add(hubbub_treebuilder *treebuilder,
+		uint32_t index)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	formatting_list_entry *list = ctx->formatting_list;
+	uint32_t chain = formatting_list_chain(list[index].details.type);
+	uint32_t link, next = 0;
 
-	if (entry->prev != NULL)
-		entry->prev->next = entry;
+	list[index].prev = 0;
+
+	if (chain == FORMATTING_CHAINS)
+		return;
+
+	/* Walk back from the end to the entries either side of this one */
+	for (link = ctx->formatting_last[chain]; link > index + 1;
+			link = list[link - 1].prev)
+		next = link;
+
+	list[index].prev = link;
+
+	if (next != 0)
+		list[next - 1].prev = index + 1;
 	else
-		treebuilder->context.formatting_list = entry;
+		ctx->formatting_last[chain] = index + 1;
+}
+
+/**
+ * Take an entry in the formatting list off the chain of its type
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param index        Index of entry
+ */
+static void formatting_list_chain_remove(hubbub_treebuilder *treebuilder,
+		uint32_t index)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	formatting_list_entry *list = ctx->formatting_list;
+	uint32_t chain = formatting_list_chain(list[index].details.type);
+	uint32_t link, next = 0;
+
+	if (chain == FORMATTING_CHAINS)
+		return;
+
+	for (link = ctx->formatting_last[chain]; link != index + 1;
+			link = list[link - 1].prev) {
+		assert(link != 0);
+		next = link;
+	}
 
-	treebuilder->context.formatting_list_end = entry;
+	if (next != 0)
+		list[next - 1].prev = list[index].prev;
+	else
+		ctx->formatting_last[chain] = list[index].prev;
+}
 
-	return HUBBUB_OK;
+/**
+ * Renumber the chains through the formatting list after entries move
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param from         Index of first entry which may link to one moved
+ * \param after        Links greater than this are to entries moved
+ * \param up           Whether entries moved up the list, or down
+ */
+static void formatting_list_chain_move(hubbub_treebuilder *treebuilder,
+		uint32_t from, uint32_t after, bool up)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	formatting_list_entry *list = ctx->formatting_list;
+	uint32_t i;
+
+	for (i = from; i < ctx->formatting_list_len; i++) {
+		if (list[i].prev > after)
+			list[i].prev = up ? list[i].prev + 1 : list[i].prev - 1;
+	}
+
+	for (i = 0; i < FORMATTING_CHAINS; i++) {
+		if (ctx->formatting_last[i] > after) {
+			ctx->formatting_last[i] = up ?
+					ctx->formatting_last[i] + 1 :
+					ctx->formatting_last[i] - 1;
+		}
+	}
 }
 
 /**
  * Insert an element into the list of active formatting elements
  *
  * \param treebuilder  Treebuilder instance containing list
- * \param prev         Previous entry
- * \param next         Next entry
+ * \param index        Index of entry to insert before, or the length of the
+ *                     list to append
  * \param ns           Namespace of node being inserted
  * \param type         Type of node being inserted
  * \param node         Node being inserted
@@ -1359,46 +1626,67 @@ hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
 hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *prev, formatting_list_entry *next,
+		uint32_t index,
 		hubbub_ns ns, element_type type, void *node,
 		uint32_t stack_index)
 {
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
 	formatting_list_entry *entry;
 
-	if (prev != NULL) {
-		assert(prev->next == next);
-	}
+	assert(index <= ctx->formatting_list_len);
+
+	if (ctx->formatting_list_len == ctx->formatting_list_alloc) {
+		formatting_list_entry *temp = treebuilder->alloc(ctx->formatting_list,
+				(ctx->formatting_list_alloc +
+					FORMATTING_LIST_CHUNK) *
+				sizeof(formatting_list_entry),
+				treebuilder->alloc_pw);
 
-	if (next != NULL) {
-		assert(next->prev == prev);
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+
+		ctx->formatting_list = temp;
+		ctx->formatting_list_alloc += FORMATTING_LIST_CHUNK;
 	}
 
-	entry = treebuilder->alloc(NULL, sizeof(formatting_list_entry),
-			treebuilder->alloc_pw);
-	if (entry == NULL)
-		return HUBBUB_NOMEM;
+	entry = &ctx->formatting_list[index];
+
+	memmove(entry + 1, entry, (ctx->formatting_list_len - index) *
+			sizeof(formatting_list_entry));
+	ctx->formatting_list_len++;
 
 	entry->details.ns = ns;
 	entry->details.type = type;
 	entry->details.node = node;
 	entry->stack_index = stack_index;
 
-	entry->prev = prev;
-	entry->next = next;
-
-	if (entry->prev != NULL)
-		entry->prev->next = entry;
-	else
-		treebuilder->context.formatting_list = entry;
+	formatting_list_chain_move(treebuilder, index + 1, index, true);
+	formatting_list_chain_add(treebuilder, index);
 
-	if (entry->next != NULL)
-		entry->next->prev = entry;
-	else
-		treebuilder->context.formatting_list_end = entry;
+	formatting_list_link(treebuilder, index, ctx->formatting_list_len);
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Append an element to the end of the list of active formatting elements
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param ns           Namespace of node being inserted
+ * \param type         Type of node being inserted
+ * \param node         Node being inserted
+ * \param stack_index  Index into stack of open elements
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
+		hubbub_ns ns, element_type type, void *node,
+		uint32_t stack_index)
+{
+	return formatting_list_insert(treebuilder,
+			treebuilder->context.formatting_list_len,
+			ns, type, node, stack_index);
+}
+
 
 /**
  * Remove an element from the list of active formatting elements
@@ -1410,28 +1698,33 @@ hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
  * \param node         Pointer to location to receive node
  * \param stack_index  Pointer to location to receive stack index
  * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * Entries after the one removed move down to fill its place.
  */
 hubbub_error formatting_list_remove(hubbub_treebuilder *treebuilder,
 		formatting_list_entry *entry,
 		hubbub_ns *ns, element_type *type, void **node,
 		uint32_t *stack_index)
 {
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	uint32_t index = entry - ctx->formatting_list;
+
+	assert(index < ctx->formatting_list_len);
+
 	*ns = entry->details.ns;
 	*type = entry->details.type;
 	*node = entry->details.node;
 	*stack_index = entry->stack_index;
 
-	if (entry->prev == NULL)
-		treebuilder->context.formatting_list = entry->next;
-	else
-		entry->prev->next = entry->next;
+	formatting_list_chain_remove(treebuilder, index);
 
-	if (entry->next == NULL)
-		treebuilder->context.formatting_list_end = entry->prev;
-	else
-		entry->next->prev = entry->prev;
+	ctx->formatting_list_len--;
+	memmove(entry, entry + 1, (ctx->formatting_list_len - index) *
+			sizeof(formatting_list_entry));
+
+	formatting_list_chain_move(treebuilder, index, index + 1, false);
 
-	treebuilder->alloc(entry, 0, treebuilder->alloc_pw);
+	formatting_list_link(treebuilder, index, ctx->formatting_list_len);
 
 	return HUBBUB_OK;
 }
@@ -1458,18 +1751,25 @@ hubbub_error formatting_list_replace(hubbub_treebuilder *treebuilder,
 		hubbub_ns *ons, element_type *otype, void **onode,
 		uint32_t *ostack_index)
 {
-	UNUSED(treebuilder);
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	uint32_t index = entry - ctx->formatting_list;
 
 	*ons = entry->details.ns;
 	*otype = entry->details.type;
 	*onode = entry->details.node;
 	*ostack_index = entry->stack_index;
 
+	formatting_list_chain_remove(treebuilder, index);
+
 	entry->details.ns = ns;
 	entry->details.type = type;
 	entry->details.node = node;
 	entry->stack_index = stack_index;
 
+	formatting_list_chain_add(treebuilder, index);
+
+	formatting_list_link(treebuilder, index, index + 1);
+
 	return HUBBUB_OK;
 }
 
@@ -1504,16 +1804,55 @@ void element_stack_dump(hubbub_treebuilder *treebuilder, FILE *fp)
  */
 void formatting_list_dump(hubbub_treebuilder *treebuilder, FILE *fp)
 {
-	formatting_list_entry *entry;
+	formatting_list_entry *list = treebuilder->context.formatting_list;
+	uint32_t i;
 
-	for (entry = treebuilder->context.formatting_list; entry != NULL;
-			entry = entry->next) {
+	for (i = 0; i < treebuilder->context.formatting_list_len; i++) {
 		fprintf(fp, "%s %p %u\n",
-				element_type_to_name(entry->details.type),
-				entry->details.node, entry->stack_index);
+				element_type_to_name(list[i].details.type),
+				list[i].details.node, list[i].stack_index);
 	}
 }
 
+/**
+ * Check the element counts and scope boundaries kept for the stack of
+ * open elements against the stack itself
+ *
+ * \param treebuilder  The treebuilder instance
+ * \return True if they agree, false otherwise
+ */
+bool element_stack_check_scope(hubbub_treebuilder *treebuilder)
+{
+	element_context *stack = treebuilder->context.element_stack;
+	uint32_t counts[UNKNOWN + 1];
+	uint32_t i, scope = 0, table_scope = 0;
+
+	memset(counts, 0, sizeof(counts));
+
+	if (stack[0].scope != 0 || stack[0].table_scope != 0)
+		return false;
+
+	/* The root element is placed manually, and not counted */
+	for (i = 1; i <= treebuilder->context.current_node; i++) {
+		element_type type = stack[i].type;
+
+		counts[type]++;
+
+		if (is_scoping_element(type) || (type == FOREIGNOBJECT &&
+				stack[i].ns == HUBBUB_NS_SVG))
+			scope = i;
+		if (type == TABLE)
+			table_scope = i;
+
+		if (stack[i].scope != scope ||
+				stack[i].table_scope != table_scope)
+			return false;
+	}
+
+	return memcmp(counts, treebuilder->context.element_counts,
+			sizeof(counts)) == 0;
+}
+
 /**
  * Convert an element type to a name
  *
@@ -1524,11 +1863,10 @@ const char *element_type_to_name(element_type type)
 {
 	size_t i;
 
-	for (i = 0;
-			i < sizeof(name_type_map) / sizeof(name_type_map[0]);
-			i++) {
-		if (name_type_map[i].type == type)
-			return name_type_map[i].name;
+	for (i = 0; i < N_ELEMENTS(atom_type_map); i++) {
+		if (atom_type_map[i] != 0 &&
+				(element_type) (atom_type_map[i] - 1) == type)
+			return hubbub_atom_name((hubbub_atom) i);
 	}
 
 	return "UNKNOWN";
@@ -28,7 +28,8 @@ typedef enum hubbub_treebuilder_opttype {
 	HUBBUB_TREEBUILDER_TREE_HANDLER,
 	HUBBUB_TREEBUILDER_DOCUMENT_NODE,
 	HUBBUB_TREEBUILDER_ENABLE_SCRIPTING,
-	HUBBUB_TREEBUILDER_ENABLE_STYLING
+	HUBBUB_TREEBUILDER_ENABLE_STYLING,
+	HUBBUB_TREEBUILDER_MAX_DEPTH
 } hubbub_treebuilder_opttype;
 
 /**
@@ -46,6 +47,9 @@ typedef union hubbub_treebuilder_optparams {
 
 	bool enable_scripting;			/**< Enable scripting */
 	bool enable_styling;			/**< Enable styling */
+
+	uint32_t max_depth;			/**< Most elements to have open
+						 * at once, or 0 for no limit */
 } hubbub_treebuilder_optparams;
 
 /* Create a hubbub treebuilder */
@@ -56,6 +60,9 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 /* Destroy a hubbub treebuilder */
 hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder);
 
+/* Return a hubbub treebuilder to its initial state */
+hubbub_error hubbub_treebuilder_reset(hubbub_treebuilder *treebuilder);
+
 /* Configure a hubbub treebuilder */
 hubbub_error hubbub_treebuilder_setopt(hubbub_treebuilder *treebuilder,
 		hubbub_treebuilder_opttype type,
@@ -0,0 +1,183 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HUBBUB_FILE_MMAP 1
+#endif
+
+#include "utils/file.h"
+
+/** Contents of an empty file */
+static const uint8_t hubbub_file_empty[1];
+
+/**
+ * Read the contents of a file into memory
+ *
+ * \param file  File to fill in
+ * \param path  Path of file
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_FILENOTFOUND if the file can't be opened,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_UNKNOWN if the file can't be read
+ *
+ * The file is read until it ends, rather than for its reported size, so
+ * this works for pipes and the like as well.
+ */
+static hubbub_error hubbub_file_read(hubbub_file *file, const char *path)
+{
+	uint8_t *data = NULL;
+	size_t len = 0, size = 0, n;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return HUBBUB_FILENOTFOUND;
+
+	do {
+		if (len == size) {
+			uint8_t *temp = NULL;
+
+			if (size <= SIZE_MAX / 2) {
+				size = (size == 0) ? 4096 : size * 2;
+				temp = file->alloc(data, size, file->pw);
+			}
+
+			if (temp == NULL) {
+				if (data != NULL)
+					file->alloc(data, 0, file->pw);
+				fclose(fp);
+				return HUBBUB_NOMEM;
+			}
+
+			data = temp;
+		}
+
+		n = fread(data + len, 1, size - len, fp);
+		len += n;
+	} while (n > 0);
+
+	if (ferror(fp)) {
+		if (data != NULL)
+			file->alloc(data, 0, file->pw);
+		fclose(fp);
+		return HUBBUB_UNKNOWN;
+	}
+
+	fclose(fp);
+
+	if (len == 0) {
+		file->alloc(data, 0, file->pw);
+		data = NULL;
+	}
+
+	file->data = (data != NULL) ? data : hubbub_file_empty;
+	file->len = len;
+	file->mapped = false;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Bring the contents of a file into memory
+ *
+ * \param file   File to fill in
+ * \param path   Path of file
+ * \param alloc  Memory (de)allocation function
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_FILENOTFOUND if the file can't be opened,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_UNKNOWN if the file can't be read
+ *
+ * Where the platform supports it, a regular file is mapped, so that its
+ * pages are read on demand and no copy is made. The file must then not be
+ * truncated while it is open. Anything else is read into allocated memory.
+ */
+hubbub_error hubbub_file_open(hubbub_file *file, const char *path,
+		hubbub_allocator_fn alloc, void *pw)
+{
+#ifdef HUBBUB_FILE_MMAP
+	struct stat st;
+	int fd;
+#endif
+
+	assert(file != NULL && path != NULL && alloc != NULL);
+
+	file->data = NULL;
+	file->len = 0;
+	file->mapped = false;
+	file->alloc = alloc;
+	file->pw = pw;
+
+#ifdef HUBBUB_FILE_MMAP
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return HUBBUB_FILENOTFOUND;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+			(uintmax_t) st.st_size <= SIZE_MAX) {
+		void *map = mmap(NULL, (size_t) st.st_size, PROT_READ,
+				MAP_PRIVATE, fd, 0);
+
+		if (map != MAP_FAILED) {
+			close(fd);
+
+#ifdef POSIX_MADV_SEQUENTIAL
+			/* The parse reads it from start to end, once */
+			posix_madvise(map, (size_t) st.st_size,
+					POSIX_MADV_SEQUENTIAL);
+#endif
+
+			file->data = map;
+			file->len = (size_t) st.st_size;
+			file->mapped = true;
+
+			return HUBBUB_OK;
+		}
+	}
+
+	close(fd);
+#endif
+
+	return hubbub_file_read(file, path);
+}
+
+/**
+ * Release the contents of a file
+ *
+ * \param file  File to release
+ */
+void hubbub_file_close(hubbub_file *file)
+{
+	assert(file != NULL);
+
+	if (file->data == NULL)
+		return;
+
+#ifdef HUBBUB_FILE_MMAP
+	if (file->mapped)
+		munmap((void *) file->data, file->len);
+	else
+#endif
+	if (file->data != hubbub_file_empty)
+		file->alloc((void *) file->data, 0, file->pw);
+
+	file->data = NULL;
+	file->len = 0;
+	file->mapped = false;
+}
+
@@ -0,0 +1,39 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_utils_file_h_
+#define hubbub_utils_file_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+
+/**
+ * Contents of a file, mapped into memory or read into it
+ */
+typedef struct hubbub_file {
+	const uint8_t *data;		/**< Contents of file, or NULL if
+					 * none is open */
+	size_t len;			/**< Length, in bytes, of data */
+	bool mapped;			/**< Whether data is mapped, rather
+					 * than allocated */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client data */
+} hubbub_file;
+
+/** Bring the contents of a file into memory */
+hubbub_error hubbub_file_open(hubbub_file *file, const char *path,
+		hubbub_allocator_fn alloc, void *pw);
+
+/** Release the contents of a file */
+void hubbub_file_close(hubbub_file *file);
+
+#endif
+
@@ -0,0 +1,96 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define HUBBUB_SCAN_SSE2 1
+#endif
+
+#include "utils/scan.h"
+
+/**
+ * Initialise a scan set
+ *
+ * \param set      Set to initialise
+ * \param bytes    Bytes to place in the set
+ * \param n_bytes  Number of bytes, in range [1, HUBBUB_SCAN_SET_MAX]
+ */
+void hubbub_scan_set_init(hubbub_scan_set *set,
+		const uint8_t *bytes, size_t n_bytes)
+{
+	size_t i;
+
+	assert(set != NULL && bytes != NULL);
+	assert(0 < n_bytes && n_bytes <= HUBBUB_SCAN_SET_MAX);
+
+	memset(set->member, 0, sizeof(set->member));
+
+	for (i = 0; i < HUBBUB_SCAN_SET_MAX; i++) {
+		/* Unused slots repeat the first byte, so the vector
+		 * code need not care how large the set is */
+		set->bytes[i] = (i < n_bytes) ? bytes[i] : bytes[0];
+		set->member[set->bytes[i]] = 1;
+	}
+}
+
+/**
+ * Find the first byte in a run of data which is a member of a set
+ *
+ * Where SSE2 is available, the data is examined 16 bytes at a time;
+ * anything left over is handled by a table lookup per byte.
+ *
+ * \param set   Set of bytes to look for
+ * \param data  Data to scan
+ * \param len   Length, in bytes, of data
+ * \return Offset of first member byte, or len if there is none
+ */
+size_t hubbub_scan(const hubbub_scan_set *set,
+		const uint8_t *data, size_t len)
+{
+	size_t pos = 0;
+
+#ifdef HUBBUB_SCAN_SSE2
+	if (len >= 16) {
+		const __m128i b0 = _mm_set1_epi8((char) set->bytes[0]);
+		const __m128i b1 = _mm_set1_epi8((char) set->bytes[1]);
+		const __m128i b2 = _mm_set1_epi8((char) set->bytes[2]);
+		const __m128i b3 = _mm_set1_epi8((char) set->bytes[3]);
+		const __m128i b4 = _mm_set1_epi8((char) set->bytes[4]);
+		const __m128i b5 = _mm_set1_epi8((char) set->bytes[5]);
+
+		for (; len - pos >= 16; pos += 16) {
+			__m128i v = _mm_loadu_si128(
+					(const __m128i *) (data + pos));
+			__m128i m;
+			int mask;
+
+			m = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, b0),
+						_mm_cmpeq_epi8(v, b1)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, b2),
+						_mm_cmpeq_epi8(v, b3)));
+			m = _mm_or_si128(m,
+				_mm_or_si128(_mm_cmpeq_epi8(v, b4),
+						_mm_cmpeq_epi8(v, b5)));
+
+			mask = _mm_movemask_epi8(m);
+			if (mask != 0)
+				return pos + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+	for (; pos < len; pos++) {
+		if (set->member[data[pos]])
+			break;
+	}
+
+	return pos;
+}
+
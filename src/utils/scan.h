@@ -0,0 +1,34 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_utils_scan_h_
+#define hubbub_utils_scan_h_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/** Maximum number of bytes in a scan set */
+#define HUBBUB_SCAN_SET_MAX 6
+
+/**
+ * Set of bytes for which to scan
+ */
+typedef struct hubbub_scan_set {
+	uint8_t bytes[HUBBUB_SCAN_SET_MAX];	/**< Members of the set,
+						 * padded by repetition */
+	uint8_t member[256];			/**< Membership table */
+} hubbub_scan_set;
+
+/** Initialise a scan set */
+void hubbub_scan_set_init(hubbub_scan_set *set,
+		const uint8_t *bytes, size_t n_bytes);
+
+/** Find the first byte in a run of data which is a member of a set */
+size_t hubbub_scan(const hubbub_scan_set *set,
+		const uint8_t *data, size_t len);
+
+#endif
+
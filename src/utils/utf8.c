@@ -0,0 +1,158 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <assert.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define HUBBUB_UTF8_SSE2 1
+#endif
+
+#include "utils/utf8.h"
+
+/**
+ * Examine the UTF-8 sequence at the start of some data
+ *
+ * \param data        Data to examine, at least one byte long
+ * \param len         Length, in bytes, of data
+ * \param bad         Pointer to location to receive length of the maximal
+ *                    subpart of an ill-formed sequence
+ * \param incomplete  Pointer to location to receive whether an ill-formed
+ *                    sequence was cut short by the end of the data
+ * \return Length of the sequence if it is well-formed, or 0 if not
+ *
+ * The ranges of each byte are those of the Unicode Standard, so overlong
+ * forms, surrogates and values beyond U+10FFFF are all ill-formed.
+ */
+static inline size_t hubbub_utf8_sequence(const uint8_t *data, size_t len,
+		size_t *bad, bool *incomplete)
+{
+	uint8_t c = data[0];
+	uint8_t lo = 0x80, hi = 0xBF;
+	size_t n, i;
+
+	if (c < 0x80) {
+		return 1;
+	} else if (c < 0xC2) {
+		n = 0;
+	} else if (c < 0xE0) {
+		n = 2;
+	} else if (c < 0xF0) {
+		n = 3;
+		if (c == 0xE0)
+			lo = 0xA0;
+		else if (c == 0xED)
+			hi = 0x9F;
+	} else if (c < 0xF5) {
+		n = 4;
+		if (c == 0xF0)
+			lo = 0x90;
+		else if (c == 0xF4)
+			hi = 0x8F;
+	} else {
+		n = 0;
+	}
+
+	*incomplete = false;
+
+	if (n == 0) {
+		*bad = 1;
+		return 0;
+	}
+
+	for (i = 1; i < n; i++) {
+		if (i == len) {
+			*bad = i;
+			*incomplete = true;
+			return 0;
+		}
+
+		if (data[i] < lo || data[i] > hi) {
+			*bad = i;
+			return 0;
+		}
+
+		/* Only the second byte has a restricted range */
+		lo = 0x80;
+		hi = 0xBF;
+	}
+
+	return n;
+}
+
+/**
+ * Find the length of the valid UTF-8 at the start of a run of data
+ *
+ * Where SSE2 is available, runs of ASCII are skipped 16 bytes at a time;
+ * only sequences of more than one byte are examined individually.
+ *
+ * \param data  Data to validate
+ * \param len   Length, in bytes, of data
+ * \return Offset of the first ill-formed (or incomplete) sequence, or len
+ *         if the data is entirely valid
+ */
+size_t hubbub_utf8_valid_length(const uint8_t *data, size_t len)
+{
+	size_t pos = 0, n, bad;
+	bool incomplete;
+
+	while (pos < len) {
+#ifdef HUBBUB_UTF8_SSE2
+		for (; len - pos >= 16; pos += 16) {
+			__m128i v = _mm_loadu_si128(
+					(const __m128i *) (data + pos));
+			int mask = _mm_movemask_epi8(v);
+
+			if (mask != 0) {
+				pos += __builtin_ctz(mask);
+				break;
+			}
+		}
+
+		if (pos == len)
+			break;
+#endif
+
+		if (data[pos] < 0x80) {
+			pos++;
+			continue;
+		}
+
+		n = hubbub_utf8_sequence(data + pos, len - pos,
+				&bad, &incomplete);
+		if (n == 0)
+			break;
+
+		pos += n;
+	}
+
+	return pos;
+}
+
+/**
+ * Find the length of an ill-formed UTF-8 sequence
+ *
+ * \param data        Data starting with an ill-formed sequence, as found
+ *                    by hubbub_utf8_valid_length
+ * \param len         Length, in bytes, of data
+ * \param incomplete  Pointer to location to receive whether the sequence
+ *                    may yet be completed by data following this
+ * \return Length of the maximal subpart of the sequence, which is to be
+ *         replaced by a single U+FFFD, or 0 if the sequence is well-formed
+ */
+size_t hubbub_utf8_invalid_length(const uint8_t *data, size_t len,
+		bool *incomplete)
+{
+	size_t bad;
+
+	assert(data != NULL && len > 0 && incomplete != NULL);
+
+	if (hubbub_utf8_sequence(data, len, &bad, incomplete) != 0)
+		return 0;
+
+	return bad;
+}
+
@@ -0,0 +1,22 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef hubbub_utils_utf8_h_
+#define hubbub_utils_utf8_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/** Find the length of the valid UTF-8 at the start of a run of data */
+size_t hubbub_utf8_valid_length(const uint8_t *data, size_t len);
+
+/** Find the length of an ill-formed UTF-8 sequence */
+size_t hubbub_utf8_invalid_length(const uint8_t *data, size_t len,
+		bool *incomplete);
+
+#endif
+
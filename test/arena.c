@@ -0,0 +1,178 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/arena.h>
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+#include "harness.h"
+
+/* A document with a little of everything */
+static const char doc[] = "<!DOCTYPE html><title>Arena</title>"
+		"<table><tr><td class=a id=b>cell &amp; more<td>cell</table>"
+		"<!-- comment --><p a=1 b=2 c=3 d=4 e=5 f=6 g=7 h=8 i=9 j=10 "
+		"k=11 l=12 m=13 n=14 o=15 p=16 q=17>many attributes</p>"
+		"<script>if (a < b) w('</p>')</script><b><i>x</b>y</i>";
+
+/* Alignment the arena must give its allocations */
+struct align {
+	char c;
+	long double d;
+};
+
+#define ALIGN offsetof(struct align, d)
+
+static void parse(hubbub_allocator_fn alloc, void *pw, token_log *l)
+{
+	hubbub_parser *parser;
+	size_t i;
+
+	assert(hubbub_parser_create("UTF-8", false, alloc, pw, &parser) ==
+			HUBBUB_OK);
+
+	log_parser(parser, l);
+
+	/* Small chunks, so that the buffers grow as they go */
+	for (i = 0; i < sizeof(doc) - 1; i += 7) {
+		size_t n = sizeof(doc) - 1 - i < 7 ? sizeof(doc) - 1 - i : 7;
+
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) doc + i, n) == HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+/* The allocation function behaves as realloc would */
+static void test_alloc(void)
+{
+	hubbub_arena *arena;
+	uint8_t *p, *q, *r, *big;
+	size_t allocs, i;
+
+	assert(hubbub_arena_create(256, counting_realloc, NULL, &arena) ==
+			HUBBUB_OK);
+
+	assert(hubbub_arena_alloc(NULL, 0, arena) == NULL);
+
+	p = hubbub_arena_alloc(NULL, 10, arena);
+	assert(p != NULL && (uintptr_t) p % ALIGN == 0);
+	memset(p, 'p', 10);
+
+	/* The latest allocation grows in place */
+	q = hubbub_arena_alloc(p, 100, arena);
+	assert(q == p);
+	memset(q + 10, 'q', 90);
+
+	/* Others move, keeping their contents */
+	r = hubbub_arena_alloc(NULL, 1, arena);
+	assert(r != NULL && (uintptr_t) r % ALIGN == 0);
+	q = hubbub_arena_alloc(p, 200, arena);
+	assert(q != p && (uintptr_t) q % ALIGN == 0);
+	for (i = 0; i < 100; i++)
+		assert(q[i] == (i < 10 ? 'p' : 'q'));
+
+	/* Shrinking is done in place */
+	assert(hubbub_arena_alloc(r, 1, arena) == r);
+	assert(hubbub_arena_alloc(q, 50, arena) == q);
+
+	/* Freeing the latest allocation gives its space back */
+	assert(hubbub_arena_alloc(q, 0, arena) == NULL);
+	assert(hubbub_arena_alloc(NULL, 16, arena) == q);
+
+	/* Larger allocations than a chunk holds get a chunk of their own */
+	big = hubbub_arena_alloc(NULL, 10000, arena);
+	assert(big != NULL && (uintptr_t) big % ALIGN == 0);
+	memset(big, 'b', 10000);
+
+	/* Only chunks of the usual size are kept */
+	allocs = mem.blocks;
+	assert(hubbub_arena_reset(arena) == HUBBUB_OK);
+	assert(mem.blocks == allocs - 1);
+
+	allocs = mem.calls;
+	p = hubbub_arena_alloc(NULL, 10, arena);
+	q = hubbub_arena_alloc(NULL, 100, arena);
+	assert(p != NULL && q != NULL && mem.calls == allocs);
+
+	assert(hubbub_arena_destroy(arena) == HUBBUB_OK);
+	assert(mem.blocks == 0);
+}
+
+/* A parser allocates from an arena */
+static void test_parser(void)
+{
+	token_log expected = { NULL, 0, 0 }, l = { NULL, 0, 0 };
+	hubbub_arena *arena;
+	size_t allocs;
+	int round;
+
+	parse(counting_realloc, NULL, &expected);
+	assert(mem.blocks == 0);
+
+	assert(hubbub_arena_create(0, counting_realloc, NULL, &arena) ==
+			HUBBUB_OK);
+
+	for (round = 0; round < 3; round++) {
+		allocs = mem.calls;
+
+		log_clear(&l);
+		parse(hubbub_arena_alloc, arena, &l);
+		assert(log_equal(&l, &expected));
+
+		/* After the first, a document needs nothing more */
+		assert(round == 0 || mem.calls == allocs);
+
+		assert(hubbub_arena_reset(arena) == HUBBUB_OK);
+	}
+
+	assert(hubbub_arena_destroy(arena) == HUBBUB_OK);
+	assert(mem.blocks == 0);
+
+	log_free(&expected);
+	log_free(&l);
+}
+
+static void test_misuse(void)
+{
+	hubbub_arena *arena;
+
+	assert(hubbub_arena_create(0, NULL, NULL, &arena) == HUBBUB_BADPARM);
+	assert(hubbub_arena_create(0, counting_realloc, NULL, NULL) ==
+			HUBBUB_BADPARM);
+	assert(hubbub_arena_create(SIZE_MAX, counting_realloc, NULL, &arena) ==
+			HUBBUB_BADPARM);
+
+	assert(hubbub_arena_create(0, counting_realloc, NULL, &arena) ==
+			HUBBUB_OK);
+	assert(hubbub_arena_alloc(NULL, SIZE_MAX, arena) == NULL);
+	assert(hubbub_arena_destroy(arena) == HUBBUB_OK);
+
+	assert(hubbub_arena_reset(NULL) == HUBBUB_BADPARM);
+	assert(hubbub_arena_destroy(NULL) == HUBBUB_BADPARM);
+	assert(mem.blocks == 0);
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	test_alloc();
+
+	test_parser();
+
+	test_misuse();
+
+	printf("PASS\n");
+
+	return 0;
+}
+
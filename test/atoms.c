@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include "utils/utils.h"
+
+#include "tokeniser/atoms.h"
+
+#include "testutils.h"
+
+#define LOOKUP(s) hubbub_atom_from_name((const uint8_t *) (s), SLEN(s))
+
+int main(int argc, char **argv)
+{
+	uint32_t atom;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(LOOKUP("a") == HUBBUB_ATOM_A);
+	assert(LOOKUP("html") == HUBBUB_ATOM_HTML);
+	assert(LOOKUP("annotation-xml") == HUBBUB_ATOM_ANNOTATION_XML);
+	assert(LOOKUP("foreignobject") == HUBBUB_ATOM_FOREIGNOBJECT);
+	assert(LOOKUP("xmp") == HUBBUB_ATOM_XMP);
+
+	/* ASCII letters match regardless of case */
+	assert(LOOKUP("HTML") == HUBBUB_ATOM_HTML);
+	assert(LOOKUP("foreignObject") == HUBBUB_ATOM_FOREIGNOBJECT);
+	assert(LOOKUP("Annotation-XML") == HUBBUB_ATOM_ANNOTATION_XML);
+	assert(LOOKUP("H1") == HUBBUB_ATOM_H1);
+
+	/* Prefixes and extensions of names are not names */
+	assert(LOOKUP("") == HUBBUB_ATOM_UNKNOWN);
+	assert(LOOKUP("h") == HUBBUB_ATOM_UNKNOWN);
+	assert(LOOKUP("h7") == HUBBUB_ATOM_UNKNOWN);
+	assert(LOOKUP("tables") == HUBBUB_ATOM_UNKNOWN);
+	assert(LOOKUP("zz") == HUBBUB_ATOM_UNKNOWN);
+	assert(LOOKUP("h\x11") == HUBBUB_ATOM_UNKNOWN);
+	assert(LOOKUP("annotation\rxml") == HUBBUB_ATOM_UNKNOWN);
+
+	assert(hubbub_atom_name(HUBBUB_ATOM_UNKNOWN) == NULL);
+
+	/* Every atom's name should resolve to that atom */
+	for (atom = HUBBUB_ATOM_UNKNOWN + 1;
+			hubbub_atom_name((hubbub_atom) atom) != NULL; atom++) {
+		const char *name = hubbub_atom_name((hubbub_atom) atom);
+
+		assert(hubbub_atom_from_name((const uint8_t *) name,
+				strlen(name)) == atom);
+	}
+
+	assert(atom == HUBBUB_ATOM_XMP + 1);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utf8.h"
+#include "utils/utils.h"
+
+#include "testutils.h"
+#include "harness.h"
+
+/* A document with a script which writes into it */
+static const char doc[] = "<p>one<script>w()</script>two</p>";
+static const char written[] = "<em>w</em>";
+
+#define S(x)   (const uint8_t *) x, sizeof(x) - 1
+
+typedef struct context {
+	token_log log;			/* Tokens seen */
+	hubbub_parser *parser;		/* Parser, for writing into */
+	bool write;			/* Whether a script writes */
+} context;
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	context *ctx = pw;
+
+	log_token(&ctx->log, token);
+
+	/* Run the script, which writes into the document */
+	if (ctx->write && token->type == HUBBUB_TOKEN_END_TAG &&
+			token->data.tag.atom == HUBBUB_ATOM_SCRIPT)
+		assert(hubbub_parser_insert_chunk(ctx->parser,
+				S(written)) == HUBBUB_OK);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_parser *create_parser(const char *enc, context *ctx)
+{
+	hubbub_parser_optparams params;
+
+	memset(ctx, 0, sizeof(*ctx));
+
+	mem.peak = mem.in_use;
+
+	assert(hubbub_parser_create(enc, false, counting_realloc, NULL,
+			&ctx->parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = ctx;
+	assert(hubbub_parser_setopt(ctx->parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	return ctx->parser;
+}
+
+static void finish(context *ctx, token_log *l)
+{
+	hubbub_parser_destroy(ctx->parser);
+	assert(mem.in_use == 0);
+
+	*l = ctx->log;
+}
+
+/* Parse a document in the usual way, a chunk at a time */
+static size_t reference(const char *enc, const uint8_t *data, size_t len,
+		token_log *l)
+{
+	context ctx;
+	size_t i;
+
+	create_parser(enc, &ctx);
+
+	for (i = 0; i < len; i += 4096) {
+		size_t n = len - i < 4096 ? len - i : 4096;
+
+		assert(hubbub_parser_parse_chunk(ctx.parser, data + i, n) ==
+				HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(ctx.parser) == HUBBUB_OK);
+
+	finish(&ctx, l);
+
+	return mem.peak;
+}
+
+/* Parse a document as a whole, from a buffer */
+static size_t parse_buffer(const char *enc, const uint8_t *data, size_t len,
+		uint32_t flags, token_log *l)
+{
+	context ctx;
+
+	create_parser(enc, &ctx);
+
+	assert(hubbub_parser_parse_buffer(ctx.parser, data, len, flags) ==
+			HUBBUB_OK);
+
+	finish(&ctx, l);
+
+	return mem.peak;
+}
+
+static void compare(token_log *l, const token_log *expected)
+{
+	assert(log_equal(l, expected));
+
+	log_free(l);
+}
+
+static void test_file(const char *path)
+{
+	const char *encs[] = { "UTF-8", NULL };
+	uint8_t *data, *copy;
+	size_t len, i;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	assert(fp != NULL);
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len + 1);
+	copy = malloc(len + 1);
+	assert(data != NULL && copy != NULL);
+	assert(fread(data, 1, len, fp) == len);
+	memcpy(copy, data, len);
+
+	fclose(fp);
+
+	for (i = 0; i < sizeof(encs) / sizeof(encs[0]); i++) {
+		token_log expected, l;
+		size_t copy_peak, borrow_peak;
+		context ctx;
+
+		reference(encs[i], data, len, &expected);
+
+		copy_peak = parse_buffer(encs[i], data, len, 0, &l);
+		compare(&l, &expected);
+
+		borrow_peak = parse_buffer(encs[i], data, len,
+				HUBBUB_PARSER_BUFFER_BORROW, &l);
+		compare(&l, &expected);
+
+		/* The document is read in place, if it can be, rather than
+		 * copied as a whole */
+		assert(memcmp(data, copy, len) == 0);
+		if (encs[i] != NULL && len >= 16384 &&
+				hubbub_utf8_valid_length(data, len) == len)
+			assert(borrow_peak + len / 2 < copy_peak);
+
+		create_parser(encs[i], &ctx);
+		assert(hubbub_parser_parse_file(ctx.parser, path) ==
+				HUBBUB_OK);
+		assert(hubbub_parser_parse_file(ctx.parser, path) ==
+				HUBBUB_INVALID);
+		finish(&ctx, &l);
+		compare(&l, &expected);
+
+		log_free(&expected);
+	}
+
+	free(copy);
+	free(data);
+}
+
+/* Write into a document which is read in place */
+static void test_write(void)
+{
+	uint8_t data[sizeof(doc)];
+	token_log expected, l;
+	context ctx;
+
+	memcpy(data, doc, sizeof(doc));
+
+	create_parser("UTF-8", &ctx);
+	ctx.write = true;
+	assert(hubbub_parser_parse_chunk(ctx.parser, S(doc)) == HUBBUB_OK);
+	assert(hubbub_parser_completed(ctx.parser) == HUBBUB_OK);
+	finish(&ctx, &expected);
+
+	create_parser("UTF-8", &ctx);
+	ctx.write = true;
+	assert(hubbub_parser_parse_buffer(ctx.parser, data, SLEN(doc),
+			HUBBUB_PARSER_BUFFER_BORROW) == HUBBUB_OK);
+	finish(&ctx, &l);
+
+	assert(strstr(l.data, "[em]w[/em]") != NULL);
+	compare(&l, &expected);
+	assert(memcmp(data, doc, sizeof(doc)) == 0);
+
+	log_free(&expected);
+}
+
+static void test_misuse(void)
+{
+	context ctx;
+
+	create_parser("UTF-8", &ctx);
+
+	assert(hubbub_parser_parse_buffer(ctx.parser, NULL, 0, 0) ==
+			HUBBUB_BADPARM);
+	assert(hubbub_parser_parse_file(ctx.parser, NULL) == HUBBUB_BADPARM);
+	assert(hubbub_parser_parse_file(ctx.parser, "no/such/file") ==
+			HUBBUB_FILENOTFOUND);
+
+	hubbub_parser_destroy(ctx.parser);
+	assert(mem.in_use == 0);
+	log_free(&ctx.log);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	test_file(argv[1]);
+
+	test_write();
+
+	test_misuse();
+
+	printf("PASS\n");
+
+	return 0;
+}
+
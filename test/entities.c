@@ -1,3 +1,4 @@
+#include "utils/utils.h"
 #include "tokeniser/entities.h"
 
 #include "testutils.h"
@@ -6,6 +7,7 @@ int main(int argc, char **argv)
 {
 	uint32_t result;
 	int32_t context = -1;
+	size_t used, match;
 
 	UNUSED(argc);
 	UNUSED(argv);
@@ -31,6 +33,40 @@ int main(int argc, char **argv)
 	assert(hubbub_entities_search_step('z', &result, &context) ==
 			HUBBUB_INVALID);
 
+	/* Whole spans: the longest match wins */
+	context = -1;
+	assert(hubbub_entities_search((const uint8_t *) "notin;x",
+			SLEN("notin;x"), &context, &used, &match, &result) ==
+			HUBBUB_OK);
+	assert(used == SLEN("notin;") && match == SLEN("notin;") &&
+			result == 0x2209);
+
+	/* Falling back to a shorter match */
+	context = -1;
+	assert(hubbub_entities_search((const uint8_t *) "notit",
+			SLEN("notit"), &context, &used, &match, &result) ==
+			HUBBUB_OK);
+	assert(used == SLEN("noti") && match == SLEN("not") &&
+			result == 0xAC);
+
+	/* Resuming a search across spans */
+	context = -1;
+	assert(hubbub_entities_search((const uint8_t *) "am",
+			SLEN("am"), &context, &used, &match, &result) ==
+			HUBBUB_NEEDDATA);
+	assert(used == SLEN("am") && match == 0);
+	assert(hubbub_entities_search((const uint8_t *) "p;",
+			SLEN("p;"), &context, &used, &match, &result) ==
+			HUBBUB_OK);
+	assert(used == SLEN("p;") && match == SLEN("p;") && result == '&');
+
+	/* No match at all */
+	context = -1;
+	assert(hubbub_entities_search((const uint8_t *) "\xc3\xa9",
+			SLEN("\xc3\xa9"), &context, &used, &match, &result) ==
+			HUBBUB_OK);
+	assert(used == 0 && match == 0);
+
 	printf("PASS\n");
 
 	return 0;
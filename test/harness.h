@@ -0,0 +1,535 @@
+#ifndef hubbub_test_harness_h_
+#define hubbub_test_harness_h_
+
+/* Fixtures shared by the tests which drive a whole parser. Include this
+ * after testutils.h, whose assert it uses. */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+/* Use of memory allocated through counting_realloc */
+typedef struct alloc_counts {
+	size_t blocks;			/* Blocks not yet freed */
+	size_t calls;			/* Calls which allocate, rather than
+					 * free */
+	size_t in_use;			/* Bytes not yet freed */
+	size_t peak;			/* Most bytes in use at once */
+} alloc_counts;
+
+alloc_counts mem;
+
+/* Header of a block allocated through counting_realloc, aligned as
+ * malloc's */
+typedef union alloc_header {
+	size_t size;
+	long double align;
+} alloc_header;
+
+void *counting_realloc(void *ptr, size_t len, void *pw);
+
+/**
+ * Allocator which keeps count of its use in mem
+ *
+ * \param ptr  Block to resize or free, or NULL to allocate a new one
+ * \param len  Size, in bytes, to make block, or 0 to free it
+ * \param pw   Ignored
+ * \return Pointer to block, or NULL if it was freed, or on failure
+ */
+void *counting_realloc(void *ptr, size_t len, void *pw)
+{
+	alloc_header *h = ptr;
+
+	UNUSED(pw);
+
+	if (h != NULL) {
+		h--;
+		mem.in_use -= h->size;
+	}
+
+	if (len == 0) {
+		if (h != NULL)
+			mem.blocks--;
+		free(h);
+		return NULL;
+	}
+
+	mem.calls++;
+
+	ptr = realloc(h, sizeof(alloc_header) + len);
+	if (ptr == NULL) {
+		if (h != NULL)
+			mem.in_use += h->size;
+		return NULL;
+	}
+
+	if (h == NULL)
+		mem.blocks++;
+
+	h = ptr;
+	h->size = len;
+	mem.in_use += len;
+	if (mem.in_use > mem.peak)
+		mem.peak = mem.in_use;
+
+	return h + 1;
+}
+
+
+/* The tokens seen, flattened to text so that runs of character data
+ * compare the same however they're split up */
+typedef struct token_log {
+	char *data;
+	size_t len;
+	size_t size;
+} token_log;
+
+void log_append(token_log *l, const char *s, size_t len);
+void log_string(token_log *l, const hubbub_string *str);
+void log_token(token_log *l, const hubbub_token *token);
+hubbub_error log_token_handler(const hubbub_token *token, void *pw);
+void log_parser(hubbub_parser *parser, token_log *l);
+bool log_equal(const token_log *a, const token_log *b);
+void log_clear(token_log *l);
+void log_free(token_log *l);
+
+/**
+ * Append text to a token log
+ *
+ * \param l    Log to append to
+ * \param s    Text to append
+ * \param len  Length, in bytes, of text
+ */
+void log_append(token_log *l, const char *s, size_t len)
+{
+	if (l->len + len >= l->size) {
+		while (l->len + len >= l->size)
+			l->size = l->size == 0 ? 4096 : l->size * 2;
+
+		l->data = realloc(l->data, l->size);
+		assert(l->data != NULL);
+	}
+
+	memcpy(l->data + l->len, s, len);
+	l->len += len;
+	l->data[l->len] = '\0';
+}
+
+/**
+ * Append a string to a token log
+ *
+ * \param l    Log to append to
+ * \param str  String to append
+ */
+void log_string(token_log *l, const hubbub_string *str)
+{
+	log_append(l, (const char *) str->ptr, str->len);
+}
+
+/**
+ * Append a token to a token log
+ *
+ * \param l      Log to append to
+ * \param token  Token to append
+ */
+void log_token(token_log *l, const hubbub_token *token)
+{
+	uint32_t i;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		log_append(l, "[!", 2);
+		log_string(l, &token->data.doctype.name);
+		log_append(l, "]", 1);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		log_append(l, token->type == HUBBUB_TOKEN_START_TAG ?
+				"[" : "[/", token->type ==
+				HUBBUB_TOKEN_START_TAG ? 1 : 2);
+		log_string(l, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			log_append(l, " ", 1);
+			log_string(l, &token->data.tag.attributes[i].name);
+			log_append(l, "=", 1);
+			log_string(l, &token->data.tag.attributes[i].value);
+		}
+		log_append(l, "]", 1);
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		log_append(l, "[--", 3);
+		log_string(l, &token->data.comment);
+		log_append(l, "]", 1);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		log_string(l, &token->data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		log_append(l, "[EOF]", 5);
+		break;
+	}
+}
+
+/**
+ * Token handler which appends each token to the log given as its data
+ */
+hubbub_error log_token_handler(const hubbub_token *token, void *pw)
+{
+	log_token(pw, token);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Have a parser append the tokens it emits to a log
+ *
+ * \param parser  Parser instance
+ * \param l       Log to append to
+ */
+void log_parser(hubbub_parser *parser, token_log *l)
+{
+	hubbub_parser_optparams params;
+
+	params.token_handler.handler = log_token_handler;
+	params.token_handler.pw = l;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+}
+
+/**
+ * Determine if two token logs hold the same tokens
+ */
+bool log_equal(const token_log *a, const token_log *b)
+{
+	return a->len == b->len &&
+			(a->len == 0 || memcmp(a->data, b->data, a->len) == 0);
+}
+
+/**
+ * Empty a token log, keeping its storage
+ */
+void log_clear(token_log *l)
+{
+	l->len = 0;
+	if (l->data != NULL)
+		l->data[0] = '\0';
+}
+
+/**
+ * Empty a token log, and free its storage
+ */
+void log_free(token_log *l)
+{
+	free(l->data);
+	l->data = NULL;
+	l->len = l->size = 0;
+}
+
+
+/* A minimal tree, of nodes which know only their parents and the number
+ * of references held to them. Nodes are numbered from 1. */
+typedef struct stub_node {
+	uintptr_t parent;
+	bool element;
+	uint32_t refs;
+} stub_node;
+
+struct {
+	stub_node *nodes;
+	uintptr_t n_nodes;
+	uintptr_t n_text;		/* Number of text nodes created */
+} stub_tree;
+
+#define STUB_NODE(n) (&stub_tree.nodes[(uintptr_t) (n) - 1])
+
+void *stub_new_node(bool element);
+void stub_tree_clear(void);
+hubbub_error stub_create_comment(void *ctx, const hubbub_string *data,
+		void **result);
+hubbub_error stub_create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result);
+hubbub_error stub_create_element(void *ctx, const hubbub_tag *tag,
+		void **result);
+hubbub_error stub_create_text(void *ctx, const hubbub_string *data,
+		void **result);
+hubbub_error stub_ref_node(void *ctx, void *node);
+hubbub_error stub_unref_node(void *ctx, void *node);
+hubbub_error stub_append_child(void *ctx, void *parent, void *child,
+		void **result);
+hubbub_error stub_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result);
+hubbub_error stub_remove_child(void *ctx, void *parent, void *child,
+		void **result);
+hubbub_error stub_clone_node(void *ctx, void *node, bool deep,
+		void **result);
+hubbub_error stub_reparent_children(void *ctx, void *node,
+		void *new_parent);
+hubbub_error stub_get_parent(void *ctx, void *node, bool element_only,
+		void **result);
+hubbub_error stub_has_children(void *ctx, void *node, bool *result);
+hubbub_error stub_form_associate(void *ctx, void *form, void *node);
+hubbub_error stub_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes);
+hubbub_error stub_set_quirks_mode(void *ctx, hubbub_quirks_mode mode);
+hubbub_error stub_complete_script(void *ctx, void *script);
+hubbub_error stub_complete_style(void *ctx, void *style);
+
+/**
+ * Create a node of the stub tree, with one reference held to it
+ *
+ * \param element  Whether the node is an element
+ * \return Node
+ */
+void *stub_new_node(bool element)
+{
+	stub_node *n;
+
+	stub_tree.nodes = realloc(stub_tree.nodes,
+			(stub_tree.n_nodes + 1) * sizeof(stub_node));
+	assert(stub_tree.nodes != NULL);
+
+	n = &stub_tree.nodes[stub_tree.n_nodes++];
+	n->parent = 0;
+	n->element = element;
+	n->refs = 1;
+
+	return (void *) stub_tree.n_nodes;
+}
+
+/**
+ * Discard every node of the stub tree
+ */
+void stub_tree_clear(void)
+{
+	free(stub_tree.nodes);
+	memset(&stub_tree, 0, sizeof(stub_tree));
+}
+
+hubbub_error stub_create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(data);
+
+	*result = stub_new_node(false);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(doctype);
+
+	*result = stub_new_node(false);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(tag);
+
+	*result = stub_new_node(true);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(data);
+
+	stub_tree.n_text++;
+	*result = stub_new_node(false);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_ref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+
+	STUB_NODE(node)->refs++;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_unref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+
+	assert(STUB_NODE(node)->refs > 0);
+	STUB_NODE(node)->refs--;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	STUB_NODE(child)->parent = (uintptr_t) parent;
+
+	stub_ref_node(ctx, child);
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ref_child);
+
+	return stub_append_child(ctx, parent, child, result);
+}
+
+hubbub_error stub_remove_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(parent);
+
+	STUB_NODE(child)->parent = 0;
+
+	stub_ref_node(ctx, child);
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(deep);
+
+	*result = stub_new_node(STUB_NODE(node)->element);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	uintptr_t i;
+
+	UNUSED(ctx);
+
+	for (i = 0; i < stub_tree.n_nodes; i++) {
+		if (stub_tree.nodes[i].parent == (uintptr_t) node)
+			stub_tree.nodes[i].parent = (uintptr_t) new_parent;
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	uintptr_t parent = STUB_NODE(node)->parent;
+
+	if (parent != 0 && element_only &&
+			STUB_NODE(parent)->element == false)
+		parent = 0;
+
+	if (parent != 0)
+		stub_ref_node(ctx, (void *) parent);
+
+	*result = (void *) parent;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_has_children(void *ctx, void *node, bool *result)
+{
+	uintptr_t i;
+
+	UNUSED(ctx);
+
+	*result = false;
+
+	for (i = 0; i < stub_tree.n_nodes; i++) {
+		if (stub_tree.nodes[i].parent == (uintptr_t) node)
+			*result = true;
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_form_associate(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(form);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_complete_script(void *ctx, void *script)
+{
+	UNUSED(ctx);
+	UNUSED(script);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error stub_complete_style(void *ctx, void *style)
+{
+	UNUSED(ctx);
+	UNUSED(style);
+
+	return HUBBUB_OK;
+}
+
+hubbub_tree_handler stub_tree_handler = {
+	stub_create_comment,
+	stub_create_doctype,
+	stub_create_element,
+	stub_create_text,
+	stub_ref_node,
+	stub_unref_node,
+	stub_append_child,
+	stub_insert_before,
+	stub_remove_child,
+	stub_clone_node,
+	stub_reparent_children,
+	stub_get_parent,
+	stub_has_children,
+	stub_form_associate,
+	stub_add_attributes,
+	stub_set_quirks_mode,
+	NULL,
+	stub_complete_script,
+	stub_complete_style,
+	NULL
+};
+
+#endif
@@ -0,0 +1,569 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+#include "harness.h"
+
+/* Limits on the size of tokens, low enough that the document below
+ * exceeds them in every way */
+#define MAX_TOKEN_BYTES 64
+#define MAX_ATTRIBUTES 8
+
+/* Limit on the number of open elements */
+#define MAX_DEPTH 32
+
+/* A document to be parsed, built up as it's written */
+typedef struct document {
+	uint8_t *data;
+	size_t len;
+} document;
+
+#define S(x)   x, sizeof(x) - 1
+
+static void doc_append(document *doc, const char *s, size_t len)
+{
+	doc->data = realloc(doc->data, doc->len + len);
+	assert(doc->data != NULL);
+
+	memcpy(doc->data + doc->len, s, len);
+	doc->len += len;
+}
+
+static void doc_repeat(document *doc, const char *s, size_t len, int n)
+{
+	while (n-- > 0)
+		doc_append(doc, s, len);
+}
+
+/* One token, with its strings flattened: the name and then the names
+ * and values of the attributes of a tag, the text of a comment, or the
+ * name and identifiers of a doctype */
+typedef struct record {
+	hubbub_token_type type;
+	uint32_t n_strings;
+	hubbub_string strings[2 + 2 * 128];
+} record;
+
+typedef struct recording {
+	record *tokens;
+	size_t n_tokens;
+
+	uint8_t *chars;			/* Character data, concatenated */
+	size_t n_chars;
+	size_t max_chars;		/* Longest character token */
+} recording;
+
+static const uint8_t *copy_of(const uint8_t *ptr, size_t len)
+{
+	uint8_t *copy = malloc(len + 1);
+
+	assert(copy != NULL);
+	memcpy(copy, ptr, len);
+
+	return copy;
+}
+
+static void add_string(record *rec, const hubbub_string *str)
+{
+	assert(rec->n_strings < sizeof(rec->strings) / sizeof(rec->strings[0]));
+
+	rec->strings[rec->n_strings].ptr = copy_of(str->ptr, str->len);
+	rec->strings[rec->n_strings].len = str->len;
+	rec->n_strings++;
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	recording *rec = pw;
+	record *r;
+	uint32_t i;
+
+	if (token->type == HUBBUB_TOKEN_CHARACTER) {
+		rec->chars = realloc(rec->chars,
+				rec->n_chars + token->data.character.len);
+		assert(rec->chars != NULL);
+
+		memcpy(rec->chars + rec->n_chars, token->data.character.ptr,
+				token->data.character.len);
+		rec->n_chars += token->data.character.len;
+
+		if (token->data.character.len > rec->max_chars)
+			rec->max_chars = token->data.character.len;
+
+		return HUBBUB_OK;
+	}
+
+	rec->tokens = realloc(rec->tokens,
+			(rec->n_tokens + 1) * sizeof(record));
+	assert(rec->tokens != NULL);
+
+	r = &rec->tokens[rec->n_tokens++];
+	r->type = token->type;
+	r->n_strings = 0;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		add_string(r, &token->data.doctype.name);
+		add_string(r, &token->data.doctype.public_id);
+		add_string(r, &token->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		add_string(r, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			add_string(r, &token->data.tag.attributes[i].name);
+			add_string(r, &token->data.tag.attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		add_string(r, &token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static void recording_free(recording *rec)
+{
+	size_t i;
+	uint32_t j;
+
+	for (i = 0; i < rec->n_tokens; i++) {
+		for (j = 0; j < rec->tokens[i].n_strings; j++)
+			free((void *) rec->tokens[i].strings[j].ptr);
+	}
+
+	free(rec->tokens);
+	free(rec->chars);
+}
+
+/* Whether a string ends with a whole UTF-8 character */
+static bool ends_whole(const hubbub_string *str)
+{
+	size_t i = str->len, n = 0;
+
+	while (i > 0 && (str->ptr[i - 1] & 0xc0) == 0x80) {
+		i--;
+		n++;
+	}
+
+	if (i == 0)
+		return n == 0;
+
+	if (str->ptr[i - 1] < 0x80)
+		return n == 0;
+	if (str->ptr[i - 1] < 0xe0)
+		return n == 1;
+	if (str->ptr[i - 1] < 0xf0)
+		return n == 2;
+
+	return n == 3;
+}
+
+static void tokenise(const document *doc, size_t chunk_size, bool limit,
+		recording *rec)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	size_t i;
+
+	memset(rec, 0, sizeof(recording));
+
+	assert(hubbub_parser_create("UTF-8", false, counting_realloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = rec;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.coalesce_characters = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_COALESCE_CHARACTERS,
+			&params) == HUBBUB_OK);
+
+	if (limit) {
+		memset(&params, 0, sizeof(params));
+		params.limits.max_token_bytes = MAX_TOKEN_BYTES;
+		params.limits.max_attributes = MAX_ATTRIBUTES;
+		assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_LIMITS,
+				&params) == HUBBUB_OK);
+	}
+
+	for (i = 0; i < doc->len; i += chunk_size) {
+		size_t len = doc->len - i < chunk_size ? doc->len - i :
+				chunk_size;
+
+		assert(hubbub_parser_parse_chunk(parser, doc->data + i, len) ==
+				HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+static void build_token_document(document *doc)
+{
+	char buf[64];
+	int i;
+
+	/* A long doctype */
+	doc_append(doc, S("<!DOCTYPE "));
+	doc_repeat(doc, S("h"), 50);
+	doc_append(doc, S(" PUBLIC \""));
+	doc_repeat(doc, S("p"), 50);
+	doc_append(doc, S("\">"));
+
+	/* Long comments, in place and copied on account of the NUL */
+	doc_append(doc, S("<!--"));
+	doc_repeat(doc, S("c"), 100);
+	doc_append(doc, S("-->"));
+	doc_append(doc, S("<!--"));
+	doc_repeat(doc, S("c"), 30);
+	doc_append(doc, S("\0"));
+	doc_repeat(doc, S("\xc3\xa9"), 50);
+	doc_append(doc, S("-->"));
+
+	/* Too many attributes */
+	doc_append(doc, S("<p"));
+	for (i = 0; i < 20; i++) {
+		sprintf(buf, " a%d=%d", i, i);
+		doc_append(doc, buf, strlen(buf));
+	}
+	doc_append(doc, S(">"));
+
+	/* Long attribute values, in place and copied */
+	doc_append(doc, S("<p title=\""));
+	doc_repeat(doc, S("t"), 20);
+	doc_append(doc, S("&amp;"));
+	doc_repeat(doc, S("\xe2\x82\xac"), 20);
+	doc_append(doc, S("\" id=x>"));
+	doc_append(doc, S("<p class="));
+	doc_repeat(doc, S("v"), 100);
+	doc_append(doc, S(" id=y>"));
+
+	/* A long tag name, and attributes cut off entirely */
+	doc_append(doc, S("<"));
+	doc_repeat(doc, S("N"), 100);
+	doc_append(doc, S(" a b c>"));
+
+	/* Long runs of text, in place and normalised */
+	doc_repeat(doc, S("x"), 300);
+	doc_repeat(doc, S("y\r\n"), 100);
+	doc_repeat(doc, S("\xc3\xa9\0"), 100);
+	doc_append(doc, S("</p>"));
+}
+
+static void test_token_limits(size_t chunk_size)
+{
+	document doc = { NULL, 0 };
+	recording full, limited;
+	size_t i;
+	uint32_t j;
+
+	build_token_document(&doc);
+
+	tokenise(&doc, chunk_size, false, &full);
+	tokenise(&doc, chunk_size, true, &limited);
+
+	/* Text is split, rather than cut off */
+	assert(limited.n_chars == full.n_chars);
+	assert(memcmp(limited.chars, full.chars, full.n_chars) == 0);
+	assert(full.max_chars > MAX_TOKEN_BYTES);
+	assert(limited.max_chars <= MAX_TOKEN_BYTES);
+
+	/* Other tokens are cut off: their strings are prefixes of those
+	 * of the whole tokens */
+	assert(limited.n_tokens == full.n_tokens);
+
+	for (i = 0; i < full.n_tokens; i++) {
+		const record *f = &full.tokens[i];
+		const record *l = &limited.tokens[i];
+		size_t total = 0;
+
+		assert(l->type == f->type);
+		assert(l->n_strings <= f->n_strings);
+
+		if (l->type == HUBBUB_TOKEN_START_TAG)
+			assert(l->n_strings <= 1 + 2 * MAX_ATTRIBUTES);
+		else
+			assert(l->n_strings == f->n_strings);
+
+		for (j = 0; j < l->n_strings; j++) {
+			assert(l->strings[j].len <= f->strings[j].len);
+			assert(memcmp(l->strings[j].ptr, f->strings[j].ptr,
+					l->strings[j].len) == 0);
+			assert(ends_whole(&l->strings[j]));
+
+			total += l->strings[j].len;
+		}
+
+		assert(total <= MAX_TOKEN_BYTES);
+	}
+
+	recording_free(&full);
+	recording_free(&limited);
+	free(doc.data);
+}
+
+/* Number of elements from the document to the deepest element, inclusive */
+static uint32_t tree_depth(void)
+{
+	uint32_t max = 0;
+	uintptr_t i;
+
+	for (i = 1; i <= stub_tree.n_nodes; i++) {
+		uint32_t depth = 0;
+		uintptr_t n;
+
+		for (n = i; n != 0; n = STUB_NODE(n)->parent) {
+			if (STUB_NODE(n)->element)
+				depth++;
+		}
+
+		if (depth > max)
+			max = depth;
+	}
+
+	return max;
+}
+
+/* Number of elements in the tree */
+static uintptr_t tree_elements(void)
+{
+	uintptr_t i, n = 0;
+
+	for (i = 1; i <= stub_tree.n_nodes; i++) {
+		if (STUB_NODE(i)->element && STUB_NODE(i)->parent != 0)
+			n++;
+	}
+
+	return n;
+}
+
+/* Memory in use once the parser was created */
+static size_t created_use;
+
+static hubbub_error build_tree(const document *doc, uint32_t max_depth,
+		size_t max_alloc_bytes)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_error error;
+
+	stub_tree_clear();
+
+	mem.peak = mem.in_use;
+
+	assert(hubbub_parser_create_limited("UTF-8", false, max_alloc_bytes,
+			counting_realloc, NULL, &parser) == HUBBUB_OK);
+	created_use = mem.in_use;
+
+	params.tree_handler = &stub_tree_handler;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.document_node = stub_new_node(false);
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params) == HUBBUB_OK);
+
+	memset(&params, 0, sizeof(params));
+	params.limits.max_depth = max_depth;
+	params.limits.max_alloc_bytes = max_alloc_bytes;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_LIMITS,
+			&params) == HUBBUB_OK);
+
+	error = hubbub_parser_parse_chunk(parser, doc->data, doc->len);
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	hubbub_parser_destroy(parser);
+
+	assert(mem.in_use == 0);
+
+	return error;
+}
+
+static void build_tree_document(document *doc)
+{
+	/* Formatting elements to be reopened as the limit is reached, a
+	 * table whose structure is implied, and deeply nested elements */
+	doc_repeat(doc, S("<div>"), MAX_DEPTH - 4);
+	doc_repeat(doc, S("<p><b><i><u><s><em>x</p>y"), 4);
+	doc_append(doc, S("<table><td>z</table>"));
+	doc_repeat(doc, S("<div>"), 100);
+	doc_repeat(doc, S("<span>"), 100);
+	doc_append(doc, S("</p>w"));
+}
+
+static void test_depth_limit(void)
+{
+	document doc = { NULL, 0 };
+	uintptr_t n_text, n_elements;
+
+	build_tree_document(&doc);
+
+	assert(build_tree(&doc, 0, 0) == HUBBUB_OK);
+	assert(tree_depth() > MAX_DEPTH);
+	n_text = stub_tree.n_text;
+
+	/* Elements beyond the limit are left out, but not their text */
+	assert(build_tree(&doc, MAX_DEPTH, 0) == HUBBUB_OK);
+	assert(tree_depth() == MAX_DEPTH);
+	assert(stub_tree.n_text > 0 && stub_tree.n_text <= n_text);
+
+	free(doc.data);
+
+	/* Once the stack is full, void elements are still inserted, and
+	 * so are elements which close others to make room */
+	memset(&doc, 0, sizeof(doc));
+	doc_repeat(&doc, S("<div>"), MAX_DEPTH - 3);
+	doc_append(&doc, S("<p>a<br><img><input>b<p>c<li>d<li>e<hr>f"));
+	doc_append(&doc, S("<select><option>g<option>h</select>"));
+
+	assert(build_tree(&doc, 0, 0) == HUBBUB_OK);
+	assert(tree_depth() == MAX_DEPTH + 2);
+	n_elements = tree_elements();
+
+	/* Only the select element and its options are left out. The void
+	 * elements are children of those at the limit */
+	assert(build_tree(&doc, MAX_DEPTH, 0) == HUBBUB_OK);
+	assert(tree_depth() == MAX_DEPTH + 1);
+	assert(tree_elements() == n_elements - 3);
+
+	free(doc.data);
+}
+
+static void test_alloc_limit(void)
+{
+	document doc = { NULL, 0 };
+	size_t peak, budget, unlimited_use;
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+
+	/* A parser without a limit leaves its allocator's blocks alone */
+	assert(hubbub_parser_create("UTF-8", false, counting_realloc, NULL,
+			&parser) == HUBBUB_OK);
+	unlimited_use = mem.in_use;
+
+	memset(&params, 0, sizeof(params));
+	params.limits.max_alloc_bytes = SIZE_MAX;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_LIMITS,
+			&params) == HUBBUB_BADPARM);
+
+	hubbub_parser_destroy(parser);
+	assert(mem.in_use == 0);
+
+	build_token_document(&doc);
+	build_tree_document(&doc);
+
+	/* Counting allocations adds a header to each block */
+	assert(build_tree(&doc, 0, SIZE_MAX) == HUBBUB_OK);
+	assert(created_use > unlimited_use);
+	peak = mem.peak;
+
+	/* The parse either fits in the budget or fails cleanly */
+	for (budget = created_use; budget < peak; budget += 256) {
+		assert(build_tree(&doc, 0, budget) == HUBBUB_NOMEM);
+		assert(mem.peak <= budget);
+	}
+
+	assert(build_tree(&doc, 0, peak) == HUBBUB_OK);
+	assert(mem.peak == peak);
+
+	free(doc.data);
+}
+
+/* Parse a token that never ends, of megabytes of the given filler */
+static hubbub_error build_unending(const char *open, size_t open_len,
+		char fill, size_t max_alloc_bytes)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_error error;
+	uint8_t chunk[4096];
+	int i;
+
+	stub_tree_clear();
+
+	mem.peak = mem.in_use;
+
+	assert(hubbub_parser_create_limited("UTF-8", false, max_alloc_bytes,
+			counting_realloc, NULL, &parser) == HUBBUB_OK);
+
+	params.tree_handler = &stub_tree_handler;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.document_node = stub_new_node(false);
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params) == HUBBUB_OK);
+
+	memset(&params, 0, sizeof(params));
+	params.limits.max_token_bytes = 1024;
+	params.limits.max_alloc_bytes = max_alloc_bytes;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_LIMITS,
+			&params) == HUBBUB_OK);
+
+	memset(chunk, fill, sizeof(chunk));
+
+	error = hubbub_parser_parse_chunk(parser,
+			(const uint8_t *) open, open_len);
+	for (i = 0; error == HUBBUB_OK && i < 1024; i++)
+		error = hubbub_parser_parse_chunk(parser, chunk, sizeof(chunk));
+	if (error == HUBBUB_OK)
+		error = hubbub_parser_completed(parser);
+
+	hubbub_parser_destroy(parser);
+
+	assert(mem.in_use == 0);
+
+	return error;
+}
+
+static void test_unending_tokens(void)
+{
+	/* Far less than the 4MB of each token */
+	const size_t budget = 256 * 1024;
+
+	/* Only as much input as the limit on their size is kept */
+	assert(build_unending(S("<a b=\""), 'v', budget) == HUBBUB_OK);
+	assert(build_unending(S("<abc"), 'c', budget) == HUBBUB_OK);
+	assert(build_unending(S("<a "), ' ', budget) == HUBBUB_OK);
+	assert(build_unending(S("<!--"), 'c', budget) == HUBBUB_OK);
+	assert(build_unending(S("<?"), 'c', budget) == HUBBUB_OK);
+	assert(build_unending(S("<!DOCTYPE a PUBLIC \""), 'p', budget) ==
+			HUBBUB_OK);
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	test_token_limits(SIZE_MAX);
+	test_token_limits(1);
+
+	test_depth_limit();
+	test_alloc_limit();
+	test_unending_tokens();
+
+	stub_tree_clear();
+
+	printf("PASS\n");
+
+	return 0;
+}
+
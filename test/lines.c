@@ -0,0 +1,255 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/lines.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* A document with the line breaks, replacements and markup that are
+ * advanced over in part before their tokens are emitted */
+static const uint8_t doc[] = "<!DOCTYPE html>\r\n<p class=x>a&amp;b</p>"
+		"<!-- c -->\0\xc3\xa9\r<br/>";
+
+#define DOC_LEN (sizeof(doc) - 1)
+
+typedef struct {
+	hubbub_token_type type;
+	size_t start;
+	size_t end;
+} expectation;
+
+static const expectation expected[] = {
+	{ HUBBUB_TOKEN_DOCTYPE,		0,	15 },
+	{ HUBBUB_TOKEN_CHARACTER,	16,	17 },	/* LF of CRLF */
+	{ HUBBUB_TOKEN_START_TAG,	17,	28 },
+	{ HUBBUB_TOKEN_CHARACTER,	28,	29 },
+	{ HUBBUB_TOKEN_CHARACTER,	29,	34 },	/* &amp; */
+	{ HUBBUB_TOKEN_CHARACTER,	34,	35 },
+	{ HUBBUB_TOKEN_END_TAG,		35,	39 },
+	{ HUBBUB_TOKEN_COMMENT,		39,	49 },
+	{ HUBBUB_TOKEN_CHARACTER,	49,	50 },	/* NUL */
+	{ HUBBUB_TOKEN_CHARACTER,	50,	52 },
+	{ HUBBUB_TOKEN_CHARACTER,	52,	53 },	/* CR */
+	{ HUBBUB_TOKEN_START_TAG,	53,	58 },
+	{ HUBBUB_TOKEN_EOF,		58,	58 },
+};
+
+/* A document starting with a byte order mark, which is not counted */
+static const uint8_t bom_doc[] = "\xef\xbb\xbf<p>\na";
+
+static const expectation bom_expected[] = {
+	{ HUBBUB_TOKEN_START_TAG,	0,	3 },
+	{ HUBBUB_TOKEN_CHARACTER,	3,	5 },
+	{ HUBBUB_TOKEN_EOF,		5,	5 },
+};
+
+/* A document into which "<i>" is written after its first tag, which is
+ * counted as though it were part of the input */
+static const uint8_t insert_doc[] = "<p>x\ny";
+
+static const expectation insert_expected[] = {
+	{ HUBBUB_TOKEN_START_TAG,	0,	3 },
+	{ HUBBUB_TOKEN_START_TAG,	3,	6 },	/* Inserted */
+	{ HUBBUB_TOKEN_CHARACTER,	6,	9 },
+	{ HUBBUB_TOKEN_EOF,		9,	9 },
+};
+
+typedef struct {
+	hubbub_parser *parser;
+	const expectation *expected;
+	size_t n_expected;
+	size_t n_tokens;
+	bool insert;		/* Whether to insert after the first token */
+} context;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	context *ctx = pw;
+	const expectation *e;
+
+	assert(ctx->n_tokens < ctx->n_expected);
+	e = &ctx->expected[ctx->n_tokens];
+
+	assert(token->type == e->type);
+	assert(token->start == e->start);
+	assert(token->end == e->end);
+
+	if (ctx->insert && ctx->n_tokens == 0)
+		assert(hubbub_parser_insert_chunk(ctx->parser,
+				(const uint8_t *) "<i>", SLEN("<i>")) ==
+				HUBBUB_OK);
+
+	ctx->n_tokens++;
+
+	return HUBBUB_OK;
+}
+
+static void parse(const char *enc, const uint8_t *data, size_t len,
+		size_t chunk_size, const expectation *e, size_t n_expected,
+		bool insert)
+{
+	hubbub_parser_optparams params;
+	context ctx;
+	size_t i;
+
+	ctx.expected = e;
+	ctx.n_expected = n_expected;
+	ctx.n_tokens = 0;
+	ctx.insert = insert;
+
+	assert(hubbub_parser_create(enc, false, myrealloc, NULL,
+			&ctx.parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = &ctx;
+	assert(hubbub_parser_setopt(ctx.parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	for (i = 0; i < len; i += chunk_size) {
+		size_t n = len - i < chunk_size ? len - i : chunk_size;
+
+		assert(hubbub_parser_parse_chunk(ctx.parser, data + i, n) ==
+				HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(ctx.parser) == HUBBUB_OK);
+
+	assert(ctx.n_tokens == n_expected);
+
+	hubbub_parser_destroy(ctx.parser);
+}
+
+static void test_offsets(size_t chunk_size)
+{
+	parse("UTF-8", doc, DOC_LEN, chunk_size,
+			expected, N_ELEMENTS(expected), false);
+}
+
+static void test_line_index(void)
+{
+	hubbub_line_index *index;
+	uint32_t line, col;
+
+	assert(hubbub_line_index_create(doc, DOC_LEN, myrealloc, NULL,
+			&index) == HUBBUB_OK);
+
+	assert(hubbub_line_index_locate(index, 0, &line, &col) == HUBBUB_OK);
+	assert(line == 1 && col == 1);
+
+	/* A CRLF is a single line break */
+	assert(hubbub_line_index_locate(index, 16, &line, &col) == HUBBUB_OK);
+	assert(line == 1 && col == 17);
+	assert(hubbub_line_index_locate(index, 17, &line, &col) == HUBBUB_OK);
+	assert(line == 2 && col == 1);
+
+	/* Columns count characters, not bytes */
+	assert(hubbub_line_index_locate(index, 52, &line, &col) == HUBBUB_OK);
+	assert(line == 2 && col == 35);
+
+	/* As is a lone CR */
+	assert(hubbub_line_index_locate(index, 55, &line, &col) == HUBBUB_OK);
+	assert(line == 3 && col == 3);
+
+	assert(hubbub_line_index_locate(index, DOC_LEN, &line, &col) ==
+			HUBBUB_OK);
+	assert(line == 3 && col == 6);
+
+	assert(hubbub_line_index_locate(index, DOC_LEN + 1, &line, &col) ==
+			HUBBUB_BADPARM);
+
+	assert(hubbub_line_index_destroy(index) == HUBBUB_OK);
+
+	/* An empty document has one, empty, line */
+	assert(hubbub_line_index_create(NULL, 0, myrealloc, NULL,
+			&index) == HUBBUB_OK);
+	assert(hubbub_line_index_locate(index, 0, &line, &col) == HUBBUB_OK);
+	assert(line == 1 && col == 1);
+	assert(hubbub_line_index_destroy(index) == HUBBUB_OK);
+}
+
+static void test_bom(void)
+{
+	hubbub_line_index *index;
+	uint32_t line, col;
+
+	/* Whether the parser is told the input is UTF-8, or finds it so */
+	parse("UTF-8", bom_doc, SLEN(bom_doc), SLEN(bom_doc),
+			bom_expected, N_ELEMENTS(bom_expected), false);
+	parse("UTF-8", bom_doc, SLEN(bom_doc), 1,
+			bom_expected, N_ELEMENTS(bom_expected), false);
+	parse(NULL, bom_doc, SLEN(bom_doc), SLEN(bom_doc),
+			bom_expected, N_ELEMENTS(bom_expected), false);
+
+	/* An index of the original input skips the byte order mark too */
+	assert(hubbub_line_index_create(bom_doc, SLEN(bom_doc), myrealloc,
+			NULL, &index) == HUBBUB_OK);
+
+	assert(hubbub_line_index_locate(index, 0, &line, &col) == HUBBUB_OK);
+	assert(line == 1 && col == 1);
+	assert(hubbub_line_index_locate(index, 3, &line, &col) == HUBBUB_OK);
+	assert(line == 1 && col == 4);
+	assert(hubbub_line_index_locate(index, 4, &line, &col) == HUBBUB_OK);
+	assert(line == 2 && col == 1);
+	assert(hubbub_line_index_locate(index, 5, &line, &col) == HUBBUB_OK);
+	assert(line == 2 && col == 2);
+	assert(hubbub_line_index_locate(index, 6, &line, &col) ==
+			HUBBUB_BADPARM);
+
+	assert(hubbub_line_index_destroy(index) == HUBBUB_OK);
+}
+
+static void test_insert(void)
+{
+	hubbub_line_index *index;
+	uint32_t line, col;
+
+	parse("UTF-8", insert_doc, SLEN(insert_doc), SLEN(insert_doc),
+			insert_expected, N_ELEMENTS(insert_expected), true);
+
+	/* With the length of what was inserted taken off, the offsets of
+	 * later tokens locate them in the original input */
+	assert(hubbub_line_index_create(insert_doc, SLEN(insert_doc),
+			myrealloc, NULL, &index) == HUBBUB_OK);
+
+	assert(hubbub_line_index_locate(index, insert_expected[2].start -
+			SLEN("<i>"), &line, &col) == HUBBUB_OK);
+	assert(line == 1 && col == 4);
+	assert(hubbub_line_index_locate(index, insert_expected[2].end -
+			SLEN("<i>"), &line, &col) == HUBBUB_OK);
+	assert(line == 2 && col == 2);
+
+	assert(hubbub_line_index_destroy(index) == HUBBUB_OK);
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	test_offsets(DOC_LEN);
+	test_offsets(1);
+
+	test_line_index();
+
+	test_bom();
+	test_insert();
+
+	printf("PASS\n");
+
+	return 0;
+}
+
@@ -0,0 +1,242 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+/* As src/pool.c, which then keeps an idle parser for each thread */
+#if defined(_POSIX_THREADS) && _POSIX_THREADS > 0 && \
+		!defined(HUBBUB_POOL_NO_THREADS)
+#include <pthread.h>
+#define POOL_THREADS 1
+#else
+#define POOL_THREADS 0
+#endif
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+#include <hubbub/pool.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+#include "harness.h"
+
+/* Documents to parse, one after another */
+static const char *docs[] = {
+	"<!DOCTYPE html><title>One</title><p class=a id=b>one &amp; two",
+	"<table><tr><td>cell<td>cell</table><!-- comment -->",
+	"<b><i>mis</b>nested</i>",
+};
+
+#define N_DOCS (sizeof(docs) / sizeof(docs[0]))
+
+#define S(x)   (const uint8_t *) x, strlen(x)
+
+static void parse(hubbub_parser *parser, const char *doc, token_log *l)
+{
+	log_clear(l);
+	log_parser(parser, l);
+
+	assert(hubbub_parser_parse_chunk(parser, S(doc)) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+}
+
+static void test_pool(void)
+{
+	token_log expected[N_DOCS], l = { NULL, 0, 0 };
+	hubbub_parser_pool *pool;
+	hubbub_parser *parser, *parsers[N_DOCS];
+	size_t allocs, kept, i;
+	int round;
+
+	memset(expected, 0, sizeof(expected));
+
+	for (i = 0; i < N_DOCS; i++) {
+		assert(hubbub_parser_create("UTF-8", false, counting_realloc,
+				NULL, &parser) == HUBBUB_OK);
+		parse(parser, docs[i], &expected[i]);
+		hubbub_parser_destroy(parser);
+	}
+	assert(mem.blocks == 0);
+
+	/* The pool keeps two parsers fewer than there are documents, and
+	 * this thread one more of its own once it has released one */
+	assert(hubbub_parser_pool_create("UTF-8", false, N_DOCS - 2,
+			counting_realloc, NULL, &pool) == HUBBUB_OK);
+
+	for (round = 0; round < 3; round++) {
+		kept = N_DOCS - 2;
+		if (round > 0 && POOL_THREADS)
+			kept++;
+
+		/* Parsers are ready, until the pool runs dry */
+		for (i = 0; i < N_DOCS; i++) {
+			allocs = mem.calls;
+			assert(hubbub_parser_pool_acquire(pool,
+					&parsers[i]) == HUBBUB_OK);
+			assert((mem.calls == allocs) == (i < kept));
+		}
+
+		assert(hubbub_parser_pool_destroy(pool) == HUBBUB_INVALID);
+
+		for (i = 0; i < N_DOCS; i++) {
+			parse(parsers[i], docs[i], &l);
+			assert(log_equal(&l, &expected[i]));
+		}
+
+		/* Those too many are destroyed */
+		for (i = 0; i < N_DOCS; i++)
+			assert(hubbub_parser_pool_release(pool,
+					parsers[i]) == HUBBUB_OK);
+	}
+
+	/* A parser is given back partway through a document */
+	assert(hubbub_parser_pool_acquire(pool, &parser) == HUBBUB_OK);
+	assert(hubbub_parser_parse_chunk(parser, S("<p>half")) == HUBBUB_OK);
+	assert(hubbub_parser_pool_release(pool, parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_pool_acquire(pool, &parser) == HUBBUB_OK);
+	parse(parser, docs[0], &l);
+	assert(log_equal(&l, &expected[0]));
+	assert(hubbub_parser_pool_release(pool, parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_pool_destroy(pool) == HUBBUB_OK);
+	assert(mem.blocks == 0);
+
+	for (i = 0; i < N_DOCS; i++)
+		log_free(&expected[i]);
+	log_free(&l);
+}
+
+static void test_options(void)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser_pool *pool;
+	hubbub_parser *parser, *first;
+	token_log l = { NULL, 0, 0 };
+
+	assert(hubbub_parser_pool_create("UTF-8", false, 1, counting_realloc,
+			NULL, &pool) == HUBBUB_OK);
+
+	/* One client takes the tokens for itself, and leaves a filter set */
+	assert(hubbub_parser_pool_acquire(pool, &parser) == HUBBUB_OK);
+	first = parser;
+	parse(parser, docs[2], &l);
+	params.token_filter = HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_START_TAG);
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_FILTER,
+			&params) == HUBBUB_OK);
+	assert(hubbub_parser_pool_release(pool, parser) == HUBBUB_OK);
+
+	/* The next is given the same parser, with none of that left */
+	log_clear(&l);
+	assert(hubbub_parser_pool_acquire(pool, &parser) == HUBBUB_OK);
+	assert(parser == first);
+	assert(hubbub_parser_parse_chunk(parser, S(docs[2])) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	assert(l.len == 0);
+
+	/* Its treebuilder is back, so must still see every token */
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_FILTER,
+			&params) == HUBBUB_BADPARM);
+	assert(hubbub_parser_pool_release(pool, parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_pool_destroy(pool) == HUBBUB_OK);
+	assert(mem.blocks == 0);
+
+	log_free(&l);
+}
+
+#if POOL_THREADS
+static void *thread_main(void *pw)
+{
+	hubbub_parser_pool *pool = pw;
+	hubbub_parser *parser;
+
+	assert(hubbub_parser_pool_acquire(pool, &parser) == HUBBUB_OK);
+	assert(hubbub_parser_pool_release(pool, parser) == HUBBUB_OK);
+
+	return parser;
+}
+
+/* A thread's own parser goes back to the pool when the thread exits */
+static void test_threads(void)
+{
+	hubbub_parser_pool *pool;
+	hubbub_parser *parser;
+	pthread_t thread;
+	void *released;
+	size_t allocs;
+
+	assert(hubbub_parser_pool_create("UTF-8", false, 1, counting_realloc,
+			NULL, &pool) == HUBBUB_OK);
+
+	assert(pthread_create(&thread, NULL, thread_main, pool) == 0);
+	assert(pthread_join(thread, &released) == 0);
+
+	allocs = mem.calls;
+	assert(hubbub_parser_pool_acquire(pool, &parser) == HUBBUB_OK);
+	assert(mem.calls == allocs);
+	assert(parser == released);
+
+	/* One acquired here is still counted, whatever other threads do */
+	assert(hubbub_parser_pool_release(pool, parser) == HUBBUB_OK);
+	assert(hubbub_parser_pool_acquire(pool, &parser) == HUBBUB_OK);
+	assert(pthread_create(&thread, NULL, thread_main, pool) == 0);
+	assert(pthread_join(thread, NULL) == 0);
+	assert(hubbub_parser_pool_destroy(pool) == HUBBUB_INVALID);
+	assert(hubbub_parser_pool_release(pool, parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_pool_destroy(pool) == HUBBUB_OK);
+	assert(mem.blocks == 0);
+}
+#endif
+
+static void test_misuse(void)
+{
+	hubbub_parser_pool *pool;
+	hubbub_parser *parser;
+
+	assert(hubbub_parser_pool_create("no-such-encoding", false, 2,
+			counting_realloc, NULL, &pool) == HUBBUB_BADENCODING);
+	assert(mem.blocks == 0);
+
+	assert(hubbub_parser_pool_create(NULL, false, 0, NULL, NULL,
+			&pool) == HUBBUB_BADPARM);
+
+	/* An empty pool creates parsers as they are needed */
+	assert(hubbub_parser_pool_create(NULL, false, 0, counting_realloc,
+			NULL, &pool) == HUBBUB_OK);
+	assert(hubbub_parser_pool_acquire(pool, &parser) == HUBBUB_OK);
+	assert(hubbub_parser_pool_acquire(pool, NULL) == HUBBUB_BADPARM);
+	assert(hubbub_parser_pool_release(pool, NULL) == HUBBUB_BADPARM);
+	assert(hubbub_parser_pool_release(pool, parser) == HUBBUB_OK);
+	assert(hubbub_parser_pool_destroy(pool) == HUBBUB_OK);
+	assert(mem.blocks == 0);
+
+	assert(hubbub_parser_pool_destroy(NULL) == HUBBUB_BADPARM);
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	test_pool();
+
+	test_options();
+
+#if POOL_THREADS
+	test_threads();
+#endif
+
+	test_misuse();
+
+	printf("PASS\n");
+
+	return 0;
+}
+
@@ -0,0 +1,157 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* A document, which pauses after its first script. What follows holds
+ * resources to find, and markup which only looks like it does */
+static const char doc[] = "<html><head><script src=a.js></script>"
+		"<link rel=stylesheet href=' b.css '>"
+		"<style>/* @import 'no.css'; */ @import url( \"c.css\" );\n"
+		"@IMPORT 'd&amp;.css';</style>"
+		"<script>document.write('<img src=no.png>')</script>"
+		"<textarea><img src=no.png></textarea>"
+		"<!-- <img src=no.png> -->"
+		"<img src=\"e.png\" srcset=\"f.png 1x, g.png 2x,h.png,\n"
+		"i.png (a, b) 3x\">"
+		"<script src=j.js></script><p>Text";
+
+static const struct {
+	hubbub_preload_type type;
+	const char *url;
+	const char *rel;
+} expected[] = {
+	{ HUBBUB_PRELOAD_LINK,		"b.css",	"stylesheet" },
+	{ HUBBUB_PRELOAD_IMPORT,	"c.css",	NULL },
+	{ HUBBUB_PRELOAD_IMPORT,	"d&amp;.css",	NULL },
+	{ HUBBUB_PRELOAD_IMAGE,		"e.png",	NULL },
+	{ HUBBUB_PRELOAD_IMAGE,		"f.png",	NULL },
+	{ HUBBUB_PRELOAD_IMAGE,		"g.png",	NULL },
+	{ HUBBUB_PRELOAD_IMAGE,		"h.png",	NULL },
+	{ HUBBUB_PRELOAD_IMAGE,		"i.png",	NULL },
+	{ HUBBUB_PRELOAD_SCRIPT,	"j.js",		NULL },
+};
+
+#define N_EXPECTED (sizeof(expected) / sizeof(expected[0]))
+
+typedef struct context {
+	size_t n_preloads;		/* Resources found so far */
+	size_t n_scripts;		/* Script end tags seen by the parse */
+	bool paused;			/* Whether the parse is paused */
+} context;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static bool string_is(const hubbub_string *str, const char *s)
+{
+	return str->len == strlen(s) && memcmp(str->ptr, s, str->len) == 0;
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	context *ctx = pw;
+
+	/* Wait for the first script to run */
+	if (token->type == HUBBUB_TOKEN_END_TAG &&
+			token->data.tag.atom == HUBBUB_ATOM_SCRIPT &&
+			ctx->n_scripts++ == 0) {
+		ctx->paused = true;
+		return HUBBUB_PAUSED;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error preload_handler(const hubbub_preload *preload, void *pw)
+{
+	context *ctx = pw;
+	size_t i = ctx->n_preloads++;
+
+	assert(ctx->paused);
+	assert(i < N_EXPECTED);
+	assert(preload->type == expected[i].type);
+	assert(string_is(&preload->url, expected[i].url));
+	if (expected[i].rel != NULL)
+		assert(string_is(&preload->rel, expected[i].rel));
+	else
+		assert(preload->rel.len == 0);
+
+	return HUBBUB_OK;
+}
+
+static void test_preload(size_t chunk_size)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	context ctx;
+	size_t i;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = &ctx;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.preload_handler.handler = preload_handler;
+	params.preload_handler.pw = &ctx;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_PRELOAD_HANDLER,
+			&params) == HUBBUB_OK);
+
+	for (i = 0; i < SLEN(doc); i += chunk_size) {
+		size_t len = SLEN(doc) - i < chunk_size ?
+				SLEN(doc) - i : chunk_size;
+		hubbub_error error;
+
+		error = hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) doc + i, len);
+		assert(error == (ctx.paused ? HUBBUB_PAUSED : HUBBUB_OK));
+	}
+
+	/* Everything after the script has been looked at */
+	assert(ctx.paused);
+	assert(ctx.n_preloads == N_EXPECTED);
+
+	/* The parse itself goes on as before */
+	ctx.paused = false;
+	params.pause_parse = false;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_PAUSE, &params) ==
+			HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	assert(ctx.n_scripts == 3);
+	assert(ctx.n_preloads == N_EXPECTED);
+
+	hubbub_parser_destroy(parser);
+}
+
+int main(int argc, char **argv)
+{
+	size_t chunk_size;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (chunk_size = 1; chunk_size <= SLEN(doc); chunk_size++)
+		test_preload(chunk_size);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+#include "harness.h"
+
+/* Documents to parse, one after another */
+static const char *docs[] = {
+	"<!DOCTYPE html><title>One</title><p class=a id=b>one &amp; two",
+	"<table><tr><td>cell<td>cell</table><!-- comment -->",
+	"<p a=1 b=2 c=3 d=4 e=5 f=6 g=7 h=8 i=9 j=10 k=11 l=12 m=13 n=14 "
+			"o=15 p=16 q=17 r=18>many attributes</p>",
+	"<script>if (a < b) w('</p>')</script><textarea><b></textarea>",
+	"",
+	"<b><i>mis</b>nested</i>",
+};
+
+#define N_DOCS (sizeof(docs) / sizeof(docs[0]))
+
+/* A document left partway through, with plenty still open */
+static const char partial[] = "<!DOCTYPE html><html><head><title>t</title>"
+		"</head><body><form><table><tr><td><b><i><u>x";
+
+#define S(x)   (const uint8_t *) x, strlen(x)
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	log_token(pw, token);
+
+	/* Wait for scripts to run */
+	if (token->type == HUBBUB_TOKEN_END_TAG &&
+			token->data.tag.atom == HUBBUB_ATOM_SCRIPT)
+		return HUBBUB_PAUSED;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_parser *create_parser(const char *enc, token_log *l)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+
+	assert(hubbub_parser_create(enc, false, counting_realloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = l;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	return parser;
+}
+
+/* Parse a whole document, running through any scripts */
+static void parse(hubbub_parser *parser, const char *doc)
+{
+	hubbub_parser_optparams params;
+	hubbub_error error;
+
+	error = hubbub_parser_parse_chunk(parser, S(doc));
+	while (error == HUBBUB_PAUSED) {
+		params.pause_parse = false;
+		error = hubbub_parser_setopt(parser, HUBBUB_PARSER_PAUSE,
+				&params);
+	}
+	assert(error == HUBBUB_OK);
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+}
+
+/* Parse each document with a parser of its own, and with one parser
+ * reset between them, which should make far fewer allocations, and
+ * none at all once it has parsed each document before */
+static void test_tokens(void)
+{
+	token_log expected[N_DOCS], l = { NULL, 0, 0 };
+	hubbub_parser *parser;
+	size_t fresh, grown = 0, reused, i;
+	int round;
+
+	memset(expected, 0, sizeof(expected));
+
+	mem.calls = 0;
+	for (i = 0; i < N_DOCS; i++) {
+		parser = create_parser("UTF-8", &expected[i]);
+		parse(parser, docs[i]);
+		hubbub_parser_destroy(parser);
+	}
+	fresh = mem.calls;
+
+	parser = create_parser("UTF-8", &l);
+
+	/* The first round grows the parser's storage */
+	for (round = 0; round < 2; round++) {
+		mem.calls = 0;
+
+		for (i = 0; i < N_DOCS; i++) {
+			log_clear(&l);
+
+			if (round > 0 || i > 0)
+				assert(hubbub_parser_reset(parser, "UTF-8",
+						false) == HUBBUB_OK);
+
+			parse(parser, docs[i]);
+
+			assert(log_equal(&l, &expected[i]));
+		}
+
+		if (round == 0)
+			grown = mem.calls;
+	}
+	reused = mem.calls;
+
+	hubbub_parser_destroy(parser);
+
+	assert(grown * 2 <= fresh);
+	assert(reused == 0);
+
+	for (i = 0; i < N_DOCS; i++)
+		log_free(&expected[i]);
+	log_free(&l);
+}
+
+/* Reset partway through a document, to one in another encoding */
+static void test_encoding(void)
+{
+	hubbub_parser *parser;
+	hubbub_charset_source source;
+	token_log l = { NULL, 0, 0 };
+
+	parser = create_parser("UTF-8", &l);
+
+	assert(hubbub_parser_parse_chunk(parser, S("<p title='a")) ==
+			HUBBUB_OK);
+	assert(hubbub_parser_reset(parser, "ISO-8859-1", false) == HUBBUB_OK);
+	assert(strcmp(hubbub_parser_read_charset(parser, &source),
+			"ISO-8859-1") == 0);
+
+	assert(hubbub_parser_parse_chunk(parser, S("caf\xe9")) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	assert(strcmp(l.data, "caf\xc3\xa9[EOF]") == 0);
+
+	/* Nothing changes if the encoding isn't supported */
+	assert(hubbub_parser_reset(parser, "no-such-encoding", false) ==
+			HUBBUB_BADENCODING);
+	assert(strcmp(hubbub_parser_read_charset(parser, &source),
+			"ISO-8859-1") == 0);
+
+	assert(hubbub_parser_reset(NULL, NULL, false) == HUBBUB_BADPARM);
+
+	hubbub_parser_destroy(parser);
+
+	log_free(&l);
+}
+
+/* Reset while paused, with a snapshot outstanding */
+static void test_paused(void)
+{
+	hubbub_parser *parser;
+	hubbub_parser_snapshot *snapshot;
+	token_log l = { NULL, 0, 0 };
+
+	parser = create_parser("UTF-8", &l);
+
+	assert(hubbub_parser_parse_chunk(parser,
+			S("<script>w()</script><p>after")) == HUBBUB_PAUSED);
+	assert(hubbub_parser_snapshot_create(parser, &snapshot) == HUBBUB_OK);
+
+	assert(hubbub_parser_reset(parser, "UTF-8", false) == HUBBUB_OK);
+
+	log_clear(&l);
+	assert(hubbub_parser_parse_chunk(parser, S("<b>new")) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	assert(strcmp(l.data, "[b]new[EOF]") == 0);
+
+	/* The snapshot belongs to the old document */
+	assert(hubbub_parser_snapshot_restore(parser, snapshot) ==
+			HUBBUB_INVALID);
+	assert(hubbub_parser_snapshot_destroy(parser, snapshot) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	log_free(&l);
+}
+
+static void set_document(hubbub_parser *parser)
+{
+	hubbub_parser_optparams params;
+
+	params.document_node = stub_new_node(false);
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params) == HUBBUB_OK);
+}
+
+/* Reset with a tree half built, then build another */
+static void test_tree(void)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	uintptr_t n;
+
+	assert(hubbub_parser_create("UTF-8", false, counting_realloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.tree_handler = &stub_tree_handler;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params) == HUBBUB_OK);
+	set_document(parser);
+
+	assert(hubbub_parser_parse_chunk(parser, S(partial)) == HUBBUB_OK);
+
+	/* Every reference to the old tree is given up */
+	assert(hubbub_parser_reset(parser, "UTF-8", false) == HUBBUB_OK);
+	for (n = 1; n <= stub_tree.n_nodes; n++)
+		assert(STUB_NODE(n)->refs == 0);
+
+	set_document(parser);
+	assert(hubbub_parser_parse_chunk(parser, S(partial)) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+	for (n = 1; n <= stub_tree.n_nodes; n++)
+		assert(STUB_NODE(n)->refs == 0);
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	test_tokens();
+
+	test_encoding();
+
+	test_paused();
+
+	test_tree();
+
+	stub_tree_clear();
+
+	printf("PASS\n");
+
+	return 0;
+}
+
@@ -0,0 +1,270 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+#include "harness.h"
+
+/* A document, with a script which writes more into it */
+static const char before[] = "<!DOCTYPE html><p class=\"a\" id=b>one "
+		"&amp; two<script>w()</script>";
+static const char written[] = "<em title='w'>wr&eacute;tten</em>";
+static const char after[] = "<b>th\xc3\xa9ree</b><!-- c -->four<i "
+		"lang=en>five &lt; six</i>";
+
+#define S(x)   (const uint8_t *) x, sizeof(x) - 1
+
+typedef struct context {
+	token_log main;			/* Tokens for the document proper */
+	token_log spec;			/* Tokens seen speculatively */
+	bool speculating;		/* Whether to log to spec */
+	bool pause_at_script;		/* Whether to pause after </script> */
+} context;
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	context *ctx = pw;
+
+	log_token(ctx->speculating ? &ctx->spec : &ctx->main, token);
+
+	/* Stop for the script to run, as a browser would */
+	if (ctx->pause_at_script && ctx->speculating == false &&
+			token->type == HUBBUB_TOKEN_END_TAG &&
+			token->data.tag.name.len == SLEN("script") &&
+			memcmp(token->data.tag.name.ptr, "script",
+					SLEN("script")) == 0)
+		return HUBBUB_PAUSED;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_parser *create_parser(context *ctx)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+
+	assert(hubbub_parser_create("UTF-8", false, counting_realloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = ctx;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	return parser;
+}
+
+/* Parse a document in one go, for the tokens it should yield */
+static void reference(const uint8_t *data, size_t len, token_log *l)
+{
+	hubbub_parser *parser;
+	context ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	parser = create_parser(&ctx);
+
+	assert(hubbub_parser_parse_chunk(parser, data, len) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	*l = ctx.main;
+}
+
+/* Tokenise ahead of a script, then roll back when it writes into the
+ * document, feeding the input a chunk at a time */
+static void test_script(size_t chunk_size)
+{
+	uint8_t data[sizeof(before) + sizeof(written) + sizeof(after)];
+	size_t len = 0, i;
+	hubbub_parser *parser;
+	hubbub_parser_snapshot *snapshot = NULL;
+	hubbub_parser_optparams params;
+	context ctx;
+	token_log expected;
+
+	memcpy(data + len, before, SLEN(before));
+	len += SLEN(before);
+	memcpy(data + len, written, SLEN(written));
+	len += SLEN(written);
+	memcpy(data + len, after, SLEN(after));
+	len += SLEN(after);
+	reference(data, len, &expected);
+
+	/* The document as it's delivered, without what the script writes */
+	len = 0;
+	memcpy(data + len, before, SLEN(before));
+	len += SLEN(before);
+	memcpy(data + len, after, SLEN(after));
+	len += SLEN(after);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.pause_at_script = true;
+
+	parser = create_parser(&ctx);
+
+	for (i = 0; i < len; i += chunk_size) {
+		size_t n = len - i < chunk_size ? len - i : chunk_size;
+		hubbub_error error;
+
+		error = hubbub_parser_parse_chunk(parser, data + i, n);
+		if (error == HUBBUB_PAUSED) {
+			/* Look ahead while the script would be running */
+			assert(snapshot == NULL);
+			assert(hubbub_parser_snapshot_create(parser,
+					&snapshot) == HUBBUB_OK);
+
+			ctx.speculating = true;
+			params.pause_parse = false;
+			error = hubbub_parser_setopt(parser,
+					HUBBUB_PARSER_PAUSE, &params);
+		}
+		assert(error == HUBBUB_OK);
+	}
+
+	assert(snapshot != NULL);
+
+	/* The script writes, so what was seen ahead is discarded */
+	assert(hubbub_parser_snapshot_restore(parser, snapshot) == HUBBUB_OK);
+	ctx.speculating = false;
+
+	assert(hubbub_parser_insert_chunk(parser, S(written)) == HUBBUB_OK);
+	assert(hubbub_parser_parse_chunk(parser, S("")) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_snapshot_destroy(parser, snapshot) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	assert(log_equal(&ctx.main, &expected));
+
+	/* Everything after the script was seen ahead of time */
+	assert(ctx.spec.len > 0);
+	assert(strstr(expected.data, ctx.spec.data) != NULL);
+
+	log_free(&ctx.main);
+	log_free(&ctx.spec);
+	log_free(&expected);
+}
+
+/* Take a snapshot at every point in a document, however partway through
+ * a token, and return to it more than once */
+static void test_split(void)
+{
+	uint8_t data[sizeof(before) + sizeof(after)];
+	size_t len = 0, split;
+	token_log expected;
+
+	memcpy(data + len, before, SLEN(before));
+	len += SLEN(before);
+	memcpy(data + len, after, SLEN(after));
+	len += SLEN(after);
+	reference(data, len, &expected);
+
+	for (split = 0; split <= len; split++) {
+		hubbub_parser *parser;
+		hubbub_parser_snapshot *snapshot;
+		context ctx;
+		int pass;
+
+		memset(&ctx, 0, sizeof(ctx));
+
+		parser = create_parser(&ctx);
+
+		assert(hubbub_parser_parse_chunk(parser, data, split) ==
+				HUBBUB_OK);
+
+		assert(hubbub_parser_snapshot_create(parser, &snapshot) ==
+				HUBBUB_OK);
+
+		ctx.speculating = true;
+		for (pass = 0; pass < 2; pass++) {
+			log_clear(&ctx.spec);
+
+			assert(hubbub_parser_parse_chunk(parser, data + split,
+					pass == 0 ? len - split : 0) ==
+					HUBBUB_OK);
+			assert(hubbub_parser_snapshot_restore(parser,
+					snapshot) == HUBBUB_OK);
+		}
+		ctx.speculating = false;
+
+		assert(hubbub_parser_parse_chunk(parser, S("")) == HUBBUB_OK);
+		assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+		assert(hubbub_parser_snapshot_destroy(parser, snapshot) ==
+				HUBBUB_OK);
+
+		hubbub_parser_destroy(parser);
+
+		assert(log_equal(&ctx.main, &expected));
+
+		log_free(&ctx.main);
+		log_free(&ctx.spec);
+	}
+
+	log_free(&expected);
+}
+
+static void test_misuse(void)
+{
+	hubbub_parser *parser;
+	hubbub_parser_snapshot *first, *second;
+	context ctx;
+
+	/* The treebuilder's state can't be kept */
+	assert(hubbub_parser_create("UTF-8", false, counting_realloc, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_parser_snapshot_create(parser, &first) ==
+			HUBBUB_BADPARM);
+	hubbub_parser_destroy(parser);
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	parser = create_parser(&ctx);
+
+	assert(hubbub_parser_parse_chunk(parser, S("<p>a")) == HUBBUB_OK);
+	assert(hubbub_parser_snapshot_create(parser, &first) == HUBBUB_OK);
+	assert(hubbub_parser_parse_chunk(parser, S("b</p>")) == HUBBUB_OK);
+	assert(hubbub_parser_snapshot_create(parser, &second) == HUBBUB_OK);
+
+	/* Returning to the first snapshot leaves the second ahead */
+	assert(hubbub_parser_snapshot_restore(parser, first) == HUBBUB_OK);
+	assert(hubbub_parser_snapshot_restore(parser, second) ==
+			HUBBUB_INVALID);
+
+	assert(hubbub_parser_snapshot_destroy(parser, second) == HUBBUB_OK);
+	assert(hubbub_parser_snapshot_destroy(parser, first) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	log_free(&ctx.main);
+}
+
+int main(int argc, char **argv)
+{
+	size_t chunk_size;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (chunk_size = 1; chunk_size <= SLEN(before) + SLEN(after);
+			chunk_size++)
+		test_script(chunk_size);
+
+	test_split();
+
+	test_misuse();
+
+	printf("PASS\n");
+
+	return 0;
+}
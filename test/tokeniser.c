@@ -12,6 +12,11 @@
 #include "testutils.h"
 
 static hubbub_error token_handler(const hubbub_token *token, void *pw);
+static void test_attribute_storage(void);
+static void test_coalesce_characters(void);
+static void test_token_batch(void);
+static void test_token_batch_pause(void);
+static void test_token_filter(void);
 
 static void *myrealloc(void *ptr, size_t len, void *pw)
 {
@@ -35,6 +40,12 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	test_attribute_storage();
+	test_coalesce_characters();
+	test_token_batch();
+	test_token_batch_pause();
+	test_token_filter();
+
 	assert(parserutils_inputstream_create("UTF-8", 0, NULL,
 			myrealloc, NULL, &stream) == PARSERUTILS_OK);
 
@@ -83,6 +94,506 @@ int main(int argc, char **argv)
 	return 0;
 }
 
+/* Once warmed up, the tokeniser should make no allocations for tags */
+void test_attribute_storage(void)
+{
+	static const uint8_t tag[] =
+		"<p a=1 b=2 c=3 d=4 e=5 f=6 g=7 h=8 i=9 j=10 k=11 l=12>";
+	parserutils_inputstream *stream;
+	hubbub_tokeniser *tok;
+	size_t count;
+	int i;
+
+	assert(parserutils_inputstream_create("UTF-8", 0, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(hubbub_tokeniser_create(stream, myrealloc, NULL, &tok) ==
+			HUBBUB_OK);
+
+	assert(hubbub_tokeniser_get_alloc_count(tok) == 0);
+
+	assert(parserutils_inputstream_append(stream,
+			tag, sizeof(tag) - 1) == PARSERUTILS_OK);
+	assert(hubbub_tokeniser_run(tok) == HUBBUB_OK);
+
+	count = hubbub_tokeniser_get_alloc_count(tok);
+	assert(count > 0);
+
+	for (i = 0; i < 100; i++) {
+		assert(parserutils_inputstream_append(stream,
+				tag, sizeof(tag) - 1) == PARSERUTILS_OK);
+		assert(hubbub_tokeniser_run(tok) == HUBBUB_OK);
+	}
+
+	assert(hubbub_tokeniser_get_alloc_count(tok) == count);
+
+	hubbub_tokeniser_destroy(tok);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+typedef struct text_t {
+	uint8_t data[64];
+	size_t len;
+	int n_tokens;
+} text_t;
+
+static hubbub_error text_handler(const hubbub_token *token, void *pw)
+{
+	text_t *text = pw;
+
+	if (token->type == HUBBUB_TOKEN_CHARACTER) {
+		assert(text->len + token->data.character.len <=
+				sizeof(text->data));
+		memcpy(text->data + text->len, token->data.character.ptr,
+				token->data.character.len);
+		text->len += token->data.character.len;
+		text->n_tokens++;
+	}
+
+	return HUBBUB_OK;
+}
+
+static void tokenise_text(bool coalesce, text_t *text)
+{
+	/* Split so that a CRLF straddles chunks */
+	static const char *chunks[] = { "a\r\nb\rc", "\0d\r", "\ne\r" };
+	parserutils_inputstream *stream;
+	hubbub_tokeniser *tok;
+	hubbub_tokeniser_optparams params;
+	size_t i;
+
+	assert(parserutils_inputstream_create("UTF-8", 0, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(hubbub_tokeniser_create(stream, myrealloc, NULL, &tok) ==
+			HUBBUB_OK);
+
+	params.token_handler.handler = text_handler;
+	params.token_handler.pw = text;
+	assert(hubbub_tokeniser_setopt(tok, HUBBUB_TOKENISER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.coalesce_characters = coalesce;
+	assert(hubbub_tokeniser_setopt(tok,
+			HUBBUB_TOKENISER_COALESCE_CHARACTERS,
+			&params) == HUBBUB_OK);
+
+	text->len = 0;
+	text->n_tokens = 0;
+
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+		/* Can't use strlen, as there's a NUL in there */
+		size_t len = (i == 1) ? 3 : strlen(chunks[i]);
+
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) chunks[i], len) ==
+				PARSERUTILS_OK);
+		assert(hubbub_tokeniser_run(tok) == HUBBUB_OK);
+	}
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+	assert(hubbub_tokeniser_run(tok) == HUBBUB_OK);
+
+	hubbub_tokeniser_destroy(tok);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Coalescing changes how character data is split into tokens, not what
+ * the data is */
+void test_coalesce_characters(void)
+{
+	static const uint8_t expected[] = "a\nb\nc\xef\xbf\xbd" "d\ne\n";
+	text_t split, coalesced;
+
+	tokenise_text(false, &split);
+	tokenise_text(true, &coalesced);
+
+	assert(split.len == sizeof(expected) - 1);
+	assert(memcmp(split.data, expected, split.len) == 0);
+	assert(split.n_tokens > 1);
+
+	assert(coalesced.len == sizeof(expected) - 1);
+	assert(memcmp(coalesced.data, expected, coalesced.len) == 0);
+	assert(coalesced.n_tokens == 1);
+}
+
+typedef struct record_t {
+	hubbub_tokeniser *tok;
+	uint32_t hash;
+	uint32_t n_tokens;
+	uint32_t n_batches;
+	uint32_t n_unwanted;
+	uint32_t filter;
+	bool script_as_cdata;
+	hubbub_error refuse;	/* Result for the first partial batch */
+	bool refused;
+} record_t;
+
+static void record_string(record_t *record, const hubbub_string *str)
+{
+	size_t i;
+
+	/* FNV-1a, with a separator after each string */
+	for (i = 0; i < str->len; i++)
+		record->hash = (record->hash ^ str->ptr[i]) * 16777619;
+
+	record->hash = (record->hash ^ '|') * 16777619;
+}
+
+/* Record a token of a type in the record's filter, switching content model
+ * as the treebuilder would */
+static void record_token(record_t *record, const hubbub_token *token)
+{
+	static const char script[] = "if (a<b) x();";
+	hubbub_tokeniser_optparams params;
+	uint32_t i;
+
+	if ((record->filter & HUBBUB_TOKEN_MASK(token->type)) == 0) {
+		record->n_unwanted++;
+		goto done;
+	}
+
+	record->hash = (record->hash ^ token->type) * 16777619;
+	record->n_tokens++;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		record_string(record, &token->data.doctype.name);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		record_string(record, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			record_string(record,
+					&token->data.tag.attributes[i].name);
+			record_string(record,
+					&token->data.tag.attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		record_string(record, &token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		record_string(record, &token->data.character);
+
+		if (token->data.character.len == SLEN(script) &&
+				memcmp(token->data.character.ptr, script,
+						SLEN(script)) == 0)
+			record->script_as_cdata = true;
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+done:
+	if (token->type == HUBBUB_TOKEN_START_TAG &&
+			token->data.tag.atom == HUBBUB_ATOM_SCRIPT) {
+		params.content_model.model = HUBBUB_CONTENT_MODEL_CDATA;
+		assert(hubbub_tokeniser_setopt(record->tok,
+				HUBBUB_TOKENISER_CONTENT_MODEL,
+				&params) == HUBBUB_OK);
+	}
+}
+
+static hubbub_error record_handler(const hubbub_token *token, void *pw)
+{
+	record_token(pw, token);
+
+	return HUBBUB_OK;
+}
+
+#define BATCH_SIZE 64
+
+static hubbub_error record_batch_handler(const hubbub_token *tokens,
+		uint32_t n_tokens, void *pw)
+{
+	record_t *record = pw;
+	uint32_t i;
+
+	assert(n_tokens > 0 && n_tokens <= BATCH_SIZE);
+
+	for (i = 0; i < n_tokens; i++)
+		record_token(record, &tokens[i]);
+
+	record->n_batches++;
+
+	if (record->refuse != HUBBUB_OK && record->refused == false &&
+			n_tokens < BATCH_SIZE) {
+		record->refused = true;
+		return record->refuse;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* Tokenise, recording the tokens of the types in record->filter, and
+ * having the tokeniser filter out the others if filter is true */
+static void tokenise_record(const char **chunks, size_t n_chunks,
+		bool batch, bool filter, record_t *record)
+{
+	parserutils_inputstream *stream;
+	hubbub_tokeniser_optparams params;
+	hubbub_token tokens[BATCH_SIZE];
+	size_t i;
+
+	assert(parserutils_inputstream_create("UTF-8", 0, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(hubbub_tokeniser_create(stream, myrealloc, NULL,
+			&record->tok) == HUBBUB_OK);
+
+	if (batch) {
+		params.token_batch.handler = record_batch_handler;
+		params.token_batch.tokens = tokens;
+		params.token_batch.size = BATCH_SIZE;
+		params.token_batch.pw = record;
+		assert(hubbub_tokeniser_setopt(record->tok,
+				HUBBUB_TOKENISER_TOKEN_BATCH,
+				&params) == HUBBUB_OK);
+	} else {
+		params.token_handler.handler = record_handler;
+		params.token_handler.pw = record;
+		assert(hubbub_tokeniser_setopt(record->tok,
+				HUBBUB_TOKENISER_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+	}
+
+	if (filter) {
+		params.token_filter = record->filter;
+		assert(hubbub_tokeniser_setopt(record->tok,
+				HUBBUB_TOKENISER_TOKEN_FILTER,
+				&params) == HUBBUB_OK);
+	}
+
+	record->hash = 2166136261u;
+	record->n_tokens = 0;
+	record->n_batches = 0;
+	record->n_unwanted = 0;
+	record->script_as_cdata = false;
+	record->refuse = HUBBUB_OK;
+	record->refused = false;
+
+	for (i = 0; i < n_chunks; i++) {
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) chunks[i],
+				strlen(chunks[i])) == PARSERUTILS_OK);
+		assert(hubbub_tokeniser_run(record->tok) == HUBBUB_OK);
+	}
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+	assert(hubbub_tokeniser_run(record->tok) == HUBBUB_OK);
+
+	hubbub_tokeniser_destroy(record->tok);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Batched tokens, and their data, should be just as they'd be had they
+ * been handled one at a time */
+void test_token_batch(void)
+{
+	static const char *chunks[] = {
+		"<!DOCTYPE html><html><head><title>a&amp;b</title><scr",
+		"ipt>if (a<b) x();</script></head><body class=x id='y'>",
+		"<!-- c --><p>text</p>\r\n</body></html>"
+	};
+	static const char row[] = "<tr class=\"r\"><td>x &lt; y</td>"
+			"<td a=1 b='2' c=&amp;>\r\n</td></tr>";
+	record_t single, batched;
+	char *doc;
+	size_t i;
+
+	single.filter = batched.filter = HUBBUB_TOKEN_MASK_ALL;
+
+	tokenise_record(chunks, sizeof(chunks) / sizeof(chunks[0]),
+			false, false, &single);
+	tokenise_record(chunks, sizeof(chunks) / sizeof(chunks[0]),
+			true, false, &batched);
+
+	assert(batched.n_tokens == single.n_tokens);
+	assert(batched.hash == single.hash);
+	assert(batched.n_batches > 1);
+
+	/* The script's content was tokenised as CDATA */
+	assert(single.script_as_cdata && batched.script_as_cdata);
+
+	/* A document long enough that the input stream has to decode more
+	 * of it while a batch is being collected */
+	doc = malloc(1000 * SLEN(row) + 1);
+	assert(doc != NULL);
+
+	for (i = 0; i < 1000; i++)
+		memcpy(doc + i * SLEN(row), row, SLEN(row));
+	doc[1000 * SLEN(row)] = '\0';
+
+	tokenise_record((const char **) &doc, 1, false, false, &single);
+	tokenise_record((const char **) &doc, 1, true, false, &batched);
+
+	assert(batched.n_tokens == single.n_tokens);
+	assert(batched.hash == single.hash);
+
+	free(doc);
+}
+
+/* A batch handler should be able to pause the tokeniser, or fail, on a
+ * batch delivered before the input runs out, and nothing more be delivered
+ * until the tokeniser carries on */
+void test_token_batch_pause(void)
+{
+	static const char row[] = "<tr class=\"r\"><td>x &lt; y</td>"
+			"<td a=1 b='2' c=&amp;>\r\n</td></tr>";
+	static const hubbub_error results[] = { HUBBUB_PAUSED, HUBBUB_NOMEM };
+	parserutils_inputstream *stream;
+	hubbub_tokeniser_optparams params;
+	hubbub_token tokens[BATCH_SIZE];
+	record_t single, batched;
+	uint32_t n_tokens;
+	char *doc;
+	size_t i;
+
+	doc = malloc(1000 * SLEN(row) + 1);
+	assert(doc != NULL);
+
+	for (i = 0; i < 1000; i++)
+		memcpy(doc + i * SLEN(row), row, SLEN(row));
+	doc[1000 * SLEN(row)] = '\0';
+
+	single.filter = batched.filter = HUBBUB_TOKEN_MASK_ALL;
+
+	tokenise_record((const char **) &doc, 1, false, false, &single);
+
+	for (i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+		assert(parserutils_inputstream_create("UTF-8", 0, NULL,
+				myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+		assert(hubbub_tokeniser_create(stream, myrealloc, NULL,
+				&batched.tok) == HUBBUB_OK);
+
+		params.token_batch.handler = record_batch_handler;
+		params.token_batch.tokens = tokens;
+		params.token_batch.size = BATCH_SIZE;
+		params.token_batch.pw = &batched;
+		assert(hubbub_tokeniser_setopt(batched.tok,
+				HUBBUB_TOKENISER_TOKEN_BATCH,
+				&params) == HUBBUB_OK);
+
+		batched.hash = 2166136261u;
+		batched.n_tokens = 0;
+		batched.n_batches = 0;
+		batched.n_unwanted = 0;
+		batched.script_as_cdata = false;
+		batched.refuse = results[i];
+		batched.refused = false;
+
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) doc, strlen(doc)) ==
+				PARSERUTILS_OK);
+
+		/* The tokeniser stops with the handler's result, well short
+		 * of the end of the input */
+		assert(hubbub_tokeniser_run(batched.tok) == results[i]);
+		assert(batched.refused);
+		assert(batched.n_tokens < single.n_tokens / 2);
+
+		n_tokens = batched.n_tokens;
+
+		if (results[i] == HUBBUB_PAUSED) {
+			/* Nothing more comes while paused */
+			assert(hubbub_tokeniser_run(batched.tok) ==
+					HUBBUB_PAUSED);
+			assert(batched.n_tokens == n_tokens);
+
+			params.pause_parse = false;
+			assert(hubbub_tokeniser_setopt(batched.tok,
+					HUBBUB_TOKENISER_PAUSE,
+					&params) == HUBBUB_OK);
+		} else {
+			assert(hubbub_tokeniser_run(batched.tok) ==
+					HUBBUB_OK);
+		}
+
+		assert(batched.n_tokens > n_tokens);
+
+		assert(parserutils_inputstream_append(stream, NULL, 0) ==
+				PARSERUTILS_OK);
+		assert(hubbub_tokeniser_run(batched.tok) == HUBBUB_OK);
+
+		/* Carrying on lost nothing, nor repeated anything */
+		assert(batched.n_tokens == single.n_tokens);
+		assert(batched.hash == single.hash);
+
+		hubbub_tokeniser_destroy(batched.tok);
+
+		parserutils_inputstream_destroy(stream);
+	}
+
+	free(doc);
+}
+
+/* Filtering out some types of token should leave the rest as they were */
+void test_token_filter(void)
+{
+	static const char doc[] =
+		"<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01//EN\" '>"
+		"<html><!-- a -- b --\r\n--><head><script>if (a<b) x();"
+		"</script><!--x--><title>a &amp; b\r\n</title></head>"
+		"<body x=1 y=&lt; x=2><?pi > &lt;text&gt;\r<!doctype a>"
+		"<!---><!-->c&#65;<p\r\n>\r\n</p><![CDATA[d]]></body>"
+		"</html><!-- e";
+	static const uint32_t filters[] = {
+		HUBBUB_TOKEN_MASK_ALL & ~HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_DOCTYPE),
+		HUBBUB_TOKEN_MASK_ALL & ~HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_END_TAG),
+		HUBBUB_TOKEN_MASK_ALL & ~HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_COMMENT),
+		HUBBUB_TOKEN_MASK_ALL &
+				~HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_CHARACTER),
+		HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_START_TAG),
+		HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_START_TAG) |
+				HUBBUB_TOKEN_MASK(HUBBUB_TOKEN_END_TAG),
+	};
+	char bytes[sizeof(doc) - 1][2];
+	const char *chunks[sizeof(doc) - 1];
+	const char *whole = doc;
+	record_t all, filtered;
+	size_t i;
+
+	/* Also feed the document in a byte at a time */
+	for (i = 0; i < sizeof(doc) - 1; i++) {
+		bytes[i][0] = doc[i];
+		bytes[i][1] = '\0';
+		chunks[i] = bytes[i];
+	}
+
+	for (i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+		all.filter = filtered.filter = filters[i];
+
+		tokenise_record(&whole, 1, false, false, &all);
+		assert(all.n_unwanted > 0);
+
+		tokenise_record(&whole, 1, false, true, &filtered);
+		assert(filtered.n_unwanted == 0);
+		assert(filtered.n_tokens == all.n_tokens);
+		assert(filtered.hash == all.hash);
+
+		tokenise_record(&whole, 1, true, true, &filtered);
+		assert(filtered.n_unwanted == 0);
+		assert(filtered.n_tokens == all.n_tokens);
+		assert(filtered.hash == all.hash);
+
+		/* Characters are split into tokens differently when the
+		 * input arrives in pieces */
+		tokenise_record(chunks, sizeof(doc) - 1, false, false, &all);
+		tokenise_record(chunks, sizeof(doc) - 1, false, true,
+				&filtered);
+		assert(filtered.n_unwanted == 0);
+		assert(filtered.n_tokens == all.n_tokens);
+		assert(filtered.hash == all.hash);
+	}
+}
+
 hubbub_error token_handler(const hubbub_token *token, void *pw)
 {
 	static const char *token_names[] = {
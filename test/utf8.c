@@ -0,0 +1,134 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define FFFD "\xef\xbf\xbd"
+
+/* Documents passed through as UTF-8, and the text they should yield */
+static const struct {
+	const char *input;
+	const char *text;
+} docs[] = {
+	/* A byte order mark is dropped at the start, and only there */
+	{ "\xef\xbb\xbfone\xef\xbb\xbf",	"one\xef\xbb\xbf" },
+	{ "\xef\xbb" "a",			FFFD "a" },
+
+	/* Long runs of ASCII, either side of longer sequences */
+	{ "The quick brown fox jumps over the lazy dog, caf\xc3\xa9 "
+	  "\xe2\x82\xac" "5 \xf0\x9f\x98\x80 and the quick brown fox again",
+	  "The quick brown fox jumps over the lazy dog, caf\xc3\xa9 "
+	  "\xe2\x82\xac" "5 \xf0\x9f\x98\x80 and the quick brown fox again" },
+
+	/* Stray continuation bytes and bytes which never start a sequence */
+	{ "a\x80" "b\xbf\xc0\xc1\xf5\xff" "c",
+	  "a" FFFD "b" FFFD FFFD FFFD FFFD FFFD "c" },
+
+	/* Overlong forms, surrogates and values beyond U+10FFFF */
+	{ "\xc0\xaf\xe0\x80\x80\xed\xa0\x80\xf4\x90\x80\x80",
+	  FFFD FFFD FFFD FFFD FFFD FFFD FFFD FFFD FFFD FFFD FFFD FFFD },
+
+	/* Truncated sequences are each replaced as a whole */
+	{ "\xe2\x82" "x\xf0\x9f\x98" "y\xf0\x9f" "\xc3",
+	  FFFD "x" FFFD "y" FFFD FFFD },
+	{ "z\xf0\x9f\x98",			"z" FFFD },
+};
+
+#define N_DOCS (sizeof(docs) / sizeof(docs[0]))
+
+typedef struct context {
+	char text[256];			/* Character data seen */
+	size_t len;			/* Length of text */
+} context;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	context *ctx = pw;
+
+	if (token->type == HUBBUB_TOKEN_CHARACTER) {
+		assert(ctx->len + token->data.character.len <
+				sizeof(ctx->text));
+
+		memcpy(ctx->text + ctx->len, token->data.character.ptr,
+				token->data.character.len);
+		ctx->len += token->data.character.len;
+		ctx->text[ctx->len] = '\0';
+	}
+
+	return HUBBUB_OK;
+}
+
+static void test_doc(size_t doc, size_t chunk_size)
+{
+	const uint8_t *data = (const uint8_t *) docs[doc].input;
+	size_t len = strlen(docs[doc].input), i;
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	context ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = &ctx;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	for (i = 0; i < len; i += chunk_size) {
+		size_t n = len - i < chunk_size ? len - i : chunk_size;
+
+		assert(hubbub_parser_parse_chunk(parser, data + i, n) ==
+				HUBBUB_OK);
+
+		/* Empty chunks change nothing */
+		assert(hubbub_parser_parse_chunk(parser, data, 0) ==
+				HUBBUB_OK);
+	}
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	if (strcmp(ctx.text, docs[doc].text) != 0) {
+		printf("%u/%u: got '%s'\n", (unsigned) doc,
+				(unsigned) chunk_size, ctx.text);
+		assert(0 && "text differs");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t doc, chunk_size;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (doc = 0; doc < N_DOCS; doc++) {
+		size_t len = strlen(docs[doc].input);
+
+		for (chunk_size = 1; chunk_size <= len; chunk_size++)
+			test_doc(doc, chunk_size);
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
+